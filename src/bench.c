@@ -0,0 +1,723 @@
+/*
+ * bench.c: benchmarks libwavutil on synthetic wav files
+ *
+ * files are generated into a temporary directory for every case (a
+ * channel count and sample format, some with extra chunks around the
+ * data) and size, from 1 KB up to --max-size of audio data. small sizes
+ * get many files so per file costs show up, big ones a single file.
+ * every operation is then timed on every file --runs times: parsing and
+ * verifying the header, patching it in place, writing a modified copy,
+ * copying the audio data with each copy method, and the convert, stats,
+ * loudness, hash, split-channels and resample modes.
+ *
+ * one record is printed per case, size and operation with the audio MB/s,
+ * calls per second and the p50/p99 latency of a single call, as csv,
+ * ndjson or json, so two runs can be compared to spot regressions. the
+ * files are read out of the page cache unless --cold is given.
+ */
+#define _GNU_SOURCE
+#include <stdio.h> /* io functions */
+#include <stdint.h> /* uint types */
+#include <inttypes.h> /* PRIu64 */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* strcmp */
+#include <math.h> /* sin */
+#include <errno.h> /* errno */
+#include <fcntl.h> /* open, posix_fadvise */
+#include <getopt.h> /* getopt_long */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* write, unlink */
+
+#include "wavutil.h"
+
+#define KB 1024ull
+#define MB (1024ull * KB)
+#define GB (1024ull * MB)
+
+#define BLOCK (1 << 20) /* bytes of audio generated at a time */
+#define MAX_FILTERS 16
+/* RIFF, JUNK/ds64, extensible fmt, LIST and data chunk headers */
+#define MAX_HEADER (12 + 36 + 48 + 34 + 8)
+
+/* a channel count and sample format to generate */
+struct bench_case {
+   const char *name;
+   unsigned channels;
+   enum wavutil_sample_format format;
+   int chunks;                /* JUNK and LIST chunks around fmt and data */
+};
+
+static const struct bench_case cases[] = {
+   { "u8-mono",           1, WAVUTIL_SAMPLE_U8,  0 },
+   { "s16-stereo",        2, WAVUTIL_SAMPLE_S16, 0 },
+   { "s16-stereo-chunks", 2, WAVUTIL_SAMPLE_S16, 1 },
+   { "s24-5.1",           6, WAVUTIL_SAMPLE_S24, 0 },
+   { "s32-7.1",           8, WAVUTIL_SAMPLE_S32, 1 },
+   { "f32-stereo",        2, WAVUTIL_SAMPLE_F32, 0 },
+   { "f64-64ch",         64, WAVUTIL_SAMPLE_F64, 0 },
+};
+
+#define NUM_CASES (sizeof(cases) / sizeof(cases[0]))
+
+/* bytes of audio data per file */
+static const uint64_t sizes[] = { 1 * KB, 64 * KB, 1 * MB, 16 * MB, 256 * MB, 1 * GB, 8 * GB };
+
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+/* what is timed */
+enum op_kind {
+   OP_PARSE,
+   OP_VERIFY,
+   OP_PATCH,
+   OP_WRITE,
+   OP_COPY,
+   OP_CONVERT,
+   OP_STATS,
+   OP_LOUDNESS,
+   OP_HASH,
+   OP_SPLIT,
+   OP_RESAMPLE,
+};
+
+struct bench_op {
+   char name[32];
+   enum op_kind kind;
+   int arg;                   /* the copy method or hash algorithm */
+};
+
+/* how the records are printed */
+enum bench_format {
+   BENCH_CSV,
+   BENCH_NDJSON,
+   BENCH_JSON,
+   BENCH_FORMATS
+};
+
+static const char *bench_format_names[BENCH_FORMATS] = { "csv", "ndjson", "json" };
+
+struct bench_options {
+   uint64_t max_size;
+   size_t files;              /* files generated for the smallest sizes */
+   int runs;
+   int cold;
+   int keep;
+   const char *dir;
+   enum bench_format format;
+   const char *cases[MAX_FILTERS];
+   size_t num_cases;
+   const char *ops[MAX_FILTERS];
+   size_t num_ops;
+};
+
+/* the timings of one operation over every file of a case and size */
+struct bench_result {
+   double *latency;
+   size_t calls;
+   size_t failed;
+   uint64_t bytes;
+   double seconds;
+};
+
+static FILE *quiet;           /* swallows what wavutil_verify has to say */
+static size_t records;
+
+static double now_seconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+   p[0] = (uint8_t)v;
+   p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+   put16(p, (uint16_t)v);
+   put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+   put32(p, (uint32_t)v);
+   put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/*
+ * builds the header of a synthetic file: RIFF (RF64 when the sizes do
+ * not fit in 32 bits), fmt (WAVE_FORMAT_EXTENSIBLE past two channels),
+ * optional JUNK and LIST chunks and the data chunk header. returns the
+ * number of bytes written to h, 0 if they do not fit in len.
+ */
+static size_t make_header(uint8_t *h, size_t len, const struct bench_case *c, uint64_t data_size,
+                          size_t trailer) {
+   unsigned bits = (unsigned)wavutil_sample_size(c->format) * 8;
+   unsigned align = c->channels * bits / 8;
+   int extensible = c->channels > 2;
+   uint16_t tag = wavutil_sample_is_float(c->format) ? 3 : 1;
+   size_t fmt_size = extensible ? 40 : 16;
+   static const char info[] = "INFOISFT\x0e\0\0\0wav-util bench";
+   size_t n = 12;
+
+   if (len < n) return 0;
+   memcpy(h + 8, "WAVE", 4);
+
+   /* a ds64 chunk, or a JUNK chunk of the same size to make room for one */
+   size_t ds64 = n;
+   if (len - n < 36) return 0;
+   memcpy(h + n, "JUNK", 4);
+   put32(h + n + 4, 28);
+   memset(h + n + 8, 0, 28);
+   n += 36;
+
+   if (len - n < 8 + fmt_size) return 0;
+   memcpy(h + n, "fmt ", 4);
+   put32(h + n + 4, (uint32_t)fmt_size);
+   put16(h + n + 8, extensible ? 0xFFFE : tag);
+   put16(h + n + 10, (uint16_t)c->channels);
+   put32(h + n + 12, 48000);
+   put32(h + n + 16, 48000 * align);
+   put16(h + n + 20, (uint16_t)align);
+   put16(h + n + 22, (uint16_t)bits);
+   if (extensible) {
+      static const uint8_t guid[14] = {
+         0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+      };
+      put16(h + n + 24, 22);
+      put16(h + n + 26, (uint16_t)bits);
+      put32(h + n + 28, c->channels <= 18 ? (1u << c->channels) - 1 : 0);
+      put16(h + n + 32, tag);
+      memcpy(h + n + 34, guid, sizeof(guid));
+   }
+   n += 8 + fmt_size;
+
+   if (c->chunks) {
+      if (len - n < 8 + sizeof(info) - 1) return 0;
+      memcpy(h + n, "LIST", 4);
+      put32(h + n + 4, sizeof(info) - 1);
+      memcpy(h + n + 8, info, sizeof(info) - 1);
+      n += 8 + sizeof(info) - 1;
+   }
+
+   if (len - n < 8) return 0;
+   memcpy(h + n, "data", 4);
+   n += 8;
+
+   uint64_t riff = n - 8 + data_size + (data_size & 1) + trailer;
+   if (riff > UINT32_MAX) {
+      memcpy(h, "RF64", 4);
+      put32(h + 4, UINT32_MAX);
+      memcpy(h + ds64, "ds64", 4);
+      put64(h + ds64 + 8, riff);
+      put64(h + ds64 + 16, data_size);
+      put64(h + ds64 + 24, data_size / align);
+      put32(h + n - 4, UINT32_MAX);
+   }
+   else {
+      memcpy(h, "RIFF", 4);
+      put32(h + 4, (uint32_t)riff);
+      put32(h + n - 4, (uint32_t)data_size);
+   }
+   return n;
+}
+
+/*
+ * fills a block with a quiet sine per channel (a different pitch each)
+ * and a little noise, converted to the case's sample format
+ */
+static int make_block(uint8_t *block, const struct bench_case *c, size_t frames) {
+   size_t n = frames * c->channels;
+   double *wave = malloc(n * sizeof(double));
+   if (wave == NULL) return -1;
+
+   uint32_t seed = 1;
+   for (size_t i = 0; i < frames; i++) {
+      for (unsigned ch = 0; ch < c->channels; ch++) {
+         seed = seed * 1664525u + 1013904223u;
+         double noise = ((double)(seed >> 8) / (1 << 24) - 0.5) * 0.002;
+         wave[i * c->channels + ch] = 0.25 * sin(2 * M_PI * 440.0 * (1 + ch / 8.0) * i / 48000.0) + noise;
+      }
+   }
+   int ret = wavutil_convert_samples(block, c->format, wave, WAVUTIL_SAMPLE_F64, n);
+   free(wave);
+   return ret;
+}
+
+/*
+ * writes one synthetic file with data_size bytes of audio (rounded down
+ * to whole frames)
+ */
+static int make_file(const char *path, const struct bench_case *c, uint64_t data_size,
+                     const uint8_t *block, size_t block_size, int sync) {
+   static const char trailer[] = "LIST\x0c\0\0\0INFOICMT\0\0\0\0";
+   size_t trailer_size = c->chunks ? sizeof(trailer) - 1 : 0;
+   uint8_t header[MAX_HEADER];
+   size_t header_size = make_header(header, sizeof(header), c, data_size, trailer_size);
+   if (header_size == 0) {
+      fprintf(stderr, "Header of %s does not fit in %zu bytes\n", path, sizeof(header));
+      return -1;
+   }
+
+   int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+   if (fd < 0) {
+      fprintf(stderr, "Failed to create %s: %s\n", path, strerror(errno));
+      return -1;
+   }
+
+   int ok = write(fd, header, header_size) == (ssize_t)header_size;
+   for (uint64_t done = 0; ok && done < data_size; ) {
+      size_t n = data_size - done < block_size ? (size_t)(data_size - done) : block_size;
+      ok = write(fd, block, n) == (ssize_t)n;
+      done += n;
+   }
+   if (ok && (data_size & 1)) ok = write(fd, "", 1) == 1;
+   if (ok && trailer_size) ok = write(fd, trailer, trailer_size) == (ssize_t)trailer_size;
+   if (ok && sync) ok = fdatasync(fd) == 0;
+   if (close(fd)) ok = 0;
+
+   if (!ok) {
+      fprintf(stderr, "Writing %s failed: %s\n", path, strerror(errno));
+      unlink(path);
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * times one call of op on the file at path. returns the seconds it took,
+ * or -1 if it failed.
+ */
+static double run_op(const struct bench_op *op, const char *path, const char *out_name,
+                     uint64_t *bytes, int cold) {
+   wavutil_info info;
+   double start, elapsed = -1;
+
+   int fd = open(path, (op->kind == OP_PATCH ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+   if (fd < 0) return -1;
+   if (cold) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+   if (op->kind == OP_PARSE) {
+      start = now_seconds();
+      int ret = wavutil_read(fd, NULL, &info);
+      elapsed = now_seconds() - start;
+      if (ret == 0) wavutil_free(&info);
+      else elapsed = -1;
+      close(fd);
+      return elapsed;
+   }
+
+   if (wavutil_read(fd, NULL, &info)) {
+      close(fd);
+      return -1;
+   }
+   if (cold) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+
+   int out = -1, ret = -1;
+   wavutil_header edited = info.header;
+   enum wavutil_sample_format format = wavutil_file_format(fd, NULL, &info);
+   struct wavutil_stats stats;
+   struct wavutil_loudness loudness;
+   uint8_t digest[WAVUTIL_HASH_MAX];
+   unsigned channels = info.header.f.numChannels;
+   struct wavutil_channels *split = NULL;
+   unsigned *split_channels = NULL;
+   char *split_names = NULL;
+   size_t name_len = strlen(out_name) + 8;
+
+   if (op->kind == OP_COPY) {
+      out = open(out_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      if (out < 0) goto done;
+   }
+   if (op->kind == OP_PATCH) {
+      edited.f.sampleRate++;
+   }
+   if (op->kind == OP_SPLIT) {
+      /* every channel into out.wav.1, out.wav.2... */
+      split = calloc(channels, sizeof(*split));
+      split_channels = calloc(channels, sizeof(*split_channels));
+      split_names = malloc(channels * name_len);
+      if (!split || !split_channels || !split_names) goto done;
+      for (unsigned c = 0; c < channels; c++) {
+         split_channels[c] = c;
+         snprintf(split_names + c * name_len, name_len, "%s.%u", out_name, c + 1);
+         split[c].name = split_names + c * name_len;
+         split[c].channels = split_channels + c;
+         split[c].count = 1;
+      }
+   }
+
+   start = now_seconds();
+   switch (op->kind) {
+   case OP_VERIFY:
+      ret = wavutil_verify(quiet, &info) ? -1 : 0;
+      break;
+   case OP_PATCH:
+      ret = wavutil_patch(fd, &info, &edited) < 0 ? -1 : 0;
+      break;
+   case OP_WRITE:
+      ret = wavutil_write(out_name, fd, &info, &edited, WAVUTIL_OUTPUT_AUTO, NULL,
+                          NULL) < 0 ? -1 : 0;
+      break;
+   case OP_COPY: {
+      struct wavutil_copy_options copy = { .method = (enum wavutil_copy_method)op->arg };
+      ret = wavutil_write_fd(fd, &info, &edited, out, &copy, NULL) < 0 ? -1 : 0;
+      break;
+   }
+   case OP_CONVERT:
+      ret = wavutil_convert(out_name, fd, &info, NULL,
+                            format == WAVUTIL_SAMPLE_F32 ? WAVUTIL_SAMPLE_S16 : WAVUTIL_SAMPLE_F32,
+                            NULL);
+      break;
+   case OP_STATS:
+      ret = wavutil_stats(fd, &info, NULL, 0, &stats);
+      if (ret == 0) wavutil_stats_free(&stats);
+      break;
+   case OP_LOUDNESS:
+      ret = wavutil_loudness(fd, &info, NULL, 0, &loudness);
+      break;
+   case OP_HASH:
+      ret = wavutil_hash(fd, &info, NULL, (enum wavutil_hash_algorithm)op->arg, 0, digest);
+      break;
+   case OP_SPLIT:
+      ret = wavutil_split_channels(fd, &info, NULL, split, channels);
+      break;
+   case OP_RESAMPLE:
+      ret = wavutil_resample(out_name, fd, &info, NULL,
+                             info.header.f.sampleRate == 48000 ? 44100 : 48000, 0);
+      break;
+   default:
+      break;
+   }
+   elapsed = now_seconds() - start;
+
+   if (op->kind == OP_PATCH && ret == 0) {
+      /* put the header back for the next run */
+      wavutil_info patched = info;
+      patched.header = edited;
+      wavutil_patch(fd, &patched, &info.header);
+   }
+   if (ret == 0 && op->kind != OP_VERIFY && op->kind != OP_PATCH) {
+      *bytes += info.data_size;
+   }
+
+done:
+   if (out >= 0) close(out);
+   for (unsigned c = 0; split_names && c < channels; c++) {
+      unlink(split_names + c * name_len);
+   }
+   free(split);
+   free(split_channels);
+   free(split_names);
+   wavutil_free(&info);
+   close(fd);
+   return ret == 0 ? elapsed : -1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+   double x = *(const double *)a, y = *(const double *)b;
+   return x < y ? -1 : x > y;
+}
+
+/* the nearest rank percentile of sorted values */
+static double percentile(const double *v, size_t n, double p) {
+   if (n == 0) return 0;
+   size_t rank = (size_t)ceil(p * (double)n);
+   return v[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_record(const struct bench_options *opts, const struct bench_case *c,
+                         uint64_t size, size_t files, const struct bench_op *op,
+                         struct bench_result *r) {
+   qsort(r->latency, r->calls, sizeof(double), cmp_double);
+   double mb_s = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+   double calls_s = r->seconds > 0 ? r->calls / r->seconds : 0;
+   double p50 = percentile(r->latency, r->calls, 0.50) * 1e6;
+   double p99 = percentile(r->latency, r->calls, 0.99) * 1e6;
+   unsigned bits = (unsigned)wavutil_sample_size(c->format) * 8;
+
+   switch (opts->format) {
+   case BENCH_CSV:
+      if (records == 0) {
+         printf("case,channels,bits,sample,chunks,size,files,op,calls,failed,bytes,seconds,"
+                "mb_s,files_s,p50_us,p99_us\n");
+      }
+      printf("%s,%u,%u,%s,%d,%" PRIu64 ",%zu,%s,%zu,%zu,%" PRIu64 ",%.6f,%.1f,%.1f,%.1f,%.1f\n",
+             c->name, c->channels, bits, wavutil_sample_names[c->format], c->chunks, size, files,
+             op->name, r->calls, r->failed, r->bytes, r->seconds, mb_s, calls_s, p50, p99);
+      break;
+   case BENCH_NDJSON:
+   case BENCH_JSON:
+      if (opts->format == BENCH_JSON) printf(records ? ",\n" : "[\n");
+      printf("{\"case\": \"%s\", \"channels\": %u, \"bits\": %u, \"sample\": \"%s\", "
+             "\"chunks\": %s, \"size\": %" PRIu64 ", \"files\": %zu, \"op\": \"%s\", "
+             "\"calls\": %zu, \"failed\": %zu, \"bytes\": %" PRIu64 ", \"seconds\": %.6f, "
+             "\"mb_s\": %.1f, \"files_s\": %.1f, \"p50_us\": %.1f, \"p99_us\": %.1f}",
+             c->name, c->channels, bits, wavutil_sample_names[c->format],
+             c->chunks ? "true" : "false", size, files, op->name, r->calls, r->failed,
+             r->bytes, r->seconds, mb_s, calls_s, p50, p99);
+      if (opts->format == BENCH_NDJSON) putchar('\n');
+      break;
+   default:
+      break;
+   }
+   fflush(stdout);
+   records++;
+}
+
+/* an empty filter list lets everything through, names match as prefixes */
+static int selected(const char *const *filters, size_t n, const char *name) {
+   for (size_t i = 0; i < n; i++) {
+      if (!strncmp(name, filters[i], strlen(filters[i]))) return 1;
+   }
+   return n == 0;
+}
+
+static size_t list_ops(struct bench_op *ops) {
+   static const struct { const char *name; enum op_kind kind; } plain[] = {
+      { "parse", OP_PARSE }, { "verify", OP_VERIFY }, { "patch", OP_PATCH },
+      { "write", OP_WRITE }, { "convert", OP_CONVERT }, { "stats", OP_STATS },
+      { "loudness", OP_LOUDNESS }, { "split", OP_SPLIT },
+      { "resample", OP_RESAMPLE },
+   };
+   size_t n = 0;
+   for (size_t i = 0; i < sizeof(plain) / sizeof(plain[0]); i++) {
+      snprintf(ops[n].name, sizeof(ops[n].name), "%s", plain[i].name);
+      ops[n].kind = plain[i].kind;
+      ops[n++].arg = 0;
+   }
+   for (int m = WAVUTIL_COPY_AUTO + 1; m < WAVUTIL_COPY_METHODS; m++) {
+      snprintf(ops[n].name, sizeof(ops[n].name), "copy:%s", wavutil_copy_names[m]);
+      ops[n].kind = OP_COPY;
+      ops[n++].arg = m;
+   }
+   for (int a = 0; a < WAVUTIL_HASH_ALGORITHMS; a++) {
+      snprintf(ops[n].name, sizeof(ops[n].name), "hash:%s", wavutil_hash_names[a]);
+      ops[n].kind = OP_HASH;
+      ops[n++].arg = a;
+   }
+   return n;
+}
+
+/*
+ * generates the files of one case and size, times every operation on
+ * them and removes them again. returns -1 if anything failed, including
+ * a single call of an operation.
+ */
+static int bench_size(const struct bench_options *opts, const char *dir,
+                      const struct bench_case *c, uint64_t size,
+                      const struct bench_op *ops, size_t num_ops) {
+   size_t align = c->channels * wavutil_sample_size(c->format);
+   size_t frames = BLOCK / align;
+   size_t block_size = frames * align;
+   uint64_t data_size = size / align * align;
+   size_t files = size < 16 * MB ? (size_t)(16 * MB / size) : 1;
+   if (files > opts->files) files = opts->files;
+   if (files < 1) files = 1;
+
+   uint8_t *block = malloc(block_size);
+   char **paths = calloc(files, sizeof(char *));
+   char *out_name = NULL;
+   struct bench_result r = {0};
+   r.latency = calloc(files * (size_t)opts->runs, sizeof(double));
+   int ret = -1, ops_failed = 0;
+
+   if (!block || !paths || !r.latency || asprintf(&out_name, "%s/out.wav", dir) < 0) {
+      fprintf(stderr, "Benchmark allocation failed\n");
+      out_name = NULL;
+      goto done;
+   }
+   if (make_block(block, c, frames)) {
+      fprintf(stderr, "Generating %s samples failed\n", c->name);
+      goto done;
+   }
+
+   double start = now_seconds();
+   for (size_t i = 0; i < files; i++) {
+      if (asprintf(&paths[i], "%s/%s-%" PRIu64 "-%04zu.wav", dir, c->name, size, i) < 0) {
+         paths[i] = NULL;
+         goto done;
+      }
+      if (make_file(paths[i], c, data_size, block, block_size, opts->cold)) goto done;
+   }
+   fprintf(stderr, "%s %" PRIu64 " bytes: %zu files generated in %.3f s\n", c->name, size,
+           files, now_seconds() - start);
+
+   for (size_t k = 0; k < num_ops; k++) {
+      r.calls = r.failed = 0;
+      r.bytes = 0;
+      r.seconds = 0;
+      for (int run = 0; run < opts->runs; run++) {
+         for (size_t i = 0; i < files; i++) {
+            double t = run_op(&ops[k], paths[i], out_name, &r.bytes, opts->cold);
+            if (t < 0) {
+               r.failed++;
+               continue;
+            }
+            r.latency[r.calls++] = t;
+            r.seconds += t;
+         }
+      }
+      unlink(out_name);
+      print_record(opts, c, size, files, &ops[k], &r);
+      if (r.failed) {
+         fprintf(stderr, "%s %" PRIu64 " bytes: %s failed %zu times\n", c->name, size,
+                 ops[k].name, r.failed);
+         ops_failed = 1;
+      }
+   }
+   ret = ops_failed ? -1 : 0;
+
+done:
+   for (size_t i = 0; paths && i < files; i++) {
+      if (paths[i] && !opts->keep) unlink(paths[i]);
+      free(paths[i]);
+   }
+   free(paths);
+   free(block);
+   free(out_name);
+   free(r.latency);
+   return ret;
+}
+
+/* parses sizes like 4096, 64K, 16M or 8G */
+static uint64_t parse_size(const char *s) {
+   char *end;
+   uint64_t v = strtoull(s, &end, 10);
+   switch (*end) {
+   case 'k': case 'K': v *= KB; end++; break;
+   case 'm': case 'M': v *= MB; end++; break;
+   case 'g': case 'G': v *= GB; end++; break;
+   default: break;
+   }
+   return *end ? 0 : v;
+}
+
+static void usage(FILE *out) {
+   fprintf(out, "usage: ./wav-bench [options]\n");
+   fprintf(out, "  -f, --format=FORMAT    csv (default), ndjson or json\n");
+   fprintf(out, "  -s, --max-size=SIZE    largest file to generate, 1K to 8G (default 16M)\n");
+   fprintf(out, "  -n, --files=N          files generated for small sizes (default 256)\n");
+   fprintf(out, "  -r, --runs=N           times each operation runs on each file (default 3)\n");
+   fprintf(out, "  -c, --case=NAME        only cases starting with NAME (can be repeated)\n");
+   fprintf(out, "  -o, --op=NAME          only operations starting with NAME (can be repeated)\n");
+   fprintf(out, "  -d, --dir=DIR          where the files are generated (default $TMPDIR)\n");
+   fprintf(out, "      --cold             drop the files from the page cache before each call\n");
+   fprintf(out, "      --keep             leave the generated files behind\n");
+   fprintf(out, "  -h, --help             show this message\n");
+   fprintf(out, "cases:");
+   for (size_t i = 0; i < NUM_CASES; i++) fprintf(out, " %s", cases[i].name);
+   fprintf(out, "\n");
+}
+
+int main(int argc, char **argv) {
+   struct bench_options opts = {0};
+   opts.max_size = 16 * MB;
+   opts.files = 256;
+   opts.runs = 3;
+
+   static const struct option options[] = {
+      {"format",     required_argument, NULL, 'f'},
+      {"max-size",   required_argument, NULL, 's'},
+      {"files",      required_argument, NULL, 'n'},
+      {"runs",       required_argument, NULL, 'r'},
+      {"case",       required_argument, NULL, 'c'},
+      {"op",         required_argument, NULL, 'o'},
+      {"dir",        required_argument, NULL, 'd'},
+      {"cold",       no_argument,       NULL, 'C'},
+      {"keep",       no_argument,       NULL, 'k'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "f:s:n:r:c:o:d:h", options, NULL)) != -1) {
+      switch (opt) {
+      case 'f': {
+         int f = -1;
+         for (int i = 0; i < BENCH_FORMATS; i++) {
+            if (!strcmp(optarg, bench_format_names[i])) f = i;
+         }
+         if (f < 0) {
+            fprintf(stderr, "unknown output format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         opts.format = (enum bench_format)f;
+         break;
+      }
+      case 's':
+         if ((opts.max_size = parse_size(optarg)) == 0) {
+            fprintf(stderr, "invalid size: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'n':
+      case 'r': {
+         int n = atoi(optarg);
+         if (n < 1) {
+            fprintf(stderr, "invalid count: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         if (opt == 'n') opts.files = (size_t)n;
+         else opts.runs = n;
+         break;
+      }
+      case 'c':
+      case 'o':
+         if ((opt == 'c' ? opts.num_cases : opts.num_ops) == MAX_FILTERS) {
+            fprintf(stderr, "too many filters: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         if (opt == 'c') opts.cases[opts.num_cases++] = optarg;
+         else opts.ops[opts.num_ops++] = optarg;
+         break;
+      case 'd':
+         opts.dir = optarg;
+         break;
+      case 'C':
+         opts.cold = 1;
+         break;
+      case 'k':
+         opts.keep = 1;
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if ((quiet = fopen("/dev/null", "w")) == NULL) {
+      fprintf(stderr, "failed to open /dev/null\n");
+      exit(EXIT_FAILURE);
+   }
+
+   char *dir = NULL;
+   const char *tmp = opts.dir ? opts.dir : getenv("TMPDIR");
+   if (asprintf(&dir, "%s/wav-bench.XXXXXX", tmp ? tmp : "/tmp") < 0 || mkdtemp(dir) == NULL) {
+      fprintf(stderr, "Failed to create a directory for the files: %s\n", strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+
+   struct bench_op all[32], ops[32];
+   size_t num_ops = 0, num_all = list_ops(all);
+   for (size_t k = 0; k < num_all; k++) {
+      if (selected(opts.ops, opts.num_ops, all[k].name)) ops[num_ops++] = all[k];
+   }
+
+   fprintf(stderr, "libwavutil %d.%d, %s kernels, files in %s\n", wavutil_version() >> 16,
+           wavutil_version() & 0xffff, wavutil_simd(), dir);
+   int failed = 0;
+   for (size_t i = 0; i < NUM_CASES; i++) {
+      if (!selected(opts.cases, opts.num_cases, cases[i].name)) continue;
+      for (size_t s = 0; s < NUM_SIZES && sizes[s] <= opts.max_size; s++) {
+         if (bench_size(&opts, dir, &cases[i], sizes[s], ops, num_ops)) failed = 1;
+      }
+   }
+   if (opts.format == BENCH_JSON) printf(records ? "\n]\n" : "[]\n");
+
+   if (!opts.keep) rmdir(dir);
+   free(dir);
+   fclose(quiet);
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
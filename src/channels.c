@@ -0,0 +1,838 @@
+/*
+ * channels.c: splitting, extracting and interleaving channels for libwavutil
+ *
+ * the data chunk is read once, a block of frames at a time, and every
+ * output is filled from that block before the next one is read, so
+ * splitting a file into N files costs one pass over its audio data
+ * whatever N is. samples are moved as bytes (blockAlign / numChannels of
+ * them), so any sample format works without being decoded.
+ *
+ * splitting every channel into its own mono file, and interleaving mono
+ * files, is a transpose of the block: frames x channels into channels x
+ * frames and back. it is done in square tiles that stay in registers,
+ * 8x8 for 2 and 4 byte samples and 4x4 for 8 byte samples with AVX2,
+ * 16x16 through the scalar version for the rest. stereo has a kernel of
+ * its own that moves a vector of each channel at a time, and other
+ * counts below a tile (5.1) use tiles with only the channels' rows
+ * loaded or stored. any other selection of channels is gathered a frame
+ * at a time, with one memcpy per frame when the channels are consecutive.
+ */
+#define _GNU_SOURCE
+#include <stdint.h> /* uint types */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* memcpy */
+#include <errno.h> /* errno */
+#include <fcntl.h> /* open */
+#include <unistd.h> /* pread, pwrite */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* AVX2 */
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "wavutil.h"
+#include "wavutil_private.h"
+
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+#define CHUNK_HEADER_SIZE 8
+#define EXTENSIBLE_SIZE 40 /* fmt body with valid bits, channel mask and sub format */
+#define EXTENSIBLE_CHANNEL_MASK 20
+
+#define CHANNELS_BLOCK (1 << 20) /* bytes of input frames per block */
+#define TILE 16 /* side of the scalar transpose tiles */
+#define PLANE_PAD 64 /* between the blocks of each file, so they do not share cache sets */
+
+/*
+ * copies a rows x cols tile of samples from src to dst, transposed:
+ * sample j of row i goes to sample i of row j of dst. strides are in
+ * bytes. size is a constant once inlined, so the copies are single moves.
+ */
+static inline __attribute__((always_inline))
+void transpose_tile(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                    size_t rows, size_t cols, size_t size) {
+   for (size_t j = 0; j < cols; j++) {
+      uint8_t *d = dst + j * dst_stride;
+      const uint8_t *s = src + j * size;
+      for (size_t i = 0; i < rows; i++) {
+         memcpy(d + i * size, s + i * src_stride, size);
+      }
+   }
+}
+
+/*
+ * tiles are taken along the longer side first, the frames, so that the
+ * interleaved side of the block is walked through once from start to end
+ * and the other side is written (or read) a few lines at a time.
+ */
+static void transpose_scalar(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                             size_t src_stride, size_t rows, size_t cols, size_t size) {
+   size_t outer = rows >= cols ? rows : cols, inner = rows >= cols ? cols : rows;
+
+   for (size_t a = 0; a < outer; a += TILE) {
+      for (size_t b = 0; b < inner; b += TILE) {
+         size_t i = rows >= cols ? a : b, j = rows >= cols ? b : a;
+         size_t r = rows - i < TILE ? rows - i : TILE;
+         size_t c = cols - j < TILE ? cols - j : TILE;
+         uint8_t *d = dst + j * dst_stride + i * size;
+         const uint8_t *s = src + i * src_stride + j * size;
+         switch (size) {
+         case 1: transpose_tile(d, dst_stride, s, src_stride, r, c, 1); break;
+         case 2: transpose_tile(d, dst_stride, s, src_stride, r, c, 2); break;
+         case 3: transpose_tile(d, dst_stride, s, src_stride, r, c, 3); break;
+         case 4: transpose_tile(d, dst_stride, s, src_stride, r, c, 4); break;
+         case 8: transpose_tile(d, dst_stride, s, src_stride, r, c, 8); break;
+         default: transpose_tile(d, dst_stride, s, src_stride, r, c, size); break;
+         }
+      }
+   }
+}
+
+#ifdef HAVE_X86_SIMD
+/*
+ * the tiles are transposed in registers, one row per vector. the tile
+ * functions load in rows of src (the others are zero), transpose them
+ * and store the first out rows of the result. in and out are constants
+ * once inlined: whole tiles move every row, and with fewer channels than
+ * a tile has rows only the channels are loaded or stored.
+ */
+
+/* 8x8 16 bit samples: three rounds of unpacking, 16, 32 and 64 bits wide */
+__attribute__((target("avx2"), always_inline))
+static inline void transpose_8x8_16(__m128i r[8]) {
+   __m128i a[8], b[8];
+   for (int i = 0; i < 8; i += 2) {
+      a[i / 2] = _mm_unpacklo_epi16(r[i], r[i + 1]);
+      a[i / 2 + 4] = _mm_unpackhi_epi16(r[i], r[i + 1]);
+   }
+   /* a[0..3] hold columns 0-3 of row pairs, a[4..7] columns 4-7 */
+   for (int h = 0; h < 8; h += 4) {
+      b[h] = _mm_unpacklo_epi32(a[h], a[h + 1]);
+      b[h + 1] = _mm_unpackhi_epi32(a[h], a[h + 1]);
+      b[h + 2] = _mm_unpacklo_epi32(a[h + 2], a[h + 3]);
+      b[h + 3] = _mm_unpackhi_epi32(a[h + 2], a[h + 3]);
+   }
+   /* b[h + k] and b[h + k + 2] hold the same 2 columns of rows 0-3 and 4-7 */
+   for (int k = 0; k < 2; k++) {
+      for (int h = 0; h < 8; h += 4) {
+         int col = h + 2 * k;
+         r[col] = _mm_unpacklo_epi64(b[h + k], b[h + k + 2]);
+         r[col + 1] = _mm_unpackhi_epi64(b[h + k], b[h + k + 2]);
+      }
+   }
+}
+
+/* 8x8 32 bit samples: unpack, shuffle, then swap 128 bit halves */
+__attribute__((target("avx2"), always_inline))
+static inline void transpose_8x8_32(__m256 r[8]) {
+   __m256 t[8], u[8];
+   for (int i = 0; i < 8; i += 2) {
+      t[i] = _mm256_unpacklo_ps(r[i], r[i + 1]);
+      t[i + 1] = _mm256_unpackhi_ps(r[i], r[i + 1]);
+   }
+   for (int i = 0; i < 8; i += 4) {
+      u[i] = _mm256_shuffle_ps(t[i], t[i + 2], 0x44);
+      u[i + 1] = _mm256_shuffle_ps(t[i], t[i + 2], 0xEE);
+      u[i + 2] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0x44);
+      u[i + 3] = _mm256_shuffle_ps(t[i + 1], t[i + 3], 0xEE);
+   }
+   for (int j = 0; j < 4; j++) {
+      r[j] = _mm256_permute2f128_ps(u[j], u[j + 4], 0x20);
+      r[j + 4] = _mm256_permute2f128_ps(u[j], u[j + 4], 0x31);
+   }
+}
+
+/* 4x4 64 bit samples */
+__attribute__((target("avx2"), always_inline))
+static inline void transpose_4x4_64(__m256d r[4]) {
+   __m256d t[4];
+   t[0] = _mm256_unpacklo_pd(r[0], r[1]);
+   t[1] = _mm256_unpackhi_pd(r[0], r[1]);
+   t[2] = _mm256_unpacklo_pd(r[2], r[3]);
+   t[3] = _mm256_unpackhi_pd(r[2], r[3]);
+   for (int j = 0; j < 2; j++) {
+      r[j] = _mm256_permute2f128_pd(t[j], t[j + 2], 0x20);
+      r[j + 2] = _mm256_permute2f128_pd(t[j], t[j + 2], 0x31);
+   }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void tile_16(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                           unsigned in, unsigned out) {
+   __m128i r[8];
+   for (unsigned i = 0; i < 8; i++) {
+      r[i] = i < in ? _mm_loadu_si128((const __m128i *)(src + i * src_stride)) : _mm_setzero_si128();
+   }
+   transpose_8x8_16(r);
+   for (unsigned i = 0; i < out; i++) {
+      _mm_storeu_si128((__m128i *)(dst + i * dst_stride), r[i]);
+   }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void tile_32(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                           unsigned in, unsigned out) {
+   __m256 r[8];
+   for (unsigned i = 0; i < 8; i++) {
+      r[i] = i < in ? _mm256_loadu_ps((const float *)(src + i * src_stride)) : _mm256_setzero_ps();
+   }
+   transpose_8x8_32(r);
+   for (unsigned i = 0; i < out; i++) {
+      _mm256_storeu_ps((float *)(dst + i * dst_stride), r[i]);
+   }
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline void tile_64(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                           unsigned in, unsigned out) {
+   __m256d r[4];
+   for (unsigned i = 0; i < 4; i++) {
+      r[i] = i < in ? _mm256_loadu_pd((const double *)(src + i * src_stride)) : _mm256_setzero_pd();
+   }
+   transpose_4x4_64(r);
+   for (unsigned i = 0; i < out && i < 4; i++) {
+      _mm256_storeu_pd((double *)(dst + i * dst_stride), r[i]);
+   }
+}
+
+/* one tile of size byte samples, in rows loaded and out stored */
+__attribute__((target("avx2"), always_inline))
+static inline void tile(uint8_t *dst, size_t dst_stride, const uint8_t *src, size_t src_stride,
+                        size_t size, unsigned in, unsigned out) {
+   if (size == 2) tile_16(dst, dst_stride, src, src_stride, in, out);
+   else if (size == 4) tile_32(dst, dst_stride, src, src_stride, in, out);
+   else tile_64(dst, dst_stride, src, src_stride, in, out);
+}
+
+/*
+ * fewer channels than a tile has rows. splitting loads a whole tile row
+ * from each frame, running into the frames after it, and stores only the
+ * channels. interleaving loads only the channels and stores whole rows
+ * in frame order, so what runs into the next frame is overwritten by
+ * that frame, and the last one by the next tile or the scalar edge. both
+ * need a tile's worth of frames after the last one done. channels is a
+ * constant once inlined. returns the frames done.
+ */
+__attribute__((target("avx2"), always_inline))
+static inline size_t narrow_tiles(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                                  size_t src_stride, size_t frames, unsigned channels,
+                                  size_t size, int split) {
+   unsigned side = size == 8 ? 4 : 8;
+   size_t done = frames >= 2 * side ? (frames - side) / side * side : 0;
+
+   for (size_t f = 0; f < done; f += side) {
+      if (split) tile(dst + f * size, dst_stride, src + f * src_stride, src_stride, size, side, channels);
+      else tile(dst + f * dst_stride, dst_stride, src + f * size, src_stride, size, channels, side);
+   }
+   return done;
+}
+
+/*
+ * stereo, a vector of each channel at a time: split with a shuffle and a
+ * swap of the middle 64 bit quarters, interleave with unpacks and a swap
+ * of 128 bit halves. returns the frames done.
+ */
+__attribute__((target("avx2")))
+static size_t transpose_stereo(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                               size_t src_stride, size_t frames, size_t size, int split) {
+   size_t group = 32 / size, done = frames / group * group;
+   const __m256i pairs = _mm256_setr_epi8(0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15,
+                                          0, 1, 4, 5, 8, 9, 12, 13, 2, 3, 6, 7, 10, 11, 14, 15);
+
+   for (size_t f = 0; f < done; f += group) {
+      if (split) {
+         const uint8_t *s = src + f * src_stride;
+         uint8_t *left = dst + f * size, *right = dst + dst_stride + f * size;
+         __m256i a = _mm256_loadu_si256((const __m256i *)s);
+         __m256i b = _mm256_loadu_si256((const __m256i *)(s + 32));
+         __m256i l, r;
+         if (size == 2) {
+            /* 32 bytes are 8 frames, a half vector of each channel */
+            __m256i x = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, pairs), 0xD8);
+            __m256i y = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, pairs), 0xD8);
+            l = _mm256_permute2x128_si256(x, y, 0x20);
+            r = _mm256_permute2x128_si256(x, y, 0x31);
+         }
+         else if (size == 4) {
+            l = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), 0x88));
+            r = _mm256_castps_si256(_mm256_shuffle_ps(_mm256_castsi256_ps(a), _mm256_castsi256_ps(b), 0xDD));
+            l = _mm256_permute4x64_epi64(l, 0xD8);
+            r = _mm256_permute4x64_epi64(r, 0xD8);
+         }
+         else {
+            l = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8);
+            r = _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xD8);
+         }
+         _mm256_storeu_si256((__m256i *)left, l);
+         _mm256_storeu_si256((__m256i *)right, r);
+      }
+      else {
+         __m256i l = _mm256_loadu_si256((const __m256i *)(src + f * size));
+         __m256i r = _mm256_loadu_si256((const __m256i *)(src + src_stride + f * size));
+         __m256i lo, hi;
+         if (size == 2) {
+            lo = _mm256_unpacklo_epi16(l, r);
+            hi = _mm256_unpackhi_epi16(l, r);
+         }
+         else if (size == 4) {
+            lo = _mm256_unpacklo_epi32(l, r);
+            hi = _mm256_unpackhi_epi32(l, r);
+         }
+         else {
+            lo = _mm256_unpacklo_epi64(l, r);
+            hi = _mm256_unpackhi_epi64(l, r);
+         }
+         uint8_t *d = dst + f * dst_stride;
+         _mm256_storeu_si256((__m256i *)d, _mm256_permute2x128_si256(lo, hi, 0x20));
+         _mm256_storeu_si256((__m256i *)(d + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+      }
+   }
+   return done;
+}
+
+__attribute__((target("avx2")))
+static size_t transpose_narrow(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                               size_t src_stride, size_t frames, unsigned channels, size_t size,
+                               int split) {
+   switch (channels) {
+   case 2: return transpose_stereo(dst, dst_stride, src, src_stride, frames, size, split);
+   case 3: return narrow_tiles(dst, dst_stride, src, src_stride, frames, 3, size, split);
+   case 4: return narrow_tiles(dst, dst_stride, src, src_stride, frames, 4, size, split);
+   case 5: return narrow_tiles(dst, dst_stride, src, src_stride, frames, 5, size, split);
+   case 6: return narrow_tiles(dst, dst_stride, src, src_stride, frames, 6, size, split);
+   default: return narrow_tiles(dst, dst_stride, src, src_stride, frames, 7, size, split);
+   }
+}
+
+/*
+ * whole tiles with the kernels above, the edges through the scalar
+ * version. with fewer channels than a tile has rows, stereo has its own
+ * kernel and narrow tiles take the rest where they beat the scalar
+ * version: 16 bit samples, and 32 bit ones filling most of a tile.
+ */
+__attribute__((target("avx2")))
+static void transpose_avx2(uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                           size_t src_stride, size_t rows, size_t cols, size_t size) {
+   size_t side = size == 8 ? 4 : 8;
+
+   if (cols < side || rows < side) {
+      int split = cols < side;
+      size_t channels = split ? cols : rows, frames = split ? rows : cols, done = 0;
+      if (channels == 2 || (channels > 2 && (size == 2 || (size == 4 && channels > 4)))) {
+         done = transpose_narrow(dst, dst_stride, src, src_stride, frames, (unsigned)channels,
+                                 size, split);
+      }
+      if (split) {
+         transpose_scalar(dst + done * size, dst_stride, src + done * src_stride, src_stride,
+                          rows - done, cols, size);
+      }
+      else {
+         transpose_scalar(dst + done * dst_stride, dst_stride, src + done * size, src_stride,
+                          rows, cols - done, size);
+      }
+      return;
+   }
+
+   size_t whole_rows = rows / side * side, whole_cols = cols / side * side;
+   size_t outer = rows >= cols ? whole_rows : whole_cols;
+   size_t inner = rows >= cols ? whole_cols : whole_rows;
+
+   for (size_t a = 0; a < outer; a += side) {
+      for (size_t b = 0; b < inner; b += side) {
+         size_t i = rows >= cols ? a : b, j = rows >= cols ? b : a;
+         tile(dst + j * dst_stride + i * size, dst_stride, src + i * src_stride + j * size,
+              src_stride, size, side, side);
+      }
+   }
+   if (whole_cols < cols) {
+      transpose_scalar(dst + whole_cols * dst_stride, dst_stride, src + whole_cols * size,
+                       src_stride, whole_rows, cols - whole_cols, size);
+   }
+   if (whole_rows < rows) {
+      transpose_scalar(dst + whole_rows * size, dst_stride, src + whole_rows * src_stride,
+                       src_stride, rows - whole_rows, cols, size);
+   }
+}
+#endif
+
+/*
+ * transposes rows frames of cols samples at src into cols rows of rows
+ * samples at dst, or back.
+ */
+static void transpose(int simd, uint8_t *dst, size_t dst_stride, const uint8_t *src,
+                      size_t src_stride, size_t rows, size_t cols, size_t size) {
+#ifdef HAVE_X86_SIMD
+   if (simd && (size == 2 || size == 4 || size == 8)) {
+      transpose_avx2(dst, dst_stride, src, src_stride, rows, cols, size);
+      return;
+   }
+#endif
+   (void)simd;
+   transpose_scalar(dst, dst_stride, src, src_stride, rows, cols, size);
+}
+
+static inline __attribute__((always_inline))
+void gather_frames(uint8_t *dst, size_t dst_frame, const uint8_t *src, size_t src_frame,
+                   const unsigned *channels, unsigned count, size_t frames, size_t size) {
+   for (size_t f = 0; f < frames; f++) {
+      for (unsigned k = 0; k < count; k++) {
+         memcpy(dst + k * size, src + channels[k] * size, size);
+      }
+      dst += dst_frame;
+      src += src_frame;
+   }
+}
+
+/*
+ * copies channels[0..count) of every frame in src into consecutive
+ * samples of every frame in dst. frame sizes are in bytes.
+ */
+static void gather(uint8_t *dst, size_t dst_frame, const uint8_t *src, size_t src_frame,
+                   const unsigned *channels, unsigned count, size_t frames, size_t size) {
+   unsigned run = 1;
+   while (run < count && channels[run] == channels[0] + run) run++;
+
+   if (run == count) {
+      size_t len = count * size;
+      src += channels[0] * size;
+      for (size_t f = 0; f < frames; f++) {
+         memcpy(dst + f * dst_frame, src + f * src_frame, len);
+      }
+      return;
+   }
+   switch (size) {
+   case 1: gather_frames(dst, dst_frame, src, src_frame, channels, count, frames, 1); break;
+   case 2: gather_frames(dst, dst_frame, src, src_frame, channels, count, frames, 2); break;
+   case 3: gather_frames(dst, dst_frame, src, src_frame, channels, count, frames, 3); break;
+   case 4: gather_frames(dst, dst_frame, src, src_frame, channels, count, frames, 4); break;
+   case 8: gather_frames(dst, dst_frame, src, src_frame, channels, count, frames, 8); break;
+   default: gather_frames(dst, dst_frame, src, src_frame, channels, count, frames, size); break;
+   }
+}
+
+/*
+ * bytes per sample of a file, from blockAlign so that samples in a
+ * bigger container (20 bits in 3 bytes) are moved whole. 0 if the fmt
+ * chunk does not add up.
+ */
+static size_t sample_bytes(const struct wavutil_fmt_chunk *f) {
+   if (f->numChannels == 0 || f->blockAlign == 0 || f->blockAlign % f->numChannels) return 0;
+   return f->blockAlign / f->numChannels;
+}
+
+/*
+ * the speaker of each channel of a WAVE_FORMAT_EXTENSIBLE file: channel
+ * k is the k-th bit set in its channel mask. fills speakers[0..channels)
+ * (0 past the bits the mask has) and returns the mask, 0 when the file
+ * has none.
+ */
+static uint32_t read_speakers(int fd, const struct wavutil_map *map, const wavutil_info *info,
+                              uint32_t *speakers) {
+   const struct wavutil_chunk_entry *c = &info->chunks[info->fmt];
+   unsigned channels = info->header.f.numChannels;
+   uint32_t mask = 0;
+
+   memset(speakers, 0, channels * sizeof(*speakers));
+   if (info->header.f.audioFormat != WAVE_FORMAT_EXTENSIBLE || c->size < EXTENSIBLE_SIZE) {
+      return 0;
+   }
+   uint64_t off = c->offset + CHUNK_HEADER_SIZE + EXTENSIBLE_CHANNEL_MASK;
+   if (map && map->base && off + sizeof(mask) <= map->size) {
+      memcpy(&mask, map->base + off, sizeof(mask));
+   }
+   else if (pread(fd, &mask, sizeof(mask), (off_t)off) != (ssize_t)sizeof(mask)) {
+      return 0;
+   }
+
+   uint32_t bits = mask;
+   for (unsigned k = 0; k < channels && bits; k++) {
+      speakers[k] = bits & -bits;
+      bits &= bits - 1;
+   }
+   return mask;
+}
+
+/*
+ * the channel mask of a file made of the given speakers in that order.
+ * a mask can only say which speakers are there, in the order of their
+ * bits, so anything else (a speaker missing, repeated or out of order)
+ * gets 0, meaning no particular speakers.
+ */
+static uint32_t speaker_mask(const uint32_t *speakers, unsigned count) {
+   uint32_t mask = 0;
+   for (unsigned k = 0; k < count; k++) {
+      if (speakers[k] == 0 || (k && speakers[k] <= speakers[k - 1])) {
+         return 0;
+      }
+      mask |= speakers[k];
+   }
+   return mask;
+}
+
+/*
+ * builds the header of an output with channels channels and mask as its
+ * channel mask, and creates it. the other chunks come from info.
+ * returns the open file, or -1.
+ */
+static int create_output(const char *name, int fd, const wavutil_info *info, unsigned channels,
+                         uint32_t mask, uint64_t data_size, size_t *len) {
+   wavutil_header edited = info->header;
+   size_t size = sample_bytes(&info->header.f);
+   edited.f.numChannels = (uint16_t)channels;
+   edited.f.blockAlign = (uint16_t)(channels * size);
+   edited.f.byteRate = edited.f.sampleRate * edited.f.blockAlign;
+
+   uint8_t *prefix = wavutil_prefix(fd, info, &edited, data_size, len);
+   if (prefix == NULL) {
+      return -1;
+   }
+
+   /* a ds64 chunk inserted in front of everything moved the fmt chunk along */
+   if (edited.f.audioFormat == WAVE_FORMAT_EXTENSIBLE &&
+       info->chunks[info->fmt].size >= EXTENSIBLE_SIZE) {
+      uint8_t *body = prefix + info->chunks[info->fmt].offset + (*len - info->data_offset) +
+                      CHUNK_HEADER_SIZE;
+      memcpy(body + EXTENSIBLE_CHANNEL_MASK, &mask, sizeof(mask));
+   }
+
+   int out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (out < 0) {
+      wu_log("Failed to create %s\n", name);
+      free(prefix);
+      return -1;
+   }
+
+   ssize_t n = pwrite(out, prefix, *len, 0);
+   free(prefix);
+   if (n != (ssize_t)*len) {
+      wu_log("Writing header to %s failed: %s\n", name, n < 0 ? strerror(errno) : "short write");
+      close(out);
+      return -1;
+   }
+   return out;
+}
+
+/*
+ * finishes an output whose data chunk ends at off: the pad byte of an odd
+ * sized data chunk and the chunks that came after the data chunk of info.
+ */
+static int finish_output(const char *name, int out, int fd, const wavutil_info *info, uint64_t off,
+                         uint64_t data_size) {
+   if ((data_size & 1) && pwrite(out, "", 1, (off_t)off++) != 1) {
+      wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+      return -1;
+   }
+   uint64_t data_end = info->data_offset + info->data_size + (info->data_size & 1);
+   if (info->file_size > data_end &&
+       wavutil_copy_range(fd, (off_t)data_end, out, (off_t)off, info->file_size - data_end,
+                          NULL) < 0) {
+      wu_log("Writing trailing chunks to %s failed: %s\n", name, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+static int write_all(int fd, const uint8_t *buf, size_t len, uint64_t off) {
+   while (len > 0) {
+      ssize_t n = pwrite(fd, buf, len, (off_t)off);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      buf += n;
+      len -= (size_t)n;
+      off += (uint64_t)n;
+   }
+   return 0;
+}
+
+static int read_all(int fd, uint8_t *buf, size_t len, uint64_t off) {
+   while (len > 0) {
+      ssize_t n = pread(fd, buf, len, (off_t)off);
+      if (n <= 0) {
+         if (n < 0 && errno == EINTR) continue;
+         if (n == 0) errno = EIO;
+         return -1;
+      }
+      buf += n;
+      len -= (size_t)n;
+      off += (uint64_t)n;
+   }
+   return 0;
+}
+
+/* frames per block: about CHANNELS_BLOCK bytes of the widest frame, whole tiles */
+static size_t block_frames(size_t frame) {
+   size_t frames = CHANNELS_BLOCK / frame;
+   frames = frames / TILE * TILE;
+   return frames ? frames : TILE;
+}
+
+static int simd_kernels(void) {
+#ifdef HAVE_X86_SIMD
+   return !strcmp(wavutil_simd(), "avx2");
+#else
+   return 0;
+#endif
+}
+
+int wavutil_split_channels(int fd, const wavutil_info *info, const struct wavutil_map *map,
+                           const struct wavutil_channels *outputs, unsigned n) {
+   const struct wavutil_fmt_chunk *f = &info->header.f;
+   size_t size = sample_bytes(f);
+   unsigned channels = f->numChannels;
+
+   if (size == 0 || n == 0) {
+      wu_log("Unsupported sample layout: %u channels, block align %u\n", channels, f->blockAlign);
+      errno = EINVAL;
+      return -1;
+   }
+   unsigned widest = 0;
+   for (unsigned o = 0; o < n; o++) {
+      if (outputs[o].count > widest) widest = outputs[o].count;
+      if (outputs[o].count == 0 || outputs[o].count > UINT16_MAX / size) {
+         wu_log("%s: %u channels\n", outputs[o].name, outputs[o].count);
+         errno = EINVAL;
+         return -1;
+      }
+      for (unsigned k = 0; k < outputs[o].count; k++) {
+         if (outputs[o].channels[k] >= channels) {
+            wu_log("%s: there is no channel %u, the file has %u\n", outputs[o].name,
+                   outputs[o].channels[k] + 1, channels);
+            errno = EINVAL;
+            return -1;
+         }
+      }
+   }
+
+   /* each channel on its own, in order: the whole block is transposed at once */
+   int planar = n == channels;
+   for (unsigned o = 0; o < n && planar; o++) {
+      planar = outputs[o].count == 1 && outputs[o].channels[0] == o;
+   }
+
+   size_t frame = channels * size;
+   uint64_t frames = info->data_size / frame;
+   size_t block = block_frames(frame);
+   int simd = simd_kernels();
+
+   const uint8_t *mapped = NULL;
+   if (map && map->base && map->size >= info->data_offset &&
+       map->size - info->data_offset >= frames * frame) {
+      mapped = map->base + info->data_offset;
+   }
+
+   /* every output gets block frames of its own after the input block */
+   size_t out_bytes = 0;
+   for (unsigned o = 0; o < n; o++) {
+      out_bytes += block * outputs[o].count * size + PLANE_PAD;
+   }
+   uint8_t *buf = malloc((mapped ? 0 : block * frame) + out_bytes);
+   int *fds = malloc(n * sizeof(*fds));
+   uint64_t *offs = malloc(n * sizeof(*offs));
+   uint32_t *speakers = malloc((channels + widest) * sizeof(*speakers));
+   if (!buf || !fds || !offs || !speakers) {
+      wu_log("Channel buffer allocation failed\n");
+      free(buf);
+      free(fds);
+      free(offs);
+      free(speakers);
+      errno = ENOMEM;
+      return -1;
+   }
+   uint8_t *in = buf, *out = buf + (mapped ? 0 : block * frame);
+   uint32_t *picked = speakers + channels;
+   read_speakers(fd, map, info, speakers);
+
+   int ret = -1;
+   unsigned opened = 0;
+   for (; opened < n; opened++) {
+      const struct wavutil_channels *o = &outputs[opened];
+      size_t len;
+      for (unsigned k = 0; k < o->count; k++) {
+         picked[k] = speakers[o->channels[k]];
+      }
+      fds[opened] = create_output(o->name, fd, info, o->count, speaker_mask(picked, o->count),
+                                  frames * o->count * size, &len);
+      if (fds[opened] < 0) goto done;
+      offs[opened] = len;
+   }
+
+   for (uint64_t done = 0; done < frames; ) {
+      size_t m = frames - done > block ? block : (size_t)(frames - done);
+      const uint8_t *src = mapped ? mapped + done * frame : in;
+
+      if (!mapped && read_all(fd, in, m * frame, info->data_offset + done * frame)) {
+         wu_log("Reading audio data failed: %s\n", strerror(errno));
+         goto done;
+      }
+      if (planar) {
+         transpose(simd, out, block * size + PLANE_PAD, src, frame, m, channels, size);
+      }
+
+      uint8_t *dst = out;
+      for (unsigned o = 0; o < n; o++) {
+         size_t out_frame = outputs[o].count * size;
+         if (!planar) {
+            gather(dst, out_frame, src, frame, outputs[o].channels, outputs[o].count, m, size);
+         }
+         if (write_all(fds[o], dst, m * out_frame, offs[o])) {
+            wu_log("Writing audio data to %s failed: %s\n", outputs[o].name, strerror(errno));
+            goto done;
+         }
+         offs[o] += m * out_frame;
+         dst += block * out_frame + PLANE_PAD;
+      }
+      done += m;
+   }
+
+   for (unsigned o = 0; o < n; o++) {
+      uint64_t data_size = frames * outputs[o].count * size;
+      if (finish_output(outputs[o].name, fds[o], fd, info, offs[o], data_size)) {
+         goto done;
+      }
+   }
+   ret = 0;
+
+done:
+   for (unsigned o = 0; o < opened; o++) {
+      if (close(fds[o]) && ret == 0) {
+         wu_log("Closing %s failed: %s\n", outputs[o].name, strerror(errno));
+         ret = -1;
+      }
+   }
+   free(buf);
+   free(fds);
+   free(offs);
+   free(speakers);
+   return ret;
+}
+
+int wavutil_interleave(const char *name, const int *fds, const wavutil_info *infos, unsigned n) {
+   const struct wavutil_fmt_chunk *first = &infos[0].header.f;
+   size_t size = n ? sample_bytes(first) : 0;
+   enum wavutil_sample_format format = n ? wavutil_file_format(fds[0], NULL, &infos[0])
+                                         : WAVUTIL_SAMPLE_UNKNOWN;
+   unsigned channels = 0;
+   uint64_t frames = 0;
+
+   if (size == 0) {
+      wu_log("Unsupported sample layout: %u channels, block align %u\n",
+             n ? first->numChannels : 0, n ? first->blockAlign : 0);
+      errno = EINVAL;
+      return -1;
+   }
+   for (unsigned i = 0; i < n; i++) {
+      const struct wavutil_fmt_chunk *f = &infos[i].header.f;
+      enum wavutil_sample_format fi = wavutil_file_format(fds[i], NULL, &infos[i]);
+      if (sample_bytes(f) != size || f->bitsPerSample != first->bitsPerSample ||
+          f->sampleRate != first->sampleRate || fi != format) {
+         wu_log("Input %u is %u Hz, %u bits, %s; the first is %u Hz, %u bits, %s\n", i + 1,
+                f->sampleRate, f->bitsPerSample, wavutil_sample_names[fi],
+                first->sampleRate, first->bitsPerSample, wavutil_sample_names[format]);
+         errno = EINVAL;
+         return -1;
+      }
+      uint64_t m = infos[i].data_size / f->blockAlign;
+      if (m > frames) frames = m;
+      channels += f->numChannels;
+   }
+   if (channels > UINT16_MAX / size) {
+      wu_log("%u channels do not fit in a fmt chunk\n", channels);
+      errno = EINVAL;
+      return -1;
+   }
+
+   /* mono inputs only: every block of them is one transpose */
+   int planar = channels == n;
+   size_t frame = channels * size;
+   size_t block = block_frames(frame);
+   int simd = simd_kernels();
+
+   uint8_t *buf = malloc(2 * block * frame + n * PLANE_PAD);
+   unsigned *identity = malloc(channels * sizeof(*identity));
+   uint32_t *speakers = malloc(2 * channels * sizeof(*speakers));
+   if (!buf || !identity || !speakers) {
+      wu_log("Channel buffer allocation failed\n");
+      free(buf);
+      free(identity);
+      free(speakers);
+      errno = ENOMEM;
+      return -1;
+   }
+   uint8_t *in = buf, *out = buf + block * frame + n * PLANE_PAD;
+   for (unsigned k = 0; k < channels; k++) {
+      identity[k] = k;
+   }
+   uint32_t *all = speakers + channels;
+   for (unsigned i = 0, c = 0; i < n; i++) {
+      read_speakers(fds[i], NULL, &infos[i], speakers);
+      memcpy(all + c, speakers, infos[i].header.f.numChannels * sizeof(*speakers));
+      c += infos[i].header.f.numChannels;
+   }
+
+   /* silence is 0 but for unsigned 8 bit samples */
+   uint8_t silence = format == WAVUTIL_SAMPLE_U8 ? 0x80 : 0;
+   uint64_t data_size = frames * frame;
+   size_t len;
+   int out_fd = create_output(name, fds[0], &infos[0], channels, speaker_mask(all, channels),
+                              data_size, &len);
+   if (out_fd < 0) {
+      free(buf);
+      free(identity);
+      free(speakers);
+      return -1;
+   }
+
+   int ret = -1;
+   uint64_t off = len;
+   for (uint64_t done = 0; done < frames; ) {
+      size_t m = frames - done > block ? block : (size_t)(frames - done);
+
+      /* each input's frames side by side, block frames apart */
+      uint8_t *src = in;
+      for (unsigned i = 0; i < n; i++) {
+         size_t in_frame = infos[i].header.f.blockAlign;
+         uint64_t have = infos[i].data_size / in_frame;
+         size_t got = have > done ? (have - done > m ? m : (size_t)(have - done)) : 0;
+         if (got && read_all(fds[i], src, got * in_frame, infos[i].data_offset + done * in_frame)) {
+            wu_log("Reading audio data of input %u failed: %s\n", i + 1, strerror(errno));
+            goto done;
+         }
+         memset(src + got * in_frame, silence, (m - got) * in_frame);
+         src += block * in_frame + PLANE_PAD;
+      }
+
+      if (planar) {
+         transpose(simd, out, frame, in, block * size + PLANE_PAD, channels, m, size);
+      }
+      else {
+         src = in;
+         uint8_t *dst = out;
+         for (unsigned i = 0; i < n; i++) {
+            unsigned c = infos[i].header.f.numChannels;
+            gather(dst, frame, src, c * size, identity, c, m, size);
+            src += block * c * size + PLANE_PAD;
+            dst += c * size;
+         }
+      }
+
+      if (write_all(out_fd, out, m * frame, off)) {
+         wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+         goto done;
+      }
+      off += m * frame;
+      done += m;
+   }
+
+   ret = finish_output(name, out_fd, fds[0], &infos[0], off, data_size);
+
+done:
+   if (close(out_fd) && ret == 0) {
+      wu_log("Closing %s failed: %s\n", name, strerror(errno));
+      ret = -1;
+   }
+   free(buf);
+   free(identity);
+   free(speakers);
+   return ret;
+}
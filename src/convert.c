@@ -0,0 +1,621 @@
+/*
+ * convert.c: sample format conversion kernels for libwavutil
+ *
+ * integer PCM (unsigned 8 bit, 16 bit, packed 24 bit, 32 bit) and IEEE
+ * float (32 and 64 bit) samples are converted through float. the hot pairs, integer to
+ * float32 and back, have AVX2, SSE4.1 and NEON versions picked once at
+ * run time from what the CPU supports; everything else, and the tail of
+ * every vector loop, goes through the scalar versions.
+ *
+ * integers map to [-1, 1) by dividing by 2^(bits-1). floats map back by
+ * multiplying, rounding to nearest (even) and clamping to the integer
+ * range, so out of range samples clip instead of wrapping and NaN becomes
+ * the most negative value. samples are little endian and may be
+ * unaligned; src and dst must not overlap.
+ */
+#define _GNU_SOURCE
+#include <stdint.h> /* uint types */
+#include <string.h> /* memcpy */
+#include <math.h> /* lrintf, lrint */
+#include <errno.h> /* errno */
+#include <pthread.h> /* pthread_once */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* AVX2, SSE4.1 */
+#define HAVE_X86_SIMD 1
+#endif
+#if defined(__aarch64__)
+#include <arm_neon.h> /* NEON */
+#define HAVE_NEON 1
+#endif
+
+#include "wavutil.h"
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+#define U8_SCALE 128.0
+#define S16_SCALE 32768.0f
+#define S24_SCALE 8388608.0f
+#define S32_SCALE 2147483648.0f
+#define S32_MAX_FLOAT 2147483520.0f /* largest float below 2^31 */
+
+#define SCRATCH 512 /* samples converted at a time through double */
+
+const char *const wavutil_sample_names[WAVUTIL_SAMPLE_FORMATS] = {
+   "unknown", "s16", "s24", "s32", "f32", "f64", "u8"
+};
+
+static const size_t sample_sizes[WAVUTIL_SAMPLE_FORMATS] = {
+   0, 2, 3, 4, 4, 8, 1
+};
+
+size_t wavutil_sample_size(enum wavutil_sample_format format) {
+   return (unsigned)format < WAVUTIL_SAMPLE_FORMATS ? sample_sizes[format] : 0;
+}
+
+int wavutil_sample_is_float(enum wavutil_sample_format format) {
+   return format == WAVUTIL_SAMPLE_F32 || format == WAVUTIL_SAMPLE_F64;
+}
+
+/*
+ * the sample format of a fmt chunk. WAVE_FORMAT_EXTENSIBLE is taken as
+ * integer PCM since its sub format is past the fields parsed here.
+ */
+enum wavutil_sample_format wavutil_sample_format(const struct wavutil_fmt_chunk *f) {
+   if (f->audioFormat == WAVE_FORMAT_IEEE_FLOAT) {
+      if (f->bitsPerSample == 32) return WAVUTIL_SAMPLE_F32;
+      if (f->bitsPerSample == 64) return WAVUTIL_SAMPLE_F64;
+      return WAVUTIL_SAMPLE_UNKNOWN;
+   }
+   if (f->audioFormat != WAVE_FORMAT_PCM && f->audioFormat != WAVE_FORMAT_EXTENSIBLE) {
+      return WAVUTIL_SAMPLE_UNKNOWN;
+   }
+   switch (f->bitsPerSample) {
+   case 8: return WAVUTIL_SAMPLE_U8;
+   case 16: return WAVUTIL_SAMPLE_S16;
+   case 24: return WAVUTIL_SAMPLE_S24;
+   case 32: return WAVUTIL_SAMPLE_S32;
+   default: return WAVUTIL_SAMPLE_UNKNOWN;
+   }
+}
+
+/*
+ * rewrites audioFormat, bitsPerSample, blockAlign and byteRate for
+ * samples in format. WAVE_FORMAT_EXTENSIBLE is kept as it is, the caller
+ * updates its sub format. returns -1 for an unknown format.
+ */
+int wavutil_set_sample_format(struct wavutil_fmt_chunk *f, enum wavutil_sample_format format) {
+   size_t size = wavutil_sample_size(format);
+   if (size == 0) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   if (f->audioFormat != WAVE_FORMAT_EXTENSIBLE) {
+      f->audioFormat = wavutil_sample_is_float(format) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+   }
+   f->bitsPerSample = (uint16_t)(size * 8);
+   f->blockAlign = (uint16_t)(size * f->numChannels);
+   f->byteRate = f->sampleRate * f->blockAlign;
+   return 0;
+}
+
+/* scalar kernels, also the tails of the vector ones */
+
+static int32_t load_s24(const uint8_t *p) {
+   uint32_t u = (uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24;
+   return (int32_t)u >> 8;
+}
+
+static void store_s24(uint8_t *p, int32_t v) {
+   p[0] = (uint8_t)v;
+   p[1] = (uint8_t)(v >> 8);
+   p[2] = (uint8_t)(v >> 16);
+}
+
+static void put_f32(uint8_t *dst, float v) {
+   memcpy(dst, &v, sizeof(v));
+}
+
+static float get_f32(const uint8_t *src) {
+   float v;
+   memcpy(&v, src, sizeof(v));
+   return v;
+}
+
+/* scales, clamps and rounds one float the way the vector kernels do */
+static int32_t float_to_int(float v, float scale, float lo, float hi) {
+   return (int32_t)lrintf(fminf(fmaxf(v * scale, lo), hi));
+}
+
+static void s16_to_f32(uint8_t *dst, const uint8_t *src, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      int16_t v;
+      memcpy(&v, src + 2 * i, sizeof(v));
+      put_f32(dst + 4 * i, v * (1.0f / S16_SCALE));
+   }
+}
+
+static void s24_to_f32(uint8_t *dst, const uint8_t *src, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      put_f32(dst + 4 * i, load_s24(src + 3 * i) * (1.0f / S24_SCALE));
+   }
+}
+
+static void s32_to_f32(uint8_t *dst, const uint8_t *src, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      int32_t v;
+      memcpy(&v, src + 4 * i, sizeof(v));
+      put_f32(dst + 4 * i, (float)v * (1.0f / S32_SCALE));
+   }
+}
+
+static void f32_to_s16(uint8_t *dst, const uint8_t *src, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      int16_t v = (int16_t)float_to_int(get_f32(src + 4 * i), S16_SCALE, -S16_SCALE, S16_SCALE - 1);
+      memcpy(dst + 2 * i, &v, sizeof(v));
+   }
+}
+
+static void f32_to_s24(uint8_t *dst, const uint8_t *src, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      store_s24(dst + 3 * i, float_to_int(get_f32(src + 4 * i), S24_SCALE, -S24_SCALE, S24_SCALE - 1));
+   }
+}
+
+static void f32_to_s32(uint8_t *dst, const uint8_t *src, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      int32_t v = float_to_int(get_f32(src + 4 * i), S32_SCALE, -S32_SCALE, S32_MAX_FLOAT);
+      memcpy(dst + 4 * i, &v, sizeof(v));
+   }
+}
+
+/* the integer <-> float32 kernels, indexed by WAVUTIL_SAMPLE_S16..WAVUTIL_SAMPLE_S32 */
+typedef void (*convert_fn)(uint8_t *dst, const uint8_t *src, size_t n);
+
+struct kernels {
+   const char *name;
+   convert_fn to_f32[3];
+   convert_fn from_f32[3];
+};
+
+static const struct kernels scalar_kernels = {
+   "scalar",
+   { s16_to_f32, s24_to_f32, s32_to_f32 },
+   { f32_to_s16, f32_to_s24, f32_to_s32 }
+};
+
+#ifdef HAVE_X86_SIMD
+/* moves the 4 packed 24 bit samples in the low 12 bytes into the top of 32 bit lanes */
+#define S24_UNPACK -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11
+/* and back: the low 3 bytes of each lane, packed into the low 12 bytes */
+#define S24_PACK 0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1
+
+__attribute__((target("sse4.1")))
+static void s16_to_f32_sse41(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m128 scale = _mm_set1_ps(1.0f / S16_SCALE);
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(src + 2 * i)));
+      _mm_storeu_ps((float *)(dst + 4 * i), _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+   }
+   s16_to_f32(dst + 4 * i, src + 2 * i, n - i);
+}
+
+/* 16 byte loads of 12 bytes of samples, so the loop stops 2 samples early */
+__attribute__((target("sse4.1")))
+static void s24_to_f32_sse41(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m128 scale = _mm_set1_ps(1.0f / S24_SCALE);
+   const __m128i unpack = _mm_setr_epi8(S24_UNPACK);
+   size_t i = 0;
+   for (; i + 6 <= n; i += 4) {
+      __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(src + 3 * i)), unpack);
+      v = _mm_srai_epi32(v, 8);
+      _mm_storeu_ps((float *)(dst + 4 * i), _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+   }
+   s24_to_f32(dst + 4 * i, src + 3 * i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void s32_to_f32_sse41(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m128 scale = _mm_set1_ps(1.0f / S32_SCALE);
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+      _mm_storeu_ps((float *)(dst + 4 * i), _mm_mul_ps(_mm_cvtepi32_ps(v), scale));
+   }
+   s32_to_f32(dst + 4 * i, src + 4 * i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static __m128i scale_sse41(const uint8_t *src, __m128 scale, __m128 lo, __m128 hi) {
+   __m128 v = _mm_mul_ps(_mm_loadu_ps((const float *)src), scale);
+   return _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(v, lo), hi));
+}
+
+__attribute__((target("sse4.1")))
+static void f32_to_s16_sse41(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m128 scale = _mm_set1_ps(S16_SCALE);
+   const __m128 lo = _mm_set1_ps(-S16_SCALE), hi = _mm_set1_ps(S16_SCALE - 1);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m128i a = scale_sse41(src + 4 * i, scale, lo, hi);
+      __m128i b = scale_sse41(src + 4 * i + 16, scale, lo, hi);
+      _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_packs_epi32(a, b));
+   }
+   f32_to_s16(dst + 2 * i, src + 4 * i, n - i);
+}
+
+/* 16 byte stores of 12 bytes of samples, the next store covers the rest */
+__attribute__((target("sse4.1")))
+static void f32_to_s24_sse41(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m128 scale = _mm_set1_ps(S24_SCALE);
+   const __m128 lo = _mm_set1_ps(-S24_SCALE), hi = _mm_set1_ps(S24_SCALE - 1);
+   const __m128i pack = _mm_setr_epi8(S24_PACK);
+   size_t i = 0;
+   for (; i + 6 <= n; i += 4) {
+      __m128i v = scale_sse41(src + 4 * i, scale, lo, hi);
+      _mm_storeu_si128((__m128i *)(dst + 3 * i), _mm_shuffle_epi8(v, pack));
+   }
+   f32_to_s24(dst + 3 * i, src + 4 * i, n - i);
+}
+
+__attribute__((target("sse4.1")))
+static void f32_to_s32_sse41(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m128 scale = _mm_set1_ps(S32_SCALE);
+   const __m128 lo = _mm_set1_ps(-S32_SCALE), hi = _mm_set1_ps(S32_MAX_FLOAT);
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      _mm_storeu_si128((__m128i *)(dst + 4 * i), scale_sse41(src + 4 * i, scale, lo, hi));
+   }
+   f32_to_s32(dst + 4 * i, src + 4 * i, n - i);
+}
+
+static const struct kernels sse41_kernels = {
+   "sse4.1",
+   { s16_to_f32_sse41, s24_to_f32_sse41, s32_to_f32_sse41 },
+   { f32_to_s16_sse41, f32_to_s24_sse41, f32_to_s32_sse41 }
+};
+
+__attribute__((target("avx2")))
+static void s16_to_f32_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m256 scale = _mm256_set1_ps(1.0f / S16_SCALE);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(src + 2 * i)));
+      _mm256_storeu_ps((float *)(dst + 4 * i), _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+   }
+   s16_to_f32(dst + 4 * i, src + 2 * i, n - i);
+}
+
+/* two 16 byte loads 12 bytes apart, so the loop stops 2 samples early */
+__attribute__((target("avx2")))
+static void s24_to_f32_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m256 scale = _mm256_set1_ps(1.0f / S24_SCALE);
+   const __m256i unpack = _mm256_setr_epi8(S24_UNPACK, S24_UNPACK);
+   size_t i = 0;
+   for (; i + 10 <= n; i += 8) {
+      const uint8_t *p = src + 3 * i;
+      __m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                                          _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+      v = _mm256_srai_epi32(_mm256_shuffle_epi8(v, unpack), 8);
+      _mm256_storeu_ps((float *)(dst + 4 * i), _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+   }
+   s24_to_f32(dst + 4 * i, src + 3 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void s32_to_f32_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m256 scale = _mm256_set1_ps(1.0f / S32_SCALE);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+      _mm256_storeu_ps((float *)(dst + 4 * i), _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+   }
+   s32_to_f32(dst + 4 * i, src + 4 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static __m256i scale_avx2(const uint8_t *src, __m256 scale, __m256 lo, __m256 hi) {
+   __m256 v = _mm256_mul_ps(_mm256_loadu_ps((const float *)src), scale);
+   return _mm256_cvtps_epi32(_mm256_min_ps(_mm256_max_ps(v, lo), hi));
+}
+
+__attribute__((target("avx2")))
+static void f32_to_s16_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m256 scale = _mm256_set1_ps(S16_SCALE);
+   const __m256 lo = _mm256_set1_ps(-S16_SCALE), hi = _mm256_set1_ps(S16_SCALE - 1);
+   size_t i = 0;
+   for (; i + 16 <= n; i += 16) {
+      __m256i a = scale_avx2(src + 4 * i, scale, lo, hi);
+      __m256i b = scale_avx2(src + 4 * i + 32, scale, lo, hi);
+      /* packs works within 128 bit lanes, put the quarters back in order */
+      __m256i v = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+      _mm256_storeu_si256((__m256i *)(dst + 2 * i), v);
+   }
+   f32_to_s16(dst + 2 * i, src + 4 * i, n - i);
+}
+
+/* two 16 byte stores 12 bytes apart, each overwritten past its samples by the next */
+__attribute__((target("avx2")))
+static void f32_to_s24_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m256 scale = _mm256_set1_ps(S24_SCALE);
+   const __m256 lo = _mm256_set1_ps(-S24_SCALE), hi = _mm256_set1_ps(S24_SCALE - 1);
+   const __m256i pack = _mm256_setr_epi8(S24_PACK, S24_PACK);
+   size_t i = 0;
+   for (; i + 10 <= n; i += 8) {
+      __m256i v = _mm256_shuffle_epi8(scale_avx2(src + 4 * i, scale, lo, hi), pack);
+      uint8_t *p = dst + 3 * i;
+      _mm_storeu_si128((__m128i *)p, _mm256_castsi256_si128(v));
+      _mm_storeu_si128((__m128i *)(p + 12), _mm256_extracti128_si256(v, 1));
+   }
+   f32_to_s24(dst + 3 * i, src + 4 * i, n - i);
+}
+
+__attribute__((target("avx2")))
+static void f32_to_s32_avx2(uint8_t *dst, const uint8_t *src, size_t n) {
+   const __m256 scale = _mm256_set1_ps(S32_SCALE);
+   const __m256 lo = _mm256_set1_ps(-S32_SCALE), hi = _mm256_set1_ps(S32_MAX_FLOAT);
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      _mm256_storeu_si256((__m256i *)(dst + 4 * i), scale_avx2(src + 4 * i, scale, lo, hi));
+   }
+   f32_to_s32(dst + 4 * i, src + 4 * i, n - i);
+}
+
+static const struct kernels avx2_kernels = {
+   "avx2",
+   { s16_to_f32_avx2, s24_to_f32_avx2, s32_to_f32_avx2 },
+   { f32_to_s16_avx2, f32_to_s24_avx2, f32_to_s32_avx2 }
+};
+#endif
+
+#ifdef HAVE_NEON
+static void s16_to_f32_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      int16x8_t v = vld1q_s16((const int16_t *)(src + 2 * i));
+      float32x4_t a = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+      float32x4_t b = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+      vst1q_f32((float *)(dst + 4 * i), vmulq_n_f32(a, 1.0f / S16_SCALE));
+      vst1q_f32((float *)(dst + 4 * i + 16), vmulq_n_f32(b, 1.0f / S16_SCALE));
+   }
+   s16_to_f32(dst + 4 * i, src + 2 * i, n - i);
+}
+
+/* vld3 splits 8 packed samples into their low, middle and high bytes */
+static void s24_to_f32_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      uint8x8x3_t b = vld3_u8(src + 3 * i);
+      uint16x8_t low = vorrq_u16(vmovl_u8(b.val[0]), vshll_n_u8(b.val[1], 8));
+      int16x8_t high = vmovl_s8(vreinterpret_s8_u8(b.val[2]));
+      int32x4_t a = vorrq_s32(vshll_n_s16(vget_low_s16(high), 16),
+                              vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(low))));
+      int32x4_t c = vorrq_s32(vshll_n_s16(vget_high_s16(high), 16),
+                              vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(low))));
+      vst1q_f32((float *)(dst + 4 * i), vmulq_n_f32(vcvtq_f32_s32(a), 1.0f / S24_SCALE));
+      vst1q_f32((float *)(dst + 4 * i + 16), vmulq_n_f32(vcvtq_f32_s32(c), 1.0f / S24_SCALE));
+   }
+   s24_to_f32(dst + 4 * i, src + 3 * i, n - i);
+}
+
+static void s32_to_f32_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      float32x4_t v = vcvtq_f32_s32(vld1q_s32((const int32_t *)(src + 4 * i)));
+      vst1q_f32((float *)(dst + 4 * i), vmulq_n_f32(v, 1.0f / S32_SCALE));
+   }
+   s32_to_f32(dst + 4 * i, src + 4 * i, n - i);
+}
+
+static int32x4_t scale_neon(const uint8_t *src, float scale, float lo, float hi) {
+   float32x4_t v = vmulq_n_f32(vld1q_f32((const float *)src), scale);
+   v = vminnmq_f32(vmaxnmq_f32(v, vdupq_n_f32(lo)), vdupq_n_f32(hi));
+   return vcvtnq_s32_f32(v);
+}
+
+static void f32_to_s16_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      int32x4_t a = scale_neon(src + 4 * i, S16_SCALE, -S16_SCALE, S16_SCALE - 1);
+      int32x4_t b = scale_neon(src + 4 * i + 16, S16_SCALE, -S16_SCALE, S16_SCALE - 1);
+      vst1q_s16((int16_t *)(dst + 2 * i), vcombine_s16(vqmovn_s32(a), vqmovn_s32(b)));
+   }
+   f32_to_s16(dst + 2 * i, src + 4 * i, n - i);
+}
+
+static void f32_to_s24_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+   size_t i = 0;
+   for (; i + 8 <= n; i += 8) {
+      uint32x4_t a = vreinterpretq_u32_s32(scale_neon(src + 4 * i, S24_SCALE, -S24_SCALE, S24_SCALE - 1));
+      uint32x4_t c = vreinterpretq_u32_s32(scale_neon(src + 4 * i + 16, S24_SCALE, -S24_SCALE, S24_SCALE - 1));
+      uint8x8x3_t b;
+      b.val[0] = vmovn_u16(vcombine_u16(vmovn_u32(a), vmovn_u32(c)));
+      b.val[1] = vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(a, 8)), vmovn_u32(vshrq_n_u32(c, 8))));
+      b.val[2] = vmovn_u16(vcombine_u16(vmovn_u32(vshrq_n_u32(a, 16)), vmovn_u32(vshrq_n_u32(c, 16))));
+      vst3_u8(dst + 3 * i, b);
+   }
+   f32_to_s24(dst + 3 * i, src + 4 * i, n - i);
+}
+
+static void f32_to_s32_neon(uint8_t *dst, const uint8_t *src, size_t n) {
+   size_t i = 0;
+   for (; i + 4 <= n; i += 4) {
+      vst1q_s32((int32_t *)(dst + 4 * i), scale_neon(src + 4 * i, S32_SCALE, -S32_SCALE, S32_MAX_FLOAT));
+   }
+   f32_to_s32(dst + 4 * i, src + 4 * i, n - i);
+}
+
+static const struct kernels neon_kernels = {
+   "neon",
+   { s16_to_f32_neon, s24_to_f32_neon, s32_to_f32_neon },
+   { f32_to_s16_neon, f32_to_s24_neon, f32_to_s32_neon }
+};
+#endif
+
+/* every set this build has, best first */
+static const struct kernels *const kernel_sets[] = {
+#ifdef HAVE_X86_SIMD
+   &avx2_kernels,
+   &sse41_kernels,
+#endif
+#ifdef HAVE_NEON
+   &neon_kernels,
+#endif
+   &scalar_kernels
+};
+
+#define NUM_KERNEL_SETS (sizeof(kernel_sets) / sizeof(kernel_sets[0]))
+
+static int kernels_supported(const struct kernels *k) {
+#ifdef HAVE_X86_SIMD
+   if (k == &avx2_kernels) return __builtin_cpu_supports("avx2");
+   if (k == &sse41_kernels) return __builtin_cpu_supports("sse4.1");
+#endif
+   (void)k;
+   return 1;
+}
+
+static const struct kernels *active;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void pick_kernels(void) {
+#ifdef HAVE_X86_SIMD
+   __builtin_cpu_init();
+#endif
+   for (size_t i = 0; i < NUM_KERNEL_SETS; i++) {
+      if (kernels_supported(kernel_sets[i])) {
+         __atomic_store_n(&active, kernel_sets[i], __ATOMIC_RELEASE);
+         return;
+      }
+   }
+}
+
+static const struct kernels *kernels(void) {
+   pthread_once(&kernels_once, pick_kernels);
+   return __atomic_load_n(&active, __ATOMIC_ACQUIRE);
+}
+
+const char *wavutil_simd(void) {
+   return kernels()->name;
+}
+
+/*
+ * forces the kernels named name (avx2, sse4.1, neon or scalar), ex: to
+ * compare them. returns -1 if this build or CPU does not have them.
+ */
+int wavutil_set_simd(const char *name) {
+   kernels();
+   for (size_t i = 0; i < NUM_KERNEL_SETS; i++) {
+      if (!strcmp(name, kernel_sets[i]->name) && kernels_supported(kernel_sets[i])) {
+         __atomic_store_n(&active, kernel_sets[i], __ATOMIC_RELEASE);
+         return 0;
+      }
+   }
+   errno = ENOTSUP;
+   return -1;
+}
+
+/* the slow path for every other pair, through double so no bits are lost */
+
+static void decode(double *dst, const uint8_t *src, enum wavutil_sample_format format, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      switch (format) {
+      case WAVUTIL_SAMPLE_S16: {
+         int16_t v;
+         memcpy(&v, src + 2 * i, sizeof(v));
+         dst[i] = v / (double)S16_SCALE;
+         break;
+      }
+      case WAVUTIL_SAMPLE_S24:
+         dst[i] = load_s24(src + 3 * i) / (double)S24_SCALE;
+         break;
+      case WAVUTIL_SAMPLE_S32: {
+         int32_t v;
+         memcpy(&v, src + 4 * i, sizeof(v));
+         dst[i] = v / (double)S32_SCALE;
+         break;
+      }
+      case WAVUTIL_SAMPLE_F32:
+         dst[i] = get_f32(src + 4 * i);
+         break;
+      case WAVUTIL_SAMPLE_U8:
+         dst[i] = (src[i] - 128) / U8_SCALE;
+         break;
+      default:
+         memcpy(&dst[i], src + 8 * i, sizeof(double));
+         break;
+      }
+   }
+}
+
+static int32_t double_to_int(double v, double scale) {
+   return (int32_t)lrint(fmin(fmax(v * scale, -scale), scale - 1));
+}
+
+static void encode(uint8_t *dst, const double *src, enum wavutil_sample_format format, size_t n) {
+   for (size_t i = 0; i < n; i++) {
+      switch (format) {
+      case WAVUTIL_SAMPLE_S16: {
+         int16_t v = (int16_t)double_to_int(src[i], S16_SCALE);
+         memcpy(dst + 2 * i, &v, sizeof(v));
+         break;
+      }
+      case WAVUTIL_SAMPLE_S24:
+         store_s24(dst + 3 * i, double_to_int(src[i], S24_SCALE));
+         break;
+      case WAVUTIL_SAMPLE_S32: {
+         int32_t v = double_to_int(src[i], S32_SCALE);
+         memcpy(dst + 4 * i, &v, sizeof(v));
+         break;
+      }
+      case WAVUTIL_SAMPLE_F32:
+         put_f32(dst + 4 * i, (float)src[i]);
+         break;
+      case WAVUTIL_SAMPLE_U8:
+         dst[i] = (uint8_t)(double_to_int(src[i], U8_SCALE) + 128);
+         break;
+      default:
+         memcpy(dst + 8 * i, &src[i], sizeof(double));
+         break;
+      }
+   }
+}
+
+/*
+ * converts n samples from src in format from to dst in format to.
+ * returns -1 if either format is unknown.
+ */
+int wavutil_convert_samples(void *dst, enum wavutil_sample_format to, const void *src,
+                            enum wavutil_sample_format from, size_t n) {
+   if (!wavutil_sample_size(to) || !wavutil_sample_size(from)) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   if (from == to) {
+      memcpy(dst, src, n * wavutil_sample_size(to));
+      return 0;
+   }
+   if (to == WAVUTIL_SAMPLE_F32 && from <= WAVUTIL_SAMPLE_S32) {
+      kernels()->to_f32[from - WAVUTIL_SAMPLE_S16](dst, src, n);
+      return 0;
+   }
+   if (from == WAVUTIL_SAMPLE_F32 && to <= WAVUTIL_SAMPLE_S32) {
+      kernels()->from_f32[to - WAVUTIL_SAMPLE_S16](dst, src, n);
+      return 0;
+   }
+
+   const uint8_t *in = src;
+   uint8_t *out = dst;
+   double scratch[SCRATCH];
+   for (size_t i = 0; i < n; i += SCRATCH) {
+      size_t count = n - i < SCRATCH ? n - i : SCRATCH;
+      decode(scratch, in + i * wavutil_sample_size(from), from, count);
+      encode(out + i * wavutil_sample_size(to), scratch, to, count);
+   }
+   return 0;
+}
@@ -0,0 +1,973 @@
+/*
+ * hash.c: digests of the audio data for libwavutil
+ *
+ * only the bytes of the data chunk are hashed, like the MD5 a FLAC file
+ * carries, so a copy whose header was edited (or whose other chunks were
+ * added, dropped or moved) hashes the same as long as its samples are
+ * bit identical. three algorithms, all written out here:
+ *
+ *    md5      RFC 1321, for comparing with tools that only know it
+ *    xxh3     XXH3 64 bit (seed 0, default secret), not cryptographic
+ *             but several times faster than reading the file; AVX2
+ *             accumulators when the CPU has them
+ *    blake3   cryptographic and a tree: whole 1 MB subtrees are hashed
+ *             on separate threads, 8 chunks at a time with AVX2, and
+ *             merged in order, so it scales with cores on big files
+ *
+ * digests are returned as the bytes each algorithm's own tools print
+ * (md5sum, xxhsum -H3, b3sum).
+ */
+#define _GNU_SOURCE
+#include <stdint.h> /* uint types */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* memcpy */
+#include <errno.h> /* errno */
+#include <pthread.h> /* worker threads */
+#include <unistd.h> /* pread, sysconf */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* AVX2 */
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "wavutil.h"
+#include "wavutil_private.h"
+
+#define HASH_BLOCK (1 << 20) /* bytes read at a time */
+
+const char *const wavutil_hash_names[WAVUTIL_HASH_ALGORITHMS] = {
+   "md5", "xxh3", "blake3"
+};
+
+static const size_t hash_sizes[WAVUTIL_HASH_ALGORITHMS] = {
+   16, 8, 32
+};
+
+size_t wavutil_hash_size(enum wavutil_hash_algorithm algorithm) {
+   return (unsigned)algorithm < WAVUTIL_HASH_ALGORITHMS ? hash_sizes[algorithm] : 0;
+}
+
+static uint32_t load32(const uint8_t *p) {
+   uint32_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static uint64_t load64(const uint8_t *p) {
+   uint64_t v;
+   memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static void store32(uint8_t *p, uint32_t v) {
+   memcpy(p, &v, sizeof(v));
+}
+
+static uint32_t rotl32(uint32_t v, int n) {
+   return v << n | v >> (32 - n);
+}
+
+static uint32_t rotr32(uint32_t v, int n) {
+   return v >> n | v << (32 - n);
+}
+
+static uint64_t rotl64(uint64_t v, int n) {
+   return v << n | v >> (64 - n);
+}
+
+/* MD5 */
+
+struct md5 {
+   uint32_t h[4];
+   uint8_t buf[64];
+   size_t buffered;
+   uint64_t len;
+};
+
+static const uint32_t md5_k[64] = {
+   0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+   0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+   0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+   0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+   0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+   0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+   0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+   0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+   0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+   0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+   0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+   0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+   0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+   0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+   0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+   0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_shift[4][4] = {
+   { 7, 12, 17, 22 }, { 5, 9, 14, 20 }, { 4, 11, 16, 23 }, { 6, 10, 15, 21 }
+};
+
+static void md5_init(struct md5 *m) {
+   m->h[0] = 0x67452301;
+   m->h[1] = 0xefcdab89;
+   m->h[2] = 0x98badcfe;
+   m->h[3] = 0x10325476;
+   m->buffered = 0;
+   m->len = 0;
+}
+
+/* one round of 16 steps, unrolled by the compiler once f is known */
+#define MD5_ROUND(r, f, g)                                        \
+   for (int i = 16 * (r); i < 16 * (r) + 16; i++) {               \
+      uint32_t t = a + (f) + md5_k[i] + w[(g) % 16];              \
+      a = d;                                                      \
+      d = c;                                                      \
+      c = b;                                                      \
+      b += rotl32(t, md5_shift[r][i % 4]);                        \
+   }
+
+static void md5_block(uint32_t h[4], const uint8_t *p) {
+   uint32_t w[16];
+   for (int i = 0; i < 16; i++) w[i] = load32(p + 4 * i);
+
+   uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+   MD5_ROUND(0, (b & c) | (~b & d), i)
+   MD5_ROUND(1, (d & b) | (~d & c), 5 * i + 1)
+   MD5_ROUND(2, b ^ c ^ d, 3 * i + 5)
+   MD5_ROUND(3, c ^ (b | ~d), 7 * i)
+   h[0] += a;
+   h[1] += b;
+   h[2] += c;
+   h[3] += d;
+}
+
+static void md5_update(struct md5 *m, const uint8_t *in, size_t len) {
+   m->len += len;
+   if (m->buffered) {
+      size_t take = 64 - m->buffered < len ? 64 - m->buffered : len;
+      memcpy(m->buf + m->buffered, in, take);
+      m->buffered += take;
+      in += take;
+      len -= take;
+      if (m->buffered < 64) return;
+      md5_block(m->h, m->buf);
+      m->buffered = 0;
+   }
+   for (; len >= 64; in += 64, len -= 64) md5_block(m->h, in);
+   memcpy(m->buf, in, len);
+   m->buffered = len;
+}
+
+static void md5_final(struct md5 *m, uint8_t *out) {
+   uint64_t bits = m->len * 8;
+   uint8_t pad[72] = { 0x80 };
+   size_t n = (m->buffered < 56 ? 56 : 120) - m->buffered;
+   for (int i = 0; i < 8; i++) pad[n + i] = (uint8_t)(bits >> (8 * i));
+   md5_update(m, pad, n + 8);
+   for (int i = 0; i < 4; i++) store32(out + 4 * i, m->h[i]);
+}
+
+/* XXH3 64 bit */
+
+#define XXH_PRIME32_1 0x9E3779B1U
+#define XXH_PRIME32_2 0x85EBCA77U
+#define XXH_PRIME32_3 0xC2B2AE3DU
+#define XXH_PRIME64_1 0x9E3779B185EBCA87ULL
+#define XXH_PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define XXH_PRIME64_3 0x165667B19E3779F9ULL
+#define XXH_PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define XXH_PRIME64_5 0x27D4EB2F165667C5ULL
+#define XXH_PRIME_MX1 0x165667919E3779F9ULL
+#define XXH_PRIME_MX2 0x9FB21C651E98DF25ULL
+
+#define XXH_SECRET_SIZE 192
+#define XXH_STRIPE 64
+#define XXH_STRIPES_PER_BLOCK ((XXH_SECRET_SIZE - XXH_STRIPE) / 8)
+#define XXH_BUFFER 256 /* input kept back so the last stripe is never consumed early */
+#define XXH_MIDSIZE_MAX 240
+
+static const uint8_t xxh_secret[XXH_SECRET_SIZE] = {
+   0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+   0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+   0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+   0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+   0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+   0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+   0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+   0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+   0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+   0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+   0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+   0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+struct xxh3 {
+   uint64_t acc[8];
+   uint8_t buf[XXH_BUFFER];
+   size_t buffered;
+   size_t stripes;            /* stripes of the current block accumulated */
+   uint64_t len;
+   int simd;
+};
+
+static uint64_t mul128_fold64(uint64_t a, uint64_t b) {
+   __uint128_t p = (__uint128_t)a * b;
+   return (uint64_t)p ^ (uint64_t)(p >> 64);
+}
+
+static uint64_t xxh64_avalanche(uint64_t h) {
+   h ^= h >> 33;
+   h *= XXH_PRIME64_2;
+   h ^= h >> 29;
+   h *= XXH_PRIME64_3;
+   return h ^ (h >> 32);
+}
+
+static uint64_t xxh3_avalanche(uint64_t h) {
+   h ^= h >> 37;
+   h *= XXH_PRIME_MX1;
+   return h ^ (h >> 32);
+}
+
+static uint64_t xxh3_rrmxmx(uint64_t h, uint64_t len) {
+   h ^= rotl64(h, 49) ^ rotl64(h, 24);
+   h *= XXH_PRIME_MX2;
+   h ^= (h >> 35) + len;
+   h *= XXH_PRIME_MX2;
+   return h ^ (h >> 28);
+}
+
+static uint64_t xxh3_mix16(const uint8_t *in, const uint8_t *secret) {
+   return mul128_fold64(load64(in) ^ load64(secret), load64(in + 8) ^ load64(secret + 8));
+}
+
+/* inputs of up to XXH_MIDSIZE_MAX bytes, which are hashed in one go */
+static uint64_t xxh3_short(const uint8_t *in, size_t len) {
+   const uint8_t *s = xxh_secret;
+
+   if (len == 0) {
+      return xxh64_avalanche(load64(s + 56) ^ load64(s + 64));
+   }
+   if (len <= 3) {
+      uint32_t combined = (uint32_t)in[0] << 16 | (uint32_t)in[len >> 1] << 24 |
+                          (uint32_t)in[len - 1] | (uint32_t)len << 8;
+      return xxh64_avalanche(combined ^ (uint64_t)(load32(s) ^ load32(s + 4)));
+   }
+   if (len <= 8) {
+      uint64_t v = load32(in + len - 4) + ((uint64_t)load32(in) << 32);
+      return xxh3_rrmxmx(v ^ (load64(s + 8) ^ load64(s + 16)), len);
+   }
+   if (len <= 16) {
+      uint64_t lo = load64(in) ^ (load64(s + 24) ^ load64(s + 32));
+      uint64_t hi = load64(in + len - 8) ^ (load64(s + 40) ^ load64(s + 48));
+      return xxh3_avalanche(len + __builtin_bswap64(lo) + hi + mul128_fold64(lo, hi));
+   }
+
+   uint64_t acc = len * XXH_PRIME64_1;
+   if (len <= 128) {
+      if (len > 32) {
+         if (len > 64) {
+            if (len > 96) {
+               acc += xxh3_mix16(in + 48, s + 96);
+               acc += xxh3_mix16(in + len - 64, s + 112);
+            }
+            acc += xxh3_mix16(in + 32, s + 64);
+            acc += xxh3_mix16(in + len - 48, s + 80);
+         }
+         acc += xxh3_mix16(in + 16, s + 32);
+         acc += xxh3_mix16(in + len - 32, s + 48);
+      }
+      acc += xxh3_mix16(in, s);
+      acc += xxh3_mix16(in + len - 16, s + 16);
+      return xxh3_avalanche(acc);
+   }
+
+   for (size_t i = 0; i < 8; i++) acc += xxh3_mix16(in + 16 * i, s + 16 * i);
+   acc = xxh3_avalanche(acc);
+   for (size_t i = 8; i < len / 16; i++) acc += xxh3_mix16(in + 16 * i, s + 16 * (i - 8) + 3);
+   acc += xxh3_mix16(in + len - 16, s + 136 - 17);
+   return xxh3_avalanche(acc);
+}
+
+/* n stripes, the j-th with the secret moved along by 8 * j bytes */
+static void xxh3_accumulate(uint64_t acc[8], const uint8_t *in, size_t n, const uint8_t *secret) {
+   for (size_t j = 0; j < n; j++, in += XXH_STRIPE, secret += 8) {
+      for (int i = 0; i < 8; i++) {
+         uint64_t v = load64(in + 8 * i), k = v ^ load64(secret + 8 * i);
+         acc[i ^ 1] += v;
+         acc[i] += (k & 0xFFFFFFFF) * (k >> 32);
+      }
+   }
+}
+
+static void xxh3_scramble(uint64_t acc[8], const uint8_t *secret) {
+   for (int i = 0; i < 8; i++) {
+      uint64_t a = acc[i];
+      a ^= a >> 47;
+      a ^= load64(secret + 8 * i);
+      acc[i] = a * XXH_PRIME32_1;
+   }
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+static void xxh3_accumulate_avx2(uint64_t acc[8], const uint8_t *in, size_t n,
+                                 const uint8_t *secret) {
+   __m256i a0 = _mm256_loadu_si256((const __m256i *)acc);
+   __m256i a1 = _mm256_loadu_si256((const __m256i *)(acc + 4));
+
+   for (size_t j = 0; j < n; j++, in += XXH_STRIPE, secret += 8) {
+      __m256i v0 = _mm256_loadu_si256((const __m256i *)in);
+      __m256i v1 = _mm256_loadu_si256((const __m256i *)(in + 32));
+      __m256i k0 = _mm256_xor_si256(v0, _mm256_loadu_si256((const __m256i *)secret));
+      __m256i k1 = _mm256_xor_si256(v1, _mm256_loadu_si256((const __m256i *)(secret + 32)));
+      /* low half of each key times its high half, plus the neighbouring input */
+      __m256i p0 = _mm256_mul_epu32(k0, _mm256_shuffle_epi32(k0, _MM_SHUFFLE(0, 3, 0, 1)));
+      __m256i p1 = _mm256_mul_epu32(k1, _mm256_shuffle_epi32(k1, _MM_SHUFFLE(0, 3, 0, 1)));
+      a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(v0, _MM_SHUFFLE(1, 0, 3, 2)));
+      a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(v1, _MM_SHUFFLE(1, 0, 3, 2)));
+      a0 = _mm256_add_epi64(a0, p0);
+      a1 = _mm256_add_epi64(a1, p1);
+   }
+
+   _mm256_storeu_si256((__m256i *)acc, a0);
+   _mm256_storeu_si256((__m256i *)(acc + 4), a1);
+}
+#endif
+
+static void xxh3_init(struct xxh3 *x, int simd) {
+   static const uint64_t init[8] = {
+      XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+      XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1
+   };
+   memcpy(x->acc, init, sizeof(init));
+   x->buffered = 0;
+   x->stripes = 0;
+   x->len = 0;
+   x->simd = simd;
+}
+
+/* n whole stripes into the accumulators, scrambling at the end of every block */
+static void xxh3_consume(int simd, uint64_t acc[8], size_t *stripes, const uint8_t *in,
+                         size_t n) {
+   while (n) {
+      size_t run = XXH_STRIPES_PER_BLOCK - *stripes;
+      if (run > n) run = n;
+   #ifdef HAVE_X86_SIMD
+      if (simd) xxh3_accumulate_avx2(acc, in, run, xxh_secret + 8 * *stripes);
+      else
+   #else
+      (void)simd;
+   #endif
+      xxh3_accumulate(acc, in, run, xxh_secret + 8 * *stripes);
+      in += run * XXH_STRIPE;
+      n -= run;
+      *stripes += run;
+      if (*stripes == XXH_STRIPES_PER_BLOCK) {
+         xxh3_scramble(acc, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE);
+         *stripes = 0;
+      }
+   }
+}
+
+/*
+ * stripes are only consumed once more input has come after them, the
+ * last one is hashed differently. what is left waits in buf, whose end
+ * still holds the stripe before it when fewer than XXH_STRIPE bytes do.
+ */
+static void xxh3_update(struct xxh3 *x, const uint8_t *in, size_t len) {
+   x->len += len;
+   if (x->buffered + len <= XXH_BUFFER) {
+      memcpy(x->buf + x->buffered, in, len);
+      x->buffered += len;
+      return;
+   }
+
+   if (x->buffered) {
+      size_t fill = XXH_BUFFER - x->buffered;
+      memcpy(x->buf + x->buffered, in, fill);
+      in += fill;
+      len -= fill;
+      xxh3_consume(x->simd, x->acc, &x->stripes, x->buf, XXH_BUFFER / XXH_STRIPE);
+      x->buffered = 0;
+   }
+   if (len > XXH_BUFFER) {
+      size_t n = (len - 1) / XXH_STRIPE;
+      xxh3_consume(x->simd, x->acc, &x->stripes, in, n);
+      memcpy(x->buf + XXH_BUFFER - XXH_STRIPE, in + (n - 1) * XXH_STRIPE, XXH_STRIPE);
+      in += n * XXH_STRIPE;
+      len -= n * XXH_STRIPE;
+   }
+   memcpy(x->buf, in, len);
+   x->buffered = len;
+}
+
+static uint64_t xxh3_final(const struct xxh3 *x) {
+   if (x->len <= XXH_MIDSIZE_MAX) return xxh3_short(x->buf, (size_t)x->len);
+
+   uint64_t acc[8];
+   size_t stripes = x->stripes;
+   uint8_t last[XXH_STRIPE];
+   memcpy(acc, x->acc, sizeof(acc));
+   if (x->buffered >= XXH_STRIPE) {
+      xxh3_consume(x->simd, acc, &stripes, x->buf, (x->buffered - 1) / XXH_STRIPE);
+      memcpy(last, x->buf + x->buffered - XXH_STRIPE, XXH_STRIPE);
+   }
+   else {
+      size_t catchup = XXH_STRIPE - x->buffered;
+      memcpy(last, x->buf + XXH_BUFFER - catchup, catchup);
+      memcpy(last + catchup, x->buf, x->buffered);
+   }
+   xxh3_accumulate(acc, last, 1, xxh_secret + XXH_SECRET_SIZE - XXH_STRIPE - 7);
+
+   uint64_t h = x->len * XXH_PRIME64_1;
+   for (int i = 0; i < 4; i++) {
+      h += mul128_fold64(acc[2 * i] ^ load64(xxh_secret + 11 + 16 * i),
+                         acc[2 * i + 1] ^ load64(xxh_secret + 11 + 16 * i + 8));
+   }
+   return xxh3_avalanche(h);
+}
+
+/* BLAKE3 */
+
+#define B3_BLOCK 64
+#define B3_CHUNK 1024
+#define B3_CHUNK_START 1
+#define B3_CHUNK_END 2
+#define B3_PARENT 4
+#define B3_ROOT 8
+#define B3_MAX_DEPTH 54
+#define B3_SPAN (1 << 20) /* bytes of the subtrees hashed on threads, a power of 2 chunks */
+#define B3_SPAN_CHUNKS (B3_SPAN / B3_CHUNK)
+#define B3_LANES 8
+#define B3_BATCH 64 /* whole chunks blake3_update hashes side by side */
+
+static const uint32_t b3_iv[8] = {
+   0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+   0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+/* the message words each of the 7 rounds takes, in order */
+static const uint8_t b3_schedule[7][16] = {
+   { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+   { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+   { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+   { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+   { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+   { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+   { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 },
+};
+
+static void b3_g(uint32_t *v, int a, int b, int c, int d, uint32_t x, uint32_t y) {
+   v[a] += v[b] + x;
+   v[d] = rotr32(v[d] ^ v[a], 16);
+   v[c] += v[d];
+   v[b] = rotr32(v[b] ^ v[c], 12);
+   v[a] += v[b] + y;
+   v[d] = rotr32(v[d] ^ v[a], 8);
+   v[c] += v[d];
+   v[b] = rotr32(v[b] ^ v[c], 7);
+}
+
+/* one block into the next chaining value (out may be cv) */
+static void b3_compress(const uint32_t cv[8], const uint8_t block[B3_BLOCK], uint32_t block_len,
+                        uint64_t counter, uint32_t flags, uint32_t out[8]) {
+   uint32_t m[16], v[16];
+   for (int i = 0; i < 16; i++) m[i] = load32(block + 4 * i);
+   memcpy(v, cv, 8 * sizeof(uint32_t));
+   memcpy(v + 8, b3_iv, 4 * sizeof(uint32_t));
+   v[12] = (uint32_t)counter;
+   v[13] = (uint32_t)(counter >> 32);
+   v[14] = block_len;
+   v[15] = flags;
+
+   for (int r = 0; r < 7; r++) {
+      const uint8_t *s = b3_schedule[r];
+      b3_g(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+      b3_g(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+      b3_g(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+      b3_g(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+      b3_g(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+      b3_g(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+      b3_g(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+      b3_g(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+   }
+   for (int i = 0; i < 8; i++) out[i] = v[i] ^ v[i + 8];
+}
+
+/*
+ * n inputs of blocks whole blocks each into n chaining values at out, 32
+ * bytes apart. counter goes up by one per input when increment is set
+ * (chunks) and stays for parents. the first and last block of each input
+ * get start and end added to flags.
+ */
+static void b3_hash_many(const uint8_t *const *in, size_t n, size_t blocks, uint64_t counter,
+                         int increment, uint32_t flags, uint32_t start, uint32_t end,
+                         uint8_t *out) {
+   for (size_t i = 0; i < n; i++) {
+      uint32_t cv[8];
+      memcpy(cv, b3_iv, sizeof(b3_iv));
+      for (size_t b = 0; b < blocks; b++) {
+         uint32_t f = flags | (b == 0 ? start : 0) | (b == blocks - 1 ? end : 0);
+         b3_compress(cv, in[i] + b * B3_BLOCK, B3_BLOCK, counter + (increment ? i : 0), f, cv);
+      }
+      for (int k = 0; k < 8; k++) store32(out + 32 * i + 4 * k, cv[k]);
+   }
+}
+
+#ifdef HAVE_X86_SIMD
+/* word k of vectors 0..7 into vector k, and back */
+__attribute__((target("avx2"), always_inline))
+static inline void b3_transpose(__m256i v[8]) {
+   __m256i ab0145 = _mm256_unpacklo_epi32(v[0], v[1]), ab2367 = _mm256_unpackhi_epi32(v[0], v[1]);
+   __m256i cd0145 = _mm256_unpacklo_epi32(v[2], v[3]), cd2367 = _mm256_unpackhi_epi32(v[2], v[3]);
+   __m256i ef0145 = _mm256_unpacklo_epi32(v[4], v[5]), ef2367 = _mm256_unpackhi_epi32(v[4], v[5]);
+   __m256i gh0145 = _mm256_unpacklo_epi32(v[6], v[7]), gh2367 = _mm256_unpackhi_epi32(v[6], v[7]);
+
+   __m256i abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+   __m256i abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+   __m256i abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+   __m256i abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+   __m256i efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+   __m256i efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+   __m256i efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+   __m256i efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+
+   v[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+   v[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+   v[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+   v[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+   v[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+   v[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+   v[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+   v[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+}
+
+#define B3_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2"), always_inline))
+static inline void b3_g8(__m256i *v, int a, int b, int c, int d, __m256i x, __m256i y) {
+   const __m256i rot16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                         13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+   const __m256i rot8 = _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                        12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1);
+   v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), x);
+   v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), rot16);
+   v[c] = _mm256_add_epi32(v[c], v[d]);
+   v[b] = B3_ROTR(_mm256_xor_si256(v[b], v[c]), 12);
+   v[a] = _mm256_add_epi32(_mm256_add_epi32(v[a], v[b]), y);
+   v[d] = _mm256_shuffle_epi8(_mm256_xor_si256(v[d], v[a]), rot8);
+   v[c] = _mm256_add_epi32(v[c], v[d]);
+   v[b] = B3_ROTR(_mm256_xor_si256(v[b], v[c]), 7);
+}
+
+/* 8 inputs side by side, one per lane */
+__attribute__((target("avx2")))
+static void b3_hash8_avx2(const uint8_t *const *in, size_t blocks, uint64_t counter,
+                          int increment, uint32_t flags, uint32_t start, uint32_t end,
+                          uint8_t *out) {
+   uint32_t lo[B3_LANES], hi[B3_LANES];
+   for (int i = 0; i < B3_LANES; i++) {
+      uint64_t c = counter + (increment ? (uint64_t)i : 0);
+      lo[i] = (uint32_t)c;
+      hi[i] = (uint32_t)(c >> 32);
+   }
+   __m256i h[8];
+   for (int i = 0; i < 8; i++) h[i] = _mm256_set1_epi32((int)b3_iv[i]);
+
+   for (size_t b = 0; b < blocks; b++) {
+      __m256i m[16], v[16];
+      for (int i = 0; i < B3_LANES; i++) {
+         m[i] = _mm256_loadu_si256((const __m256i *)(in[i] + b * B3_BLOCK));
+         m[i + 8] = _mm256_loadu_si256((const __m256i *)(in[i] + b * B3_BLOCK + 32));
+      }
+      b3_transpose(m);
+      b3_transpose(m + 8);
+
+      uint32_t f = flags | (b == 0 ? start : 0) | (b == blocks - 1 ? end : 0);
+      for (int i = 0; i < 8; i++) v[i] = h[i];
+      for (int i = 0; i < 4; i++) v[i + 8] = _mm256_set1_epi32((int)b3_iv[i]);
+      v[12] = _mm256_loadu_si256((const __m256i *)lo);
+      v[13] = _mm256_loadu_si256((const __m256i *)hi);
+      v[14] = _mm256_set1_epi32(B3_BLOCK);
+      v[15] = _mm256_set1_epi32((int)f);
+
+      for (int r = 0; r < 7; r++) {
+         const uint8_t *s = b3_schedule[r];
+         b3_g8(v, 0, 4, 8, 12, m[s[0]], m[s[1]]);
+         b3_g8(v, 1, 5, 9, 13, m[s[2]], m[s[3]]);
+         b3_g8(v, 2, 6, 10, 14, m[s[4]], m[s[5]]);
+         b3_g8(v, 3, 7, 11, 15, m[s[6]], m[s[7]]);
+         b3_g8(v, 0, 5, 10, 15, m[s[8]], m[s[9]]);
+         b3_g8(v, 1, 6, 11, 12, m[s[10]], m[s[11]]);
+         b3_g8(v, 2, 7, 8, 13, m[s[12]], m[s[13]]);
+         b3_g8(v, 3, 4, 9, 14, m[s[14]], m[s[15]]);
+      }
+      for (int i = 0; i < 8; i++) h[i] = _mm256_xor_si256(v[i], v[i + 8]);
+   }
+
+   b3_transpose(h);
+   for (int i = 0; i < B3_LANES; i++) _mm256_storeu_si256((__m256i *)(out + 32 * i), h[i]);
+}
+#endif
+
+/* b3_hash_many, 8 inputs at a time when simd is set */
+static void b3_hash(const uint8_t *const *in, size_t n, size_t blocks, uint64_t counter,
+                    int increment, uint32_t flags, uint32_t start, uint32_t end, uint8_t *out,
+                    int simd) {
+#ifdef HAVE_X86_SIMD
+   for (; simd && n >= B3_LANES; n -= B3_LANES) {
+      b3_hash8_avx2(in, blocks, counter, increment, flags, start, end, out);
+      in += B3_LANES;
+      out += 32 * B3_LANES;
+      if (increment) counter += B3_LANES;
+   }
+#else
+   (void)simd;
+#endif
+   b3_hash_many(in, n, blocks, counter, increment, flags, start, end, out);
+}
+
+/*
+ * the chaining value of B3_SPAN bytes starting at chunk counter, a
+ * subtree of the final tree as long as more input follows it. cvs holds
+ * B3_SPAN_CHUNKS of them; parents are hashed in place over their children.
+ */
+static void b3_span(const uint8_t *in, uint64_t counter, uint8_t *cvs, int simd, uint32_t cv[8]) {
+   const uint8_t *inputs[B3_SPAN_CHUNKS];
+   for (size_t i = 0; i < B3_SPAN_CHUNKS; i++) inputs[i] = in + i * B3_CHUNK;
+   b3_hash(inputs, B3_SPAN_CHUNKS, B3_CHUNK / B3_BLOCK, counter, 1, 0, B3_CHUNK_START,
+           B3_CHUNK_END, cvs, simd);
+
+   for (size_t n = B3_SPAN_CHUNKS / 2; n >= 1; n /= 2) {
+      for (size_t i = 0; i < n; i++) inputs[i] = cvs + 64 * i;
+      b3_hash(inputs, n, 1, 0, 0, B3_PARENT, 0, 0, cvs, simd);
+   }
+   for (int k = 0; k < 8; k++) cv[k] = load32(cvs + 4 * k);
+}
+
+/* the chunk being hashed and the stack of finished subtrees to its left */
+struct blake3 {
+   uint32_t cv[8];
+   uint64_t counter;
+   uint8_t buf[B3_BLOCK];
+   size_t buffered;
+   size_t blocks;             /* compressed so far in this chunk */
+   uint32_t stack[B3_MAX_DEPTH][8];
+   size_t depth;
+   int simd;
+};
+
+static void blake3_init(struct blake3 *h, int simd) {
+   memcpy(h->cv, b3_iv, sizeof(b3_iv));
+   h->counter = 0;
+   h->buffered = 0;
+   h->blocks = 0;
+   h->depth = 0;
+   h->simd = simd;
+}
+
+static void b3_parent(const uint32_t left[8], const uint32_t right[8], uint32_t flags,
+                      uint32_t out[8]) {
+   uint8_t block[B3_BLOCK];
+   for (int k = 0; k < 8; k++) {
+      store32(block + 4 * k, left[k]);
+      store32(block + 32 + 4 * k, right[k]);
+   }
+   b3_compress(b3_iv, block, B3_BLOCK, 0, B3_PARENT | flags, out);
+}
+
+/*
+ * pushes the chaining value of a subtree, merging it with the ones to
+ * its left while total, the subtrees of its size so far, is even
+ */
+static void blake3_push(struct blake3 *h, const uint32_t cv[8], uint64_t total) {
+   uint32_t merged[8];
+   memcpy(merged, cv, sizeof(merged));
+   for (; (total & 1) == 0; total >>= 1) {
+      b3_parent(h->stack[--h->depth], merged, 0, merged);
+   }
+   memcpy(h->stack[h->depth++], merged, sizeof(merged));
+}
+
+static uint32_t b3_chunk_flags(const struct blake3 *h) {
+   return h->blocks == 0 ? B3_CHUNK_START : 0;
+}
+
+/*
+ * a full chunk is only finished once more input comes, the last one is
+ * the root's. between chunks, whole chunks with input after them are
+ * hashed B3_LANES at a time, so inputs shorter than a span use the simd
+ * kernel too.
+ */
+static void blake3_update(struct blake3 *h, const uint8_t *in, size_t len) {
+   while (len) {
+      if (h->blocks * B3_BLOCK + h->buffered == B3_CHUNK) {
+         uint32_t out[8];
+         b3_compress(h->cv, h->buf, B3_BLOCK, h->counter, b3_chunk_flags(h) | B3_CHUNK_END, out);
+         blake3_push(h, out, ++h->counter);
+         memcpy(h->cv, b3_iv, sizeof(b3_iv));
+         h->buffered = 0;
+         h->blocks = 0;
+      }
+      size_t whole = (len - 1) / B3_CHUNK;
+      if (h->blocks == 0 && h->buffered == 0 && whole >= B3_LANES) {
+         const uint8_t *inputs[B3_BATCH];
+         uint8_t cvs[B3_BATCH * 32];
+         size_t n = whole < B3_BATCH ? whole : B3_BATCH;
+         for (size_t i = 0; i < n; i++) inputs[i] = in + i * B3_CHUNK;
+         b3_hash(inputs, n, B3_CHUNK / B3_BLOCK, h->counter, 1, 0, B3_CHUNK_START, B3_CHUNK_END,
+                 cvs, h->simd);
+         for (size_t i = 0; i < n; i++) {
+            uint32_t cv[8];
+            for (int k = 0; k < 8; k++) cv[k] = load32(cvs + 32 * i + 4 * k);
+            blake3_push(h, cv, ++h->counter);
+         }
+         in += n * B3_CHUNK;
+         len -= n * B3_CHUNK;
+         continue;
+      }
+      if (h->buffered == B3_BLOCK) {
+         b3_compress(h->cv, h->buf, B3_BLOCK, h->counter, b3_chunk_flags(h), h->cv);
+         h->blocks++;
+         h->buffered = 0;
+      }
+      size_t take = B3_BLOCK - h->buffered < len ? B3_BLOCK - h->buffered : len;
+      memcpy(h->buf + h->buffered, in, take);
+      h->buffered += take;
+      in += take;
+      len -= take;
+   }
+}
+
+static void blake3_final(struct blake3 *h, uint8_t out[32]) {
+   uint32_t node[8];
+   uint8_t block[B3_BLOCK] = {0};
+   memcpy(block, h->buf, h->buffered);
+   uint32_t flags = b3_chunk_flags(h) | B3_CHUNK_END;
+
+   if (h->depth == 0) {
+      b3_compress(h->cv, block, (uint32_t)h->buffered, h->counter, flags | B3_ROOT, node);
+   }
+   else {
+      b3_compress(h->cv, block, (uint32_t)h->buffered, h->counter, flags, node);
+      for (size_t d = h->depth; d-- > 0;) {
+         b3_parent(h->stack[d], node, d == 0 ? B3_ROOT : 0, node);
+      }
+   }
+   for (int k = 0; k < 8; k++) store32(out + 4 * k, node[k]);
+}
+
+/* the spans of one thread */
+struct hash_part {
+   int fd;
+   const uint8_t *mapped;     /* the bytes, NULL to read them */
+   uint64_t offset;           /* of the first byte hashed in the file */
+   uint64_t first, last;      /* spans [first, last) */
+   uint32_t (*cvs)[8];        /* one per span */
+   int simd;
+   int err;                   /* errno of a failure, 0 if none */
+};
+
+static void *hash_worker(void *arg) {
+   struct hash_part *p = arg;
+   uint8_t *buf = p->mapped ? NULL : malloc(B3_SPAN);
+   uint8_t *cvs = malloc(B3_SPAN_CHUNKS * 32);
+   if ((!p->mapped && !buf) || !cvs) {
+      p->err = ENOMEM;
+      goto done;
+   }
+
+   for (uint64_t s = p->first; s < p->last; s++) {
+      const uint8_t *in = p->mapped ? p->mapped + s * B3_SPAN : buf;
+      if (!p->mapped) {
+         ssize_t got = pread(p->fd, buf, B3_SPAN, (off_t)(p->offset + s * B3_SPAN));
+         if (got != B3_SPAN) {
+            p->err = got < 0 ? errno : EIO;
+            goto done;
+         }
+      }
+      b3_span(in, s * B3_SPAN_CHUNKS, cvs, p->simd, p->cvs[s]);
+   }
+
+done:
+   free(buf);
+   free(cvs);
+   return NULL;
+}
+
+/* the blake3 spans of len bytes on up to threads threads, pushed onto h */
+static int blake3_spans(struct blake3 *h, int fd, const uint8_t *mapped, uint64_t offset,
+                        uint64_t spans, int threads, int simd) {
+   if ((uint64_t)threads > spans) threads = (int)spans;
+   struct hash_part *parts = calloc((size_t)threads, sizeof(*parts));
+   pthread_t *tids = calloc((size_t)threads, sizeof(*tids));
+   uint32_t (*cvs)[8] = calloc((size_t)spans, sizeof(*cvs));
+   if (!parts || !tids || !cvs) {
+      free(parts);
+      free(tids);
+      free(cvs);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   for (int t = 0; t < threads; t++) {
+      struct hash_part *p = &parts[t];
+      p->fd = fd;
+      p->mapped = mapped;
+      p->offset = offset;
+      p->first = spans * (uint64_t)t / (uint64_t)threads;
+      p->last = spans * (uint64_t)(t + 1) / (uint64_t)threads;
+      p->cvs = cvs;
+      p->simd = simd;
+   }
+
+   /* the calling thread takes the first part */
+   int started = 1;
+   for (; started < threads; started++) {
+      if (pthread_create(&tids[started], NULL, hash_worker, &parts[started])) break;
+   }
+   hash_worker(&parts[0]);
+   for (int t = 1; t < started; t++) {
+      pthread_join(tids[t], NULL);
+   }
+   for (int t = started; t < threads; t++) {
+      hash_worker(&parts[t]);
+   }
+
+   int err = 0;
+   for (int t = 0; t < threads; t++) {
+      if (parts[t].err) err = parts[t].err;
+   }
+   for (uint64_t s = 0; s < spans && !err; s++) {
+      blake3_push(h, cvs[s], s + 1);
+   }
+   h->counter = spans * B3_SPAN_CHUNKS;
+
+   free(parts);
+   free(tids);
+   free(cvs);
+   if (err) {
+      errno = err;
+      return -1;
+   }
+   return 0;
+}
+
+/* any of the three, fed the same way */
+struct hasher {
+   enum wavutil_hash_algorithm algorithm;
+   union {
+      struct md5 md5;
+      struct xxh3 xxh3;
+      struct blake3 blake3;
+   } u;
+};
+
+static void hasher_update(struct hasher *h, const uint8_t *in, size_t len) {
+   switch (h->algorithm) {
+   case WAVUTIL_HASH_MD5: md5_update(&h->u.md5, in, len); break;
+   case WAVUTIL_HASH_XXH3: xxh3_update(&h->u.xxh3, in, len); break;
+   default: blake3_update(&h->u.blake3, in, len); break;
+   }
+}
+
+static void hasher_final(struct hasher *h, uint8_t *digest) {
+   switch (h->algorithm) {
+   case WAVUTIL_HASH_MD5:
+      md5_final(&h->u.md5, digest);
+      break;
+   case WAVUTIL_HASH_XXH3: {
+      uint64_t v = xxh3_final(&h->u.xxh3);
+      for (int i = 0; i < 8; i++) digest[i] = (uint8_t)(v >> (56 - 8 * i));
+      break;
+   }
+   default:
+      blake3_final(&h->u.blake3, digest);
+      break;
+   }
+}
+
+/*
+ * hashes len bytes of the file from offset (out of map when it holds
+ * them), blake3 on up to threads threads (0 for one per CPU). returns 0
+ * on success and -1 on error.
+ */
+int wavutil_hash_range(int fd, const struct wavutil_map *map, uint64_t offset, uint64_t len,
+                       enum wavutil_hash_algorithm algorithm, int threads, uint8_t *digest) {
+   if (!wavutil_hash_size(algorithm)) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   const uint8_t *mapped = NULL;
+   if (map && map->base && map->size >= offset && map->size - offset >= len) {
+      mapped = map->base + offset;
+   }
+   if (threads <= 0) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? (int)cpus : 1;
+   }
+#ifdef HAVE_X86_SIMD
+   int simd = !strcmp(wavutil_simd(), "avx2");
+#else
+   int simd = 0;
+#endif
+
+   struct hasher h;
+   h.algorithm = algorithm;
+   uint64_t at = 0;
+   switch (algorithm) {
+   case WAVUTIL_HASH_MD5:
+      md5_init(&h.u.md5);
+      break;
+   case WAVUTIL_HASH_XXH3:
+      xxh3_init(&h.u.xxh3, simd);
+      break;
+   default:
+      /* whole spans with at least a byte after them, the rest as it comes */
+      blake3_init(&h.u.blake3, simd);
+      at = len ? (len - 1) / B3_SPAN * B3_SPAN : 0;
+      if (at && blake3_spans(&h.u.blake3, fd, mapped, offset, at / B3_SPAN, threads, simd)) {
+         wu_log("Hashing audio data failed: %s\n", strerror(errno));
+         return -1;
+      }
+      break;
+   }
+
+   uint8_t *buf = mapped ? NULL : malloc(HASH_BLOCK);
+   if (!mapped && !buf) {
+      wu_log("Hash buffer allocation failed\n");
+      errno = ENOMEM;
+      return -1;
+   }
+   while (at < len) {
+      size_t n = len - at > HASH_BLOCK ? HASH_BLOCK : (size_t)(len - at);
+      if (mapped) {
+         hasher_update(&h, mapped + at, n);
+      }
+      else {
+         ssize_t got = pread(fd, buf, n, (off_t)(offset + at));
+         if (got != (ssize_t)n) {
+            int err = got < 0 ? errno : EIO;
+            wu_log("Reading audio data failed: %s\n", strerror(err));
+            free(buf);
+            errno = err;
+            return -1;
+         }
+         hasher_update(&h, buf, n);
+      }
+      at += n;
+   }
+   free(buf);
+
+   hasher_final(&h, digest);
+   return 0;
+}
+
+/* the data chunk of a parsed file, without its pad byte */
+int wavutil_hash(int fd, const wavutil_info *info, const struct wavutil_map *map,
+                 enum wavutil_hash_algorithm algorithm, int threads, uint8_t *digest) {
+   return wavutil_hash_range(fd, map, info->data_offset, info->data_size, algorithm, threads,
+                             digest);
+}
@@ -0,0 +1,498 @@
+/*
+ * loudness.c: EBU R128 / ITU-R BS.1770-4 loudness of the audio data for
+ * libwavutil
+ *
+ * every channel is K-weighted (the high shelf pre-filter, then the RLB
+ * high-pass, two biquads whose coefficients are derived for the sample
+ * rate) and its mean square summed over 100 ms segments. everything else
+ * comes from those sums once the data has been read:
+ *
+ *    momentary    400 ms windows, one every segment
+ *    short term   3 s windows, one every segment
+ *    integrated   400 ms blocks (75% overlap) gated at -70 LUFS, then at
+ *                 10 LU below the mean of the blocks that passed
+ *    range (LRA)  the 10th to 95th percentile of the short term levels
+ *                 gated at -70 LUFS and 20 LU below their mean (EBU
+ *                 Tech 3342)
+ *
+ * the filters are recursive, so the data cannot be split in time the way
+ * stats.c splits it. channels are split instead: up to KLANES channels
+ * share a group filtered side by side in the lanes of one AVX2 vector,
+ * and the groups are shared out between threads, each of which reads and
+ * converts the data chunk on its own. filtering is done in double, the
+ * 38 Hz high-pass is too sharp for float at 48 kHz and up.
+ */
+#define _GNU_SOURCE
+#include <stdint.h> /* uint types */
+#include <stdlib.h> /* mem allocation, qsort */
+#include <string.h> /* memset */
+#include <math.h> /* tan, log10 */
+#include <errno.h> /* errno */
+#include <pthread.h> /* worker threads */
+#include <unistd.h> /* pread, sysconf */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* AVX2 */
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "wavutil.h"
+#include "wavutil_private.h"
+
+#define LOUDNESS_FRAMES 4096 /* frames per block */
+#define LOUDNESS_SPLIT (16 << 20) /* bytes of audio data before channels get their own threads */
+#define KLANES 4 /* channels per group, doubles per vector */
+#define STAGES 2 /* biquads in the K-weighting filter */
+
+#define SEGMENTS_PER_SECOND 10
+#define MOMENTARY 4 /* segments in a 400 ms window */
+#define SHORT_TERM 30 /* segments in a 3 s window */
+#define ABSOLUTE_GATE -70.0 /* LUFS */
+#define RELATIVE_GATE -10.0 /* LU below the mean, integrated loudness */
+#define RANGE_GATE -20.0 /* LU below the mean, loudness range */
+#define MIN_RATE 8000 /* the pre-filter shelf must be well below Nyquist */
+
+/* b0, b1, b2, a1, a2 of one biquad, a0 normalized to 1 */
+struct biquad {
+   double b[3], a[2];
+};
+
+/* up to KLANES channels filtered together; unused lanes filter zeros */
+struct kgroup {
+   unsigned first, count;     /* channels [first, first + count) */
+   double z[STAGES][2][KLANES];  /* transposed direct form II state */
+   double energy[KLANES];     /* sum of squares of the segment so far */
+};
+
+/* the channel groups one thread filters */
+struct loudness_part {
+   int fd;
+   const wavutil_info *info;
+   const uint8_t *mapped;     /* the audio data, NULL to read it */
+   enum wavutil_sample_format format;
+   unsigned channels;
+   const struct biquad *filter;  /* STAGES of them */
+   int simd;
+   uint64_t frames;
+   size_t segment;            /* frames per segment */
+   size_t segments;           /* whole segments in the data */
+   struct kgroup *groups;
+   size_t num_groups;
+   double *energy;            /* segments sums per channel, channel after channel */
+   int err;                   /* errno of a failure, 0 if none */
+};
+
+/*
+ * the K-weighting filter for a sample rate: BS.1770 gives the
+ * coefficients for 48 kHz only, these are the analog prototypes behind
+ * them through the bilinear transform, as in libebur128, so 48 kHz gives
+ * the published values.
+ */
+static void k_weighting(struct biquad filter[STAGES], double rate) {
+   double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+   double k = tan(M_PI * f0 / rate);
+   double vh = pow(10.0, gain / 20.0);
+   double vb = pow(vh, 0.4996667741545416);
+   double a0 = 1.0 + k / q + k * k;
+
+   filter[0].b[0] = (vh + vb * k / q + k * k) / a0;
+   filter[0].b[1] = 2.0 * (k * k - vh) / a0;
+   filter[0].b[2] = (vh - vb * k / q + k * k) / a0;
+   filter[0].a[0] = 2.0 * (k * k - 1.0) / a0;
+   filter[0].a[1] = (1.0 - k / q + k * k) / a0;
+
+   f0 = 38.13547087602444;
+   q = 0.5003270373238773;
+   k = tan(M_PI * f0 / rate);
+   a0 = 1.0 + k / q + k * k;
+
+   filter[1].b[0] = 1.0;
+   filter[1].b[1] = -2.0;
+   filter[1].b[2] = 1.0;
+   filter[1].a[0] = 2.0 * (k * k - 1.0) / a0;
+   filter[1].a[1] = (1.0 - k / q + k * k) / a0;
+}
+
+/*
+ * the BS.1770 weight of a channel in WAVE order: the LFE of 5.1 and 7.1
+ * layouts is left out and their surrounds count 1.41 times (+1.5 dB).
+ * other channel counts are taken as front channels.
+ */
+static double channel_weight(unsigned c, unsigned channels) {
+   if (channels != 6 && channels != 8) return 1.0;
+   if (c == 3) return 0.0;
+   return c > 3 ? 1.41 : 1.0;
+}
+
+/* n frames of KLANES interleaved doubles through the filter, squares added to energy */
+static void k_filter(const struct biquad *f, struct kgroup *g, const double *x, size_t n) {
+   for (int l = 0; l < KLANES; l++) {
+      double z[STAGES][2], energy = g->energy[l];
+      for (int s = 0; s < STAGES; s++) {
+         z[s][0] = g->z[s][0][l];
+         z[s][1] = g->z[s][1][l];
+      }
+      for (size_t i = 0; i < n; i++) {
+         double v = x[i * KLANES + l];
+         for (int s = 0; s < STAGES; s++) {
+            double y = f[s].b[0] * v + z[s][0];
+            z[s][0] = f[s].b[1] * v - f[s].a[0] * y + z[s][1];
+            z[s][1] = f[s].b[2] * v - f[s].a[1] * y;
+            v = y;
+         }
+         energy += v * v;
+      }
+      for (int s = 0; s < STAGES; s++) {
+         g->z[s][0][l] = z[s][0];
+         g->z[s][1][l] = z[s][1];
+      }
+      g->energy[l] = energy;
+   }
+}
+
+#ifdef HAVE_X86_SIMD
+/* the same with the lanes of one vector */
+__attribute__((target("avx2")))
+static void k_filter_avx2(const struct biquad *f, struct kgroup *g, const double *x, size_t n) {
+   __m256d b0[STAGES], b1[STAGES], b2[STAGES], a1[STAGES], a2[STAGES];
+   __m256d z0[STAGES], z1[STAGES];
+   for (int s = 0; s < STAGES; s++) {
+      b0[s] = _mm256_set1_pd(f[s].b[0]);
+      b1[s] = _mm256_set1_pd(f[s].b[1]);
+      b2[s] = _mm256_set1_pd(f[s].b[2]);
+      a1[s] = _mm256_set1_pd(f[s].a[0]);
+      a2[s] = _mm256_set1_pd(f[s].a[1]);
+      z0[s] = _mm256_loadu_pd(g->z[s][0]);
+      z1[s] = _mm256_loadu_pd(g->z[s][1]);
+   }
+   __m256d energy = _mm256_loadu_pd(g->energy);
+
+   for (size_t i = 0; i < n; i++) {
+      __m256d v = _mm256_loadu_pd(x + i * KLANES);
+      for (int s = 0; s < STAGES; s++) {
+         __m256d y = _mm256_add_pd(_mm256_mul_pd(b0[s], v), z0[s]);
+         z0[s] = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(b1[s], v), _mm256_mul_pd(a1[s], y)),
+                               z1[s]);
+         z1[s] = _mm256_sub_pd(_mm256_mul_pd(b2[s], v), _mm256_mul_pd(a2[s], y));
+         v = y;
+      }
+      energy = _mm256_add_pd(energy, _mm256_mul_pd(v, v));
+   }
+
+   for (int s = 0; s < STAGES; s++) {
+      _mm256_storeu_pd(g->z[s][0], z0[s]);
+      _mm256_storeu_pd(g->z[s][1], z1[s]);
+   }
+   _mm256_storeu_pd(g->energy, energy);
+}
+#endif
+
+/* state decaying through silence would go denormal and crawl */
+static void flush_denormals(struct kgroup *g) {
+   for (int s = 0; s < STAGES; s++) {
+      for (int l = 0; l < KLANES; l++) {
+         if (fabs(g->z[s][0][l]) < 1e-30) g->z[s][0][l] = 0;
+         if (fabs(g->z[s][1][l]) < 1e-30) g->z[s][1][l] = 0;
+      }
+   }
+}
+
+/* reads all of the audio data and filters the groups of one part */
+static void *loudness_worker(void *arg) {
+   struct loudness_part *p = arg;
+   unsigned channels = p->channels;
+   size_t in_frame = wavutil_sample_size(p->format) * channels;
+
+   uint8_t *raw = p->mapped ? NULL : malloc(LOUDNESS_FRAMES * in_frame);
+   float *block = malloc((size_t)LOUDNESS_FRAMES * channels * sizeof(float));
+   double *lanes = malloc(LOUDNESS_FRAMES * KLANES * sizeof(double));
+   if ((!p->mapped && !raw) || !block || !lanes) {
+      p->err = ENOMEM;
+      goto done;
+   }
+   memset(lanes, 0, LOUDNESS_FRAMES * KLANES * sizeof(double));
+
+   for (uint64_t at = 0; at < p->frames;) {
+      size_t n = p->frames - at > LOUDNESS_FRAMES ? LOUDNESS_FRAMES : (size_t)(p->frames - at);
+      const uint8_t *src = p->mapped ? p->mapped + at * in_frame : raw;
+
+      if (!p->mapped) {
+         size_t want = n * in_frame;
+         ssize_t got = pread(p->fd, raw, want, (off_t)(p->info->data_offset + at * in_frame));
+         if (got != (ssize_t)want) {
+            p->err = got < 0 ? errno : EIO;
+            goto done;
+         }
+      }
+      wavutil_convert_samples(block, WAVUTIL_SAMPLE_F32, src, p->format, n * channels);
+
+      for (size_t k = 0; k < p->num_groups; k++) {
+         struct kgroup *g = &p->groups[k];
+         for (size_t i = 0; i < n; i++) {
+            for (unsigned l = 0; l < g->count; l++) {
+               lanes[i * KLANES + l] = block[i * channels + g->first + l];
+            }
+         }
+
+         /* run up to each segment boundary, then move the sums out */
+         for (size_t i = 0; i < n;) {
+            uint64_t pos = at + i;
+            size_t left = p->segment - (size_t)(pos % p->segment);
+            size_t m = n - i < left ? n - i : left;
+         #ifdef HAVE_X86_SIMD
+            if (p->simd) k_filter_avx2(p->filter, g, lanes + i * KLANES, m);
+            else
+         #endif
+            k_filter(p->filter, g, lanes + i * KLANES, m);
+            i += m;
+
+            if (m == left) {
+               uint64_t s = pos / p->segment;
+               for (unsigned l = 0; l < g->count && s < p->segments; l++) {
+                  p->energy[(size_t)(g->first + l) * p->segments + s] = g->energy[l];
+               }
+               memset(g->energy, 0, sizeof(g->energy));
+               flush_denormals(g);
+            }
+         }
+      }
+
+      at += n;
+   }
+
+done:
+   free(raw);
+   free(block);
+   free(lanes);
+   return NULL;
+}
+
+/* mean square to LUFS (LKFS), -inf for silence */
+static double lufs(double power) {
+   return power > 0 ? -0.691 + 10.0 * log10(power) : -INFINITY;
+}
+
+static double power_of(double lufs) {
+   return pow(10.0, (lufs + 0.691) / 10.0);
+}
+
+static int cmp_double(const void *a, const void *b) {
+   double x = *(const double *)a, y = *(const double *)b;
+   return (x > y) - (x < y);
+}
+
+/*
+ * the mean square of every window of len segments starting at each
+ * segment, from the channel weighted segment sums. returns the number of
+ * windows.
+ */
+static size_t windows(const double *weighted, size_t segments, size_t len, size_t segment,
+                      double *power) {
+   if (segments < len) return 0;
+   size_t count = segments - len + 1;
+   for (size_t j = 0; j < count; j++) {
+      double sum = 0;
+      for (size_t k = 0; k < len; k++) sum += weighted[j + k];
+      power[j] = sum / (double)(len * segment);
+   }
+   return count;
+}
+
+/* the gated mean of power (which gating reorders), 0 if no window passes */
+static double gated_mean(double *power, size_t count, double relative, size_t *kept) {
+   double absolute = power_of(ABSOLUTE_GATE), sum = 0;
+   size_t n = 0;
+   for (size_t j = 0; j < count; j++) {
+      if (power[j] > absolute) {
+         power[n++] = power[j];
+         sum += power[j];
+      }
+   }
+   if (n == 0) {
+      *kept = 0;
+      return 0;
+   }
+
+   double threshold = sum / (double)n * pow(10.0, relative / 10.0);
+   size_t m = 0;
+   sum = 0;
+   for (size_t j = 0; j < n; j++) {
+      if (power[j] > threshold) {
+         power[m++] = power[j];
+         sum += power[j];
+      }
+   }
+   *kept = m;
+   return m ? sum / (double)m : 0;
+}
+
+/* integrated loudness, maxima and LRA from the per channel segment sums */
+static void measure(const double *energy, unsigned channels, size_t segments, size_t segment,
+                    double *scratch, struct wavutil_loudness *out) {
+   double *weighted = scratch, *power = scratch + segments;
+   memset(weighted, 0, segments * sizeof(double));
+   for (unsigned c = 0; c < channels; c++) {
+      double w = channel_weight(c, channels);
+      for (size_t s = 0; s < segments && w > 0; s++) {
+         weighted[s] += w * energy[(size_t)c * segments + s];
+      }
+   }
+
+   size_t count = windows(weighted, segments, MOMENTARY, segment, power);
+   double max = 0;
+   for (size_t j = 0; j < count; j++) {
+      if (power[j] > max) max = power[j];
+   }
+   out->momentary_max = lufs(max);
+
+   size_t kept;
+   out->integrated = lufs(gated_mean(power, count, RELATIVE_GATE, &kept));
+
+   count = windows(weighted, segments, SHORT_TERM, segment, power);
+   max = 0;
+   for (size_t j = 0; j < count; j++) {
+      if (power[j] > max) max = power[j];
+   }
+   out->short_term_max = lufs(max);
+
+   gated_mean(power, count, RANGE_GATE, &kept);
+   out->range = 0;
+   if (kept > 1) {
+      qsort(power, kept, sizeof(double), cmp_double);
+      size_t low = (size_t)((double)(kept - 1) * 0.10 + 0.5);
+      size_t high = (size_t)((double)(kept - 1) * 0.95 + 0.5);
+      out->range = lufs(power[high]) - lufs(power[low]);
+   }
+}
+
+/*
+ * reads the audio data (out of map when it holds all of it) and measures
+ * its loudness, filtering the channels on up to threads threads (0 for
+ * one per CPU when the file is big enough). returns 0 on success and -1
+ * on error.
+ */
+int wavutil_loudness(int fd, const wavutil_info *info, const struct wavutil_map *map, int threads,
+                     struct wavutil_loudness *loudness) {
+   enum wavutil_sample_format format = wavutil_file_format(fd, map, info);
+   unsigned channels = info->header.f.numChannels;
+   uint32_t rate = info->header.f.sampleRate;
+   size_t in_frame = wavutil_sample_size(format) * channels;
+
+   memset(loudness, 0, sizeof(*loudness));
+   if (in_frame == 0) {
+      wu_log("Unsupported sample format: audioFormat %u, %u bits, %u channels\n",
+             info->header.f.audioFormat, info->header.f.bitsPerSample, channels);
+      errno = EINVAL;
+      return -1;
+   }
+   if (rate < MIN_RATE) {
+      wu_log("Loudness needs a sample rate of at least %u Hz, not %u\n", MIN_RATE, rate);
+      errno = EINVAL;
+      return -1;
+   }
+
+   uint64_t frames = info->data_size / in_frame;
+   size_t segment = (rate + SEGMENTS_PER_SECOND / 2) / SEGMENTS_PER_SECOND;
+   size_t segments = (size_t)(frames / segment);
+
+   /* narrower groups when there are more threads than groups of KLANES */
+   if (threads <= 0) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? (int)cpus : 1;
+      if (info->data_size < LOUDNESS_SPLIT) threads = 1;
+   }
+   size_t width = (channels + (unsigned)threads - 1) / (unsigned)threads;
+   if (width > KLANES) width = KLANES;
+   if (width < 1) width = 1;
+   size_t num_groups = (channels + width - 1) / width;
+   if ((size_t)threads > num_groups) threads = (int)num_groups;
+
+   struct loudness_part *parts = calloc((size_t)threads, sizeof(*parts));
+   struct kgroup *groups = calloc(num_groups, sizeof(*groups));
+   pthread_t *tids = calloc((size_t)threads, sizeof(*tids));
+   double *energy = calloc((size_t)channels * segments + 1, sizeof(double));
+   double *scratch = malloc((2 * segments + 1) * sizeof(double));
+   if (!parts || !groups || !tids || !energy || !scratch) {
+      wu_log("Loudness allocation failed\n");
+      free(parts);
+      free(groups);
+      free(tids);
+      free(energy);
+      free(scratch);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   const uint8_t *mapped = NULL;
+   if (map && map->base && map->size >= info->data_offset &&
+       map->size - info->data_offset >= frames * in_frame) {
+      mapped = map->base + info->data_offset;
+   }
+
+   struct biquad filter[STAGES];
+   k_weighting(filter, rate);
+
+#ifdef HAVE_X86_SIMD
+   int simd = !strcmp(wavutil_simd(), "avx2");
+#else
+   int simd = 0;
+#endif
+
+   /* thread t takes groups t, t + threads, ... which sit next to each other in groups */
+   size_t g = 0;
+   for (int t = 0; t < threads; t++) {
+      struct loudness_part *p = &parts[t];
+      p->fd = fd;
+      p->info = info;
+      p->mapped = mapped;
+      p->format = format;
+      p->channels = channels;
+      p->filter = filter;
+      p->simd = simd;
+      p->frames = frames;
+      p->segment = segment;
+      p->segments = segments;
+      p->energy = energy;
+      p->groups = groups + g;
+      for (size_t k = (size_t)t; k < num_groups; k += (size_t)threads, g++) {
+         groups[g].first = (unsigned)(k * width);
+         groups[g].count = (unsigned)(channels - k * width < width ? channels - k * width : width);
+         p->num_groups++;
+      }
+   }
+
+   /* the calling thread takes the first part */
+   int started = 1;
+   for (; started < threads; started++) {
+      if (pthread_create(&tids[started], NULL, loudness_worker, &parts[started])) break;
+   }
+   loudness_worker(&parts[0]);
+   for (int t = 1; t < started; t++) {
+      pthread_join(tids[t], NULL);
+   }
+   for (int t = started; t < threads; t++) {
+      loudness_worker(&parts[t]);
+   }
+
+   int err = 0;
+   for (int t = 0; t < threads; t++) {
+      if (parts[t].err) err = parts[t].err;
+   }
+
+   loudness->channels = channels;
+   loudness->frames = frames;
+   if (!err) measure(energy, channels, segments, segment, scratch, loudness);
+
+   free(parts);
+   free(groups);
+   free(tids);
+   free(energy);
+   free(scratch);
+
+   if (err) {
+      wu_log("Reading audio data failed: %s\n", strerror(err));
+      errno = err;
+      return -1;
+   }
+   return 0;
+}
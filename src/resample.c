@@ -0,0 +1,671 @@
+/*
+ * resample.c: sample rate conversion for libwavutil
+ *
+ * a polyphase windowed sinc resampler. the ratio out/in is reduced to
+ * L/M, and output sample n sits at input time n * M / L: between input
+ * samples i = n * M / L and i + 1, at phase p = n * M % L of L. each
+ * phase has its own row of taps, the sinc shifted by p / L under a
+ * Kaiser window, so an output is one dot product of its row with the
+ * input samples around i. the cutoff sits between 20 kHz at 44.1 kHz
+ * (0.4535 of the lower rate) and the lower Nyquist, with the stopband
+ * 110 dB down, and the taps stretch with the ratio when going down. when
+ * L is too big for a table of its own (44100 to 44101 Hz) the rows are
+ * a finer grid of phases and an output is interpolated between the two
+ * rows around it. designs are kept for the next file at the same ratio,
+ * so a batch of 44.1k to 48k files designs its filter once, and the
+ * least recently used one makes way when there are more ratios than
+ * the cache holds.
+ *
+ * the data chunk is streamed a block at a time through float, each
+ * channel keeping the last taps samples of history, so memory does not
+ * grow with the file. the channels are shared out between threads that
+ * work through each block in step with the one reading and writing. the
+ * dot products use AVX2 when the CPU has it.
+ */
+#define _GNU_SOURCE
+#include <stdint.h> /* uint types */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* memset */
+#include <math.h> /* sin, sqrt */
+#include <errno.h> /* errno */
+#include <fcntl.h> /* open */
+#include <pthread.h> /* worker threads, filter cache */
+#include <unistd.h> /* pread, pwrite, sysconf */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* AVX2 */
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "wavutil.h"
+#include "wavutil_private.h"
+
+#define RESAMPLE_FRAMES 16384 /* input frames read per block, more than MAX_TAPS */
+#define RESAMPLE_OUT 16384 /* output frames written per block */
+#define RESAMPLE_SPLIT (16 << 20) /* bytes of audio data before channels get their own threads */
+
+#define PASSBAND 0.4535 /* of the lower rate, 20 kHz at 44.1 kHz */
+#define STOPBAND 0.5
+#define ATTENUATION 110.0 /* dB in the stopband */
+#define MAX_TAPS 8192 /* a 1:50 or so ratio */
+#define MAX_PHASES 2048 /* rows of an exact table */
+#define MAX_TABLE (4 << 20) /* floats in a table, exact or not */
+#define GRID_PHASES 1024 /* rows when interpolating, fewer if they do not fit */
+#define CACHED_FILTERS 8
+#define LANES 8 /* floats per vector, taps are a multiple */
+
+struct resample_filter {
+   uint64_t up, down;         /* L and M: out = in * up / down */
+   unsigned taps;             /* per row, a multiple of LANES */
+   unsigned grid;             /* 0 for a row per phase, or the rows interpolated between */
+   float *coef;               /* up rows (grid + 1 when interpolating) of taps */
+   /* the rest belongs to the cache, under cache_lock */
+   unsigned refs;             /* resamples using it */
+   int cached;                /* in cache[], freed by whoever drops the last ref otherwise */
+   uint64_t used;             /* cache_clock when last handed out */
+};
+
+/* designs kept between files, the least recently used one replaced first */
+static struct resample_filter *cache[CACHED_FILTERS];
+static uint64_t cache_clock;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+   while (b) {
+      uint64_t t = a % b;
+      a = b;
+      b = t;
+   }
+   return a;
+}
+
+/* the modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x) {
+   double sum = 1, term = 1, q = x * x / 4;
+   for (int k = 1; k < 200 && term > sum * 1e-16; k++) {
+      term *= q / ((double)k * k);
+      sum += term;
+   }
+   return sum;
+}
+
+/*
+ * designs the filter for up/down. row r holds the taps of an output at
+ * phase r / rows past an input sample (rows being up, or grid when
+ * interpolating, with one more row for phase 1), tap k weighing the input
+ * taps / 2 - 1 - k samples before it. every row is scaled to a gain of
+ * exactly 1 at DC.
+ */
+static struct resample_filter *design(uint64_t up, uint64_t down) {
+   double scale = up < down ? (double)up / (double)down : 1.0;
+   double cutoff = (PASSBAND + STOPBAND) / 2 * scale;   /* cycles per input sample */
+   double width = (STOPBAND - PASSBAND) * scale;
+   double beta = 0.1102 * (ATTENUATION - 8.7);
+   double length = (ATTENUATION - 7.95) / (2.285 * 2 * M_PI * width) + 1;
+
+   if (length > MAX_TAPS) {
+      wu_log("Resampling by %llu/%llu needs too long a filter\n", (unsigned long long)up,
+             (unsigned long long)down);
+      errno = EINVAL;
+      return NULL;
+   }
+   unsigned taps = ((unsigned)ceil(length) + LANES - 1) / LANES * LANES;
+
+   struct resample_filter *f = calloc(1, sizeof(*f));
+   if (f == NULL) {
+      errno = ENOMEM;
+      return NULL;
+   }
+   f->up = up;
+   f->down = down;
+   f->taps = taps;
+   uint64_t rows = up;
+   if (up > MAX_PHASES || up * taps > MAX_TABLE) {
+      f->grid = MAX_TABLE / taps - 1 < GRID_PHASES ? MAX_TABLE / taps - 1 : GRID_PHASES;
+      rows = f->grid + 1;
+   }
+
+   if (posix_memalign((void **)&f->coef, 32, rows * taps * sizeof(float))) {
+      free(f);
+      errno = ENOMEM;
+      return NULL;
+   }
+
+   double half = taps / 2.0, norm = bessel_i0(beta);
+   double *row = malloc(taps * sizeof(double));
+   if (row == NULL) {
+      free(f->coef);
+      free(f);
+      errno = ENOMEM;
+      return NULL;
+   }
+   for (uint64_t r = 0; r < rows; r++) {
+      double phase = (double)r / (double)(f->grid ? f->grid : up), sum = 0;
+      for (unsigned k = 0; k < taps; k++) {
+         double t = (double)k - (half - 1) - phase;
+         double x = 2 * cutoff * t, w = t / half;
+         double sinc = x == 0 ? 1 : sin(M_PI * x) / (M_PI * x);
+         row[k] = 2 * cutoff * sinc * (w * w < 1 ? bessel_i0(beta * sqrt(1 - w * w)) / norm : 0);
+         sum += row[k];
+      }
+      for (unsigned k = 0; k < taps; k++) {
+         f->coef[r * taps + k] = (float)(row[k] / sum);
+      }
+   }
+   free(row);
+   return f;
+}
+
+static void free_filter(struct resample_filter *f) {
+   free(f->coef);
+   free(f);
+}
+
+/*
+ * the filter for up/down from the cache, designing it if need be, to be
+ * handed back with put_filter. a new design takes a free slot or that of
+ * the least recently used filter nobody is using; when every slot is in
+ * use it is not cached at all.
+ */
+static struct resample_filter *get_filter(uint64_t up, uint64_t down) {
+   pthread_mutex_lock(&cache_lock);
+   for (int i = 0; i < CACHED_FILTERS && cache[i]; i++) {
+      if (cache[i]->up == up && cache[i]->down == down) {
+         struct resample_filter *f = cache[i];
+         f->refs++;
+         f->used = ++cache_clock;
+         pthread_mutex_unlock(&cache_lock);
+         return f;
+      }
+   }
+   pthread_mutex_unlock(&cache_lock);
+
+   /* designing takes a while, two threads may end up doing it at once */
+   struct resample_filter *f = design(up, down);
+   if (f == NULL) return NULL;
+   f->refs = 1;
+
+   struct resample_filter *evicted = NULL;
+   pthread_mutex_lock(&cache_lock);
+   int slot = -1;
+   for (int i = 0; i < CACHED_FILTERS; i++) {
+      if (cache[i] == NULL) {
+         slot = i;
+         break;
+      }
+      if (cache[i]->refs == 0 && (slot < 0 || cache[i]->used < cache[slot]->used)) slot = i;
+   }
+   if (slot >= 0) {
+      evicted = cache[slot];
+      cache[slot] = f;
+      f->cached = 1;
+      f->used = ++cache_clock;
+   }
+   pthread_mutex_unlock(&cache_lock);
+
+   if (evicted) free_filter(evicted);
+   return f;
+}
+
+/* gives back a filter from get_filter, freeing it if it was not cached */
+static void put_filter(struct resample_filter *f) {
+   pthread_mutex_lock(&cache_lock);
+   int last = --f->refs == 0 && !f->cached;
+   pthread_mutex_unlock(&cache_lock);
+   if (last) free_filter(f);
+}
+
+void wavutil_resample_cleanup(void) {
+   pthread_mutex_lock(&cache_lock);
+   for (int i = 0; i < CACHED_FILTERS; i++) {
+      struct resample_filter *f = cache[i];
+      if (f == NULL) continue;
+      cache[i] = NULL;
+      f->cached = 0;
+      /* a resample still running frees it in put_filter */
+      if (f->refs == 0) free_filter(f);
+   }
+   pthread_mutex_unlock(&cache_lock);
+}
+
+static float dot(const float *x, const float *h, unsigned n) {
+   float sum[LANES] = {0};
+   for (unsigned k = 0; k < n; k += LANES) {
+      for (int l = 0; l < LANES; l++) {
+         sum[l] += x[k + l] * h[k + l];
+      }
+   }
+   return ((sum[0] + sum[4]) + (sum[1] + sum[5])) + ((sum[2] + sum[6]) + (sum[3] + sum[7]));
+}
+
+#ifdef HAVE_X86_SIMD
+/* two accumulators to keep the adds apart, n a multiple of LANES */
+__attribute__((target("avx2")))
+static float dot_avx2(const float *x, const float *h, unsigned n) {
+   __m256 a = _mm256_setzero_ps(), b = _mm256_setzero_ps();
+   unsigned k = 0;
+   for (; k + 2 * LANES <= n; k += 2 * LANES) {
+      a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_load_ps(h + k)));
+      b = _mm256_add_ps(b, _mm256_mul_ps(_mm256_loadu_ps(x + k + LANES),
+                                         _mm256_load_ps(h + k + LANES)));
+   }
+   if (k < n) {
+      a = _mm256_add_ps(a, _mm256_mul_ps(_mm256_loadu_ps(x + k), _mm256_load_ps(h + k)));
+   }
+   a = _mm256_add_ps(a, b);
+   __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+   s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+   s = _mm_add_ss(s, _mm_movehdup_ps(s));
+   return _mm_cvtss_f32(s);
+}
+#endif
+
+/* where the outputs of a block are: the same for every channel */
+struct schedule {
+   size_t count;
+   size_t *first;             /* history index of the first tap */
+   const float **row;         /* taps, and the next row when interpolating */
+   float *frac;               /* weight of the next row, 0 for none */
+};
+
+/* everything the threads share, rewritten by the reading thread between blocks */
+struct resampler {
+   const struct resample_filter *filter;
+   unsigned channels;
+   int simd;
+   const float *in;           /* interleaved input frames of the block */
+   size_t in_frames;
+   size_t len;                /* history samples per channel before the block */
+   size_t drop;               /* history samples dropped after it */
+   struct schedule s;
+   float **history;           /* per channel, taps + RESAMPLE_FRAMES samples */
+   float *out;                /* per channel, RESAMPLE_OUT samples apart */
+
+   pthread_mutex_t lock;
+   pthread_cond_t ready_cond;
+   int ready;                 /* the barriers are set up */
+   int quit;
+   pthread_barrier_t start, end;
+};
+
+/* the channels one thread resamples */
+struct resample_part {
+   struct resampler *r;
+   unsigned first, count;     /* channels [first, first + count) */
+};
+
+/* appends the block to the history of the part's channels and filters them */
+static void resample_part(struct resample_part *p) {
+   struct resampler *r = p->r;
+   const struct schedule *s = &r->s;
+   unsigned taps = r->filter->taps, channels = r->channels;
+
+   for (unsigned c = p->first; c < p->first + p->count; c++) {
+      float *h = r->history[c], *y = r->out + (size_t)c * RESAMPLE_OUT;
+      for (size_t i = 0; i < r->in_frames; i++) {
+         h[r->len + i] = r->in[i * channels + c];
+      }
+
+      for (size_t j = 0; j < s->count; j++) {
+         const float *x = h + s->first[j];
+         float v;
+      #ifdef HAVE_X86_SIMD
+         if (r->simd) {
+            v = dot_avx2(x, s->row[j], taps);
+            if (s->frac[j] != 0) v += s->frac[j] * (dot_avx2(x, s->row[j] + taps, taps) - v);
+         }
+         else
+      #endif
+         {
+            v = dot(x, s->row[j], taps);
+            if (s->frac[j] != 0) v += s->frac[j] * (dot(x, s->row[j] + taps, taps) - v);
+         }
+         y[j] = v;
+      }
+
+      memmove(h, h + r->drop, (r->len + r->in_frames - r->drop) * sizeof(float));
+   }
+}
+
+static void *resample_worker(void *arg) {
+   struct resample_part *p = arg;
+   struct resampler *r = p->r;
+
+   pthread_mutex_lock(&r->lock);
+   while (!r->ready) pthread_cond_wait(&r->ready_cond, &r->lock);
+   pthread_mutex_unlock(&r->lock);
+
+   for (;;) {
+      pthread_barrier_wait(&r->start);
+      if (r->quit) break;
+      resample_part(p);
+      pthread_barrier_wait(&r->end);
+   }
+   return NULL;
+}
+
+/*
+ * reads n frames of the data chunk starting at frame into raw, or finds
+ * them in mapped. returns where they are, NULL on a failed read.
+ */
+static const uint8_t *read_frames(int fd, const wavutil_info *info, const uint8_t *mapped,
+                                  uint8_t *raw, uint64_t frame, size_t n, size_t in_frame) {
+   if (mapped) return mapped + frame * in_frame;
+
+   uint8_t *p = raw;
+   size_t left = n * in_frame;
+   uint64_t off = info->data_offset + frame * in_frame;
+   while (left > 0) {
+      ssize_t got = pread(fd, p, left, (off_t)off);
+      if (got <= 0) {
+         if (got < 0 && errno == EINTR) continue;
+         if (got == 0) errno = EIO;
+         return NULL;
+      }
+      p += got;
+      left -= (size_t)got;
+      off += (uint64_t)got;
+   }
+   return raw;
+}
+
+static int write_frames(int fd, const uint8_t *buf, size_t len, uint64_t off) {
+   while (len > 0) {
+      ssize_t n = pwrite(fd, buf, len, (off_t)off);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      buf += n;
+      len -= (size_t)n;
+      off += (uint64_t)n;
+   }
+   return 0;
+}
+
+/*
+ * resamples the data chunk into out from out_off. the reading thread
+ * fills r->in, works out the schedule, runs its own parts between the
+ * barriers and writes what came out.
+ */
+static int resample_data(const char *name, int fd, const wavutil_info *info, const uint8_t *mapped,
+                         enum wavutil_sample_format format, uint64_t frames, struct resampler *r,
+                         struct resample_part *parts, int threads, int started, int out,
+                         uint64_t out_off, uint64_t out_frames) {
+   const struct resample_filter *f = r->filter;
+   unsigned channels = r->channels, half = f->taps / 2;
+   size_t size = wavutil_sample_size(format), in_frame = size * channels;
+
+   uint8_t *raw = malloc(RESAMPLE_FRAMES * in_frame);
+   float *in = malloc((size_t)RESAMPLE_FRAMES * channels * sizeof(float));
+   float *block = malloc((size_t)RESAMPLE_OUT * channels * sizeof(float));
+   uint8_t *bytes = malloc(RESAMPLE_OUT * in_frame);
+   if (!raw || !in || !block || !bytes) {
+      wu_log("Resampling allocation failed\n");
+      free(raw);
+      free(in);
+      free(block);
+      free(bytes);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   /* the history starts with the taps before input sample 0, all silence */
+   int64_t start = -(int64_t)(half - 1);
+   uint64_t read = 0, next = 0;
+   int tail = 0, backlog = 0, ret = -1;
+   r->in = in;
+   r->len = half - 1;
+
+   while (next < out_frames) {
+      /* new input unless the last block could not take every output there was */
+      size_t m = 0;
+      if (!backlog && read < frames) {
+         m = frames - read > RESAMPLE_FRAMES ? RESAMPLE_FRAMES : (size_t)(frames - read);
+         const uint8_t *src = read_frames(fd, info, mapped, raw, read, m, in_frame);
+         if (src == NULL) {
+            wu_log("Reading audio data failed: %s\n", strerror(errno));
+            goto done;
+         }
+         wavutil_convert_samples(in, WAVUTIL_SAMPLE_F32, src, format, m * channels);
+         read += m;
+      }
+      else if (!backlog && !tail) {
+         /* silence after the end for the taps of the last outputs */
+         m = half;
+         memset(in, 0, m * channels * sizeof(float));
+         tail = 1;
+      }
+      r->in_frames = m;
+
+      int64_t end = start + (int64_t)(r->len + m);
+      size_t count = 0;
+      uint64_t n = next;
+      for (; n < out_frames && count < RESAMPLE_OUT; n++, count++) {
+         uint64_t pos = n * f->down;
+         int64_t i = (int64_t)(pos / f->up);
+         uint64_t phase = pos % f->up;
+         if (i + (int64_t)half >= end) break;
+
+         r->s.first[count] = (size_t)(i - (int64_t)(half - 1) - start);
+         if (f->grid) {
+            uint64_t q = phase * f->grid;
+            r->s.row[count] = f->coef + (size_t)(q / f->up) * f->taps;
+            r->s.frac[count] = (float)(q % f->up) / (float)f->up;
+         }
+         else {
+            r->s.row[count] = f->coef + (size_t)phase * f->taps;
+            r->s.frac[count] = 0;
+         }
+      }
+      r->s.count = count;
+      /* more outputs than a block holds, ex: upsampling a whole block of input */
+      backlog = n < out_frames && (int64_t)(n * f->down / f->up) + (int64_t)half < end;
+      if (count == 0 && m == 0) {
+         wu_log("Resampling stalled at output frame %llu\n", (unsigned long long)n);
+         errno = EIO;
+         goto done;
+      }
+
+      /* keep the history from the first tap of the next output on */
+      int64_t keep = (int64_t)(n * f->down / f->up) - (int64_t)(half - 1);
+      if (keep > end) keep = end;
+      r->drop = (size_t)(keep - start);
+
+      if (started > 1) pthread_barrier_wait(&r->start);
+      resample_part(&parts[0]);
+      for (int t = started; t < threads; t++) {
+         resample_part(&parts[t]);
+      }
+      if (started > 1) pthread_barrier_wait(&r->end);
+
+      r->len = r->len + m - r->drop;
+      start = keep;
+      next = n;
+
+      for (size_t j = 0; j < count; j++) {
+         for (unsigned c = 0; c < channels; c++) {
+            block[j * channels + c] = r->out[(size_t)c * RESAMPLE_OUT + j];
+         }
+      }
+      wavutil_convert_samples(bytes, format, block, WAVUTIL_SAMPLE_F32, count * channels);
+      if (write_frames(out, bytes, count * in_frame, out_off)) {
+         wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+         goto done;
+      }
+      out_off += count * in_frame;
+   }
+   ret = 0;
+
+done:
+   free(raw);
+   free(in);
+   free(block);
+   free(bytes);
+   return ret;
+}
+
+int wavutil_resample(const char *name, int fd, const wavutil_info *info,
+                     const struct wavutil_map *map, uint32_t rate, int threads) {
+   enum wavutil_sample_format format = wavutil_file_format(fd, map, info);
+   unsigned channels = info->header.f.numChannels;
+   uint32_t from = info->header.f.sampleRate;
+   size_t size = wavutil_sample_size(format), in_frame = size * channels;
+
+   if (in_frame == 0) {
+      wu_log("Unsupported sample format: audioFormat %u, %u bits, %u channels\n",
+             info->header.f.audioFormat, info->header.f.bitsPerSample, channels);
+      errno = EINVAL;
+      return -1;
+   }
+   if (from == 0 || rate == 0) {
+      wu_log("Cannot resample from %u Hz to %u Hz\n", from, rate);
+      errno = EINVAL;
+      return -1;
+   }
+   if (rate == from) {
+      return wavutil_convert(name, fd, info, map, format, NULL);
+   }
+
+   uint64_t g = gcd(from, rate);
+   struct resample_filter *f = get_filter(rate / g, from / g);
+   if (f == NULL) {
+      if (errno == ENOMEM) wu_log("Resampling allocation failed\n");
+      return -1;
+   }
+
+   /* a partial frame at the end of the data chunk is dropped */
+   uint64_t frames = info->data_size / in_frame;
+   uint64_t out_frames = (frames * f->up + f->down - 1) / f->down;
+   uint64_t data_size = out_frames * in_frame;
+
+   wavutil_header edited = info->header;
+   edited.f.sampleRate = rate;
+   edited.f.byteRate = rate * edited.f.blockAlign;
+
+   if (threads <= 0) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? (int)cpus : 1;
+      if (info->data_size < RESAMPLE_SPLIT) threads = 1;
+   }
+   if ((unsigned)threads > channels) threads = (int)channels;
+
+   struct resampler r = {0};
+   r.filter = f;
+   r.channels = channels;
+   r.simd = 0;
+#ifdef HAVE_X86_SIMD
+   r.simd = !strcmp(wavutil_simd(), "avx2");
+#endif
+   r.s.first = malloc(RESAMPLE_OUT * sizeof(*r.s.first));
+   r.s.row = malloc(RESAMPLE_OUT * sizeof(*r.s.row));
+   r.s.frac = malloc(RESAMPLE_OUT * sizeof(*r.s.frac));
+   r.history = calloc(channels, sizeof(*r.history));
+   r.out = malloc((size_t)channels * RESAMPLE_OUT * sizeof(float));
+   struct resample_part *parts = calloc((size_t)threads, sizeof(*parts));
+   pthread_t *tids = calloc((size_t)threads, sizeof(*tids));
+   int ok = r.s.first && r.s.row && r.s.frac && r.history && r.out && parts && tids;
+   for (unsigned c = 0; ok && c < channels; c++) {
+      ok = (r.history[c] = calloc(f->taps + RESAMPLE_FRAMES, sizeof(float))) != NULL;
+   }
+
+   int ret = -1, out = -1, started = 1;
+   uint8_t *prefix = NULL;
+   size_t len;
+   if (!ok) {
+      wu_log("Resampling allocation failed\n");
+      errno = ENOMEM;
+      goto done;
+   }
+
+   const uint8_t *mapped = NULL;
+   if (map && map->base && map->size >= info->data_offset &&
+       map->size - info->data_offset >= frames * in_frame) {
+      mapped = map->base + info->data_offset;
+   }
+
+   if ((prefix = wavutil_prefix(fd, info, &edited, data_size, &len)) == NULL) {
+      goto done;
+   }
+   if ((out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+      wu_log("Failed to create %s\n", name);
+      goto done;
+   }
+   if (write_frames(out, prefix, len, 0)) {
+      wu_log("Writing header to %s failed: %s\n", name, strerror(errno));
+      goto done;
+   }
+
+   /* whole ranges of channels per thread, the calling thread takes the first */
+   for (int t = 0; t < threads; t++) {
+      parts[t].r = &r;
+      parts[t].first = (unsigned)((uint64_t)channels * (unsigned)t / (unsigned)threads);
+      parts[t].count = (unsigned)((uint64_t)channels * (unsigned)(t + 1) / (unsigned)threads) -
+                       parts[t].first;
+   }
+   pthread_mutex_init(&r.lock, NULL);
+   pthread_cond_init(&r.ready_cond, NULL);
+   pthread_mutex_lock(&r.lock);
+   for (; started < threads; started++) {
+      if (pthread_create(&tids[started], NULL, resample_worker, &parts[started])) break;
+   }
+   if (started > 1) {
+      pthread_barrier_init(&r.start, NULL, (unsigned)started);
+      pthread_barrier_init(&r.end, NULL, (unsigned)started);
+   }
+   r.ready = 1;
+   pthread_cond_broadcast(&r.ready_cond);
+   pthread_mutex_unlock(&r.lock);
+
+   /* parts whose thread did not start are done by the calling thread */
+   ret = resample_data(name, fd, info, mapped, format, frames, &r, parts, threads, started, out,
+                       len, out_frames);
+
+   if (started > 1) {
+      r.quit = 1;
+      pthread_barrier_wait(&r.start);
+      for (int t = 1; t < started; t++) {
+         pthread_join(tids[t], NULL);
+      }
+      pthread_barrier_destroy(&r.start);
+      pthread_barrier_destroy(&r.end);
+   }
+   pthread_cond_destroy(&r.ready_cond);
+   pthread_mutex_destroy(&r.lock);
+   if (ret) goto done;
+
+   /* the pad byte of an odd sized data chunk, then the chunks after it */
+   ret = -1;
+   uint64_t out_off = len + data_size;
+   if ((data_size & 1) && write_frames(out, (const uint8_t *)"", 1, out_off++)) {
+      wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+      goto done;
+   }
+   uint64_t data_end = info->data_offset + info->data_size + (info->data_size & 1);
+   if (info->file_size > data_end &&
+       wavutil_copy_range(fd, (off_t)data_end, out, (off_t)out_off, info->file_size - data_end,
+                          NULL) < 0) {
+      wu_log("Writing trailing chunks to %s failed: %s\n", name, strerror(errno));
+      goto done;
+   }
+   ret = 0;
+
+done:
+   if (out >= 0 && close(out) && ret == 0) {
+      wu_log("Closing %s failed: %s\n", name, strerror(errno));
+      ret = -1;
+   }
+   for (unsigned c = 0; r.history && c < channels; c++) {
+      free(r.history[c]);
+   }
+   free(r.history);
+   free(r.out);
+   free(r.s.first);
+   free(r.s.row);
+   free(r.s.frac);
+   free(parts);
+   free(tids);
+   free(prefix);
+   put_filter(f);
+   return ret;
+}
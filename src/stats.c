@@ -0,0 +1,400 @@
+/*
+ * stats.c: level statistics of the audio data for libwavutil
+ *
+ * the data chunk is read once, a block of frames at a time, converted to
+ * float32 with the conversion kernels and reduced per channel: peak,
+ * sum and sum of squares (for DC offset and RMS), clipped samples, and
+ * the true peak of the signal oversampled 4 times with the ITU-R
+ * BS.1770 interpolation filter. large files are split into ranges of
+ * frames reduced on separate threads and merged at the end.
+ *
+ * the reductions keep one accumulator per vector lane. with frames of C
+ * samples, a run of lcm(C, 8) floats always starts on channel 0, so lane
+ * k of that run belongs to channel k % C and is folded into it once per
+ * block, when the float sums are also moved into doubles.
+ */
+#define _GNU_SOURCE
+#include <stdint.h> /* uint types */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* memset */
+#include <math.h> /* sqrt */
+#include <errno.h> /* errno */
+#include <pthread.h> /* worker threads */
+#include <unistd.h> /* pread, sysconf */
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> /* AVX2 */
+#define HAVE_X86_SIMD 1
+#endif
+
+#include "wavutil.h"
+#include "wavutil_private.h"
+
+#define STATS_FRAMES 4096 /* frames per block, a multiple of the vector width */
+#define STATS_SPLIT (64 << 20) /* bytes of audio data per thread when splitting */
+#define LANES 8 /* floats per vector */
+
+#define TAPS 12 /* per phase of the true peak filter */
+#define PHASES 4 /* oversampling */
+#define HISTORY (TAPS - 1)
+
+/* ITU-R BS.1770-4 annex 2, 48 tap interpolation filter split in 4 phases */
+static const float tp_coef[PHASES][TAPS] = {
+   {  0.0017089843750f,  0.0109863281250f, -0.0196533203125f,  0.0332031250000f,
+     -0.0594482421875f,  0.1373291015625f,  0.9721679687500f, -0.1022949218750f,
+      0.0476074218750f, -0.0266113281250f,  0.0148925781250f, -0.0083007812500f },
+   { -0.0291748046875f,  0.0292968750000f, -0.0517578125000f,  0.0891113281250f,
+     -0.1665039062500f,  0.4650878906250f,  0.7797851562500f, -0.2003173828125f,
+      0.1015625000000f, -0.0582275390625f,  0.0330810546875f, -0.0189208984375f },
+   { -0.0189208984375f,  0.0330810546875f, -0.0582275390625f,  0.1015625000000f,
+     -0.2003173828125f,  0.7797851562500f,  0.4650878906250f, -0.1665039062500f,
+      0.0891113281250f, -0.0517578125000f,  0.0292968750000f, -0.0291748046875f },
+   { -0.0083007812500f,  0.0148925781250f, -0.0266113281250f,  0.0476074218750f,
+     -0.1022949218750f,  0.9721679687500f,  0.1373291015625f, -0.0594482421875f,
+      0.0332031250000f, -0.0196533203125f,  0.0109863281250f,  0.0017089843750f }
+};
+
+/* one channel, summed over the frames a thread has seen */
+struct channel_acc {
+   double peak;
+   double true_peak;
+   double sum;
+   double squares;
+   uint64_t clips;
+};
+
+/* the per lane accumulators of one block */
+struct lane_acc {
+   float *peak;
+   float *sum;
+   float *squares;
+   float *clips;
+};
+
+/* a range of frames reduced by one thread */
+struct stats_part {
+   int fd;
+   const wavutil_info *info;
+   const uint8_t *mapped;     /* the audio data, NULL to read it */
+   enum wavutil_sample_format format;
+   unsigned channels;
+   size_t lanes;              /* lcm(channels, LANES) */
+   float level;               /* positive samples from here up are clipped, negative from -1 down */
+   int simd;
+   uint64_t first, last;      /* frames [first, last) */
+   struct channel_acc *acc;
+   int err;                   /* errno of a failure, 0 if none */
+};
+
+static size_t gcd(size_t a, size_t b) {
+   while (b) {
+      size_t t = a % b;
+      a = b;
+      b = t;
+   }
+   return a;
+}
+
+/* n floats (a multiple of lanes) into lane accumulators that start at zero */
+static void reduce(const float *x, size_t n, size_t lanes, float level, struct lane_acc *l) {
+   for (size_t i = 0; i < n; i += lanes) {
+      for (size_t k = 0; k < lanes; k++) {
+         float v = x[i + k], a = fabsf(v);
+         l->peak[k] = a > l->peak[k] ? a : l->peak[k];
+         l->sum[k] += v;
+         l->squares[k] += v * v;
+         l->clips[k] += v >= level || v <= -1.0f;
+      }
+   }
+}
+
+/* the true peak of outputs skip.. of one channel, chan is HISTORY samples then n new ones */
+static float true_peak(const float *chan, size_t skip, size_t n) {
+   float peak = 0;
+   for (size_t i = skip; i < n; i++) {
+      for (int p = 0; p < PHASES; p++) {
+         float y = 0;
+         for (int k = 0; k < TAPS; k++) {
+            y += tp_coef[p][k] * chan[HISTORY + i - k];
+         }
+         y = fabsf(y);
+         peak = y > peak ? y : peak;
+      }
+   }
+   return peak;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("avx2")))
+static void reduce_avx2(const float *x, size_t n, size_t lanes, float level, struct lane_acc *l) {
+   const __m256 sign = _mm256_set1_ps(-0.0f), one = _mm256_set1_ps(1.0f);
+   const __m256 hi = _mm256_set1_ps(level), lo = _mm256_set1_ps(-1.0f);
+
+   for (size_t k = 0; k < lanes; k += LANES) {
+      __m256 peak = _mm256_setzero_ps(), sum = peak, squares = peak, clips = peak;
+      for (size_t i = k; i < n; i += lanes) {
+         __m256 v = _mm256_loadu_ps(x + i);
+         __m256 a = _mm256_andnot_ps(sign, v);
+         peak = _mm256_max_ps(a, peak); /* NaN keeps the old peak */
+         sum = _mm256_add_ps(sum, v);
+         squares = _mm256_add_ps(squares, _mm256_mul_ps(v, v));
+         __m256 clipped = _mm256_or_ps(_mm256_cmp_ps(v, hi, _CMP_GE_OQ),
+                                       _mm256_cmp_ps(v, lo, _CMP_LE_OQ));
+         clips = _mm256_add_ps(clips, _mm256_and_ps(clipped, one));
+      }
+      _mm256_storeu_ps(l->peak + k, peak);
+      _mm256_storeu_ps(l->sum + k, sum);
+      _mm256_storeu_ps(l->squares + k, squares);
+      _mm256_storeu_ps(l->clips + k, clips);
+   }
+}
+
+/* 8 outputs of every phase at a time, the rest through the scalar version */
+__attribute__((target("avx2")))
+static float true_peak_avx2(const float *chan, size_t skip, size_t n) {
+   const __m256 sign = _mm256_set1_ps(-0.0f);
+   __m256 peak = _mm256_setzero_ps();
+   size_t i = skip;
+
+   for (; i + LANES <= n; i += LANES) {
+      for (int p = 0; p < PHASES; p++) {
+         __m256 y = _mm256_setzero_ps();
+         for (int k = 0; k < TAPS; k++) {
+            __m256 x = _mm256_loadu_ps(chan + HISTORY + i - k);
+            y = _mm256_add_ps(y, _mm256_mul_ps(_mm256_set1_ps(tp_coef[p][k]), x));
+         }
+         peak = _mm256_max_ps(_mm256_andnot_ps(sign, y), peak);
+      }
+   }
+
+   float lanes[LANES];
+   _mm256_storeu_ps(lanes, peak);
+   float max = true_peak(chan, i, n);
+   for (int k = 0; k < LANES; k++) {
+      max = lanes[k] > max ? lanes[k] : max;
+   }
+   return max;
+}
+#endif
+
+/*
+ * reduces the frames of one part. the true peak filter needs the
+ * HISTORY frames in front of the part, so those are read too but only
+ * fed to the filter.
+ */
+static void *stats_worker(void *arg) {
+   struct stats_part *p = arg;
+   unsigned channels = p->channels;
+   size_t in_frame = wavutil_sample_size(p->format) * channels;
+   size_t samples = (size_t)STATS_FRAMES * channels;
+
+   uint8_t *raw = p->mapped ? NULL : malloc(STATS_FRAMES * in_frame);
+   float *block = malloc(samples * sizeof(float));
+   float *chan = malloc((STATS_FRAMES + HISTORY) * sizeof(float));
+   float *history = calloc((size_t)channels * HISTORY, sizeof(float));
+   float *lanes = malloc(4 * p->lanes * sizeof(float));
+   if ((!p->mapped && !raw) || !block || !chan || !history || !lanes) {
+      p->err = ENOMEM;
+      goto done;
+   }
+   struct lane_acc l = { lanes, lanes + p->lanes, lanes + 2 * p->lanes, lanes + 3 * p->lanes };
+
+   uint64_t at = p->first > HISTORY ? p->first - HISTORY : 0;
+   while (at < p->last) {
+      size_t n = p->last - at > STATS_FRAMES ? STATS_FRAMES : (size_t)(p->last - at);
+      size_t skip = at < p->first ? (size_t)(p->first - at) : 0;
+      const uint8_t *src = p->mapped ? p->mapped + at * in_frame : raw;
+
+      if (!p->mapped) {
+         size_t want = n * in_frame;
+         ssize_t got = pread(p->fd, raw, want, (off_t)(p->info->data_offset + at * in_frame));
+         if (got != (ssize_t)want) {
+            p->err = got < 0 ? errno : EIO;
+            goto done;
+         }
+      }
+      wavutil_convert_samples(block, WAVUTIL_SAMPLE_F32, src, p->format, n * channels);
+
+      /* whole runs of LANES frames through the lanes, the rest straight into the channels */
+      size_t whole = (n - skip) / LANES * LANES;
+      const float *x = block + skip * channels;
+      memset(lanes, 0, 4 * p->lanes * sizeof(float));
+   #ifdef HAVE_X86_SIMD
+      if (p->simd) reduce_avx2(x, whole * channels, p->lanes, p->level, &l);
+      else
+   #endif
+      reduce(x, whole * channels, p->lanes, p->level, &l);
+
+      for (size_t k = 0; k < p->lanes; k++) {
+         struct channel_acc *a = &p->acc[k % channels];
+         a->peak = l.peak[k] > a->peak ? l.peak[k] : a->peak;
+         a->sum += l.sum[k];
+         a->squares += l.squares[k];
+         a->clips += (uint64_t)l.clips[k];
+      }
+      for (size_t i = whole * channels; i < (n - skip) * channels; i++) {
+         struct channel_acc *a = &p->acc[i % channels];
+         float v = x[i], m = fabsf(v);
+         a->peak = m > a->peak ? m : a->peak;
+         a->sum += v;
+         a->squares += (double)v * v;
+         a->clips += v >= p->level || v <= -1.0f;
+      }
+
+      /* one channel at a time behind its history */
+      for (unsigned c = 0; c < channels; c++) {
+         float *h = history + (size_t)c * HISTORY;
+         memcpy(chan, h, HISTORY * sizeof(float));
+         for (size_t i = 0; i < n; i++) {
+            chan[HISTORY + i] = block[i * channels + c];
+         }
+      #ifdef HAVE_X86_SIMD
+         float peak = p->simd ? true_peak_avx2(chan, skip, n) : true_peak(chan, skip, n);
+      #else
+         float peak = true_peak(chan, skip, n);
+      #endif
+         if (peak > p->acc[c].true_peak) p->acc[c].true_peak = peak;
+         memcpy(h, chan + n, HISTORY * sizeof(float));
+      }
+
+      at += n;
+   }
+
+done:
+   free(raw);
+   free(block);
+   free(chan);
+   free(history);
+   free(lanes);
+   return NULL;
+}
+
+/*
+ * reads every sample of the data chunk (out of map when it holds all of
+ * it) and fills in stats, splitting the work across up to threads threads
+ * (0 for one per CPU, as long as each gets enough data to be worth it).
+ * returns 0 on success and -1 on error.
+ */
+int wavutil_stats(int fd, const wavutil_info *info, const struct wavutil_map *map, int threads,
+                  struct wavutil_stats *stats) {
+   enum wavutil_sample_format format = wavutil_file_format(fd, map, info);
+   unsigned channels = info->header.f.numChannels;
+   size_t in_frame = wavutil_sample_size(format) * channels;
+
+   memset(stats, 0, sizeof(*stats));
+   if (in_frame == 0) {
+      wu_log("Unsupported sample format: audioFormat %u, %u bits, %u channels\n",
+             info->header.f.audioFormat, info->header.f.bitsPerSample, channels);
+      errno = EINVAL;
+      return -1;
+   }
+
+   uint64_t frames = info->data_size / in_frame;
+   if (threads <= 0) {
+      long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+      threads = cpus > 0 ? (int)cpus : 1;
+   }
+   uint64_t worth = info->data_size / STATS_SPLIT + 1;
+   if ((uint64_t)threads > worth) threads = (int)worth;
+
+   struct stats_part *parts = calloc((size_t)threads, sizeof(*parts));
+   struct channel_acc *acc = calloc((size_t)threads * channels, sizeof(*acc));
+   pthread_t *tids = calloc((size_t)threads, sizeof(*tids));
+   stats->channel = calloc(channels, sizeof(*stats->channel));
+   if (!parts || !acc || !tids || !stats->channel) {
+      wu_log("Statistics allocation failed\n");
+      free(parts);
+      free(acc);
+      free(tids);
+      wavutil_stats_free(stats);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   const uint8_t *mapped = NULL;
+   if (map && map->base && map->size >= info->data_offset &&
+       map->size - info->data_offset >= frames * in_frame) {
+      mapped = map->base + info->data_offset;
+   }
+
+   /* integers at either end of their range are clipped, floats from 1.0 up */
+   float level = 1.0f;
+   if (!wavutil_sample_is_float(format)) {
+      double scale = ldexp(1.0, (int)wavutil_sample_size(format) * 8 - 1);
+      level = (float)((scale - 1) / scale);
+   }
+
+#ifdef HAVE_X86_SIMD
+   int simd = !strcmp(wavutil_simd(), "avx2");
+#else
+   int simd = 0;
+#endif
+
+   for (int t = 0; t < threads; t++) {
+      struct stats_part *p = &parts[t];
+      p->fd = fd;
+      p->info = info;
+      p->mapped = mapped;
+      p->format = format;
+      p->channels = channels;
+      p->lanes = (size_t)channels * LANES / gcd(channels, LANES);
+      p->level = level;
+      p->simd = simd;
+      p->first = frames * (uint64_t)t / (uint64_t)threads;
+      p->last = frames * (uint64_t)(t + 1) / (uint64_t)threads;
+      p->acc = acc + (size_t)t * channels;
+   }
+
+   /* the calling thread takes the first part */
+   int started = 1;
+   for (; started < threads; started++) {
+      if (pthread_create(&tids[started], NULL, stats_worker, &parts[started])) break;
+   }
+   stats_worker(&parts[0]);
+   for (int t = 1; t < started; t++) {
+      pthread_join(tids[t], NULL);
+   }
+   for (int t = started; t < threads; t++) {
+      stats_worker(&parts[t]);
+   }
+
+   int err = 0;
+   for (int t = 0; t < threads; t++) {
+      if (parts[t].err) err = parts[t].err;
+   }
+
+   stats->channels = channels;
+   stats->frames = frames;
+   for (unsigned c = 0; c < channels && !err; c++) {
+      struct wavutil_channel_stats *s = &stats->channel[c];
+      double sum = 0, squares = 0;
+      for (int t = 0; t < threads; t++) {
+         const struct channel_acc *a = &acc[(size_t)t * channels + c];
+         if (a->peak > s->peak) s->peak = a->peak;
+         if (a->true_peak > s->true_peak) s->true_peak = a->true_peak;
+         sum += a->sum;
+         squares += a->squares;
+         s->clips += a->clips;
+      }
+      if (s->peak > s->true_peak) s->true_peak = s->peak;
+      s->dc = frames ? sum / (double)frames : 0;
+      s->rms = frames ? sqrt(squares / (double)frames) : 0;
+   }
+
+   free(parts);
+   free(acc);
+   free(tids);
+
+   if (err) {
+      wu_log("Reading audio data failed: %s\n", strerror(err));
+      wavutil_stats_free(stats);
+      errno = err;
+      return -1;
+   }
+   return 0;
+}
+
+void wavutil_stats_free(struct wavutil_stats *stats) {
+   free(stats->channel);
+   stats->channel = NULL;
+}
@@ -7,241 +7,3843 @@
  * 30 October 2024
  * - renamed things from wav-look to wav-util
  * - removed extra code related to assignment specifications
+ *
+ * 15 October 2026
+ * - audio data is copied kernel side (copy_file_range/sendfile/splice)
+ * - fmt fields can be edited with --set, optionally in place with pwrite
+ * - modified.wav is a reflink clone of the original where supported
+ * - optional mmap backed reader for the header and audio data
+ * - chunks are found by walking the RIFF tree, so JUNK, LIST, bext...
+ *   before or after the data chunk are supported
+ * - RF64/BW64 (ds64 chunk) files are read and written, output above
+ *   4gb is promoted from RIFF to RF64
+ * - batch mode runs many files across a pool of worker threads
+ * - --scan walks directories and caches parsed headers between runs
+ * - --format prints json, ndjson or csv, each file formatted in one buffer
+ * - pipelined copy with separate reader and writer threads
+ * - io_uring copy (linked read/write) and batched header reads
+ * - copy block size probed from st_blksize and the device, or tuned
+ * - --direct copies around the page cache
+ * - output files are preallocated with fallocate
+ * - the parser and writer moved to libwavutil (wavutil.c), this file is
+ *   the command line around it
+ * - convert subcommand, SIMD sample format conversion (convert.c)
+ * - stats subcommand: peak, true peak, RMS, DC offset and clips (stats.c)
+ * - loudness subcommand: EBU R128 integrated, momentary, short term and
+ *   LRA (loudness.c)
+ * - hash subcommand: MD5, XXH3 or BLAKE3 of the audio data alone (hash.c)
+ * - dedup subcommand: duplicate audio found by size, sampled ends, then a
+ *   full hash, optionally hardlinked or reflinked
+ * - --stats times each phase of every file and counts system calls (and
+ *   perf_event counters), --trace writes a Chrome trace of the run
+ * - split-channels, extract-channels and interleave subcommands, one
+ *   pass over the audio data with SIMD transposes (channels.c)
+ * - resample subcommand, polyphase windowed sinc sample rate conversion
+ *   streamed in blocks across threads per channel (resample.c)
  */
+#define _GNU_SOURCE
 #include <stdio.h> /* io functions */
 #include <stdint.h> /* uint types */
+#include <inttypes.h> /* PRIu64 */
+#include <stdarg.h> /* va_list */
 #include <stdlib.h> /* mem allocation */
 #include <string.h> /* strcmp */
+#include <math.h> /* log10 */
+#include <errno.h> /* errno */
+#include <fcntl.h> /* splice, copy_file_range */
+#include <getopt.h> /* getopt_long */
+#include <libgen.h> /* basename */
+#include <pthread.h> /* worker threads */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* read, write, lseek */
+#include <sys/stat.h> /* fstat */
+#include <sys/syscall.h> /* SYS_getdents64, SYS_perf_event_open */
+#include <sys/resource.h> /* getrusage */
+#include <linux/perf_event.h> /* perf_event_attr */
+#include <dirent.h> /* DT_DIR, DT_REG */
+
+#include "wavutil.h"
 
 #ifndef DEBUG
 #define DEBUG 0
 #endif
 
-#define ID_LEN 4 /* chunk IDs */
-
-#define BLOCK 4096 /* how much data we will read in at a time */
-#define MAX_BLOCKS 524288 /* wav files are capped at 2gb */
-
 #define BITS_PER_BYTE 8
 
+#define URING_BATCH 32 /* files opened per io_uring submission */
+
 const char *modified_name  = "modified.wav";
+const char *bench_name     = "wav-util-bench.tmp";
+const char *cache_magic    = "WUC1";
 
-/* RIFF definitions */
-const char *RIFF_ID = "RIFF";
-const char *RIFF_FMT = "WAVE";
-struct riff_chunk {
-   char chunkID[ID_LEN];
-   uint32_t chunkSize;
-   char format[ID_LEN];
+const size_t HEADER_SIZE = sizeof(wavutil_header);
+
+/* how the header of each file is printed */
+enum output_format {
+   FORMAT_TEXT,
+   FORMAT_JSON,
+   FORMAT_NDJSON,
+   FORMAT_CSV,
+   FORMATS
+};
+
+const char *format_names[FORMATS] = {
+   "text", "json", "ndjson", "csv"
 };
 
-/* fmt definitions */
-const char *FMT_ID = "fmt ";
-struct fmt_chunk {
-   char chunkID[ID_LEN];
-   uint32_t chunkSize;
-   uint16_t audioFormat;
-   uint16_t numChannels;
-   uint32_t sampleRate;
-   uint32_t byteRate;
-   uint16_t blockAlign;
-   uint16_t bitsPerSample;
+/* everything the command line asked for, shared by every file */
+struct wav_options {
+   char **edits;
+   int num_edits;
+   int in_place;
+   const char *backup;        /* file name, or a suffix in batch mode */
+   enum wavutil_output_strategy strategy;
+   struct wavutil_copy_options *copy;   /* one for every thread, so tuning happens once */
+   int use_mmap;
+   int timing;
+   const char *output_dir;    /* batch mode: where rewritten files go */
+   int jobs;                  /* batch mode: number of worker threads */
+   int unordered;             /* batch mode: print results as they finish */
+   enum output_format format;
+   int batch;                 /* records are joined up by an emitter */
+   int uring;                 /* batch mode: open and read headers with io_uring */
 };
 
-/* data definitions */
-const char *DATA_ID = "data";
-struct data_chunk {
-   char chunkID[ID_LEN];
-   uint32_t chunkSize;
+/*
+ * a growing string that a whole record is formatted into, so each file
+ * costs a single write no matter how many fields it has
+ */
+struct strbuf {
+   char *data;
+   size_t len;
+   size_t cap;
 };
 
-/* the wav file containing the 3 chunks */
-typedef struct wav_header_t {
-   struct riff_chunk r;
-   struct fmt_chunk f;
-   struct data_chunk d;
-}wav_header;
+static void sb_reserve(struct strbuf *sb, size_t extra) {
+   if (sb->len + extra + 1 <= sb->cap) return;
+
+   size_t cap = sb->cap ? sb->cap : 1024;
+   while (cap < sb->len + extra + 1) cap *= 2;
+   char *grown = realloc(sb->data, cap);
+   if (grown == NULL) {
+      fprintf(stderr, "Output buffer allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+   sb->data = grown;
+   sb->cap = cap;
+}
+
+static void sb_printf(struct strbuf *sb, const char *fmt, ...) {
+   va_list ap;
+
+   sb_reserve(sb, 128);
+   va_start(ap, fmt);
+   int n = vsnprintf(sb->data + sb->len, sb->cap - sb->len, fmt, ap);
+   va_end(ap);
+   if (n < 0) return;
+
+   if ((size_t)n >= sb->cap - sb->len) {
+      sb_reserve(sb, (size_t)n);
+      va_start(ap, fmt);
+      vsnprintf(sb->data + sb->len, sb->cap - sb->len, fmt, ap);
+      va_end(ap);
+   }
+   sb->len += (size_t)n;
+}
 
-const size_t HEADER_SIZE = sizeof(wav_header);
+static void sb_putc(struct strbuf *sb, char c) {
+   sb_reserve(sb, 1);
+   sb->data[sb->len++] = c;
+   sb->data[sb->len] = '\0';
+}
 
 /*
- * this function is used to verify that the file entered
- * is in fact a wav file. If it is not, the program
- * will terminate. Some wav files can contain extra chunks
- * such as JUNK but this program will only accept wav files
- * with the 3 chunks.
+ * the length of the well formed UTF-8 sequence at str (no overlong
+ * forms or surrogates), 0 if there is none
  */
-int verify_file(wav_header *input) {
-   int error = 0;
-   /* check the RIFF id */
-   if (strncmp(input->r.chunkID, RIFF_ID, ID_LEN)) {
-      printf("riff chunk could not be verified: %s\n", input->r.chunkID);
-      error++;
+static size_t utf8_len(const unsigned char *str, size_t left) {
+   unsigned char c = str[0];
+   size_t n;
+   unsigned char lo = 0x80, hi = 0xbf;   /* range of the second byte */
+
+   if (c < 0x80) return 1;
+   if (c >= 0xc2 && c <= 0xdf) n = 2;
+   else if (c >= 0xe0 && c <= 0xef) {
+      n = 3;
+      if (c == 0xe0) lo = 0xa0;
+      if (c == 0xed) hi = 0x9f;
    }
+   else if (c >= 0xf0 && c <= 0xf4) {
+      n = 4;
+      if (c == 0xf0) lo = 0x90;
+      if (c == 0xf4) hi = 0x8f;
+   }
+   else return 0;
 
-   /* check the RIFF format */
-   if (strncmp(input->r.format, RIFF_FMT, ID_LEN)) {
-      printf("riff format could not be verified: %s\n", input->r.format);
-      error++;
+   if (left < n || str[1] < lo || str[1] > hi) return 0;
+   for (size_t i = 2; i < n; i++) {
+      if ((str[i] & 0xc0) != 0x80) return 0;
    }
+   return n;
+}
 
-   /* check the fmt ID */
-   if (strncmp(input->f.chunkID, FMT_ID, ID_LEN)) {
-      printf("format chunk could not be verified: %s\n", input->f.chunkID);
-      error++;
+/*
+ * a JSON string. UTF-8 is kept as it is and control characters are
+ * escaped; bytes that are not UTF-8 (paths can hold anything) become
+ * U+FFFD.
+ */
+static void sb_json(struct strbuf *sb, const char *str, size_t len) {
+   const unsigned char *s = (const unsigned char *)str;
+   sb_putc(sb, '"');
+   for (size_t i = 0; i < len; ) {
+      unsigned char c = s[i];
+      size_t n = utf8_len(s + i, len - i);
+      if (c == '"' || c == '\\') {
+         sb_putc(sb, '\\');
+         sb_putc(sb, (char)c);
+      }
+      else if (c < 0x20) {
+         sb_printf(sb, "\\u%04x", c);
+      }
+      else if (n == 0) {
+         sb_printf(sb, "\\ufffd");
+         n = 1;
+      }
+      else {
+         sb_printf(sb, "%.*s", (int)n, str + i);
+      }
+      i += n;
    }
+   sb_putc(sb, '"');
+}
 
-   /* check the data ID */
-   if (strncmp(input->d.chunkID, DATA_ID, ID_LEN)) {
-      printf("data chunk could not be verified: %s\n", input->d.chunkID);
-      error++;
+/* a CSV field, quoted when it has to be. str need not end in a NUL */
+static void sb_csv(struct strbuf *sb, const char *str, size_t len) {
+   size_t i = 0;
+   while (i < len && !memchr(",\"\r\n", str[i], 4)) i++;
+   if (i == len) {
+      sb_printf(sb, "%.*s", (int)len, str);
+      return;
+   }
+   sb_putc(sb, '"');
+   for (i = 0; i < len; i++) {
+      if (str[i] == '"') sb_putc(sb, '"');
+      sb_putc(sb, str[i]);
    }
+   sb_putc(sb, '"');
+}
 
-   return error;
+/*
+ * the size stored for the data chunk. records from the scan cache have
+ * no chunk table, only the size itself.
+ */
+static uint64_t data_chunk_size(const wavutil_info *info) {
+   if (info->data >= 0 && info->chunks) {
+      return info->chunks[info->data].size;
+   }
+   return info->data_size;
 }
 
 /* 
  * This function displays info about the wav file to the user
  */
-void print(wav_header *input) {
-   printf("+------------+\n");
-   printf("| RIFF CHUNK |\n");
-   printf("+____________+\n");
+static void format_text(struct strbuf *sb, const wavutil_info *info) {
+   const wavutil_header *input = &info->header;
 
-   printf("ID\t%.4s\n",     input->r.chunkID);
-   printf("Size\t%d\n",     input->r.chunkSize);
-   printf("Format\t%.4s\n", input->r.format);
+   sb_printf(sb, "+------------+\n"
+                 "| RIFF CHUNK |\n"
+                 "+____________+\n");
 
-   printf("+-----------+\n");
-   printf("| FMT CHUNK |\n");
-   printf("+-----------+\n");
+   sb_printf(sb, "ID\t%.4s\n",     input->r.chunkID);
+   sb_printf(sb, "Size\t%" PRIu64 "\n", info->riff_size);
+   sb_printf(sb, "Format\t%.4s\n", input->r.format);
 
-   printf("ID\t\t%.4s\n",            input->f.chunkID);
-   printf("Size\t\t%d\n",            input->f.chunkSize);
-   printf("Format\t\t%d\n",          input->f.audioFormat);
-   printf("Channels\t%d\n",        input->f.numChannels);
-   printf("Sample rate\t%d\n",     input->f.sampleRate);
-   printf("Byte rate\t%d\n",       input->f.byteRate);
-   printf("Block align\t%d\n",     input->f.blockAlign);
-   printf("Bits per sample\t%d\n", input->f.bitsPerSample);
+   sb_printf(sb, "+-----------+\n"
+                 "| FMT CHUNK |\n"
+                 "+-----------+\n");
 
-   // TODO: print other chunks if available. ex: JUNK
+   sb_printf(sb, "ID\t\t%.4s\n",          input->f.chunkID);
+   sb_printf(sb, "Size\t\t%u\n",          input->f.chunkSize);
+   sb_printf(sb, "Format\t\t%d\n",        input->f.audioFormat);
+   sb_printf(sb, "Channels\t%d\n",        input->f.numChannels);
+   sb_printf(sb, "Sample rate\t%u\n",     input->f.sampleRate);
+   sb_printf(sb, "Byte rate\t%u\n",       input->f.byteRate);
+   sb_printf(sb, "Block align\t%d\n",     input->f.blockAlign);
+   sb_printf(sb, "Bits per sample\t%d\n", input->f.bitsPerSample);
+
+   /* everything that is not fmt or data, in file order */
+   if (info->num_chunks > 2) {
+      sb_printf(sb, "+--------------+\n"
+                    "| OTHER CHUNKS |\n"
+                    "+--------------+\n"
+                    "ID\tOffset\t\tSize\n");
+      for (size_t i = 0; i < info->num_chunks; i++) {
+         if ((int)i == info->fmt || (int)i == info->data) continue;
+         sb_printf(sb, "%.4s\t%-12" PRIu64 "\t%" PRIu64 "\n", info->chunks[i].id,
+                   info->chunks[i].offset, info->chunks[i].size);
+      }
+   }
 
-   printf("+------------+\n");
-   printf("| DATA CHUNK |\n");
-   printf("+------------+\n");
-   printf("ID\t%.4s\n",     input->d.chunkID);
-   printf("Size\t%d\n",     input->d.chunkSize);
+   sb_printf(sb, "+------------+\n"
+                 "| DATA CHUNK |\n"
+                 "+------------+\n");
+   sb_printf(sb, "ID\t%.4s\n",     input->d.chunkID);
+   sb_printf(sb, "Size\t%" PRIu64 "\n", data_chunk_size(info));
 }
 
 /*
- * This function creates a new wav file and writes the modified header
- * to the new file.
+ * one JSON object per file. ndjson is the same object on a single line.
  */
-FILE* create_file (const char *name, wav_header header) {
-   FILE* f = NULL;
+static void format_json(struct strbuf *sb, const char *path, const wavutil_info *info, int valid,
+                        int pretty) {
+   const wavutil_header *h = &info->header;
+   const char *nl = pretty ? "\n" : "";
+   const char *in = pretty ? "  " : "";
 
-   /* create the file */
-   if (!(f = fopen(name, "w"))) {
-      fprintf(stderr, "Failed to create %s\n", name);
-      exit(EXIT_FAILURE);
+   sb_printf(sb, "{%s%s\"path\": ", nl, in);
+   sb_json(sb, path, strlen(path));
+   sb_printf(sb, ",%s%s\"valid\": %s", nl, in, valid ? "true" : "false");
+
+   if (valid) {
+      sb_printf(sb, ",%s%s\"riff\": {\"id\": ", nl, in);
+      sb_json(sb, h->r.chunkID, WAVUTIL_ID_LEN);
+      sb_printf(sb, ", \"size\": %" PRIu64 ", \"format\": ", info->riff_size);
+      sb_json(sb, h->r.format, WAVUTIL_ID_LEN);
+      sb_printf(sb, "},%s%s\"fmt\": {\"size\": %u, \"audioFormat\": %d, \"numChannels\": %d, "
+                "\"sampleRate\": %u, \"byteRate\": %u, \"blockAlign\": %d, \"bitsPerSample\": %d},",
+                nl, in, h->f.chunkSize, h->f.audioFormat, h->f.numChannels, h->f.sampleRate,
+                h->f.byteRate, h->f.blockAlign, h->f.bitsPerSample);
+      sb_printf(sb, "%s%s\"data\": {\"offset\": %" PRIu64 ", \"size\": %" PRIu64 "}",
+                nl, in, info->data_offset, data_chunk_size(info));
+
+      if (info->chunks) {
+         sb_printf(sb, ",%s%s\"chunks\": [", nl, in);
+         for (size_t i = 0; i < info->num_chunks; i++) {
+            sb_printf(sb, "%s{\"id\": ", i ? ", " : "");
+            sb_json(sb, info->chunks[i].id, WAVUTIL_ID_LEN);
+            sb_printf(sb, ", \"offset\": %" PRIu64 ", \"size\": %" PRIu64 "}",
+                      info->chunks[i].offset, info->chunks[i].size);
+         }
+         sb_putc(sb, ']');
+      }
    }
 
-   /* write the header to the new file */
-   size_t bytes;
-   if ((bytes = fwrite(&header, HEADER_SIZE, 1, f)) != 1) {
-      fprintf(stderr, "Writing header to %s failed. bytes written: %zu\n", name, bytes);
-      exit(EXIT_FAILURE);
+   sb_printf(sb, "%s}", nl);
+}
+
+static const char *csv_columns =
+   "path,valid,riff_id,riff_size,audio_format,channels,sample_rate,byte_rate,"
+   "block_align,bits_per_sample,data_offset,data_size,chunks\n";
+
+static void format_csv(struct strbuf *sb, const char *path, const wavutil_info *info, int valid) {
+   const wavutil_header *h = &info->header;
+
+   sb_csv(sb, path, strlen(path));
+   if (!valid) {
+      sb_printf(sb, ",0,,,,,,,,,,,\n");
+      return;
+   }
+   sb_printf(sb, ",1,");
+   sb_csv(sb, h->r.chunkID, strnlen(h->r.chunkID, WAVUTIL_ID_LEN));
+   sb_printf(sb, ",%" PRIu64 ",%d,%d,%u,%u,%d,%d,%" PRIu64 ",%" PRIu64 ",%zu\n",
+             info->riff_size, h->f.audioFormat, h->f.numChannels, h->f.sampleRate,
+             h->f.byteRate, h->f.blockAlign, h->f.bitsPerSample, info->data_offset,
+             data_chunk_size(info), info->num_chunks);
+}
+
+/*
+ * formats one file in the requested format. text is the original boxed
+ * layout, json/ndjson/csv are records meant for other programs.
+ */
+void format_record(struct strbuf *sb, enum output_format format, const char *path,
+                   const wavutil_info *info, int valid) {
+   switch (format) {
+   case FORMAT_TEXT:
+      if (valid) format_text(sb, info);
+      break;
+   case FORMAT_JSON:
+      format_json(sb, path, info, valid, 1);
+      break;
+   case FORMAT_NDJSON:
+      format_json(sb, path, info, valid, 0);
+      sb_putc(sb, '\n');
+      break;
+   case FORMAT_CSV:
+      format_csv(sb, path, info, valid);
+      break;
+   default:
+      break;
+   }
+}
+
+/*
+ * This function displays info about the wav file to the user, formatted
+ * into one buffer and written with a single call
+ */
+void print(FILE *out, enum output_format format, const char *path, const wavutil_info *info,
+           int valid) {
+   struct strbuf sb = {0};
+
+   if (format == FORMAT_CSV) sb_printf(&sb, "%s", csv_columns);
+   format_record(&sb, format, path, info, valid);
+   if (format == FORMAT_JSON) sb_putc(&sb, '\n');
+   if (sb.len) fwrite(sb.data, 1, sb.len, out);
+   free(sb.data);
+}
+
+/*
+ * prints a file on its own, or just its record when it is part of a batch
+ */
+void report(FILE *out, const struct wav_options *opts, const char *path, const wavutil_info *info,
+            int valid) {
+   if (!opts->batch) {
+      print(out, opts->format, path, info, valid);
+      return;
    }
 
-   /* return the file pointer to main */
-   return f;
+   struct strbuf sb = {0};
+   format_record(&sb, opts->format, path, info, valid);
+   if (sb.len) fwrite(sb.data, 1, sb.len, out);
+   free(sb.data);
 }
 
 /*
- * this function writes the audio data to the newly created wav files
+ * Writes records one after another so that the whole run is valid in its
+ * format: a single JSON array, or a CSV file with one header row. Callers
+ * serialise calls to emit_record.
  */
-void write_data(wav_header header, FILE* original, FILE* modified) {
-   size_t bytes;
+struct emitter {
+   FILE *out;
+   enum output_format format;
+   size_t count;
+   const char *columns;       /* CSV header row, csv_columns when NULL */
+};
 
-   /* allocate data to read in the audio data portion of the file */
-   uint8_t *data = (uint8_t *)calloc(BLOCK, sizeof(uint8_t));
-   if (data == NULL) {
-      fprintf(stderr, "Data block allocation failed\n");
-      exit(EXIT_FAILURE);
+void emit_begin(struct emitter *e) {
+   if (e->format == FORMAT_JSON) fputs("[\n", e->out);
+   if (e->format == FORMAT_CSV) fputs(e->columns ? e->columns : csv_columns, e->out);
+}
+
+void emit_record(struct emitter *e, const char *buf, size_t len) {
+   if (len == 0) return;
+   if (e->format == FORMAT_JSON && e->count) fputs(",\n", e->out);
+   fwrite(buf, 1, len, e->out);
+   e->count++;
+}
+
+void emit_end(struct emitter *e) {
+   if (e->format == FORMAT_JSON) fputs(e->count ? "\n]\n" : "]\n", e->out);
+   fflush(e->out);
+}
+
+/*
+ * applies every edit from the command line to the header.
+ * returns 0 on success and -1 if an edit is not valid.
+ */
+int apply_edits(wavutil_header *header, const struct wav_options *opts) {
+   for (int i = 0; i < opts->num_edits; i++) {
+      if (wavutil_edit(header, opts->edits[i])) {
+         return -1;
+      }
+   }
+   return 0;
+}
+
+static double now_seconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * --stats and --trace. each thread that processes files times the phases
+ * of every file into its own counters (the library reports the steps of
+ * writing one through wavutil_set_trace) and takes its system counters
+ * when it starts and ends: read and write system calls and bytes from
+ * /proc/thread-self/io, page faults and context switches from getrusage,
+ * and with --stats=perf a set of perf_event counters. everything is added
+ * up when the thread ends. trace events are collected per thread too and
+ * written out in chunks under the lock.
+ */
+enum phase {
+   PHASE_OPEN,
+   PHASE_READ,
+   PHASE_VERIFY,
+   PHASE_PRINT,
+   PHASE_PATCH,
+   PHASE_CREATE,
+   PHASE_CLONE,
+   PHASE_COPY,
+   PHASE_CLOSE,
+   PHASES
+};
+
+const char *phase_names[PHASES] = {
+   "open", "read", "verify", "print", "patch", "create", "clone", "copy", "close"
+};
+
+struct phase_stats {
+   uint64_t calls;
+   uint64_t bytes;
+   double seconds;
+   double max;
+};
+
+/* perf_event counters opened on every thread with --stats=perf */
+struct perf_counter {
+   const char *name;
+   uint32_t type;
+   uint64_t config;
+};
+
+static const struct perf_counter perf_counters[] = {
+   { "cycles",           PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+   { "instructions",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+   { "cache-references", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES },
+   { "cache-misses",     PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+   { "page-faults",      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+   { "context-switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+   { "syscalls",         PERF_TYPE_TRACEPOINT, 0 },  /* raw_syscalls:sys_enter, looked up */
+};
+
+#define PERF_COUNTERS (sizeof(perf_counters) / sizeof(perf_counters[0]))
+#define TRACE_FLUSH (64 * 1024) /* trace bytes a thread collects before writing them */
+
+/* what a thread's system counters moved by while it ran */
+struct thread_counters {
+   uint64_t syscr, syscw;     /* read and write system calls */
+   uint64_t rchar, wchar;     /* bytes they moved */
+   uint64_t minflt, majflt;
+   uint64_t nvcsw, nivcsw;    /* voluntary and involuntary context switches */
+   uint64_t perf[PERF_COUNTERS];
+};
+
+struct profiler {
+   int stats;                 /* --stats */
+   int perf;                  /* --stats=perf */
+   FILE *trace;               /* --trace */
+   double start;
+   uint64_t syscall_id;       /* tracepoint id of raw_syscalls:sys_enter, 0 if unknown */
+   pthread_mutex_t lock;
+   struct phase_stats phase[PHASES];
+   struct thread_counters totals;
+   unsigned perf_seen;        /* counters that opened on at least one thread */
+   size_t threads;
+   size_t files;
+};
+
+static struct profiler prof = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+struct profile_thread {
+   int active;
+   pid_t tid;
+   double begun[PHASES];
+   struct phase_stats phase[PHASES];
+   struct thread_counters at_start;
+   int perf_fd[PERF_COUNTERS];
+   size_t files;
+   struct strbuf events;
+};
+
+static _Thread_local struct profile_thread thread_prof;
+
+/* the system counters of the calling thread, perf counters excepted */
+static void read_thread_counters(struct thread_counters *c) {
+   memset(c, 0, sizeof(*c));
+
+   FILE *f = fopen("/proc/thread-self/io", "r");
+   if (f) {
+      char key[32];
+      unsigned long long v;
+      while (fscanf(f, "%31[^:]: %llu\n", key, &v) == 2) {
+         if (!strcmp(key, "syscr")) c->syscr = v;
+         else if (!strcmp(key, "syscw")) c->syscw = v;
+         else if (!strcmp(key, "rchar")) c->rchar = v;
+         else if (!strcmp(key, "wchar")) c->wchar = v;
+      }
+      fclose(f);
+   }
+
+   struct rusage ru;
+   if (getrusage(RUSAGE_THREAD, &ru) == 0) {
+      c->minflt = (uint64_t)ru.ru_minflt;
+      c->majflt = (uint64_t)ru.ru_majflt;
+      c->nvcsw = (uint64_t)ru.ru_nvcsw;
+      c->nivcsw = (uint64_t)ru.ru_nivcsw;
+   }
+}
+
+/*
+ * opens one perf counter on the calling thread. counting the kernel side
+ * as well is tried first, then user space only, which is all a
+ * perf_event_paranoid of 2 allows.
+ */
+static int perf_open(const struct perf_counter *pc) {
+   struct perf_event_attr attr;
+   memset(&attr, 0, sizeof(attr));
+   attr.size = sizeof(attr);
+   attr.type = pc->type;
+   attr.config = pc->type == PERF_TYPE_TRACEPOINT ? prof.syscall_id : pc->config;
+   attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+   attr.exclude_hv = 1;
+   if (pc->type == PERF_TYPE_TRACEPOINT && prof.syscall_id == 0) return -1;
+
+   int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+   if (fd < 0 && (errno == EACCES || errno == EPERM) && pc->type != PERF_TYPE_TRACEPOINT) {
+      attr.exclude_kernel = 1;
+      fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+   }
+   return fd;
+}
+
+/* a counter's value, scaled up if the kernel had to multiplex it */
+static uint64_t perf_read(int fd) {
+   uint64_t v[3];
+   if (read(fd, v, sizeof(v)) != sizeof(v) || v[2] == 0) return 0;
+   return v[2] < v[1] ? (uint64_t)((double)v[0] * v[1] / v[2]) : v[0];
+}
+
+static double trace_us(double t) {
+   return (t - prof.start) * 1e6;
+}
+
+/* hands the events a thread has collected to the trace file */
+static void trace_flush(struct profile_thread *t) {
+   if (t->events.len == 0) return;
+   pthread_mutex_lock(&prof.lock);
+   fwrite(t->events.data, 1, t->events.len, prof.trace);
+   pthread_mutex_unlock(&prof.lock);
+   t->events.len = 0;
+}
+
+/* one complete ("X") event of the Chrome trace event format */
+static void trace_event(struct profile_thread *t, const char *name, const char *cat,
+                        double start, double end, uint64_t bytes) {
+   sb_printf(&t->events, ",\n{\"name\": ");
+   sb_json(&t->events, name, strlen(name));
+   sb_printf(&t->events, ", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+             "\"pid\": %d, \"tid\": %d, \"args\": {\"bytes\": %" PRIu64 "}}",
+             cat, trace_us(start), (end - start) * 1e6, (int)getpid(), (int)t->tid, bytes);
+   if (t->events.len >= TRACE_FLUSH) trace_flush(t);
+}
+
+static void phase_begin(enum phase p) {
+   if (thread_prof.active) thread_prof.begun[p] = now_seconds();
+}
+
+static void phase_end(enum phase p, uint64_t bytes) {
+   struct profile_thread *t = &thread_prof;
+   if (!t->active || t->begun[p] == 0) return;
+
+   double end = now_seconds();
+   double elapsed = end - t->begun[p];
+   t->phase[p].calls++;
+   t->phase[p].bytes += bytes;
+   t->phase[p].seconds += elapsed;
+   if (elapsed > t->phase[p].max) t->phase[p].max = elapsed;
+   if (prof.trace) trace_event(t, phase_names[p], "phase", t->begun[p], end, bytes);
+   t->begun[p] = 0;
+}
+
+/* the library's steps of writing a file, as phases */
+static void profile_step(void *ctx, const char *step, int begin, uint64_t bytes) {
+   (void)ctx;
+   for (int p = 0; p < PHASES; p++) {
+      if (strcmp(step, phase_names[p])) continue;
+      if (begin) phase_begin((enum phase)p);
+      else phase_end((enum phase)p, bytes);
+      return;
+   }
+}
+
+/* starts the file span of the trace, returns when it started */
+static double profile_file_begin(void) {
+   return thread_prof.active ? now_seconds() : 0;
+}
+
+static void profile_file_end(const char *path, double start, uint64_t bytes) {
+   struct profile_thread *t = &thread_prof;
+   if (!t->active) return;
+   t->files++;
+   if (prof.trace) trace_event(t, path, "file", start, now_seconds(), bytes);
+}
+
+/* starts counting on the calling thread, which the trace calls "role n" */
+static void profile_thread_begin(const char *role) {
+   struct profile_thread *t = &thread_prof;
+   if (!prof.stats && !prof.trace) return;
+
+   memset(t, 0, sizeof(*t));
+   t->active = 1;
+   t->tid = (pid_t)syscall(SYS_gettid);
+
+   pthread_mutex_lock(&prof.lock);
+   size_t n = ++prof.threads;
+   pthread_mutex_unlock(&prof.lock);
+
+   if (prof.trace) {
+      char name[64];
+      snprintf(name, sizeof(name), "%s %zu", role, n);
+      sb_printf(&t->events, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, "
+                "\"tid\": %d, \"args\": {\"name\": \"%s\"}}", (int)getpid(), (int)t->tid, name);
+   }
+
+   for (size_t k = 0; k < PERF_COUNTERS; k++) {
+      t->perf_fd[k] = prof.perf ? perf_open(&perf_counters[k]) : -1;
+   }
+   read_thread_counters(&t->at_start);
+}
+
+/* stops counting on the calling thread and adds it to the totals */
+static void profile_thread_end(void) {
+   struct profile_thread *t = &thread_prof;
+   if (!t->active) return;
+
+   struct thread_counters now;
+   read_thread_counters(&now);
+   uint64_t perf[PERF_COUNTERS] = {0};
+   unsigned seen = 0;
+   for (size_t k = 0; k < PERF_COUNTERS; k++) {
+      if (t->perf_fd[k] < 0) continue;
+      perf[k] = perf_read(t->perf_fd[k]);
+      seen |= 1u << k;
+      close(t->perf_fd[k]);
+   }
+   if (prof.trace) trace_flush(t);
+
+   pthread_mutex_lock(&prof.lock);
+   for (int p = 0; p < PHASES; p++) {
+      prof.phase[p].calls += t->phase[p].calls;
+      prof.phase[p].bytes += t->phase[p].bytes;
+      prof.phase[p].seconds += t->phase[p].seconds;
+      if (t->phase[p].max > prof.phase[p].max) prof.phase[p].max = t->phase[p].max;
+   }
+   prof.totals.syscr += now.syscr - t->at_start.syscr;
+   prof.totals.syscw += now.syscw - t->at_start.syscw;
+   prof.totals.rchar += now.rchar - t->at_start.rchar;
+   prof.totals.wchar += now.wchar - t->at_start.wchar;
+   prof.totals.minflt += now.minflt - t->at_start.minflt;
+   prof.totals.majflt += now.majflt - t->at_start.majflt;
+   prof.totals.nvcsw += now.nvcsw - t->at_start.nvcsw;
+   prof.totals.nivcsw += now.nivcsw - t->at_start.nivcsw;
+   for (size_t k = 0; k < PERF_COUNTERS; k++) {
+      prof.totals.perf[k] += perf[k];
+   }
+   prof.perf_seen |= seen;
+   prof.files += t->files;
+   pthread_mutex_unlock(&prof.lock);
+
+   free(t->events.data);
+   memset(t, 0, sizeof(*t));
+}
+
+/* the id of the raw_syscalls:sys_enter tracepoint, 0 without tracefs */
+static uint64_t syscall_tracepoint(void) {
+   static const char *paths[] = {
+      "/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+      "/sys/kernel/debug/tracing/events/raw_syscalls/sys_enter/id",
+   };
+   unsigned long long id = 0;
+   for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]) && id == 0; i++) {
+      FILE *f = fopen(paths[i], "r");
+      if (f == NULL) continue;
+      if (fscanf(f, "%llu", &id) != 1) id = 0;
+      fclose(f);
+   }
+   return id;
+}
+
+/*
+ * turns profiling on before any thread starts: stats is 0 (off), 1
+ * (--stats) or 2 (--stats=perf), trace_name the file for --trace or NULL
+ */
+static int profile_start(int stats, const char *trace_name) {
+   prof.stats = stats > 0;
+   prof.perf = stats > 1;
+   prof.start = now_seconds();
+   if (prof.perf) prof.syscall_id = syscall_tracepoint();
+
+   if (trace_name) {
+      if ((prof.trace = fopen(trace_name, "w")) == NULL) {
+         fprintf(stderr, "Failed to create %s\n", trace_name);
+         return -1;
+      }
+      fprintf(prof.trace, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+              "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+              "\"args\": {\"name\": \"wav-util\"}}", (int)getpid());
+   }
+   if (prof.stats || prof.trace) wavutil_set_trace(profile_step, NULL);
+   return 0;
+}
+
+/* prints what --stats collected to out */
+static void profile_report(FILE *out) {
+   double wall = now_seconds() - prof.start;
+   const struct thread_counters *c = &prof.totals;
+
+   fprintf(out, "%-8s %8s %12s %12s %12s %12s %10s\n", "phase", "calls", "total ms", "mean us",
+           "max us", "bytes", "MB/s");
+   for (int p = 0; p < PHASES; p++) {
+      const struct phase_stats *s = &prof.phase[p];
+      if (s->calls == 0) continue;
+      fprintf(out, "%-8s %8" PRIu64 " %12.3f %12.1f %12.1f %12" PRIu64 " %10.1f\n",
+              phase_names[p], s->calls, s->seconds * 1e3, s->seconds / s->calls * 1e6,
+              s->max * 1e6, s->bytes, s->seconds > 0 ? s->bytes / s->seconds / 1e6 : 0.0);
+   }
+   fprintf(out, "%zu files on %zu threads in %.3f ms\n", prof.files, prof.threads, wall * 1e3);
+   fprintf(out, "system calls: %" PRIu64 " reads (%.1f MB), %" PRIu64 " writes (%.1f MB)\n",
+           c->syscr, c->rchar / 1e6, c->syscw, c->wchar / 1e6);
+   fprintf(out, "page faults: %" PRIu64 " minor, %" PRIu64 " major; context switches: %" PRIu64
+           " voluntary, %" PRIu64 " involuntary\n", c->minflt, c->majflt, c->nvcsw, c->nivcsw);
+
+   if (!prof.perf) return;
+   fprintf(out, "perf:");
+   for (size_t k = 0; k < PERF_COUNTERS; k++) {
+      if (prof.perf_seen & (1u << k)) {
+         fprintf(out, " %s %" PRIu64, perf_counters[k].name, c->perf[k]);
+      }
+      else {
+         fprintf(out, " %s n/a", perf_counters[k].name);
+      }
+      fputc(k + 1 < PERF_COUNTERS ? ',' : '\n', out);
+   }
+   if ((prof.perf_seen & 3) == 3 && c->perf[0] > 0) {
+      fprintf(out, "%.2f instructions per cycle\n", (double)c->perf[1] / c->perf[0]);
+   }
+}
+
+/* ends the main thread's counting, reports and closes the trace */
+static void profile_finish(void) {
+   profile_thread_end();
+   if (prof.stats) profile_report(stderr);
+   if (prof.trace) {
+      fprintf(prof.trace, "\n]}\n");
+      if (fclose(prof.trace)) fprintf(stderr, "Writing the trace failed\n");
+      prof.trace = NULL;
+   }
+   wavutil_set_trace(NULL, NULL);
+}
+
+/*
+ * edits the header of the file without copying it. only the header
+ * fields that changed are written, so the cost does not depend on the
+ * size of the audio data. returns 0 on success and -1 on error.
+ */
+int edit_in_place(FILE *out, const char *path, const struct wav_options *opts, const char *backup,
+                  const struct wavutil_prefetch *pre, uint64_t *bytes) {
+   wavutil_info info;
+   wavutil_header edited;
+   struct wavutil_map head = {0};
+   int ret = -1;
+
+   phase_begin(PHASE_OPEN);
+   int fd = pre ? pre->fd : open(path, O_RDWR);
+   phase_end(PHASE_OPEN, 0);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      return -1;
+   }
+   if (pre) wavutil_prefetch_map(pre, &head);
+
+   phase_begin(PHASE_READ);
+   if (wavutil_read(fd, &head, &info)) {
+      phase_end(PHASE_READ, 0);
+      close(fd);
+      return -1;
+   }
+   phase_end(PHASE_READ, info.data_offset);
+   *bytes += info.file_size;
+
+   phase_begin(PHASE_VERIFY);
+   int invalid = wavutil_verify(opts->format == FORMAT_TEXT ? out : stderr, &info);
+   phase_end(PHASE_VERIFY, 0);
+   if (invalid) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+      report(out, opts, path, &info, 0);
+      goto done;
    }
 
-   /* read a chunk of data from the original file */
-   size_t data_bytes;
-   int num_blocks = 0;
-   while ((bytes = fread(data, sizeof(uint8_t), BLOCK, original)) > 0) {
-      num_blocks++;
+   edited = info.header;
+   if (apply_edits(&edited, opts)) {
+      goto done;
+   }
+
+   wavutil_info shown = info;
+   shown.header = edited;
+   phase_begin(PHASE_PRINT);
+   report(out, opts, path, &shown, 1);
+   phase_end(PHASE_PRINT, 0);
+
+   if (!memcmp(&info.header, &edited, HEADER_SIZE)) {
+      ret = 0;
+      goto done;
+   }
+
+   phase_begin(PHASE_PATCH);
+   if (backup && wavutil_backup(backup, fd, &info)) {
+      phase_end(PHASE_PATCH, 0);
+      goto done;
+   }
+
+   ssize_t patched = wavutil_patch(fd, &info, &edited);
+   if (patched < 0 || fsync(fd) < 0) {
+      phase_end(PHASE_PATCH, 0);
+      fprintf(stderr, "Patching the header of %s failed: %s\n", path, strerror(errno));
+      goto done;
+   }
+   phase_end(PHASE_PATCH, (uint64_t)patched);
 
-   #if (DEBUG)
-      fprintf(stderr, "Bytes read: %zu\n", bytes);
-   #endif
-      
-      /* write original audio data to the modified wav file */
-      if ((data_bytes = fwrite(data, sizeof(uint8_t), bytes, modified)) != bytes) {
-         fprintf(stderr, "Writing audio data to modified.wav failed. bytes written: %zu\n", data_bytes);
+#if (DEBUG)
+   fprintf(stderr, "%zd header bytes patched\n", patched);
+#endif
+   ret = 0;
+
+done:
+   phase_begin(PHASE_CLOSE);
+   wavutil_free(&info);
+   close(fd);
+   phase_end(PHASE_CLOSE, 0);
+   return ret;
+}
+
+/*
+ * copies the audio data of the original file once with every copy method
+ * and reports how fast each one was. the scratch file is removed after.
+ */
+void bench_copy(FILE* original, const wavutil_info *info, const struct wavutil_copy_options *copy) {
+   int in = fileno(original);
+   uint64_t len = info->file_size - info->data_offset;
+   off_t off = (off_t)info->data_offset;
+
+   printf("%-16s %12s %10s %10s\n", "method", "bytes", "seconds", "MB/s");
+   for (int m = WAVUTIL_COPY_FILE_RANGE; m < WAVUTIL_COPY_METHODS; m++) {
+      int out = open(bench_name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (out < 0) {
+         fprintf(stderr, "Failed to create %s\n", bench_name);
          exit(EXIT_FAILURE);
       }
+
+      double start = now_seconds();
+      struct wavutil_copy_options with = *copy;
+      with.method = (enum wavutil_copy_method)m;
+      int used = wavutil_copy_range(in, off, out, off, len, &with);
+      if (used >= 0) fsync(out);
+      double elapsed = now_seconds() - start;
+      close(out);
+
+      if (used < 0) {
+         printf("%-16s %12s (%s)\n", wavutil_copy_names[m], "unavailable", strerror(errno));
+         continue;
+      }
+      printf("%-16s %12llu %10.4f %10.1f\n", wavutil_copy_names[m], (unsigned long long)len,
+             elapsed, elapsed > 0 ? len / elapsed / 1e6 : 0.0);
    }
 
-   #if (DEBUG)
-      fprintf(stderr, "%d blocks read in\n", num_blocks);
-   #endif
+   unlink(bench_name);
 }
 
-int main(int argc, char **argv) {
+/*
+ * reads, verifies and prints one wav file, then writes the modified copy
+ * to output (when there is one) or patches the file in place. everything
+ * meant for the user goes to out and the file size is added to *bytes.
+ * returns 0 on success and -1 on error.
+ */
+int process_file(FILE *out, const char *path, const char *output, const char *backup,
+                 const struct wav_options *opts, const struct wavutil_prefetch *pre,
+                 uint64_t *bytes) {
    FILE *original;
-   wav_header header;
+   wavutil_info info;
+   struct wavutil_map map = {0};
+   struct wavutil_map head = {0};
+   int ret = -1;
 
-   /* check command line usage */
-   if (argc == 1) {
-      printf("please provide a file: ./wav-util <filename|path>\n");
-      exit(EXIT_FAILURE);
-   }
-   else if (argc > 2) {
-      printf("too many arguments: ./wav-util <filename|path>\n");
-      exit(EXIT_FAILURE);
+   /* patch the header of the file itself, no copy is made */
+   if (opts->in_place) {
+      return edit_in_place(out, path, opts, backup, pre, bytes);
    }
 
-   /* try to open the file */
-   if (!(original = fopen(argv[1], "rb"))) {
-      fprintf(stderr, "failed to open file: %s\n", argv[1]);
-      exit(EXIT_FAILURE);
+   /* try to open the file, unless it was opened ahead of time */
+   phase_begin(PHASE_OPEN);
+   original = pre ? fdopen(pre->fd, "rb") : fopen(path, "rb");
+   phase_end(PHASE_OPEN, 0);
+   if (!original) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      if (pre) close(pre->fd);
+      return -1;
    }
 
    /* try to read in the header */
-   size_t header_read = fread(&header, HEADER_SIZE, 1, original);
-   if (header_read < 1) {
-      fprintf(stderr, "reading file header failed. bytes read: %zu\n", header_read);
-      exit(EXIT_FAILURE);
+   phase_begin(PHASE_READ);
+   if (opts->use_mmap && wavutil_map(fileno(original), &map)) {
+      phase_end(PHASE_READ, 0);
+      fclose(original);
+      return -1;
    }
+   if (pre && !opts->use_mmap) wavutil_prefetch_map(pre, &head);
+   if (wavutil_read(fileno(original), opts->use_mmap ? &map : &head, &info)) {
+      phase_end(PHASE_READ, 0);
+      wavutil_unmap(&map);
+      fclose(original);
+      return -1;
+   }
+   phase_end(PHASE_READ, info.data_offset);
+   *bytes += info.file_size;
 
    /* check to make sure the file is a wav file */
-   if (verify_file(&header)) {
-      fprintf(stderr, "Input file could not be verified\n");
-      exit(EXIT_FAILURE);
+   phase_begin(PHASE_VERIFY);
+   int invalid = wavutil_verify(opts->format == FORMAT_TEXT ? out : stderr, &info);
+   phase_end(PHASE_VERIFY, 0);
+   if (invalid) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+      report(out, opts, path, &info, 0);
+      goto done;
    }
 
-   /* print the header information */
-   print(&header);
+   /* the audio data inside the mapping */
+   if (opts->use_mmap) {
+      map.data = map.base + info.data_offset;
+      map.data_size = (size_t)info.data_size;
+   }
 
-   // TODO: edit header here
+   /* apply the edits from the command line */
+   wavutil_header edited = info.header;
+   if (apply_edits(&edited, opts)) {
+      goto done;
+   }
+
+   /* print the header information */
+   wavutil_info shown = info;
+   shown.header = edited;
+   phase_begin(PHASE_PRINT);
+   report(out, opts, path, &shown, 1);
+   phase_end(PHASE_PRINT, 0);
 
-   /* create the modified file with the altered header data */
-   FILE *modified = create_file(modified_name, header);
+   if (output == NULL) {
+      ret = 0;
+      goto done;
+   }
 
-   /* write the audio data to the new files */
-   write_data(header, original, modified);
+   /* write the modified file with the altered header data */
+   double start = now_seconds();
+   int used = wavutil_write(output, fileno(original), &info, &edited, opts->strategy,
+                            opts->copy, opts->use_mmap ? &map : NULL);
+   if (used < 0) {
+      goto done;
+   }
+   if (opts->timing) {
+      fprintf(stderr, "%s: %s in %.3f ms\n", output, wavutil_output_names[used],
+              (now_seconds() - start) * 1e3);
+   }
+   ret = 0;
 
-   /* close the modified file */
-   fclose(modified);
-   
+done:
    /* close the original file */
+   phase_begin(PHASE_CLOSE);
+   wavutil_free(&info);
+   wavutil_unmap(&map);
    fclose(original);
+   phase_end(PHASE_CLOSE, 0);
+
+   return ret;
+}
+
+/* the state shared by the worker threads of a batch run */
+struct batch {
+   char **paths;
+   size_t count;
+   const struct wav_options *opts;
+
+   pthread_mutex_t lock;
+   pthread_cond_t finished;
+   size_t next;            /* next file to hand to a worker */
+   size_t group;           /* files handed out at a time */
+   char **results;         /* ordered output waiting to be printed */
+   size_t *result_lens;
+   int *done;
+   size_t failed;
+   uint64_t bytes;
+   struct emitter emit;
+};
+
+/*
+ * joins a directory and the last part of path into a new string
+ */
+static char *output_path(const char *dir, const char *path) {
+   char *copy = strdup(path);
+   char *joined = NULL;
+   if (copy && asprintf(&joined, "%s/%s", dir, basename(copy)) < 0) {
+      joined = NULL;
+   }
+   free(copy);
+   return joined;
+}
+
+/*
+ * runs file i through process_file and hands over its output. the output
+ * is collected in a memory stream, so the workers never interleave lines,
+ * and is either printed right away (unordered) or handed to the main
+ * thread to print in the order the files were given.
+ */
+static void batch_file(struct batch *b, size_t i, const struct wavutil_prefetch *pre) {
+   char *buf = NULL;
+   size_t len = 0;
+   uint64_t bytes = 0;
+   int ret = -1;
+   char *output = NULL;
+   char *backup = NULL;
+
+   FILE *out = open_memstream(&buf, &len);
+   if (out) {
+      if (b->opts->format == FORMAT_TEXT) fprintf(out, "==> %s <==\n", b->paths[i]);
+      if (b->opts->output_dir && !(output = output_path(b->opts->output_dir, b->paths[i]))) {
+         fprintf(stderr, "Output path allocation failed\n");
+      }
+      else if (b->opts->backup && asprintf(&backup, "%s%s", b->paths[i], b->opts->backup) < 0) {
+         backup = NULL;
+         fprintf(stderr, "Backup path allocation failed\n");
+      }
+      else {
+         double start = profile_file_begin();
+         ret = process_file(out, b->paths[i], output, backup, b->opts, pre, &bytes);
+         profile_file_end(b->paths[i], start, bytes);
+         pre = NULL;
+      }
+      fclose(out);
+   }
+   if (pre) close(pre->fd);
+   free(output);
+   free(backup);
+
+   pthread_mutex_lock(&b->lock);
+   b->bytes += bytes;
+   if (ret) b->failed++;
+   if (b->opts->unordered) {
+      if (buf) emit_record(&b->emit, buf, len);
+      free(buf);
+   }
+   else {
+      b->results[i] = buf;
+      b->result_lens[i] = len;
+      b->done[i] = 1;
+      pthread_cond_broadcast(&b->finished);
+   }
+   pthread_mutex_unlock(&b->lock);
+}
+
+/*
+ * a worker takes files off the list until there are none left. with
+ * --uring it takes a group at a time and opens them and reads their
+ * headers in one batch first; any file the batch could not open goes
+ * through the normal path, which reports the error.
+ */
+static void *batch_worker(void *arg) {
+   struct batch *b = (struct batch *)arg;
+   struct wavutil_prefetch pre[URING_BATCH];
+   uint8_t *heads = NULL;
+   struct wavutil_ring *ring = NULL;
+   profile_thread_begin("worker");
+   if (b->opts->uring && posix_memalign((void **)&heads, (size_t)sysconf(_SC_PAGESIZE),
+                                        URING_BATCH * WAVUTIL_HEAD_SIZE) == 0) {
+      if (!(ring = wavutil_ring_open(URING_BATCH))) {
+         fprintf(stderr, "io_uring unavailable, opening files one at a time: %s\n", strerror(errno));
+      }
+   }
+
+   for (;;) {
+      pthread_mutex_lock(&b->lock);
+      size_t first = b->next;
+      size_t n = first < b->count ? b->count - first : 0;
+      if (n > b->group) n = b->group;
+      b->next += n;
+      pthread_mutex_unlock(&b->lock);
+      if (n == 0) break;
+
+      if (ring && wavutil_prefetch(ring, b->paths + first, n,
+                                   b->opts->in_place ? O_RDWR : O_RDONLY, heads, pre)) {
+         fprintf(stderr, "io_uring failed, opening files one at a time: %s\n", strerror(errno));
+         wavutil_ring_close(ring);
+         ring = NULL;
+      }
+      for (size_t k = 0; k < n; k++) {
+         batch_file(b, first + k, ring && pre[k].fd >= 0 ? &pre[k] : NULL);
+      }
+   }
+
+   wavutil_ring_close(ring);
+   free(heads);
+
+   /* the copy buffer belongs to this thread */
+   wavutil_thread_done();
+   profile_thread_end();
+
+   return NULL;
+}
+
+/*
+ * runs every file through process_file on a fixed pool of worker threads
+ * and reports the throughput at the end. returns the number of files that
+ * failed.
+ */
+size_t run_batch(char **paths, size_t count, const struct wav_options *opts) {
+   struct batch b = {0};
+   int jobs = opts->jobs > 0 ? opts->jobs : 1;
+   if ((size_t)jobs > count) jobs = count ? (int)count : 1;
+
+   b.paths = paths;
+   b.count = count;
+   b.opts = opts;
+   b.emit.out = stdout;
+   b.emit.format = opts->format;
+   b.group = 1;
+   if (opts->uring) {
+      /* big enough to batch, small enough to keep every worker busy */
+      b.group = count / (size_t)jobs;
+      if (b.group > URING_BATCH) b.group = URING_BATCH;
+      if (b.group < 1) b.group = 1;
+   }
+   pthread_mutex_init(&b.lock, NULL);
+   pthread_cond_init(&b.finished, NULL);
+   b.results = calloc(count ? count : 1, sizeof(char *));
+   b.result_lens = calloc(count ? count : 1, sizeof(size_t));
+   b.done = calloc(count ? count : 1, sizeof(int));
+   pthread_t *threads = calloc((size_t)jobs, sizeof(pthread_t));
+   if (!b.results || !b.result_lens || !b.done || !threads) {
+      fprintf(stderr, "Batch allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+
+   emit_begin(&b.emit);
+   double start = now_seconds();
+   int started = 0;
+   for (; started < jobs; started++) {
+      if (pthread_create(&threads[started], NULL, batch_worker, &b)) {
+         break;
+      }
+   }
+   if (started == 0) {
+      fprintf(stderr, "Could not start any worker threads\n");
+      exit(EXIT_FAILURE);
+   }
+
+   /* print the results in order as soon as each one is ready */
+   if (!opts->unordered) {
+      for (size_t i = 0; i < count; i++) {
+         pthread_mutex_lock(&b.lock);
+         while (!b.done[i]) {
+            pthread_cond_wait(&b.finished, &b.lock);
+         }
+         pthread_mutex_unlock(&b.lock);
+
+         if (b.results[i]) emit_record(&b.emit, b.results[i], b.result_lens[i]);
+         free(b.results[i]);
+      }
+   }
+
+   for (int t = 0; t < started; t++) {
+      pthread_join(threads[t], NULL);
+   }
+   double elapsed = now_seconds() - start;
+   emit_end(&b.emit);
+
+   fprintf(stderr, "%zu files (%zu failed) with %d threads in %.3f s: %.1f files/s, %.1f MB/s\n",
+           count, b.failed, started, elapsed,
+           elapsed > 0 ? count / elapsed : 0.0,
+           elapsed > 0 ? b.bytes / elapsed / 1e6 : 0.0);
+
+   free(threads);
+   free(b.results);
+   free(b.result_lens);
+   free(b.done);
+   pthread_cond_destroy(&b.finished);
+   pthread_mutex_destroy(&b.lock);
+
+   return b.failed;
+}
+
+/*
+ * adds every line of stdin to the list of paths
+ */
+static void read_path_list(char ***paths, size_t *count, size_t *cap) {
+   char *line = NULL;
+   size_t line_cap = 0;
+   ssize_t n;
+
+   while ((n = getline(&line, &line_cap, stdin)) > 0) {
+      if (line[n - 1] == '\n') line[--n] = '\0';
+      if (n == 0) continue;
+
+      if (*count == *cap) {
+         *cap = *cap ? *cap * 2 : 64;
+         char **grown = realloc(*paths, *cap * sizeof(char *));
+         if (grown == NULL) {
+            fprintf(stderr, "Path list allocation failed\n");
+            exit(EXIT_FAILURE);
+         }
+         *paths = grown;
+      }
+      if (((*paths)[(*count)++] = strdup(line)) == NULL) {
+         fprintf(stderr, "Path list allocation failed\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   free(line);
+}
+
+/*
+ * one file in the scan cache. the key is (dev, ino) and the entry is only
+ * used when mtime and size still match, otherwise the file is parsed again.
+ */
+struct cache_record {
+   uint64_t dev;
+   uint64_t ino;
+   int64_t mtime_sec;
+   int64_t mtime_nsec;
+   uint64_t size;
+   uint64_t riff_size;
+   uint64_t data_offset;
+   uint64_t data_size;
+   uint32_t num_chunks;
+   uint32_t valid;           /* passed wavutil_verify */
+   wavutil_header header;
+   uint32_t pad;
+};
+
+/* an open addressing hash table of cache records */
+struct scan_cache {
+   struct cache_record *slots;
+   uint8_t *used;
+   size_t cap;               /* always a power of two */
+   size_t count;
+};
+
+struct scan_state {
+   struct scan_cache old;    /* what the last run found */
+   struct scan_cache now;    /* what this run found, saved at the end */
+   size_t files;
+   size_t cached;
+   size_t invalid;
+   size_t errors;            /* files that could not be opened or read */
+   uint64_t bytes;
+   FILE *quiet;              /* swallows what wavutil_verify has to say */
+   struct emitter emit;
+   struct strbuf line;       /* reused for every record */
+   /* called for every file instead of printing it when set */
+   void (*visit)(struct scan_state *state, const char *path, const struct cache_record *rec);
+   void *arg;
+};
+
+/* the kernel's directory entry for getdents64 */
+struct linux_dirent64 {
+   uint64_t d_ino;
+   int64_t d_off;
+   unsigned short d_reclen;
+   unsigned char d_type;
+   char d_name[];
+};
+
+#define DIRENT_BUF (64 * 1024)
+#define MAX_SCAN_DEPTH 64
+
+static size_t cache_hash(uint64_t dev, uint64_t ino) {
+   uint64_t h = (dev * 0x9E3779B97F4A7C15ull) ^ (ino * 0xC2B2AE3D27D4EB4Full);
+   return (size_t)(h ^ (h >> 29));
+}
+
+static struct cache_record *cache_find(const struct scan_cache *c, uint64_t dev, uint64_t ino) {
+   if (c->cap == 0) return NULL;
+   for (size_t i = cache_hash(dev, ino) & (c->cap - 1); c->used[i]; i = (i + 1) & (c->cap - 1)) {
+      if (c->slots[i].dev == dev && c->slots[i].ino == ino) {
+         return &c->slots[i];
+      }
+   }
+   return NULL;
+}
+
+static int cache_put(struct scan_cache *c, const struct cache_record *rec) {
+   /* keep the table at most half full */
+   if ((c->count + 1) * 2 > c->cap) {
+      struct scan_cache grown = {0};
+      grown.cap = c->cap ? c->cap * 2 : 1024;
+      grown.slots = calloc(grown.cap, sizeof(*grown.slots));
+      grown.used = calloc(grown.cap, 1);
+      if (!grown.slots || !grown.used) {
+         free(grown.slots);
+         free(grown.used);
+         return -1;
+      }
+      for (size_t i = 0; i < c->cap; i++) {
+         if (c->used[i]) cache_put(&grown, &c->slots[i]);
+      }
+      free(c->slots);
+      free(c->used);
+      *c = grown;
+   }
+
+   size_t i = cache_hash(rec->dev, rec->ino) & (c->cap - 1);
+   while (c->used[i] && !(c->slots[i].dev == rec->dev && c->slots[i].ino == rec->ino)) {
+      i = (i + 1) & (c->cap - 1);
+   }
+   if (!c->used[i]) c->count++;
+   c->used[i] = 1;
+   c->slots[i] = *rec;
+   return 0;
+}
+
+static void cache_free(struct scan_cache *c) {
+   free(c->slots);
+   free(c->used);
+   memset(c, 0, sizeof(*c));
+}
+
+/*
+ * loads the cache written by an earlier scan. a missing or unreadable
+ * cache is not an error, every file is simply parsed again.
+ */
+void load_cache(const char *name, struct scan_cache *c) {
+   char magic[WAVUTIL_ID_LEN];
+   uint32_t rec_size;
+   uint64_t count;
+
+   FILE *f = fopen(name, "rb");
+   if (f == NULL) return;
+
+   if (fread(magic, WAVUTIL_ID_LEN, 1, f) == 1 && !strncmp(magic, cache_magic, WAVUTIL_ID_LEN) &&
+       fread(&rec_size, sizeof(rec_size), 1, f) == 1 && rec_size == sizeof(struct cache_record) &&
+       fread(&count, sizeof(count), 1, f) == 1) {
+      struct cache_record rec;
+      for (uint64_t i = 0; i < count && fread(&rec, sizeof(rec), 1, f) == 1; i++) {
+         if (cache_put(c, &rec)) break;
+      }
+   }
+   else {
+      fprintf(stderr, "ignoring unrecognised cache file: %s\n", name);
+   }
+
+   fclose(f);
+}
+
+/*
+ * writes the records of this scan to a temporary file and renames it over
+ * the old cache, so an interrupted run never leaves a broken cache behind.
+ */
+int save_cache(const char *name, const struct scan_cache *c) {
+   char *tmp = NULL;
+   if (asprintf(&tmp, "%s.tmp", name) < 0) {
+      return -1;
+   }
+
+   FILE *f = fopen(tmp, "wb");
+   if (f == NULL) {
+      fprintf(stderr, "Failed to create %s\n", tmp);
+      free(tmp);
+      return -1;
+   }
+
+   uint32_t rec_size = sizeof(struct cache_record);
+   uint64_t count = c->count;
+   int ok = fwrite(cache_magic, WAVUTIL_ID_LEN, 1, f) == 1 &&
+            fwrite(&rec_size, sizeof(rec_size), 1, f) == 1 &&
+            fwrite(&count, sizeof(count), 1, f) == 1;
+   for (size_t i = 0; ok && i < c->cap; i++) {
+      if (c->used[i]) ok = fwrite(&c->slots[i], sizeof(c->slots[i]), 1, f) == 1;
+   }
+   if (fclose(f)) ok = 0;
+
+   if (!ok || rename(tmp, name)) {
+      fprintf(stderr, "Writing cache %s failed\n", name);
+      unlink(tmp);
+      free(tmp);
+      return -1;
+   }
+
+   free(tmp);
+   return 0;
+}
+
+/*
+ * parses the header of a file that is not in the cache (or has changed).
+ * returns -1 with errno set when the file could not be opened or read,
+ * which says nothing about whether it is a wav file.
+ */
+static int scan_parse(int dirfd, const char *name, const struct stat *st, struct cache_record *rec,
+                       FILE *quiet) {
+   wavutil_info info;
+
+   memset(rec, 0, sizeof(*rec));
+   rec->dev = (uint64_t)st->st_dev;
+   rec->ino = (uint64_t)st->st_ino;
+   rec->mtime_sec = (int64_t)st->st_mtim.tv_sec;
+   rec->mtime_nsec = (int64_t)st->st_mtim.tv_nsec;
+   rec->size = (uint64_t)st->st_size;
+
+   int fd = openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+   if (fd < 0) return -1;
+
+   /* a short read leaves errno alone: the file is too small to be a wav */
+   errno = 0;
+   if (wavutil_read(fd, NULL, &info) == 0) {
+      /* wavutil_verify reports problems, which a scan only counts */
+      rec->valid = wavutil_verify(quiet, &info) == 0;
+
+      rec->header = info.header;
+      rec->riff_size = info.riff_size;
+      rec->data_offset = info.data_offset;
+      rec->data_size = info.data >= 0 ? info.chunks[info.data].size : 0;
+      rec->num_chunks = (uint32_t)info.num_chunks;
+      wavutil_free(&info);
+   }
+   else if (errno) {
+      int saved = errno;
+      close(fd);
+      errno = saved;
+      return -1;
+   }
+   close(fd);
+   return 0;
+}
+
+/*
+ * prints one scanned file. text is one line per file, the other formats
+ * are the same records print() makes, minus the chunk list.
+ */
+static void scan_print(struct scan_state *state, const char *path, const struct cache_record *rec) {
+   struct strbuf *sb = &state->line;
+   sb->len = 0;
+
+   if (state->emit.format != FORMAT_TEXT) {
+      wavutil_info info = {0};
+      info.header = rec->header;
+      info.riff_size = rec->riff_size;
+      info.data_offset = rec->data_offset;
+      info.data_size = rec->data_size;
+      info.num_chunks = rec->num_chunks;
+      info.fmt = info.data = info.ds64 = -1;
+      format_record(sb, state->emit.format, path, &info, (int)rec->valid);
+   }
+   else if (!rec->valid) {
+      sb_printf(sb, "%s\tinvalid\n", path);
+   }
+   else {
+      const struct wavutil_fmt_chunk *f = &rec->header.f;
+      sb_printf(sb, "%s\t%.4s\tformat=%d channels=%d rate=%u bits=%d chunks=%u data=%" PRIu64 "\n",
+                path, rec->header.r.chunkID, f->audioFormat, f->numChannels, f->sampleRate,
+                f->bitsPerSample, rec->num_chunks, rec->data_size);
+   }
+
+   emit_record(&state->emit, sb->data, sb->len);
+}
+
+static int has_wav_suffix(const char *name) {
+   size_t len = strlen(name);
+   return len > 4 && !strcasecmp(name + len - 4, ".wav");
+}
+
+/*
+ * looks one file up in the cache, parses it when it is not there (or has
+ * changed) and hands it to the visitor, or prints it
+ */
+static void scan_file(int dirfd, const char *name, const char *path, const struct stat *st,
+                      struct scan_state *state) {
+   struct cache_record rec;
+   const struct cache_record *hit = cache_find(&state->old, (uint64_t)st->st_dev,
+                                               (uint64_t)st->st_ino);
+   if (hit && hit->mtime_sec == (int64_t)st->st_mtim.tv_sec &&
+       hit->mtime_nsec == (int64_t)st->st_mtim.tv_nsec && hit->size == (uint64_t)st->st_size) {
+      rec = *hit;
+      state->cached++;
+   }
+   else {
+      /* not cached either, so it is looked at again once it can be read */
+      if (scan_parse(dirfd, name, st, &rec, state->quiet)) {
+         fprintf(stderr, "%s: %s\n", path, strerror(errno));
+         state->errors++;
+         return;
+      }
+      state->bytes += rec.size;
+   }
+
+   state->files++;
+   if (!rec.valid) state->invalid++;
+   if (state->visit) state->visit(state, path, &rec);
+   else scan_print(state, path, &rec);
+   if (cache_put(&state->now, &rec)) {
+      fprintf(stderr, "Cache allocation failed\n");
+   }
+}
+
+/*
+ * walks one directory with getdents64, descending with openat so no path
+ * is ever resolved from the root again. path is only used for output.
+ */
+static void scan_dir(int dirfd, const char *path, struct scan_state *state, int depth) {
+   if (depth > MAX_SCAN_DEPTH) {
+      fprintf(stderr, "%s: too deep, skipped\n", path);
+      return;
+   }
+
+   /* each level needs its own buffer, the parent's is still being walked */
+   char *buf = malloc(DIRENT_BUF);
+   if (buf == NULL) {
+      fprintf(stderr, "Directory buffer allocation failed\n");
+      return;
+   }
+
+   for (;;) {
+      long n = syscall(SYS_getdents64, dirfd, buf, DIRENT_BUF);
+      if (n < 0) {
+         fprintf(stderr, "%s: reading directory failed: %s\n", path, strerror(errno));
+         break;
+      }
+      if (n == 0) break;
+
+      for (long pos = 0; pos < n; ) {
+         struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+         pos += d->d_reclen;
+
+         const char *name = d->d_name;
+         if (!strcmp(name, ".") || !strcmp(name, "..")) continue;
+         if (d->d_type != DT_DIR && d->d_type != DT_UNKNOWN &&
+             (d->d_type != DT_REG || !has_wav_suffix(name))) {
+            continue;
+         }
+
+         struct stat st;
+         if (fstatat(dirfd, name, &st, AT_SYMLINK_NOFOLLOW) < 0) continue;
+
+         char *child = NULL;
+         if (asprintf(&child, "%s/%s", path, name) < 0) continue;
+
+         if (S_ISDIR(st.st_mode)) {
+            int sub = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (sub >= 0) {
+               scan_dir(sub, child, state, depth + 1);
+               close(sub);
+            }
+         }
+         else if (S_ISREG(st.st_mode) && has_wav_suffix(name)) {
+            scan_file(dirfd, name, child, &st, state);
+         }
+         free(child);
+      }
+   }
+
+   free(buf);
+}
+
+/*
+ * scans every directory for wav files. files whose (dev, inode, mtime,
+ * size) match the cache from the last run are not opened at all.
+ * returns the number of invalid or unreadable files.
+ */
+size_t run_scan(char **dirs, size_t count, const char *cache_name, enum output_format format) {
+   struct scan_state state = {0};
+
+   state.emit.out = stdout;
+   state.emit.format = format;
+   emit_begin(&state.emit);
+
+   if (cache_name) {
+      load_cache(cache_name, &state.old);
+   }
+   if ((state.quiet = fopen("/dev/null", "w")) == NULL) {
+      fprintf(stderr, "failed to open /dev/null\n");
+      exit(EXIT_FAILURE);
+   }
+
+   double start = now_seconds();
+   for (size_t i = 0; i < count; i++) {
+      int fd = open(dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      if (fd < 0) {
+         fprintf(stderr, "failed to open directory: %s\n", dirs[i]);
+         state.errors++;
+         continue;
+      }
+      scan_dir(fd, dirs[i], &state, 0);
+      close(fd);
+   }
+   double elapsed = now_seconds() - start;
+   emit_end(&state.emit);
+
+   if (cache_name) {
+      save_cache(cache_name, &state.now);
+   }
+
+   fprintf(stderr, "%zu files (%zu cached, %zu invalid, %zu unreadable) in %.3f s: %.1f files/s, "
+           "%.1f MB in new or changed files\n",
+           state.files, state.cached, state.invalid, state.errors, elapsed,
+           elapsed > 0 ? state.files / elapsed : 0.0, state.bytes / 1e6);
+
+   fclose(state.quiet);
+   free(state.line.data);
+   cache_free(&state.old);
+   cache_free(&state.now);
+   return state.invalid + state.errors;
+}
+
+/*
+ * prints how to use the program
+ */
+void usage(FILE *out) {
+   fprintf(out, "usage: ./wav-util [options] <filename|path>\n");
+   fprintf(out, "       ./wav-util [options] <filename|path>... (or - to read paths from stdin)\n");
+   fprintf(out, "  -s, --set FIELD=VALUE  edit a fmt field (ex: sampleRate=48000)\n");
+   fprintf(out, "  -i, --in-place         edit the file itself instead of writing %s\n", modified_name);
+   fprintf(out, "      --backup=FILE      save the original header before editing in place\n");
+   fprintf(out, "                         (in batch mode FILE is a suffix added to each path)\n");
+   fprintf(out, "  -S, --strategy=NAME    how to write %s: auto, reflink or copy\n", modified_name);
+   fprintf(out, "  -m, --mmap             read the file through a memory mapping\n");
+   fprintf(out, "  -c, --copy=METHOD      auto, copy_file_range, sendfile, splice, io_uring,\n");
+   fprintf(out, "                         buffered or pipeline (separate reader and writer threads)\n");
+   fprintf(out, "      --direct           copy with O_DIRECT and drop both files from the page cache\n");
+   fprintf(out, "      --block-size=SIZE  copy buffer size (ex: 4M, default probed), or auto to tune it\n");
+   fprintf(out, "      --pipeline-depth=N number of pipeline buffers (default 4)\n");
+   fprintf(out, "  -t, --timing           report how long writing took and which path was used\n");
+   fprintf(out, "  -f, --format=FORMAT    text, json, ndjson or csv\n");
+   fprintf(out, "  -j, --jobs=N           batch mode: number of worker threads\n");
+   fprintf(out, "  -o, --output-dir=DIR   batch mode: write modified files into DIR\n");
+   fprintf(out, "  -u, --unordered        batch mode: print results as soon as they are ready\n");
+   fprintf(out, "      --uring            batch mode: open files and read headers with io_uring\n");
+   fprintf(out, "      --scan=DIR         list every wav file under DIR (can be repeated)\n");
+   fprintf(out, "      --cache=FILE       scan mode: reuse and update parsed headers in FILE\n");
+   fprintf(out, "      --bench-copy       time every copy method on the file's audio data\n");
+   fprintf(out, "      --stats[=perf]     report time per phase, bytes and system calls on stderr,\n");
+   fprintf(out, "                         with perf the cycle, cache and fault counters too\n");
+   fprintf(out, "      --trace=FILE       write a Chrome trace (chrome://tracing, Perfetto) to FILE\n");
+   fprintf(out, "  -h, --help             show this message\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util convert --to=FORMAT [options] <filename|path>\n");
+   fprintf(out, "      --to=FORMAT        u8, s16, s24, s32 (integer PCM), f32 or f64 (IEEE float)\n");
+   fprintf(out, "  -o, --output=FILE      where the converted copy goes (default %s)\n", modified_name);
+   fprintf(out, "  -m, --mmap             read the samples through a memory mapping\n");
+   fprintf(out, "  -t, --timing           report the kernels used and the throughput\n");
+   fprintf(out, "      --simd=NAME        force avx2, sse4.1, neon or scalar kernels\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util stats [options] <filename|path>...\n");
+   fprintf(out, "  -f, --format=FORMAT    text, json, ndjson or csv\n");
+   fprintf(out, "  -j, --jobs=N           threads per file (default: one per CPU for big files)\n");
+   fprintf(out, "  -m, --mmap             read the samples through a memory mapping\n");
+   fprintf(out, "      --simd=NAME        force avx2 or scalar reductions\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util loudness [options] <filename|path>...\n");
+   fprintf(out, "  -f, --format=FORMAT    text, json, ndjson or csv\n");
+   fprintf(out, "  -j, --jobs=N           threads per file, channels are split between them\n");
+   fprintf(out, "  -m, --mmap             read the samples through a memory mapping\n");
+   fprintf(out, "      --simd=NAME        force avx2 or scalar filters\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util hash [options] <filename|path>...\n");
+   fprintf(out, "  -a, --algorithm=NAME   md5 (default), xxh3 or blake3\n");
+   fprintf(out, "  -f, --format=FORMAT    text, json, ndjson or csv\n");
+   fprintf(out, "  -j, --jobs=N           blake3 threads per file (default: one per CPU)\n");
+   fprintf(out, "  -m, --mmap             read the audio data through a memory mapping\n");
+   fprintf(out, "      --simd=NAME        force avx2 or scalar kernels\n");
+   fprintf(out, "      --bench            time every algorithm on each file's audio data\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util dedup [options] <dir|filename>...\n");
+   fprintf(out, "  -f, --format=FORMAT    text, json, ndjson or csv\n");
+   fprintf(out, "  -j, --jobs=N           files hashed at once (default: one per CPU)\n");
+   fprintf(out, "      --cache=FILE       reuse and update parsed headers in FILE\n");
+   fprintf(out, "  -l, --link=METHOD      replace duplicates: hardlink (identical files) or\n");
+   fprintf(out, "                         reflink (share the audio data, keep each header; whole\n");
+   fprintf(out, "                         blocks only, so the data must start at the same offset\n");
+   fprintf(out, "                         within a filesystem block in both files, otherwise the\n");
+   fprintf(out, "                         copy is reported as misaligned and left alone)\n");
+   fprintf(out, "  -n, --dry-run          check what --link would do without doing it\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util split-channels [options] <filename|path>\n");
+   fprintf(out, "       ./wav-util extract-channels --channels=LIST [options] <filename|path>\n");
+   fprintf(out, "       ./wav-util interleave [options] <filename|path>...\n");
+   fprintf(out, "  -c, --channels=LIST    extract: 1 based channels in output order, ex: 3-4 or 1,2,6\n");
+   fprintf(out, "  -g, --group=N          split: channels per output file (default 1)\n");
+   fprintf(out, "  -o, --output=FILE      where the output goes (default %s); split: the\n", modified_name);
+   fprintf(out, "                         start of each file name (default the input's, ex: song_)\n");
+   fprintf(out, "  -m, --mmap             read the samples through a memory mapping\n");
+   fprintf(out, "  -t, --timing           report the kernels used and the throughput\n");
+   fprintf(out, "      --simd=NAME        force avx2 or scalar transposes\n");
+   fprintf(out, "\n");
+   fprintf(out, "       ./wav-util resample --rate=HZ [options] <filename|path>\n");
+   fprintf(out, "  -r, --rate=HZ          the new sample rate (ex: 48000)\n");
+   fprintf(out, "  -o, --output=FILE      where the resampled copy goes (default %s)\n", modified_name);
+   fprintf(out, "  -j, --jobs=N           threads per file, channels are split between them\n");
+   fprintf(out, "  -m, --mmap             read the samples through a memory mapping\n");
+   fprintf(out, "  -t, --timing           report the kernels used and the throughput\n");
+   fprintf(out, "      --simd=NAME        force avx2 or scalar filters\n");
+}
+
+/*
+ * looks up a copy method by name. returns -1 if there is no such method.
+ */
+int parse_copy_method(const char *name) {
+   for (int m = 0; m < WAVUTIL_COPY_METHODS; m++) {
+      if (!strcmp(name, wavutil_copy_names[m])) {
+         return m;
+      }
+   }
+   return -1;
+}
+
+/*
+ * the library only reports the tuned block size with --timing, the rest
+ * of the time it is printed once the run is over
+ */
+static void report_block_size(const struct wavutil_copy_options *copy) {
+   size_t tuned = __atomic_load_n(&copy->tuned, __ATOMIC_ACQUIRE);
+   if (copy->tune && tuned && !copy->report) {
+      fprintf(stderr, "block size tuned to %zu bytes\n", tuned);
+   }
+}
+
+/*
+ * parses a size like 4096, 64K or 8M. returns 0 if it is not a size.
+ */
+size_t parse_size(const char *str) {
+   char *end;
+   errno = 0;
+   unsigned long long v = strtoull(str, &end, 10);
+   if (errno || end == str || str[0] == '-') return 0;
+
+   switch (*end) {
+   case 'k': case 'K': v <<= 10; end++; break;
+   case 'm': case 'M': v <<= 20; end++; break;
+   case 'g': case 'G': v <<= 30; end++; break;
+   default: break;
+   }
+   return *end == '\0' && v <= SIZE_MAX ? (size_t)v : 0;
+}
+
+/*
+ * times the copy methods on one file instead of writing modified.wav
+ */
+int bench_file(const char *path, const struct wavutil_copy_options *copy) {
+   FILE *original;
+   wavutil_info info;
+
+   if (!(original = fopen(path, "rb"))) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      return -1;
+   }
+   if (wavutil_read(fileno(original), NULL, &info)) {
+      fclose(original);
+      return -1;
+   }
+   if (wavutil_verify(stdout, &info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+      wavutil_free(&info);
+      fclose(original);
+      return -1;
+   }
+
+   bench_copy(original, &info, copy);
+
+   wavutil_free(&info);
+   fclose(original);
+   return 0;
+}
+
+/*
+ * looks up a sample format by name. returns -1 if there is no such format.
+ */
+int parse_sample_format(const char *name) {
+   for (int f = WAVUTIL_SAMPLE_S16; f < WAVUTIL_SAMPLE_FORMATS; f++) {
+      if (!strcmp(name, wavutil_sample_names[f])) {
+         return f;
+      }
+   }
+   return -1;
+}
+
+/*
+ * writes a copy of path to output with its samples converted to format.
+ * returns 0 on success and -1 on error.
+ */
+int convert_file(const char *path, const char *output, enum wavutil_sample_format format,
+                 int use_mmap, int timing) {
+   struct wavutil_map map = {0};
+   wavutil_info info;
+   int ret = -1;
+
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      return -1;
+   }
+   if (use_mmap && wavutil_map(fd, &map)) {
+      close(fd);
+      return -1;
+   }
+   if (wavutil_read(fd, use_mmap ? &map : NULL, &info)) {
+      wavutil_unmap(&map);
+      close(fd);
+      return -1;
+   }
+
+   if (wavutil_verify(stderr, &info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+      goto done;
+   }
+
+   double start = now_seconds();
+   if (wavutil_convert(output, fd, &info, use_mmap ? &map : NULL, format, NULL)) {
+      goto done;
+   }
+   if (timing) {
+      double seconds = now_seconds() - start;
+      fprintf(stderr, "%s: %u bit to %s with %s kernels in %.3f ms (%.1f MB/s)\n", output,
+              info.header.f.bitsPerSample, wavutil_sample_names[format], wavutil_simd(),
+              seconds * 1e3, seconds > 0 ? info.data_size / seconds / 1e6 : 0);
+   }
+   ret = 0;
+
+done:
+   wavutil_free(&info);
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+/*
+ * ./wav-util convert --to=FORMAT [options] <filename|path>
+ */
+int convert_main(int argc, char **argv) {
+   const char *output = modified_name;
+   int format = -1, use_mmap = 0, timing = 0;
+
+   static const struct option options[] = {
+      {"to",         required_argument, NULL, 'T'},
+      {"output",     required_argument, NULL, 'o'},
+      {"mmap",       no_argument,       NULL, 'm'},
+      {"timing",     no_argument,       NULL, 't'},
+      {"simd",       required_argument, NULL, 'V'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "o:mth", options, NULL)) != -1) {
+      switch (opt) {
+      case 'T':
+         if ((format = parse_sample_format(optarg)) < 0) {
+            fprintf(stderr, "unknown sample format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'o':
+         output = optarg;
+         break;
+      case 'm':
+         use_mmap = 1;
+         break;
+      case 't':
+         timing = 1;
+         break;
+      case 'V':
+         if (wavutil_set_simd(optarg)) {
+            fprintf(stderr, "SIMD kernels not available: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (format < 0 || argc - optind != 1) {
+      printf("usage: ./wav-util convert --to=FORMAT [-o FILE] <filename|path>\n");
+      exit(EXIT_FAILURE);
+   }
+
+   return convert_file(argv[optind], output, (enum wavutil_sample_format)format, use_mmap, timing)
+             ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static const char *stats_columns =
+   "path,valid,channel,peak_dbfs,true_peak_dbtp,rms_dbfs,dc_offset,clips\n";
+
+/* a level in dB relative to full scale, -inf for silence */
+static double level_db(double v) {
+   return v > 0 ? 20 * log10(v) : -INFINITY;
+}
+
+/* JSON has no infinities, silence is null there */
+static void sb_db(struct strbuf *sb, double v, int json) {
+   double db = level_db(v);
+   if (isinf(db)) sb_printf(sb, json ? "null" : "-inf");
+   else sb_printf(sb, "%.2f", db);
+}
+
+/*
+ * formats the levels of one file like format_record formats its header.
+ * csv has a row per channel, json an array of channels.
+ */
+void format_stats(struct strbuf *sb, enum output_format format, const char *path,
+                  const struct wavutil_stats *st, int valid) {
+   int json = format == FORMAT_JSON || format == FORMAT_NDJSON;
+   const char *nl = format == FORMAT_JSON ? "\n" : "";
+   const char *in = format == FORMAT_JSON ? "  " : "";
+
+   switch (format) {
+   case FORMAT_TEXT:
+      if (!valid) break;
+      sb_printf(sb, "+-------+\n"
+                    "| STATS |\n"
+                    "+-------+\n");
+      sb_printf(sb, "File\t%s\n", path);
+      sb_printf(sb, "Frames\t%" PRIu64 "\n", st->frames);
+      sb_printf(sb, "Channel\tPeak dBFS\tTrue peak dBTP\tRMS dBFS\tDC offset\tClips\n");
+      for (unsigned c = 0; c < st->channels; c++) {
+         const struct wavutil_channel_stats *ch = &st->channel[c];
+         sb_printf(sb, "%u\t", c + 1);
+         sb_db(sb, ch->peak, 0);
+         sb_printf(sb, "\t\t");
+         sb_db(sb, ch->true_peak, 0);
+         sb_printf(sb, "\t\t");
+         sb_db(sb, ch->rms, 0);
+         sb_printf(sb, "\t\t%+.6f\t%" PRIu64 "\n", ch->dc, ch->clips);
+      }
+      break;
+   case FORMAT_JSON:
+   case FORMAT_NDJSON:
+      sb_printf(sb, "{%s%s\"path\": ", nl, in);
+      sb_json(sb, path, strlen(path));
+      sb_printf(sb, ",%s%s\"valid\": %s", nl, in, valid ? "true" : "false");
+      if (valid) {
+         sb_printf(sb, ",%s%s\"frames\": %" PRIu64 ",%s%s\"channels\": [", nl, in, st->frames,
+                   nl, in);
+         for (unsigned c = 0; c < st->channels; c++) {
+            const struct wavutil_channel_stats *ch = &st->channel[c];
+            sb_printf(sb, "%s{\"channel\": %u, \"peak_dbfs\": ", c ? ", " : "", c + 1);
+            sb_db(sb, ch->peak, json);
+            sb_printf(sb, ", \"true_peak_dbtp\": ");
+            sb_db(sb, ch->true_peak, json);
+            sb_printf(sb, ", \"rms_dbfs\": ");
+            sb_db(sb, ch->rms, json);
+            sb_printf(sb, ", \"dc_offset\": %.6f, \"clips\": %" PRIu64 "}", ch->dc, ch->clips);
+         }
+         sb_putc(sb, ']');
+      }
+      sb_printf(sb, "%s}", nl);
+      if (format == FORMAT_NDJSON) sb_putc(sb, '\n');
+      break;
+   case FORMAT_CSV:
+      if (!valid) {
+         sb_csv(sb, path, strlen(path));
+         sb_printf(sb, ",0,,,,,,\n");
+         break;
+      }
+      for (unsigned c = 0; c < st->channels; c++) {
+         const struct wavutil_channel_stats *ch = &st->channel[c];
+         sb_csv(sb, path, strlen(path));
+         sb_printf(sb, ",1,%u,", c + 1);
+         sb_db(sb, ch->peak, 0);
+         sb_putc(sb, ',');
+         sb_db(sb, ch->true_peak, 0);
+         sb_putc(sb, ',');
+         sb_db(sb, ch->rms, 0);
+         sb_printf(sb, ",%.6f,%" PRIu64 "\n", ch->dc, ch->clips);
+      }
+      break;
+   default:
+      break;
+   }
+}
+
+/*
+ * measures the levels of one file and formats them into sb.
+ * returns 0 on success and -1 on error.
+ */
+int stats_file(struct strbuf *sb, const char *path, enum output_format format, int threads,
+               int use_mmap) {
+   struct wavutil_map map = {0};
+   struct wavutil_stats st = {0};
+   wavutil_info info;
+   int ret = -1;
+
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      format_stats(sb, format, path, &st, 0);
+      return -1;
+   }
+   if (use_mmap && wavutil_map(fd, &map)) {
+      format_stats(sb, format, path, &st, 0);
+      close(fd);
+      return -1;
+   }
+   if (wavutil_read(fd, use_mmap ? &map : NULL, &info)) {
+      format_stats(sb, format, path, &st, 0);
+      wavutil_unmap(&map);
+      close(fd);
+      return -1;
+   }
+
+   if (wavutil_verify(stderr, &info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+   }
+   else if (wavutil_stats(fd, &info, use_mmap ? &map : NULL, threads, &st) == 0) {
+      ret = 0;
+   }
+   format_stats(sb, format, path, &st, ret == 0);
+
+   wavutil_stats_free(&st);
+   wavutil_free(&info);
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+static const char *loudness_columns =
+   "path,valid,integrated_lufs,range_lu,momentary_max_lufs,short_term_max_lufs\n";
+
+/* a loudness in LUFS or LU, null in JSON (-inf elsewhere) when there is none */
+static void sb_lufs(struct strbuf *sb, double v, int json) {
+   if (isinf(v)) sb_printf(sb, json ? "null" : "-inf");
+   else sb_printf(sb, "%.1f", v);
+}
+
+/* formats the loudness of one file like format_stats formats its levels */
+void format_loudness(struct strbuf *sb, enum output_format format, const char *path,
+                     const struct wavutil_loudness *l, int valid) {
+   int json = format == FORMAT_JSON || format == FORMAT_NDJSON;
+   const char *nl = format == FORMAT_JSON ? "\n" : "";
+   const char *in = format == FORMAT_JSON ? "  " : "";
+
+   switch (format) {
+   case FORMAT_TEXT:
+      if (!valid) break;
+      sb_printf(sb, "+----------+\n"
+                    "| LOUDNESS |\n"
+                    "+----------+\n");
+      sb_printf(sb, "File\t\t%s\n", path);
+      sb_printf(sb, "Integrated\t");
+      sb_lufs(sb, l->integrated, 0);
+      sb_printf(sb, " LUFS\nRange\t\t%.1f LU\nMomentary max\t", l->range);
+      sb_lufs(sb, l->momentary_max, 0);
+      sb_printf(sb, " LUFS\nShort term max\t");
+      sb_lufs(sb, l->short_term_max, 0);
+      sb_printf(sb, " LUFS\n");
+      break;
+   case FORMAT_JSON:
+   case FORMAT_NDJSON:
+      sb_printf(sb, "{%s%s\"path\": ", nl, in);
+      sb_json(sb, path, strlen(path));
+      sb_printf(sb, ",%s%s\"valid\": %s", nl, in, valid ? "true" : "false");
+      if (valid) {
+         sb_printf(sb, ",%s%s\"integrated_lufs\": ", nl, in);
+         sb_lufs(sb, l->integrated, json);
+         sb_printf(sb, ",%s%s\"range_lu\": %.1f", nl, in, l->range);
+         sb_printf(sb, ",%s%s\"momentary_max_lufs\": ", nl, in);
+         sb_lufs(sb, l->momentary_max, json);
+         sb_printf(sb, ",%s%s\"short_term_max_lufs\": ", nl, in);
+         sb_lufs(sb, l->short_term_max, json);
+      }
+      sb_printf(sb, "%s}", nl);
+      if (format == FORMAT_NDJSON) sb_putc(sb, '\n');
+      break;
+   case FORMAT_CSV:
+      sb_csv(sb, path, strlen(path));
+      if (!valid) {
+         sb_printf(sb, ",0,,,,\n");
+         break;
+      }
+      sb_printf(sb, ",1,");
+      sb_lufs(sb, l->integrated, 0);
+      sb_printf(sb, ",%.1f,", l->range);
+      sb_lufs(sb, l->momentary_max, 0);
+      sb_putc(sb, ',');
+      sb_lufs(sb, l->short_term_max, 0);
+      sb_putc(sb, '\n');
+      break;
+   default:
+      break;
+   }
+}
+
+/*
+ * measures the loudness of one file and formats it into sb.
+ * returns 0 on success and -1 on error.
+ */
+int loudness_file(struct strbuf *sb, const char *path, enum output_format format, int threads,
+                  int use_mmap) {
+   struct wavutil_map map = {0};
+   struct wavutil_loudness l = {0};
+   wavutil_info info;
+   int ret = -1;
+
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      format_loudness(sb, format, path, &l, 0);
+      return -1;
+   }
+   if (use_mmap && wavutil_map(fd, &map)) {
+      format_loudness(sb, format, path, &l, 0);
+      close(fd);
+      return -1;
+   }
+   if (wavutil_read(fd, use_mmap ? &map : NULL, &info)) {
+      format_loudness(sb, format, path, &l, 0);
+      wavutil_unmap(&map);
+      close(fd);
+      return -1;
+   }
+
+   if (wavutil_verify(stderr, &info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+   }
+   else if (wavutil_loudness(fd, &info, use_mmap ? &map : NULL, threads, &l) == 0) {
+      ret = 0;
+   }
+   format_loudness(sb, format, path, &l, ret == 0);
+
+   wavutil_free(&info);
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+typedef int (*measure_fn)(struct strbuf *sb, const char *path, enum output_format format,
+                          int threads, int use_mmap);
+
+/*
+ * ./wav-util stats [options] <filename|path>...
+ * ./wav-util loudness [options] <filename|path>...
+ */
+static int measure_main(int argc, char **argv, const char *columns, measure_fn measure) {
+   struct emitter emit = {0};
+   int threads = 0, use_mmap = 0;
+
+   emit.out = stdout;
+   emit.columns = columns;
+
+   static const struct option options[] = {
+      {"format",     required_argument, NULL, 'f'},
+      {"jobs",       required_argument, NULL, 'j'},
+      {"mmap",       no_argument,       NULL, 'm'},
+      {"simd",       required_argument, NULL, 'V'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "f:j:mh", options, NULL)) != -1) {
+      switch (opt) {
+      case 'f': {
+         int f = -1;
+         for (int i = 0; i < FORMATS; i++) {
+            if (!strcmp(optarg, format_names[i])) f = i;
+         }
+         if (f < 0) {
+            fprintf(stderr, "unknown output format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         emit.format = (enum output_format)f;
+         break;
+      }
+      case 'j':
+         if ((threads = atoi(optarg)) < 1) {
+            fprintf(stderr, "invalid number of jobs: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'm':
+         use_mmap = 1;
+         break;
+      case 'V':
+         if (wavutil_set_simd(optarg)) {
+            fprintf(stderr, "SIMD kernels not available: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (optind == argc) {
+      printf("usage: ./wav-util %s [options] <filename|path>...\n", argv[0]);
+      exit(EXIT_FAILURE);
+   }
+
+   size_t failed = 0;
+   emit_begin(&emit);
+   for (int i = optind; i < argc; i++) {
+      struct strbuf sb = {0};
+      if (measure(&sb, argv[i], emit.format, threads, use_mmap)) failed++;
+      emit_record(&emit, sb.data, sb.len);
+      free(sb.data);
+   }
+   emit_end(&emit);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static const char *hash_columns = "path,valid,algorithm,hash\n";
+
+/*
+ * formats the digest of one file: "<hex>  <path>" in text like md5sum,
+ * so the output of two runs can be compared with diff or sort | uniq
+ */
+void format_hash(struct strbuf *sb, enum output_format format, const char *path,
+                 enum wavutil_hash_algorithm algorithm, const uint8_t *digest, int valid) {
+   char hex[2 * WAVUTIL_HASH_MAX + 1] = "";
+   for (size_t i = 0; valid && i < wavutil_hash_size(algorithm); i++) {
+      snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+   }
+   const char *nl = format == FORMAT_JSON ? "\n" : "";
+   const char *in = format == FORMAT_JSON ? "  " : "";
+
+   switch (format) {
+   case FORMAT_TEXT:
+      if (valid) sb_printf(sb, "%s  %s\n", hex, path);
+      break;
+   case FORMAT_JSON:
+   case FORMAT_NDJSON:
+      sb_printf(sb, "{%s%s\"path\": ", nl, in);
+      sb_json(sb, path, strlen(path));
+      sb_printf(sb, ",%s%s\"valid\": %s", nl, in, valid ? "true" : "false");
+      if (valid) {
+         sb_printf(sb, ",%s%s\"algorithm\": \"%s\",%s%s\"hash\": \"%s\"", nl, in,
+                   wavutil_hash_names[algorithm], nl, in, hex);
+      }
+      sb_printf(sb, "%s}", nl);
+      if (format == FORMAT_NDJSON) sb_putc(sb, '\n');
+      break;
+   case FORMAT_CSV:
+      sb_csv(sb, path, strlen(path));
+      sb_printf(sb, ",%d,%s,%s\n", valid, valid ? wavutil_hash_names[algorithm] : "", hex);
+      break;
+   default:
+      break;
+   }
+}
+
+/*
+ * hashes the audio data of every algorithm, with the SIMD kernels picked
+ * for the CPU and without, and reports how fast each one was. the file
+ * is read once first so every run comes out of the page cache.
+ */
+void bench_hash(int fd, const wavutil_info *info, const struct wavutil_map *map, int threads) {
+   uint8_t digest[WAVUTIL_HASH_MAX];
+   const char *best = wavutil_simd();
+   const char *simd[] = { best, "scalar" };
+
+   wavutil_hash(fd, info, map, WAVUTIL_HASH_XXH3, threads, digest);
+   printf("%-8s %-8s %12s %10s %10s\n", "hash", "simd", "bytes", "seconds", "MB/s");
+   for (int a = WAVUTIL_HASH_MD5; a < WAVUTIL_HASH_ALGORITHMS; a++) {
+      for (int k = 0; k < 2; k++) {
+         if (k == 1 && (a == WAVUTIL_HASH_MD5 || !strcmp(best, "scalar"))) break;
+         wavutil_set_simd(simd[k]);
+         double start = now_seconds();
+         int ret = wavutil_hash(fd, info, map, (enum wavutil_hash_algorithm)a, threads, digest);
+         double elapsed = now_seconds() - start;
+         if (ret) {
+            printf("%-8s %-8s %12s (%s)\n", wavutil_hash_names[a], simd[k], "failed",
+                   strerror(errno));
+            continue;
+         }
+         printf("%-8s %-8s %12llu %10.4f %10.1f\n", wavutil_hash_names[a],
+                a == WAVUTIL_HASH_MD5 ? "-" : simd[k], (unsigned long long)info->data_size, elapsed,
+                elapsed > 0 ? info->data_size / elapsed / 1e6 : 0.0);
+      }
+   }
+   wavutil_set_simd(best);
+}
+
+/*
+ * hashes the audio data of one file (or benchmarks every algorithm on
+ * it) and formats the digest into sb. returns 0 on success and -1 on
+ * error.
+ */
+int hash_file(struct strbuf *sb, const char *path, enum output_format format,
+              enum wavutil_hash_algorithm algorithm, int threads, int use_mmap, int bench) {
+   struct wavutil_map map = {0};
+   uint8_t digest[WAVUTIL_HASH_MAX];
+   wavutil_info info;
+   int ret = -1;
+
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      format_hash(sb, format, path, algorithm, digest, 0);
+      return -1;
+   }
+   if (use_mmap && wavutil_map(fd, &map)) {
+      format_hash(sb, format, path, algorithm, digest, 0);
+      close(fd);
+      return -1;
+   }
+   if (wavutil_read(fd, use_mmap ? &map : NULL, &info)) {
+      format_hash(sb, format, path, algorithm, digest, 0);
+      wavutil_unmap(&map);
+      close(fd);
+      return -1;
+   }
+
+   if (wavutil_verify(stderr, &info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+   }
+   else if (bench) {
+      printf("%s\n", path);
+      bench_hash(fd, &info, use_mmap ? &map : NULL, threads);
+      ret = 0;
+   }
+   else if (wavutil_hash(fd, &info, use_mmap ? &map : NULL, algorithm, threads, digest) == 0) {
+      ret = 0;
+   }
+   if (!bench) format_hash(sb, format, path, algorithm, digest, ret == 0);
+
+   wavutil_free(&info);
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+/*
+ * ./wav-util hash [options] <filename|path>...
+ */
+int hash_main(int argc, char **argv) {
+   struct emitter emit = {0};
+   enum wavutil_hash_algorithm algorithm = WAVUTIL_HASH_MD5;
+   int threads = 0, use_mmap = 0, bench = 0;
+
+   emit.out = stdout;
+   emit.columns = hash_columns;
+
+   static const struct option options[] = {
+      {"algorithm",  required_argument, NULL, 'a'},
+      {"format",     required_argument, NULL, 'f'},
+      {"jobs",       required_argument, NULL, 'j'},
+      {"mmap",       no_argument,       NULL, 'm'},
+      {"simd",       required_argument, NULL, 'V'},
+      {"bench",      no_argument,       NULL, 'B'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "a:f:j:mh", options, NULL)) != -1) {
+      switch (opt) {
+      case 'a': {
+         int a = -1;
+         for (int i = 0; i < WAVUTIL_HASH_ALGORITHMS; i++) {
+            if (!strcmp(optarg, wavutil_hash_names[i])) a = i;
+         }
+         if (a < 0) {
+            fprintf(stderr, "unknown hash algorithm: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         algorithm = (enum wavutil_hash_algorithm)a;
+         break;
+      }
+      case 'f': {
+         int f = -1;
+         for (int i = 0; i < FORMATS; i++) {
+            if (!strcmp(optarg, format_names[i])) f = i;
+         }
+         if (f < 0) {
+            fprintf(stderr, "unknown output format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         emit.format = (enum output_format)f;
+         break;
+      }
+      case 'j':
+         if ((threads = atoi(optarg)) < 1) {
+            fprintf(stderr, "invalid number of jobs: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'm':
+         use_mmap = 1;
+         break;
+      case 'V':
+         if (wavutil_set_simd(optarg)) {
+            fprintf(stderr, "SIMD kernels not available: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'B':
+         bench = 1;
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (optind == argc) {
+      printf("usage: ./wav-util hash [options] <filename|path>...\n");
+      exit(EXIT_FAILURE);
+   }
+
+   size_t failed = 0;
+   if (!bench) emit_begin(&emit);
+   for (int i = optind; i < argc; i++) {
+      struct strbuf sb = {0};
+      if (hash_file(&sb, argv[i], emit.format, algorithm, threads, use_mmap, bench)) failed++;
+      if (!bench) emit_record(&emit, sb.data, sb.len);
+      free(sb.data);
+   }
+   if (!bench) emit_end(&emit);
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#define DEDUP_SAMPLE (64 * 1024) /* audio bytes hashed at each end of a file */
+
+/* how dedup replaces the copies it finds */
+enum dedup_link {
+   LINK_NONE,
+   LINK_HARDLINK,
+   LINK_REFLINK,
+   LINKS
+};
+
+const char *link_names[LINKS] = {
+   [LINK_NONE]     = "none",
+   [LINK_HARDLINK] = "hardlink",
+   [LINK_REFLINK]  = "reflink",
+};
+
+/* one file dedup is looking at */
+struct dedup_file {
+   char *path;
+   struct cache_record rec;
+   uint8_t sample[16];       /* xxh3 of the first and last DEDUP_SAMPLE bytes of audio */
+   uint8_t digest[32];       /* blake3 of all of it */
+   int hashed;               /* digest is set */
+   int failed;
+};
+
+struct dedup {
+   struct dedup_file *files;
+   size_t count;
+   size_t cap;
+
+   /* the files the workers hash in the current stage */
+   struct dedup_file **todo;
+   size_t todo_count;
+   int full;                 /* hash all of the audio, not just its ends */
+   int threads;              /* blake3 threads per file */
+   pthread_mutex_t lock;
+   size_t next;
+   uint64_t bytes_read;
+};
+
+/* the stages files are told apart by, each one reading more of them */
+enum dedup_stage {
+   STAGE_SIZE,               /* fmt chunk and data size, from the headers */
+   STAGE_SAMPLE,             /* the ends of the audio */
+   STAGE_FULL,               /* all of the audio */
+};
+
+#define DEDUP_CMP(x, y) do { if ((x) != (y)) return (x) < (y) ? -1 : 1; } while (0)
+
+/*
+ * orders two files by what is known of their audio by the given stage.
+ * equal files are duplicates as far as that stage can tell.
+ */
+static int dedup_key(const struct dedup_file *a, const struct dedup_file *b, enum dedup_stage stage) {
+   const struct wavutil_fmt_chunk *fa = &a->rec.header.f, *fb = &b->rec.header.f;
+   DEDUP_CMP(fa->audioFormat, fb->audioFormat);
+   DEDUP_CMP(fa->numChannels, fb->numChannels);
+   DEDUP_CMP(fa->sampleRate, fb->sampleRate);
+   DEDUP_CMP(fa->byteRate, fb->byteRate);
+   DEDUP_CMP(fa->blockAlign, fb->blockAlign);
+   DEDUP_CMP(fa->bitsPerSample, fb->bitsPerSample);
+   DEDUP_CMP(a->rec.data_size, b->rec.data_size);
+   if (stage >= STAGE_SAMPLE) {
+      int c = memcmp(a->sample, b->sample, sizeof(a->sample));
+      if (c) return c;
+   }
+   if (stage >= STAGE_FULL) {
+      int c = memcmp(a->digest, b->digest, sizeof(a->digest));
+      if (c) return c;
+   }
+   return 0;
+}
+
+static int same_inode(const struct dedup_file *a, const struct dedup_file *b) {
+   return a->rec.dev == b->rec.dev && a->rec.ino == b->rec.ino;
+}
+
+/* sorts by key, then inode so hard links of one file sit together */
+static int dedup_cmp(const void *pa, const void *pb, void *arg) {
+   const struct dedup_file *a = pa, *b = pb;
+   int c = dedup_key(a, b, *(const enum dedup_stage *)arg);
+   if (c) return c;
+   DEDUP_CMP(a->rec.dev, b->rec.dev);
+   DEDUP_CMP(a->rec.ino, b->rec.ino);
+   return strcmp(a->path, b->path);
+}
+
+static int dedup_path_cmp(const void *pa, const void *pb) {
+   return strcmp(((const struct dedup_file *)pa)->path, ((const struct dedup_file *)pb)->path);
+}
+
+/* end of the run of files from i that are equal at this stage */
+static size_t dedup_run(const struct dedup *d, size_t i, enum dedup_stage stage) {
+   size_t j = i + 1;
+   while (j < d->count && dedup_key(&d->files[i], &d->files[j], stage) == 0) j++;
+   return j;
+}
+
+/* counts the inodes among files [i, j), which are sorted by inode */
+static size_t dedup_inodes(const struct dedup *d, size_t i, size_t j) {
+   size_t n = 0;
+   for (size_t k = i; k < j; k++) {
+      if (k == i || !same_inode(&d->files[k], &d->files[k - 1])) n++;
+   }
+   return n;
+}
+
+/*
+ * drops the files that failed and the ones no other inode matches at
+ * this stage, leaving the candidates sorted by key and inode
+ */
+static void dedup_keep(struct dedup *d, enum dedup_stage stage) {
+   size_t kept = 0;
+   for (size_t i = 0; i < d->count; i++) {
+      if (d->files[i].failed) free(d->files[i].path);
+      else d->files[kept++] = d->files[i];
+   }
+   d->count = kept;
+
+   qsort_r(d->files, d->count, sizeof(*d->files), dedup_cmp, &stage);
+
+   kept = 0;
+   for (size_t i = 0, j; i < d->count; i = j) {
+      j = dedup_run(d, i, stage);
+      int keep = dedup_inodes(d, i, j) > 1;
+      for (size_t k = i; k < j; k++) {
+         /* a file named twice on the command line is only listed once */
+         if (keep && !(k > i && !strcmp(d->files[k].path, d->files[kept - 1].path))) {
+            d->files[kept++] = d->files[k];
+         }
+         else {
+            free(d->files[k].path);
+         }
+      }
+   }
+   d->count = kept;
+}
+
+/*
+ * hashes the ends of a file's audio, or all of it in the full stage.
+ * audio no longer than the two ends is hashed in full straight away.
+ */
+static void dedup_hash(struct dedup *d, struct dedup_file *f) {
+   uint64_t off = f->rec.data_offset, len = f->rec.data_size, bytes;
+   int ret;
+
+   int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", f->path);
+      f->failed = 1;
+      return;
+   }
+
+   if (d->full || len <= 2 * DEDUP_SAMPLE) {
+      ret = wavutil_hash_range(fd, NULL, off, len, WAVUTIL_HASH_BLAKE3, d->threads, f->digest);
+      memcpy(f->sample, f->digest, sizeof(f->sample));
+      f->hashed = ret == 0;
+      bytes = len;
+   }
+   else {
+      ret = wavutil_hash_range(fd, NULL, off, DEDUP_SAMPLE, WAVUTIL_HASH_XXH3, 1, f->sample);
+      if (ret == 0) {
+         ret = wavutil_hash_range(fd, NULL, off + len - DEDUP_SAMPLE, DEDUP_SAMPLE,
+                                  WAVUTIL_HASH_XXH3, 1, f->sample + 8);
+      }
+      bytes = 2 * DEDUP_SAMPLE;
+   }
+   if (ret) {
+      fprintf(stderr, "%s: hashing failed: %s\n", f->path, strerror(errno));
+      f->failed = 1;
+   }
+   close(fd);
+
+   pthread_mutex_lock(&d->lock);
+   d->bytes_read += bytes;
+   pthread_mutex_unlock(&d->lock);
+}
+
+static void *dedup_worker(void *arg) {
+   struct dedup *d = (struct dedup *)arg;
+   for (;;) {
+      pthread_mutex_lock(&d->lock);
+      size_t i = d->next++;
+      pthread_mutex_unlock(&d->lock);
+      if (i >= d->todo_count) break;
+      dedup_hash(d, d->todo[i]);
+   }
+   return NULL;
+}
+
+/*
+ * hashes one inode of every candidate across jobs threads and gives the
+ * result to its other links. a file whose audio was hashed in full in
+ * the sample stage is not read again.
+ */
+static int dedup_stage(struct dedup *d, int full, int jobs) {
+   d->todo_count = 0;
+   for (size_t k = 0; k < d->count; k++) {
+      struct dedup_file *f = &d->files[k];
+      if (k > 0 && same_inode(f, f - 1)) continue;
+      if (full && f->hashed) continue;
+      d->todo[d->todo_count++] = f;
+   }
+
+   size_t workers = d->todo_count < (size_t)jobs ? d->todo_count : (size_t)jobs;
+   d->threads = workers ? jobs / (int)workers : 1;
+   d->full = full;
+   d->next = 0;
+
+   pthread_t *tids = calloc(workers ? workers : 1, sizeof(pthread_t));
+   if (tids == NULL) {
+      fprintf(stderr, "Thread allocation failed\n");
+      return -1;
+   }
+   size_t started = 0;
+   while (started + 1 < workers &&
+          pthread_create(&tids[started], NULL, dedup_worker, d) == 0) {
+      started++;
+   }
+   dedup_worker(d);
+   for (size_t k = 0; k < started; k++) {
+      pthread_join(tids[k], NULL);
+   }
+   free(tids);
+
+   for (size_t k = 1; k < d->count; k++) {
+      struct dedup_file *f = &d->files[k];
+      if (!same_inode(f, f - 1)) continue;
+      memcpy(f->sample, f[-1].sample, sizeof(f->sample));
+      memcpy(f->digest, f[-1].digest, sizeof(f->digest));
+      f->hashed = f[-1].hashed;
+      f->failed = f[-1].failed;
+   }
+   return 0;
+}
+
+/* checks that an open file is still the one the scan saw */
+static int dedup_unchanged(int fd, const struct dedup_file *f) {
+   struct stat st;
+   return fstat(fd, &st) == 0 && (uint64_t)st.st_dev == f->rec.dev &&
+          (uint64_t)st.st_ino == f->rec.ino && (uint64_t)st.st_size == f->rec.size &&
+          (int64_t)st.st_mtim.tv_sec == f->rec.mtime_sec &&
+          (int64_t)st.st_mtim.tv_nsec == f->rec.mtime_nsec;
+}
+
+/*
+ * compares len bytes of two files. returns 1 when they are the same, 0
+ * when they differ and -1 on error.
+ */
+static int same_bytes(int a, int b, uint64_t off, uint64_t len) {
+   char x[64 * 1024], y[64 * 1024];
+   while (len > 0) {
+      size_t n = len < sizeof(x) ? (size_t)len : sizeof(x);
+      if (pread(a, x, n, (off_t)off) != (ssize_t)n || pread(b, y, n, (off_t)off) != (ssize_t)n) {
+         return -1;
+      }
+      if (memcmp(x, y, n)) return 0;
+      off += n;
+      len -= n;
+   }
+   return 1;
+}
+
+/*
+ * replaces f with a hard link to keep. only whole files can be linked, so
+ * the bytes around the audio (header and other chunks) are compared as
+ * well; the link is made under a temporary name and renamed over f.
+ */
+static const char *dedup_hardlink(const struct dedup_file *keep, const struct dedup_file *f,
+                                  int dry_run) {
+   const char *action = "failed";
+   if (keep->rec.dev != f->rec.dev) return "other filesystem";
+   if (keep->rec.size != f->rec.size || keep->rec.data_offset != f->rec.data_offset) {
+      return "headers differ";
+   }
+
+   int a = open(keep->path, O_RDONLY | O_CLOEXEC);
+   int b = open(f->path, O_RDONLY | O_CLOEXEC);
+   if (a < 0 || b < 0) {
+      fprintf(stderr, "failed to open file: %s\n", a < 0 ? keep->path : f->path);
+   }
+   else if (!dedup_unchanged(a, keep) || !dedup_unchanged(b, f)) {
+      action = "changed";
+   }
+   else {
+      uint64_t tail = f->rec.data_offset + f->rec.data_size;
+      int same = same_bytes(a, b, 0, f->rec.data_offset);
+      if (same == 1 && tail < f->rec.size) same = same_bytes(a, b, tail, f->rec.size - tail);
+      if (same < 0) {
+         fprintf(stderr, "%s: reading failed: %s\n", f->path, strerror(errno));
+      }
+      else if (same == 0) {
+         action = "headers differ";
+      }
+      else if (dry_run) {
+         action = "would link";
+      }
+      else {
+         char *tmp = NULL;
+         if (asprintf(&tmp, "%s.wav-util-link", f->path) < 0) tmp = NULL;
+         if (tmp && link(keep->path, tmp) == 0 && rename(tmp, f->path) == 0) {
+            action = "linked";
+         }
+         else {
+            fprintf(stderr, "%s: linking failed: %s\n", f->path, strerror(errno));
+            if (tmp) unlink(tmp);
+         }
+         free(tmp);
+      }
+   }
+
+   if (a >= 0) close(a);
+   if (b >= 0) close(b);
+   return action;
+}
+
+/*
+ * shares the audio data of f with keep's through the filesystem. each
+ * file keeps its own header, and the kernel checks the bytes match.
+ */
+static const char *dedup_reflink(const struct dedup_file *keep, const struct dedup_file *f,
+                                 int dry_run, uint64_t *shared) {
+   const char *action = "failed";
+   int a = open(keep->path, O_RDONLY | O_CLOEXEC);
+   int b = open(f->path, dry_run ? O_RDONLY | O_CLOEXEC : O_RDWR | O_CLOEXEC);
+   if (a < 0 || b < 0) {
+      fprintf(stderr, "failed to open file: %s\n", a < 0 ? keep->path : f->path);
+   }
+   else if (!dedup_unchanged(a, keep) || !dedup_unchanged(b, f)) {
+      action = "changed";
+   }
+   else if (dry_run) {
+      /* the same test wavutil_dedupe makes before asking the kernel */
+      struct stat st;
+      uint64_t block = fstat(b, &st) == 0 && st.st_blksize > 0 ? (uint64_t)st.st_blksize : 4096;
+      action = keep->rec.data_offset % block != f->rec.data_offset % block ? "misaligned"
+                                                                           : "would reflink";
+   }
+   else {
+      int64_t n = wavutil_dedupe(a, keep->rec.data_offset, b, f->rec.data_offset,
+                                 f->rec.data_size);
+      if (n > 0) {
+         *shared += (uint64_t)n;
+         action = "reflinked";
+      }
+      else if (n == 0) {
+         action = "under a block";
+      }
+      else if (errno == EOPNOTSUPP || errno == ENOTTY) {
+         action = "not supported";
+      }
+      else if (errno == EINVAL) {
+         action = "misaligned";
+      }
+      else if (errno == EBADE) {
+         action = "contents differ";
+      }
+      else {
+         fprintf(stderr, "%s: reflink failed: %s\n", f->path, strerror(errno));
+      }
+   }
+
+   if (a >= 0) close(a);
+   if (b >= 0) close(b);
+   return action;
+}
+
+static const char *dedup_columns = "group,hash,data_size,path,action\n";
+
+/*
+ * formats one group of duplicates, the file that is kept first. actions
+ * is NULL when nothing is being linked.
+ */
+void format_dedup(struct strbuf *sb, enum output_format format, size_t group,
+                  const struct dedup_file *files, size_t n, const char **actions) {
+   char hex[2 * sizeof(files->digest) + 1];
+   for (size_t i = 0; i < sizeof(files->digest); i++) {
+      snprintf(hex + 2 * i, 3, "%02x", files->digest[i]);
+   }
+   const char *nl = format == FORMAT_JSON ? "\n" : "";
+   const char *in = format == FORMAT_JSON ? "  " : "";
+   uint64_t size = files->rec.data_size;
+
+   switch (format) {
+   case FORMAT_TEXT:
+      sb_printf(sb, "%s  %zu files, %" PRIu64 " bytes of audio\n", hex, n, size);
+      for (size_t i = 0; i < n; i++) {
+         if (actions) sb_printf(sb, "  %-16s %s\n", actions[i], files[i].path);
+         else sb_printf(sb, "  %s\n", files[i].path);
+      }
+      sb_putc(sb, '\n');
+      break;
+   case FORMAT_JSON:
+   case FORMAT_NDJSON:
+      sb_printf(sb, "{%s%s\"hash\": \"%s\",%s%s\"data_size\": %" PRIu64 ",%s%s\"files\": [",
+                nl, in, hex, nl, in, size, nl, in);
+      for (size_t i = 0; i < n; i++) {
+         sb_printf(sb, "%s{\"path\": ", i ? ", " : "");
+         sb_json(sb, files[i].path, strlen(files[i].path));
+         if (actions) sb_printf(sb, ", \"action\": \"%s\"", actions[i]);
+         sb_putc(sb, '}');
+      }
+      sb_printf(sb, "]%s}", nl);
+      if (format == FORMAT_NDJSON) sb_putc(sb, '\n');
+      break;
+   case FORMAT_CSV:
+      for (size_t i = 0; i < n; i++) {
+         sb_printf(sb, "%zu,%s,%" PRIu64 ",", group, hex, size);
+         sb_csv(sb, files[i].path, strlen(files[i].path));
+         sb_printf(sb, ",%s\n", actions ? actions[i] : "");
+      }
+      break;
+   default:
+      break;
+   }
+}
+
+/* collects the files the scan finds */
+static void dedup_visit(struct scan_state *state, const char *path, const struct cache_record *rec) {
+   struct dedup *d = (struct dedup *)state->arg;
+   if (!rec->valid || rec->data_size == 0) return;
+
+   if (d->count == d->cap) {
+      size_t cap = d->cap ? d->cap * 2 : 1024;
+      struct dedup_file *grown = realloc(d->files, cap * sizeof(*grown));
+      if (grown == NULL) {
+         fprintf(stderr, "File list allocation failed\n");
+         exit(EXIT_FAILURE);
+      }
+      d->files = grown;
+      d->cap = cap;
+   }
+
+   struct dedup_file *f = &d->files[d->count];
+   memset(f, 0, sizeof(*f));
+   f->rec = *rec;
+   if ((f->path = strdup(path)) == NULL) {
+      fprintf(stderr, "File list allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+   d->count++;
+}
+
+/*
+ * ./wav-util dedup [options] <dir|filename>...
+ *
+ * finds files with the same audio in three stages, each one reading more
+ * of fewer files: the headers (fmt chunk and data size, from the scan
+ * cache when there is one), the first and last DEDUP_SAMPLE bytes of
+ * audio, and a full blake3 of the audio of the files still matching.
+ */
+int dedup_main(int argc, char **argv) {
+   struct scan_state state = {0};
+   struct dedup d = {0};
+   enum dedup_link link_method = LINK_NONE;
+   const char *cache_name = NULL;
+   int dry_run = 0;
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+   int jobs = cpus > 0 ? (int)cpus : 1;
+
+   state.emit.out = stdout;
+   state.emit.columns = dedup_columns;
+
+   static const struct option options[] = {
+      {"format",     required_argument, NULL, 'f'},
+      {"jobs",       required_argument, NULL, 'j'},
+      {"cache",      required_argument, NULL, 'C'},
+      {"link",       required_argument, NULL, 'l'},
+      {"dry-run",    no_argument,       NULL, 'n'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "f:j:l:nh", options, NULL)) != -1) {
+      switch (opt) {
+      case 'f': {
+         int f = -1;
+         for (int i = 0; i < FORMATS; i++) {
+            if (!strcmp(optarg, format_names[i])) f = i;
+         }
+         if (f < 0) {
+            fprintf(stderr, "unknown output format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         state.emit.format = (enum output_format)f;
+         break;
+      }
+      case 'j':
+         if ((jobs = atoi(optarg)) < 1) {
+            fprintf(stderr, "invalid number of jobs: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'C':
+         cache_name = optarg;
+         break;
+      case 'l': {
+         int l = -1;
+         for (int i = 0; i < LINKS; i++) {
+            if (!strcmp(optarg, link_names[i])) l = i;
+         }
+         if (l < 0) {
+            fprintf(stderr, "unknown link method: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         link_method = (enum dedup_link)l;
+         break;
+      }
+      case 'n':
+         dry_run = 1;
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (optind == argc) {
+      printf("usage: ./wav-util dedup [options] <dir|filename>...\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (cache_name) {
+      load_cache(cache_name, &state.old);
+   }
+   if ((state.quiet = fopen("/dev/null", "w")) == NULL) {
+      fprintf(stderr, "failed to open /dev/null\n");
+      exit(EXIT_FAILURE);
+   }
+   state.visit = dedup_visit;
+   state.arg = &d;
+   pthread_mutex_init(&d.lock, NULL);
+
+   double start = now_seconds();
+   size_t failed = 0;
+   for (int i = optind; i < argc; i++) {
+      struct stat st;
+      if (lstat(argv[i], &st)) {
+         fprintf(stderr, "failed to open file: %s\n", argv[i]);
+         failed++;
+      }
+      else if (S_ISDIR(st.st_mode)) {
+         int fd = open(argv[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+         if (fd < 0) {
+            fprintf(stderr, "failed to open directory: %s\n", argv[i]);
+            failed++;
+            continue;
+         }
+         scan_dir(fd, argv[i], &state, 0);
+         close(fd);
+      }
+      else if (S_ISREG(st.st_mode)) {
+         scan_file(AT_FDCWD, argv[i], argv[i], &st, &state);
+      }
+      else {
+         fprintf(stderr, "not a regular file: %s\n", argv[i]);
+      }
+   }
+   if (cache_name) {
+      save_cache(cache_name, &state.now);
+   }
+
+   dedup_keep(&d, STAGE_SIZE);
+   size_t same_size = d.count;
+
+   if ((d.todo = calloc(d.count ? d.count : 1, sizeof(*d.todo))) == NULL) {
+      fprintf(stderr, "File list allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+   if (dedup_stage(&d, 0, jobs)) exit(EXIT_FAILURE);
+   dedup_keep(&d, STAGE_SAMPLE);
+   size_t same_sample = d.count;
+
+   if (dedup_stage(&d, 1, jobs)) exit(EXIT_FAILURE);
+   dedup_keep(&d, STAGE_FULL);
+
+   /* every group left is a set of duplicates, the first path is kept */
+   size_t groups = 0, linked = 0;
+   uint64_t reclaimable = 0, shared = 0;
+   const char **actions = calloc(d.count ? d.count : 1, sizeof(*actions));
+   if (actions == NULL) {
+      fprintf(stderr, "File list allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+   emit_begin(&state.emit);
+   for (size_t i = 0, j; i < d.count; i = j) {
+      j = dedup_run(&d, i, STAGE_FULL);
+      struct dedup_file *g = d.files + i;
+      size_t n = j - i;
+      reclaimable += g->rec.data_size * (dedup_inodes(&d, i, j) - 1);
+      qsort(g, n, sizeof(*g), dedup_path_cmp);
+
+      for (size_t k = 0; link_method != LINK_NONE && k < n; k++) {
+         if (k == 0) actions[k] = "keep";
+         else if (same_inode(&g[k], g)) actions[k] = "already linked";
+         else if (link_method == LINK_HARDLINK) actions[k] = dedup_hardlink(g, &g[k], dry_run);
+         else actions[k] = dedup_reflink(g, &g[k], dry_run, &shared);
+
+         if (!strcmp(actions[k], "linked") || !strcmp(actions[k], "reflinked")) linked++;
+         if (!strcmp(actions[k], "failed") || !strcmp(actions[k], "not supported")) failed++;
+      }
+
+      struct strbuf sb = {0};
+      format_dedup(&sb, state.emit.format, ++groups, g, n,
+                   link_method != LINK_NONE ? actions : NULL);
+      emit_record(&state.emit, sb.data, sb.len);
+      free(sb.data);
+   }
+   emit_end(&state.emit);
+   double elapsed = now_seconds() - start;
+
+   fprintf(stderr, "%zu files (%zu cached, %zu invalid, %zu unreadable), %zu with a size match, "
+           "%zu after sampling, %zu duplicates in %zu groups\n", state.files, state.cached,
+           state.invalid, state.errors, same_size, same_sample, d.count - groups, groups);
+   fprintf(stderr, "%.1f MB of audio read in %.3f s, %.1f MB reclaimable", d.bytes_read / 1e6,
+           elapsed, reclaimable / 1e6);
+   if (link_method == LINK_HARDLINK) fprintf(stderr, ", %zu files linked", linked);
+   if (link_method == LINK_REFLINK) {
+      fprintf(stderr, ", %zu files reflinked sharing %.1f MB", linked, shared / 1e6);
+   }
+   fputc('\n', stderr);
+
+   for (size_t i = 0; i < d.count; i++) {
+      free(d.files[i].path);
+   }
+   free(d.files);
+   free(d.todo);
+   free(actions);
+   pthread_mutex_destroy(&d.lock);
+   fclose(state.quiet);
+   free(state.line.data);
+   cache_free(&state.old);
+   cache_free(&state.now);
+   return failed || state.errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+enum channel_op { SPLIT_CHANNELS, EXTRACT_CHANNELS, INTERLEAVE };
+
+/*
+ * parses a list of 1 based channels like 3-4 or 1,2,6 into 0 based ones.
+ * a range given backwards (4-3) counts down. returns the number of
+ * channels, 0 if the list is not valid.
+ */
+static unsigned parse_channels(const char *list, unsigned **channels) {
+   unsigned count = 0, *out = NULL;
+   const char *p = list;
+
+   for (;;) {
+      char *end;
+      unsigned long first = strtoul(p, &end, 10), last;
+      if (end == p || *p == '-' || *p == '+' || first == 0) break;
+      last = first;
+      if (*end == '-') {
+         p = end + 1;
+         last = strtoul(p, &end, 10);
+         if (end == p || *p == '-' || *p == '+' || last == 0) break;
+      }
+      unsigned long n = (first > last ? first - last : last - first) + 1;
+      if (first > UINT16_MAX || last > UINT16_MAX || count + n > UINT16_MAX) break;
+
+      unsigned *grown = realloc(out, (count + n) * sizeof(*out));
+      if (grown == NULL) break;
+      out = grown;
+      for (unsigned long i = 0; i < n; i++) {
+         out[count++] = (unsigned)(first > last ? first - i : first + i) - 1;
+      }
+
+      if (*end == '\0') {
+         *channels = out;
+         return count;
+      }
+      if (*end != ',') break;
+      p = end + 1;
+   }
+   free(out);
+   return 0;
+}
+
+/*
+ * opens, reads and verifies a wav file for the channel subcommands.
+ * returns the file descriptor, or -1 with nothing left open.
+ */
+static int open_verified(const char *path, int use_mmap, struct wavutil_map *map,
+                         wavutil_info *info) {
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      return -1;
+   }
+   if (use_mmap && wavutil_map(fd, map)) {
+      close(fd);
+      return -1;
+   }
+   if (wavutil_read(fd, use_mmap ? map : NULL, info)) {
+      wavutil_unmap(map);
+      close(fd);
+      return -1;
+   }
+   if (wavutil_verify(stderr, info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+      wavutil_free(info);
+      wavutil_unmap(map);
+      close(fd);
+      return -1;
+   }
+   return fd;
+}
+
+/*
+ * splits path into files of group channels each, named prefix followed
+ * by their channels (song_3.wav, song_3-4.wav), or writes the channels
+ * in list to output. returns 0 on success and -1 on error.
+ */
+int split_file(const char *path, const char *prefix, unsigned group, const char *output,
+               const unsigned *list, unsigned count, int use_mmap, int timing) {
+   struct wavutil_map map = {0};
+   wavutil_info info;
+   int ret = -1;
+
+   int fd = open_verified(path, use_mmap, &map, &info);
+   if (fd < 0) {
+      return -1;
+   }
+
+   unsigned channels = info.header.f.numChannels, n = 1;
+   unsigned *all = NULL;
+   struct wavutil_channels *outputs = NULL;
+   char *names = NULL;
+
+   if (list == NULL) {
+      /* "-a-b.wav" with both channel numbers up to 5 digits */
+      size_t name_len = strlen(prefix) + 17;
+      n = (channels + group - 1) / group;
+      all = malloc(channels * sizeof(*all));
+      outputs = calloc(n, sizeof(*outputs));
+      names = malloc(n * name_len);
+      if (!all || !outputs || !names) {
+         fprintf(stderr, "Memory allocation failed\n");
+         goto done;
+      }
+      for (unsigned c = 0; c < channels; c++) {
+         all[c] = c;
+      }
+      for (unsigned o = 0; o < n; o++) {
+         unsigned first = o * group, last = first + group > channels ? channels : first + group;
+         char *name = names + o * name_len;
+         if (last - first == 1) snprintf(name, name_len, "%s%u.wav", prefix, first + 1);
+         else snprintf(name, name_len, "%s%u-%u.wav", prefix, first + 1, last);
+         outputs[o].name = name;
+         outputs[o].channels = all + first;
+         outputs[o].count = last - first;
+      }
+   }
+   else {
+      outputs = calloc(1, sizeof(*outputs));
+      if (!outputs) {
+         fprintf(stderr, "Memory allocation failed\n");
+         goto done;
+      }
+      outputs[0].name = output;
+      outputs[0].channels = list;
+      outputs[0].count = count;
+   }
+
+   double start = now_seconds();
+   if (wavutil_split_channels(fd, &info, use_mmap ? &map : NULL, outputs, n)) {
+      goto done;
+   }
+   if (timing) {
+      double seconds = now_seconds() - start;
+      fprintf(stderr, "%s: %u channels into %u file%s with %s kernels in %.3f ms (%.1f MB/s)\n",
+              path, channels, n, n == 1 ? "" : "s", wavutil_simd(), seconds * 1e3,
+              seconds > 0 ? info.data_size / seconds / 1e6 : 0);
+   }
+   ret = 0;
+
+done:
+   free(all);
+   free(outputs);
+   free(names);
+   wavutil_free(&info);
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+/*
+ * writes the channels of every file in paths, in that order, to output.
+ * returns 0 on success and -1 on error.
+ */
+int interleave_files(char **paths, int n, const char *output, int timing) {
+   struct wavutil_map map = {0};
+   int *fds = malloc((size_t)n * sizeof(*fds));
+   wavutil_info *infos = malloc((size_t)n * sizeof(*infos));
+   int opened = 0, ret = -1;
+
+   if (!fds || !infos) {
+      fprintf(stderr, "Memory allocation failed\n");
+      goto done;
+   }
+   for (; opened < n; opened++) {
+      if ((fds[opened] = open_verified(paths[opened], 0, &map, &infos[opened])) < 0) goto done;
+   }
+
+   double start = now_seconds();
+   if (wavutil_interleave(output, fds, infos, (unsigned)n)) {
+      goto done;
+   }
+   if (timing) {
+      uint64_t bytes = 0;
+      for (int i = 0; i < n; i++) {
+         bytes += infos[i].data_size;
+      }
+      double seconds = now_seconds() - start;
+      fprintf(stderr, "%s: %d files with %s kernels in %.3f ms (%.1f MB/s)\n", output, n,
+              wavutil_simd(), seconds * 1e3, seconds > 0 ? bytes / seconds / 1e6 : 0);
+   }
+   ret = 0;
+
+done:
+   for (int i = 0; i < opened; i++) {
+      wavutil_free(&infos[i]);
+      close(fds[i]);
+   }
+   free(fds);
+   free(infos);
+   return ret;
+}
+
+/*
+ * ./wav-util split-channels [options] <filename|path>
+ * ./wav-util extract-channels --channels=LIST [options] <filename|path>
+ * ./wav-util interleave [options] <filename|path>...
+ */
+static int channels_main(int argc, char **argv, enum channel_op op) {
+   const char *output = op == SPLIT_CHANNELS ? NULL : modified_name;
+   unsigned *list = NULL, count = 0;
+   unsigned long group = 1;
+   int use_mmap = 0, timing = 0;
+
+   static const struct option options[] = {
+      {"output",     required_argument, NULL, 'o'},
+      {"channels",   required_argument, NULL, 'c'},
+      {"group",      required_argument, NULL, 'g'},
+      {"mmap",       no_argument,       NULL, 'm'},
+      {"timing",     no_argument,       NULL, 't'},
+      {"simd",       required_argument, NULL, 'V'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "o:c:g:mth", options, NULL)) != -1) {
+      switch (opt) {
+      case 'o':
+         output = optarg;
+         break;
+      case 'c':
+         free(list);
+         if ((count = parse_channels(optarg, &list)) == 0) {
+            fprintf(stderr, "invalid channel list: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'g': {
+         char *end;
+         group = strtoul(optarg, &end, 10);
+         if (*end || end == optarg || group == 0 || group > UINT16_MAX) {
+            fprintf(stderr, "invalid group size: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      }
+      case 'm':
+         use_mmap = 1;
+         break;
+      case 't':
+         timing = 1;
+         break;
+      case 'V':
+         if (wavutil_set_simd(optarg)) {
+            fprintf(stderr, "SIMD kernels not available: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   int ret;
+   switch (op) {
+   case SPLIT_CHANNELS: {
+      if (argc - optind != 1) {
+         printf("usage: ./wav-util split-channels [-g N] [-o PREFIX] <filename|path>\n");
+         exit(EXIT_FAILURE);
+      }
+      /* song.wav splits into song_1.wav, song_2.wav... */
+      char *prefix = NULL;
+      if (output == NULL) {
+         const char *path = argv[optind];
+         size_t len = strlen(path);
+         if (len > 4 && !strcasecmp(path + len - 4, ".wav")) len -= 4;
+         if ((prefix = malloc(len + 2)) == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+         }
+         memcpy(prefix, path, len);
+         memcpy(prefix + len, "_", 2);
+      }
+      ret = split_file(argv[optind], prefix ? prefix : output, (unsigned)group, NULL, NULL, 0,
+                       use_mmap, timing);
+      free(prefix);
+      break;
+   }
+   case EXTRACT_CHANNELS:
+      if (list == NULL || argc - optind != 1) {
+         printf("usage: ./wav-util extract-channels --channels=LIST [-o FILE] <filename|path>\n");
+         exit(EXIT_FAILURE);
+      }
+      ret = split_file(argv[optind], NULL, 0, output, list, count, use_mmap, timing);
+      break;
+   default:
+      if (argc - optind < 1) {
+         printf("usage: ./wav-util interleave [-o FILE] <filename|path>...\n");
+         exit(EXIT_FAILURE);
+      }
+      ret = interleave_files(argv + optind, argc - optind, output, timing);
+      break;
+   }
+
+   free(list);
+   return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * writes a copy of path to output resampled to rate Hz. returns 0 on
+ * success and -1 on error.
+ */
+static int resample_file(const char *path, const char *output, uint32_t rate, int threads,
+                         int use_mmap, int timing) {
+   struct wavutil_map map = {0};
+   wavutil_info info;
+   int ret = -1;
+
+   int fd = open(path, O_RDONLY);
+   if (fd < 0) {
+      fprintf(stderr, "failed to open file: %s\n", path);
+      return -1;
+   }
+   if (use_mmap && wavutil_map(fd, &map)) {
+      close(fd);
+      return -1;
+   }
+   if (wavutil_read(fd, use_mmap ? &map : NULL, &info)) {
+      wavutil_unmap(&map);
+      close(fd);
+      return -1;
+   }
+
+   if (wavutil_verify(stderr, &info)) {
+      fprintf(stderr, "Input file could not be verified: %s\n", path);
+      goto done;
+   }
+
+   double start = now_seconds();
+   if (wavutil_resample(output, fd, &info, use_mmap ? &map : NULL, rate, threads)) {
+      goto done;
+   }
+   if (timing) {
+      double seconds = now_seconds() - start;
+      double audio = info.header.f.byteRate ? (double)info.data_size / info.header.f.byteRate : 0;
+      fprintf(stderr, "%s: %u Hz to %u Hz with %s kernels in %.3f ms (%.1f MB/s, %.0fx real time)\n",
+              output, info.header.f.sampleRate, rate, wavutil_simd(), seconds * 1e3,
+              seconds > 0 ? info.data_size / seconds / 1e6 : 0, seconds > 0 ? audio / seconds : 0);
+   }
+   ret = 0;
+
+done:
+   wavutil_free(&info);
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+/*
+ * ./wav-util resample --rate=HZ [options] <filename|path>
+ */
+static int resample_main(int argc, char **argv) {
+   const char *output = modified_name;
+   unsigned long rate = 0;
+   int threads = 0, use_mmap = 0, timing = 0;
+
+   static const struct option options[] = {
+      {"rate",       required_argument, NULL, 'r'},
+      {"output",     required_argument, NULL, 'o'},
+      {"jobs",       required_argument, NULL, 'j'},
+      {"mmap",       no_argument,       NULL, 'm'},
+      {"timing",     no_argument,       NULL, 't'},
+      {"simd",       required_argument, NULL, 'V'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "r:o:j:mth", options, NULL)) != -1) {
+      switch (opt) {
+      case 'r': {
+         char *end;
+         rate = strtoul(optarg, &end, 10);
+         if (*end || end == optarg || rate == 0 || rate > UINT32_MAX) {
+            fprintf(stderr, "invalid sample rate: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      }
+      case 'o':
+         output = optarg;
+         break;
+      case 'j':
+         if ((threads = atoi(optarg)) < 1) {
+            fprintf(stderr, "invalid number of jobs: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'm':
+         use_mmap = 1;
+         break;
+      case 't':
+         timing = 1;
+         break;
+      case 'V':
+         if (wavutil_set_simd(optarg)) {
+            fprintf(stderr, "SIMD kernels not available: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if (rate == 0 || argc - optind != 1) {
+      printf("usage: ./wav-util resample --rate=HZ [-o FILE] <filename|path>\n");
+      exit(EXIT_FAILURE);
+   }
+
+   return resample_file(argv[optind], output, (uint32_t)rate, threads, use_mmap, timing)
+             ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+   /* subcommands come first (a file called convert can be given as ./convert) */
+   if (argc > 1 && !strcmp(argv[1], "convert")) {
+      return convert_main(argc - 1, argv + 1);
+   }
+   if (argc > 1 && !strcmp(argv[1], "stats")) {
+      return measure_main(argc - 1, argv + 1, stats_columns, stats_file);
+   }
+   if (argc > 1 && !strcmp(argv[1], "loudness")) {
+      return measure_main(argc - 1, argv + 1, loudness_columns, loudness_file);
+   }
+   if (argc > 1 && !strcmp(argv[1], "hash")) {
+      return hash_main(argc - 1, argv + 1);
+   }
+   if (argc > 1 && !strcmp(argv[1], "dedup")) {
+      return dedup_main(argc - 1, argv + 1);
+   }
+   if (argc > 1 && !strcmp(argv[1], "split-channels")) {
+      return channels_main(argc - 1, argv + 1, SPLIT_CHANNELS);
+   }
+   if (argc > 1 && !strcmp(argv[1], "extract-channels")) {
+      return channels_main(argc - 1, argv + 1, EXTRACT_CHANNELS);
+   }
+   if (argc > 1 && !strcmp(argv[1], "interleave")) {
+      return channels_main(argc - 1, argv + 1, INTERLEAVE);
+   }
+   if (argc > 1 && !strcmp(argv[1], "resample")) {
+      return resample_main(argc - 1, argv + 1);
+   }
+
+   struct wav_options opts = {0};
+   struct wavutil_copy_options copy = {0};
+   int bench = 0;
+   char **scan_dirs = calloc((size_t)argc, sizeof(char *));
+   size_t num_scan_dirs = 0;
+   const char *cache_name = NULL;
+   const char *trace_name = NULL;
+   int stats = 0;
+   long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+   opts.strategy = WAVUTIL_OUTPUT_AUTO;
+   opts.copy = &copy;
+   opts.jobs = cpus > 0 ? (int)cpus : 1;
+   opts.edits = calloc((size_t)argc, sizeof(char *));
+   if (opts.edits == NULL || scan_dirs == NULL) {
+      fprintf(stderr, "Edit list allocation failed\n");
+      exit(EXIT_FAILURE);
+   }
+
+   static const struct option options[] = {
+      {"set",        required_argument, NULL, 's'},
+      {"in-place",   no_argument,       NULL, 'i'},
+      {"backup",     required_argument, NULL, 'b'},
+      {"strategy",   required_argument, NULL, 'S'},
+      {"copy",       required_argument, NULL, 'c'},
+      {"timing",     no_argument,       NULL, 't'},
+      {"mmap",       no_argument,       NULL, 'm'},
+      {"format",     required_argument, NULL, 'f'},
+      {"jobs",       required_argument, NULL, 'j'},
+      {"output-dir", required_argument, NULL, 'o'},
+      {"unordered",  no_argument,       NULL, 'u'},
+      {"uring",      no_argument,       NULL, 'U'},
+      {"direct",     no_argument,       NULL, 'O'},
+      {"scan",       required_argument, NULL, 'D'},
+      {"cache",      required_argument, NULL, 'C'},
+      {"block-size", required_argument, NULL, 'K'},
+      {"pipeline-depth", required_argument, NULL, 'P'},
+      {"bench-copy", no_argument,       NULL, 'B'},
+      {"stats",      optional_argument, NULL, 'X'},
+      {"trace",      required_argument, NULL, 'R'},
+      {"help",       no_argument,       NULL, 'h'},
+      {NULL, 0, NULL, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "s:iS:c:tmf:j:o:uh", options, NULL)) != -1) {
+      switch (opt) {
+      case 'c': {
+         int m = parse_copy_method(optarg);
+         if (m < 0) {
+            fprintf(stderr, "unknown copy method: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         copy.method = (enum wavutil_copy_method)m;
+         break;
+      }
+      case 'S': {
+         int st = -1;
+         for (int i = 0; i < WAVUTIL_OUTPUT_STRATEGIES; i++) {
+            if (!strcmp(optarg, wavutil_output_names[i])) st = i;
+         }
+         if (st < 0) {
+            fprintf(stderr, "unknown output strategy: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         opts.strategy = (enum wavutil_output_strategy)st;
+         break;
+      }
+      case 't':
+         opts.timing = 1;
+         copy.report = 1;
+         break;
+      case 'K':
+         if (!strcmp(optarg, "auto")) {
+            copy.tune = 1;
+         }
+         else if ((copy.block_size = parse_size(optarg)) == 0) {
+            fprintf(stderr, "invalid block size: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'P':
+         if ((copy.depth = atoi(optarg)) < 2) {
+            fprintf(stderr, "the pipeline needs at least 2 buffers: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'm':
+         opts.use_mmap = 1;
+         break;
+      case 'f': {
+         int f = -1;
+         for (int i = 0; i < FORMATS; i++) {
+            if (!strcmp(optarg, format_names[i])) f = i;
+         }
+         if (f < 0) {
+            fprintf(stderr, "unknown output format: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         opts.format = (enum output_format)f;
+         break;
+      }
+      case 'j':
+         if ((opts.jobs = atoi(optarg)) < 1) {
+            fprintf(stderr, "invalid number of jobs: %s\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         break;
+      case 'o':
+         opts.output_dir = optarg;
+         break;
+      case 'u':
+         opts.unordered = 1;
+         break;
+      case 'U':
+         opts.uring = 1;
+         break;
+      case 'O':
+         copy.direct = 1;
+         break;
+      case 'B':
+         bench = 1;
+         break;
+      case 'X':
+         if (optarg && strcmp(optarg, "perf")) {
+            fprintf(stderr, "unknown stats: %s (only perf)\n", optarg);
+            exit(EXIT_FAILURE);
+         }
+         stats = optarg ? 2 : 1;
+         break;
+      case 'R':
+         trace_name = optarg;
+         break;
+      case 'D':
+         scan_dirs[num_scan_dirs++] = optarg;
+         break;
+      case 'C':
+         cache_name = optarg;
+         break;
+      case 's':
+         opts.edits[opts.num_edits++] = optarg;
+         break;
+      case 'i':
+         opts.in_place = 1;
+         break;
+      case 'b':
+         opts.backup = optarg;
+         break;
+      case 'h':
+         usage(stdout);
+         exit(EXIT_SUCCESS);
+      default:
+         usage(stderr);
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   if ((stats || trace_name) && profile_start(stats, trace_name)) {
+      exit(EXIT_FAILURE);
+   }
+   profile_thread_begin("main");
+
+   /* audit directories, nothing is written except the cache */
+   if (num_scan_dirs > 0) {
+      if (optind != argc || opts.num_edits || opts.in_place || bench) {
+         printf("--scan only lists files: ./wav-util --scan=DIR [--cache=FILE]\n");
+         exit(EXIT_FAILURE);
+      }
+      size_t invalid = run_scan(scan_dirs, num_scan_dirs, cache_name, opts.format);
+      profile_finish();
+      free(scan_dirs);
+      free(opts.edits);
+      return invalid ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+   free(scan_dirs);
+
+   if (cache_name) {
+      fprintf(stderr, "--cache only applies to --scan\n");
+      exit(EXIT_FAILURE);
+   }
+
+   /* check command line usage */
+   if (optind == argc) {
+      printf("please provide a file: ./wav-util <filename|path>\n");
+      exit(EXIT_FAILURE);
+   }
+
+   if (opts.backup && !opts.in_place) {
+      fprintf(stderr, "--backup only applies to --in-place edits\n");
+      exit(EXIT_FAILURE);
+   }
+
+   /* one file, as it has always worked */
+   if (argc - optind == 1 && strcmp(argv[optind], "-")) {
+      const char *path = argv[optind];
+      uint64_t bytes = 0;
+      int ret;
+
+      if (bench) {
+         ret = bench_file(path, &copy);
+      }
+      else {
+         double start = profile_file_begin();
+         ret = process_file(stdout, path, opts.in_place ? NULL : modified_name, opts.backup,
+                            &opts, NULL, &bytes);
+         profile_file_end(path, start, bytes);
+      }
+
+      report_block_size(&copy);
+      profile_finish();
+      free(opts.edits);
+      return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+   }
+
+   if (bench) {
+      printf("too many arguments: ./wav-util --bench-copy <filename|path>\n");
+      exit(EXIT_FAILURE);
+   }
+
+   /* batch mode: every argument, with - standing for a list on stdin */
+   char **paths = NULL;
+   size_t count = 0, cap = 0;
+   for (int i = optind; i < argc; i++) {
+      if (!strcmp(argv[i], "-")) {
+         read_path_list(&paths, &count, &cap);
+         continue;
+      }
+      if (count == cap) {
+         cap = cap ? cap * 2 : 64;
+         if ((paths = realloc(paths, cap * sizeof(char *))) == NULL) {
+            fprintf(stderr, "Path list allocation failed\n");
+            exit(EXIT_FAILURE);
+         }
+      }
+      if ((paths[count++] = strdup(argv[i])) == NULL) {
+         fprintf(stderr, "Path list allocation failed\n");
+         exit(EXIT_FAILURE);
+      }
+   }
+
+   opts.batch = 1;
+   size_t failed = run_batch(paths, count, &opts);
+   report_block_size(&copy);
+   profile_finish();
+
+   for (size_t i = 0; i < count; i++) {
+      free(paths[i]);
+   }
+   free(paths);
+   free(opts.edits);
 
-   return EXIT_SUCCESS;
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,2379 @@
+/*
+ * libwavutil: the wav parser and writer behind wav-util, see wavutil.h
+ * Nicholas Berriochoa
+ * 14 February 2021
+ *
+ * 15 October 2026
+ * - split out of wav-util.c so other programs can link it
+ */
+#define _GNU_SOURCE
+#include <stdio.h> /* io functions */
+#include <stdint.h> /* uint types */
+#include <stddef.h> /* offsetof */
+#include <stdarg.h> /* va_list */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* strcmp */
+#include <strings.h> /* strncasecmp */
+#include <errno.h> /* errno */
+#include <fcntl.h> /* splice, copy_file_range, fallocate */
+#include <pthread.h> /* pipeline reader thread */
+#include <time.h> /* clock_gettime */
+#include <unistd.h> /* read, write, lseek */
+#include <sys/mman.h> /* mmap, madvise */
+#include <sys/uio.h> /* struct iovec */
+#include <sys/stat.h> /* fstat */
+#include <sys/sysmacros.h> /* major, minor */
+#include <sys/syscall.h> /* io_uring system calls */
+#ifdef __linux__
+#include <sys/sendfile.h> /* sendfile */
+#include <sys/ioctl.h> /* ioctl */
+#include <linux/fs.h> /* FICLONE, FIDEDUPERANGE */
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h> /* io_uring_setup, io_uring_enter */
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#include "wavutil.h"
+#include "wavutil_private.h"
+
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+#define BLOCK WAVUTIL_HEAD_SIZE /* header bytes read ahead of parsing */
+
+#define CHUNK_HEADER_SIZE 8 /* chunk ID + chunk size */
+#define RIFF_HEADER_SIZE 12 /* RIFF + size + WAVE */
+#define FMT_SIZE 16 /* the part of the fmt chunk every wav file has */
+#define MAX_CHUNKS 4096 /* stop walking files that are obviously broken */
+
+/* RIFF definitions */
+static const char *RIFF_ID = "RIFF";
+static const char *RIFF_FMT = "WAVE";
+
+/* RF64/BW64 definitions, for files bigger than 4gb */
+static const char *RF64_ID = "RF64";
+static const char *BW64_ID = "BW64";
+static const char *DS64_ID = "ds64";
+static const char *JUNK_ID = "JUNK";
+#define SIZE_IN_DS64 0xFFFFFFFFu /* 32 bit size that means "look in ds64" */
+#define DS64_SIZE 28 /* ds64 body without a table */
+#define DS64_ENTRY_SIZE 12 /* chunk ID + 64 bit size */
+
+/* fmt definitions */
+static const char *FMT_ID = "fmt ";
+
+/* data definitions */
+static const char *DATA_ID = "data";
+
+/* audioFormat values, and WAVE_FORMAT_EXTENSIBLE offsets into the fmt body */
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+#define EXTENSIBLE_SIZE 40 /* fmt body with valid bits, channel mask and sub format */
+#define EXTENSIBLE_VALID_BITS 18
+#define EXTENSIBLE_SUB_FORMAT 24 /* a GUID whose first 2 bytes are the real audioFormat */
+
+const char *const wavutil_copy_names[WAVUTIL_COPY_METHODS] = {
+   "auto", "copy_file_range", "sendfile", "splice", "io_uring", "buffered", "pipeline"
+};
+
+const char *const wavutil_output_names[WAVUTIL_OUTPUT_STRATEGIES] = {
+   "auto", "reflink", "copy"
+};
+
+#define BUFFER_ALIGN 4096 /* page (and most sector sizes) aligned buffers */
+#define DEFAULT_DEPTH 4 /* pipeline and io_uring buffers when the options say 0 */
+#define DEFAULT_BLOCK (1 << 20) /* copy block when the device gives no hint */
+#define MIN_BLOCK (64 << 10) /* smallest probed or tuned copy block */
+#define MAX_BLOCK (16 << 20) /* largest probed or tuned copy block */
+#define DIRECT_ALIGN 4096 /* O_DIRECT offsets, lengths and buffers (any sector size) */
+#define TUNE_BYTES (16 << 20) /* bytes copied at each size while tuning */
+#define TUNE_GAIN 1.05 /* a bigger block has to be this much faster to keep */
+
+#define COPY_MAX_CHUNK (1 << 30) /* largest single kernel side transfer */
+
+int wavutil_version(void) {
+   return WAVUTIL_VERSION_MAJOR << 16 | WAVUTIL_VERSION_MINOR;
+}
+
+static void log_stderr(void *ctx, const char *msg) {
+   (void)ctx;
+   fprintf(stderr, "%s\n", msg);
+}
+
+static wavutil_log_fn log_fn = log_stderr;
+static void *log_ctx;
+static _Thread_local char last_error[256];
+
+void wavutil_set_log(wavutil_log_fn fn, void *ctx) {
+   log_fn = fn;
+   log_ctx = ctx;
+}
+
+const char *wavutil_error(void) {
+   return last_error;
+}
+
+static wavutil_trace_fn trace_fn;
+static void *trace_ctx;
+
+void wavutil_set_trace(wavutil_trace_fn fn, void *ctx) {
+   trace_fn = fn;
+   trace_ctx = ctx;
+}
+
+void wu_trace(const char *step, int begin, uint64_t bytes) {
+   if (trace_fn) trace_fn(trace_ctx, step, begin, bytes);
+}
+
+/*
+ * describes a failure: kept for wavutil_error and handed to the log
+ * callback. errno is left as it was so callers can still report it.
+ */
+void wu_log(const char *fmt, ...) {
+   int saved = errno;
+   va_list ap;
+   va_start(ap, fmt);
+   vsnprintf(last_error, sizeof(last_error), fmt, ap);
+   va_end(ap);
+
+   size_t n = strlen(last_error);
+   if (n && last_error[n - 1] == '\n') last_error[n - 1] = '\0';
+   if (log_fn) log_fn(log_ctx, last_error);
+   errno = saved;
+}
+
+/*
+ * hands what wavutil_copy_options.report asked for to the log callback.
+ * it is not a failure, so wavutil_error still describes the last one.
+ */
+void wu_report(const char *fmt, ...) {
+   if (log_fn == NULL) return;
+
+   int saved = errno;
+   char msg[256];
+   va_list ap;
+   va_start(ap, fmt);
+   vsnprintf(msg, sizeof(msg), fmt, ap);
+   va_end(ap);
+
+   size_t n = strlen(msg);
+   if (n && msg[n - 1] == '\n') msg[n - 1] = '\0';
+   log_fn(log_ctx, msg);
+   errno = saved;
+}
+
+/*
+ * wraps prefetched bytes as a partial map. it does not own them, so it
+ * must never be passed to wavutil_unmap.
+ */
+void wavutil_prefetch_map(const struct wavutil_prefetch *pre, struct wavutil_map *map) {
+   memset(map, 0, sizeof(*map));
+   map->base = pre->head;
+   map->file_size = pre->file_size;
+   map->size = pre->len < pre->file_size ? pre->len : (size_t)pre->file_size;
+}
+
+/*
+ * maps the whole file and tells the kernel it will be read front to back.
+ * returns 0 on success and -1 if the file is too small or can not be mapped.
+ */
+int wavutil_map(int fd, struct wavutil_map *map) {
+   struct stat st;
+
+   memset(map, 0, sizeof(*map));
+   if (fstat(fd, &st) < 0) {
+      wu_log("Could not stat the original file: %s\n", strerror(errno));
+      return -1;
+   }
+   if ((uint64_t)st.st_size < RIFF_HEADER_SIZE || (uint64_t)st.st_size > SIZE_MAX) {
+      wu_log("reading file header failed. file size: %lld\n", (long long)st.st_size);
+      return -1;
+   }
+
+   void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   if (base == MAP_FAILED) {
+      wu_log("Mapping the original file failed: %s\n", strerror(errno));
+      return -1;
+   }
+
+   map->base = (uint8_t *)base;
+   map->size = (size_t)st.st_size;
+   map->file_size = map->size;
+
+   /* advice only, so failures are not errors */
+   madvise(map->base, map->size, MADV_SEQUENTIAL);
+   madvise(map->base, map->size, MADV_WILLNEED);
+
+   return 0;
+}
+
+void wavutil_unmap(struct wavutil_map *map) {
+   if (map->base) {
+      munmap(map->base, map->size);
+   }
+   memset(map, 0, sizeof(*map));
+}
+
+/*
+ * reads len bytes at off, from the mapping when there is one. returns 0
+ * on success and -1 on error, or on a short read at the end of the file
+ * (with errno untouched).
+ */
+static int read_at(int fd, const struct wavutil_map *map, void *buf, size_t len, uint64_t off) {
+   if (map && map->base) {
+      if (off <= map->size && len <= map->size - off) {
+         memcpy(buf, map->base + off, len);
+         return 0;
+      }
+      if (map->size == map->file_size) return -1;
+   }
+
+   uint8_t *p = buf;
+   while (len > 0) {
+      ssize_t n = pread(fd, p, len, (off_t)off);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return -1;
+      p += n;
+      len -= (size_t)n;
+      off += (uint64_t)n;
+   }
+   return 0;
+}
+
+/*
+ * writes len bytes at off. returns 0 on success and -1 on error.
+ */
+static int write_at(int fd, const void *buf, size_t len, uint64_t off) {
+   const uint8_t *p = buf;
+   while (len > 0) {
+      ssize_t n = pwrite(fd, p, len, (off_t)off);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      p += n;
+      len -= (size_t)n;
+      off += (uint64_t)n;
+   }
+   return 0;
+}
+
+void wavutil_free(wavutil_info *info) {
+   free(info->chunks);
+   info->chunks = NULL;
+   info->num_chunks = 0;
+}
+
+/*
+ * RF64 and BW64 are the same thing under two names
+ */
+int wavutil_is_rf64(const char *id) {
+   return !strncmp(id, RF64_ID, WAVUTIL_ID_LEN) || !strncmp(id, BW64_ID, WAVUTIL_ID_LEN);
+}
+
+/*
+ * walks the RIFF tree of the file, reading only the 8 byte header of each
+ * chunk and seeking past the body (and its pad byte). fills in the chunk
+ * table and the riff, fmt and data headers. whether those make a valid
+ * wav file is left to wavutil_verify. returns -1 if the file can not be read.
+ */
+int wavutil_read(int fd, const struct wavutil_map *map, wavutil_info *info) {
+   struct stat st;
+
+   struct wavutil_ds64_chunk ds64;
+   uint8_t *table = NULL;
+   uint32_t table_len = 0;
+
+   memset(info, 0, sizeof(*info));
+   info->fmt = info->data = info->ds64 = -1;
+
+   if (map && map->base) {
+      info->file_size = map->file_size;
+   }
+   else if (fstat(fd, &st) == 0) {
+      info->file_size = (uint64_t)st.st_size;
+   }
+   else {
+      wu_log("Could not stat the original file: %s\n", strerror(errno));
+      return -1;
+   }
+
+   if (read_at(fd, map, &info->header.r, RIFF_HEADER_SIZE, 0)) {
+      wu_log("reading file header failed. file size: %llu\n",
+             (unsigned long long)info->file_size);
+      return -1;
+   }
+   info->riff_size = info->header.r.chunkSize;
+
+   int rf64 = wavutil_is_rf64(info->header.r.chunkID);
+   size_t cap = 0;
+   uint64_t off = RIFF_HEADER_SIZE;
+   while (off + CHUNK_HEADER_SIZE <= info->file_size && info->num_chunks < MAX_CHUNKS) {
+      struct wavutil_data_chunk hdr;
+      if (read_at(fd, map, &hdr, CHUNK_HEADER_SIZE, off)) {
+         wu_log("reading chunk header at %llu failed\n", (unsigned long long)off);
+         wavutil_free(info);
+         return -1;
+      }
+
+      if (info->num_chunks == cap) {
+         cap = cap ? cap * 2 : 16;
+         struct wavutil_chunk_entry *grown = realloc(info->chunks, cap * sizeof(*grown));
+         if (grown == NULL) {
+            wu_log("Chunk table allocation failed\n");
+            wavutil_free(info);
+            return -1;
+         }
+         info->chunks = grown;
+      }
+
+      struct wavutil_chunk_entry *c = &info->chunks[info->num_chunks];
+      memcpy(c->id, hdr.chunkID, WAVUTIL_ID_LEN);
+      c->size = hdr.chunkSize;
+      c->offset = off;
+
+      /* the real sizes of an RF64 file are in the ds64 chunk up front */
+      if (rf64 && info->num_chunks == 0 && !strncmp(c->id, DS64_ID, WAVUTIL_ID_LEN) &&
+          c->size >= DS64_SIZE) {
+         if (read_at(fd, map, &ds64, sizeof(ds64), off)) {
+            wu_log("reading ds64 chunk failed\n");
+            wavutil_free(info);
+            return -1;
+         }
+         info->ds64 = 0;
+         info->riff_size = (uint64_t)ds64.riffSizeHigh << 32 | ds64.riffSizeLow;
+
+         /* the table holds the sizes of other chunks bigger than 4gb */
+         uint64_t room = (c->size - DS64_SIZE) / DS64_ENTRY_SIZE;
+         table_len = ds64.tableLength < room ? ds64.tableLength : (uint32_t)room;
+         if (table_len > 0) {
+            table = malloc((size_t)table_len * DS64_ENTRY_SIZE);
+            if (table == NULL ||
+                read_at(fd, map, table, (size_t)table_len * DS64_ENTRY_SIZE, off + sizeof(ds64))) {
+               wu_log("reading ds64 table failed\n");
+               free(table);
+               wavutil_free(info);
+               return -1;
+            }
+         }
+      }
+      else if (rf64 && info->ds64 == 0 && hdr.chunkSize == SIZE_IN_DS64) {
+         if (!strncmp(c->id, DATA_ID, WAVUTIL_ID_LEN)) {
+            c->size = (uint64_t)ds64.dataSizeHigh << 32 | ds64.dataSizeLow;
+         }
+         for (uint32_t t = 0; t < table_len; t++) {
+            const uint8_t *entry = table + (size_t)t * DS64_ENTRY_SIZE;
+            if (!memcmp(entry, c->id, WAVUTIL_ID_LEN)) {
+               uint32_t low, high;
+               memcpy(&low, entry + WAVUTIL_ID_LEN, sizeof(low));
+               memcpy(&high, entry + WAVUTIL_ID_LEN + sizeof(low), sizeof(high));
+               c->size = (uint64_t)high << 32 | low;
+               break;
+            }
+         }
+      }
+
+      if (info->fmt < 0 && !strncmp(c->id, FMT_ID, WAVUTIL_ID_LEN)) {
+         info->fmt = (int)info->num_chunks;
+         memcpy(&info->header.f, &hdr, CHUNK_HEADER_SIZE);
+         size_t body = c->size < FMT_SIZE ? (size_t)c->size : FMT_SIZE;
+         if (read_at(fd, map, &info->header.f.audioFormat, body, off + CHUNK_HEADER_SIZE)) {
+            wu_log("reading format chunk failed\n");
+            wavutil_free(info);
+            return -1;
+         }
+      }
+      else if (info->data < 0 && !strncmp(c->id, DATA_ID, WAVUTIL_ID_LEN)) {
+         info->data = (int)info->num_chunks;
+         info->header.d = hdr;
+         info->data_offset = off + CHUNK_HEADER_SIZE;
+
+         /* trust the data chunk size, but never past the end of the file */
+         info->data_size = info->file_size - info->data_offset;
+         if (c->size < info->data_size) {
+            info->data_size = c->size;
+         }
+      }
+      info->num_chunks++;
+
+      /* chunk bodies are padded to an even number of bytes */
+      off += CHUNK_HEADER_SIZE + c->size + (c->size & 1);
+   }
+
+   free(table);
+   return 0;
+}
+
+static void problem(FILE *out, const char *fmt, ...) {
+   if (out == NULL) return;
+   va_list ap;
+   va_start(ap, fmt);
+   vfprintf(out, fmt, ap);
+   va_end(ap);
+}
+
+/*
+ * this function is used to verify that the file entered
+ * is in fact a wav file, printing what is wrong to out (nothing when
+ * out is NULL). Extra chunks such as JUNK or LIST are fine
+ * as long as there is a fmt chunk and a data chunk. returns the
+ * number of problems found, 0 if the file is valid.
+ */
+int wavutil_verify(FILE *out, const wavutil_info *input) {
+   int error = 0;
+   /* check the RIFF id */
+   if (wavutil_is_rf64(input->header.r.chunkID)) {
+      if (input->ds64 < 0) {
+         problem(out, "rf64 file has no ds64 chunk\n");
+         error++;
+      }
+   }
+   else if (strncmp(input->header.r.chunkID, RIFF_ID, WAVUTIL_ID_LEN)) {
+      problem(out, "riff chunk could not be verified: %.4s\n", input->header.r.chunkID);
+      error++;
+   }
+
+   /* check the RIFF format */
+   if (strncmp(input->header.r.format, RIFF_FMT, WAVUTIL_ID_LEN)) {
+      problem(out, "riff format could not be verified: %.4s\n", input->header.r.format);
+      error++;
+   }
+
+   /* check the fmt chunk */
+   if (input->fmt < 0) {
+      problem(out, "format chunk could not be found\n");
+      error++;
+   }
+   else if (input->header.f.chunkSize < FMT_SIZE) {
+      problem(out, "format chunk is too small: %u\n", input->header.f.chunkSize);
+      error++;
+   }
+
+   /* check the data chunk */
+   if (input->data < 0) {
+      problem(out, "data chunk could not be found\n");
+      error++;
+   }
+   else if (input->chunks[input->data].size > input->data_size) {
+      problem(out, "data chunk runs past the end of the file: %llu of %llu bytes\n",
+              (unsigned long long)input->data_size,
+              (unsigned long long)input->chunks[input->data].size);
+      error++;
+   }
+
+   return error;
+}
+
+/*
+ * the fmt chunk fields that can be edited
+ */
+struct header_field {
+   const char *name;
+   size_t offset;
+   size_t size;
+};
+
+#define FMT_FIELD(member) \
+   { #member, offsetof(wavutil_header, f.member), sizeof(((wavutil_header *)0)->f.member) }
+
+const struct header_field header_fields[] = {
+   FMT_FIELD(audioFormat),
+   FMT_FIELD(numChannels),
+   FMT_FIELD(sampleRate),
+   FMT_FIELD(byteRate),
+   FMT_FIELD(blockAlign),
+   FMT_FIELD(bitsPerSample),
+};
+
+#define NUM_HEADER_FIELDS (sizeof(header_fields) / sizeof(header_fields[0]))
+
+/*
+ * applies an edit of the form field=value (ex: sampleRate=48000) to the
+ * header. returns 0 on success and -1 if the edit is not valid.
+ */
+int wavutil_edit(wavutil_header *header, const char *edit) {
+   const char *eq = strchr(edit, '=');
+   if (!eq || eq == edit) {
+      wu_log("edits look like field=value: %s\n", edit);
+      return -1;
+   }
+
+   size_t name_len = (size_t)(eq - edit);
+   for (size_t i = 0; i < NUM_HEADER_FIELDS; i++) {
+      const struct header_field *field = &header_fields[i];
+      if (strlen(field->name) != name_len || strncasecmp(field->name, edit, name_len)) {
+         continue;
+      }
+
+      char *end;
+      errno = 0;
+      unsigned long long value = strtoull(eq + 1, &end, 0);
+      unsigned long long max = field->size == sizeof(uint16_t) ? UINT16_MAX : UINT32_MAX;
+      if (errno || *end != '\0' || end == eq + 1 || value > max || eq[1] == '-') {
+         wu_log("invalid value for %s: %s\n", field->name, eq + 1);
+         return -1;
+      }
+
+      uint8_t *dst = (uint8_t *)header + field->offset;
+      if (field->size == sizeof(uint16_t)) {
+         uint16_t v = (uint16_t)value;
+         memcpy(dst, &v, sizeof(v));
+      }
+      else {
+         uint32_t v = (uint32_t)value;
+         memcpy(dst, &v, sizeof(v));
+      }
+      return 0;
+   }
+
+   wu_log("unknown header field: %.*s\n", (int)name_len, edit);
+   return -1;
+}
+
+/*
+ * writes the bytes of b that differ from a to the file at off, one pwrite
+ * per changed run. returns the number of bytes patched or -1 on error.
+ */
+static ssize_t patch_bytes(int fd, const void *a_, const void *b_, size_t len, uint64_t off) {
+   const uint8_t *a = (const uint8_t *)a_;
+   const uint8_t *b = (const uint8_t *)b_;
+   ssize_t patched = 0;
+
+   for (size_t i = 0; i < len; ) {
+      if (a[i] == b[i]) {
+         i++;
+         continue;
+      }
+
+      size_t run = i;
+      while (run < len && a[run] != b[run]) run++;
+
+      ssize_t n = pwrite(fd, b + i, run - i, (off_t)(off + i));
+      if (n != (ssize_t)(run - i)) {
+         return -1;
+      }
+      patched += n;
+      i = run;
+   }
+
+   return patched;
+}
+
+/*
+ * writes only the header bytes that differ between the original and
+ * edited header back into the file, at wherever the riff, fmt and data
+ * chunks live. returns the number of bytes patched or -1 on error.
+ */
+ssize_t wavutil_patch(int fd, const wavutil_info *info, const wavutil_header *edited) {
+   const wavutil_header *original = &info->header;
+   ssize_t r, f, d;
+
+   if ((r = patch_bytes(fd, &original->r, &edited->r, RIFF_HEADER_SIZE, 0)) < 0 ||
+       (f = patch_bytes(fd, &original->f, &edited->f, CHUNK_HEADER_SIZE + FMT_SIZE,
+                        info->chunks[info->fmt].offset)) < 0 ||
+       (d = patch_bytes(fd, &original->d, &edited->d, CHUNK_HEADER_SIZE,
+                        info->chunks[info->data].offset)) < 0) {
+      return -1;
+   }
+
+   return r + f + d;
+}
+
+/*
+ * reads everything in front of the audio data (the riff header and every
+ * chunk before data) and lays the edited header over it. the caller frees
+ * the buffer. returns NULL if the file can not be read.
+ */
+static uint8_t *read_prefix(int fd, const wavutil_info *info, const wavutil_header *edited) {
+   uint8_t *prefix = malloc(info->data_offset);
+   if (prefix == NULL) {
+      wu_log("Header allocation failed\n");
+      return NULL;
+   }
+
+   if (read_at(fd, NULL, prefix, info->data_offset, 0)) {
+      wu_log("reading file header failed\n");
+      free(prefix);
+      return NULL;
+   }
+
+   if (edited) {
+      memcpy(prefix, &edited->r, RIFF_HEADER_SIZE);
+      memcpy(prefix + info->chunks[info->fmt].offset, &edited->f, CHUNK_HEADER_SIZE + FMT_SIZE);
+      memcpy(prefix + info->chunks[info->data].offset, &edited->d, CHUNK_HEADER_SIZE);
+   }
+
+   return prefix;
+}
+
+static void put_u32(uint8_t *dst, uint32_t v) {
+   memcpy(dst, &v, sizeof(v));
+}
+
+/*
+ * builds the header of an output file whose data chunk holds data_size
+ * bytes: the original prefix with the edited header laid over it. if the
+ * size of the audio data changed, the RIFF and data sizes are updated, and
+ * a file that no longer fits in 32 bit sizes is promoted to RF64. a JUNK
+ * chunk right after the RIFF header (the usual placeholder) becomes the
+ * ds64 chunk when it is big enough, otherwise a ds64 chunk is inserted.
+ * *len is set to the size of the returned header.
+ */
+uint8_t *wavutil_prefix(int fd, const wavutil_info *info, const wavutil_header *edited,
+                      uint64_t data_size, size_t *len) {
+   uint8_t *prefix = read_prefix(fd, info, edited);
+   if (prefix == NULL) {
+      return NULL;
+   }
+   *len = (size_t)info->data_offset;
+
+   if (data_size == info->data_size) {
+      return prefix;
+   }
+
+   /* chunks after the data chunk are carried over as they are */
+   uint64_t data_end = info->data_offset + info->data_size + (info->data_size & 1);
+   uint64_t trailing = info->file_size > data_end ? info->file_size - data_end : 0;
+   uint64_t riff_size = *len - CHUNK_HEADER_SIZE + data_size + (data_size & 1) + trailing;
+   size_t data_hdr = *len - CHUNK_HEADER_SIZE;
+   size_t ds64_off;
+
+   if (info->ds64 < 0 && riff_size <= UINT32_MAX && data_size <= UINT32_MAX) {
+      put_u32(prefix + WAVUTIL_ID_LEN, (uint32_t)riff_size);
+      put_u32(prefix + data_hdr + WAVUTIL_ID_LEN, (uint32_t)data_size);
+      return prefix;
+   }
+
+   if (info->ds64 >= 0) {
+      ds64_off = (size_t)info->chunks[info->ds64].offset;
+   }
+   else {
+      const struct wavutil_chunk_entry *first = &info->chunks[0];
+      ds64_off = RIFF_HEADER_SIZE;
+
+      if (!strncmp(first->id, JUNK_ID, WAVUTIL_ID_LEN) &&
+          (first->size == DS64_SIZE || first->size >= DS64_SIZE + CHUNK_HEADER_SIZE)) {
+         /* whatever the placeholder does not need stays JUNK */
+         if (first->size > DS64_SIZE) {
+            uint8_t *rest = prefix + ds64_off + CHUNK_HEADER_SIZE + DS64_SIZE;
+            memcpy(rest, JUNK_ID, WAVUTIL_ID_LEN);
+            put_u32(rest + WAVUTIL_ID_LEN, (uint32_t)(first->size - DS64_SIZE - CHUNK_HEADER_SIZE));
+         }
+      }
+      else {
+         size_t grow = CHUNK_HEADER_SIZE + DS64_SIZE;
+         uint8_t *grown = realloc(prefix, *len + grow);
+         if (grown == NULL) {
+            wu_log("Header allocation failed\n");
+            free(prefix);
+            return NULL;
+         }
+         prefix = grown;
+         memmove(prefix + ds64_off + grow, prefix + ds64_off, *len - ds64_off);
+         *len += grow;
+         data_hdr += grow;
+         riff_size += grow;
+      }
+
+      memcpy(prefix, wavutil_is_rf64(info->header.r.chunkID) ? info->header.r.chunkID : RF64_ID,
+             WAVUTIL_ID_LEN);
+      memcpy(prefix + ds64_off, DS64_ID, WAVUTIL_ID_LEN);
+      put_u32(prefix + ds64_off + WAVUTIL_ID_LEN, DS64_SIZE);
+      put_u32(prefix + ds64_off + offsetof(struct wavutil_ds64_chunk, tableLength), 0);
+   }
+
+   uint64_t samples = edited->f.blockAlign ? data_size / edited->f.blockAlign : 0;
+   uint8_t *ds64 = prefix + ds64_off;
+   put_u32(ds64 + offsetof(struct wavutil_ds64_chunk, riffSizeLow),     (uint32_t)riff_size);
+   put_u32(ds64 + offsetof(struct wavutil_ds64_chunk, riffSizeHigh),    (uint32_t)(riff_size >> 32));
+   put_u32(ds64 + offsetof(struct wavutil_ds64_chunk, dataSizeLow),     (uint32_t)data_size);
+   put_u32(ds64 + offsetof(struct wavutil_ds64_chunk, dataSizeHigh),    (uint32_t)(data_size >> 32));
+   put_u32(ds64 + offsetof(struct wavutil_ds64_chunk, sampleCountLow),  (uint32_t)samples);
+   put_u32(ds64 + offsetof(struct wavutil_ds64_chunk, sampleCountHigh), (uint32_t)(samples >> 32));
+   put_u32(prefix + WAVUTIL_ID_LEN, SIZE_IN_DS64);
+   put_u32(prefix + data_hdr + WAVUTIL_ID_LEN, SIZE_IN_DS64);
+
+   return prefix;
+}
+
+/*
+ * saves the untouched header (everything in front of the audio data) so
+ * an in place edit can be undone by writing the backup over the start of
+ * the wav file.
+ */
+int wavutil_backup(const char *name, int in, const wavutil_info *info) {
+   uint8_t *prefix = read_prefix(in, info, NULL);
+   if (prefix == NULL) {
+      return -1;
+   }
+
+   int fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (fd < 0) {
+      wu_log("Failed to create %s\n", name);
+      free(prefix);
+      return -1;
+   }
+
+   if (write(fd, prefix, info->data_offset) != (ssize_t)info->data_offset || fsync(fd) < 0) {
+      wu_log("Writing header backup to %s failed\n", name);
+      free(prefix);
+      close(fd);
+      return -1;
+   }
+
+   free(prefix);
+   return close(fd);
+}
+
+/*
+ * the final size is known up front, so reserve all of it now: one
+ * contiguous allocation instead of one per write. the size is kept so a
+ * copy that fails part way leaves a short file, not zeros.
+ */
+static void preallocate(int fd, const wavutil_info *info, size_t len, uint64_t data_size,
+                        const char *name) {
+#ifdef FALLOC_FL_KEEP_SIZE
+   uint64_t data_end = info->data_offset + info->data_size + (info->data_size & 1);
+   uint64_t trailing = info->file_size > data_end ? info->file_size - data_end : 0;
+   uint64_t total = len + data_size + (data_size & 1) + trailing;
+   if (fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)total) < 0) {
+   #if (DEBUG)
+      fprintf(stderr, "Preallocating %s failed: %s\n", name, strerror(errno));
+   #endif
+   }
+#endif
+   (void)name;
+}
+
+/*
+ * This function creates a new wav file and writes the modified header,
+ * along with every chunk in front of the audio data, to the new file.
+ * returns NULL if the file could not be created.
+ */
+FILE* wavutil_create (const char *name, int original, const wavutil_info *info,
+                      const wavutil_header *header, uint64_t data_size) {
+   FILE* f = NULL;
+   size_t len;
+
+   uint8_t *prefix = wavutil_prefix(original, info, header, data_size, &len);
+   if (prefix == NULL) {
+      return NULL;
+   }
+
+   /* create the file */
+   if (!(f = fopen(name, "w"))) {
+      wu_log("Failed to create %s\n", name);
+      free(prefix);
+      return NULL;
+   }
+   preallocate(fileno(f), info, len, data_size, name);
+
+   /* write the header to the new file */
+   size_t bytes;
+   if ((bytes = fwrite(prefix, len, 1, f)) != 1) {
+      wu_log("Writing header to %s failed. bytes written: %zu\n", name, bytes);
+      free(prefix);
+      fclose(f);
+      return NULL;
+   }
+   free(prefix);
+
+   /* return the file pointer to the caller */
+   return f;
+}
+
+static double now_seconds(void) {
+   struct timespec ts;
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * errors that mean a copy method is not available for these two files
+ * (old kernel, cross device, special files...) rather than a real failure.
+ */
+static int copy_unsupported(int err) {
+   return err == ENOSYS || err == EXDEV || err == EINVAL ||
+          err == EOPNOTSUPP || err == EBADF || err == ESPIPE;
+}
+
+/*
+ * Each copy function moves up to *len bytes from in at *in_off to out at
+ * *out_off, advancing the offsets and shrinking *len as it goes. They
+ * return 0 when everything was copied and -1 with errno set otherwise, so
+ * the caller can pick up where a refused method left off. An input that
+ * ends before *len bytes is EIO, the header promised more than is there.
+ * Only the userspace copies look at the copy options.
+ */
+static int copy_with_file_range(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                                struct wavutil_copy_options *copy) {
+   (void)copy;
+#ifdef __linux__
+   while (*len > 0) {
+      size_t chunk = *len > COPY_MAX_CHUNK ? COPY_MAX_CHUNK : (size_t)*len;
+      ssize_t n = copy_file_range(in, in_off, out, out_off, chunk, 0);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      if (n == 0) {
+         errno = EIO;   /* input shorter than expected */
+         return -1;
+      }
+      *len -= (uint64_t)n;
+   }
+   return 0;
+#else
+   (void)in; (void)in_off; (void)out; (void)out_off; (void)len;
+   errno = ENOSYS;
+   return -1;
+#endif
+}
+
+static int copy_with_sendfile(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                              struct wavutil_copy_options *copy) {
+   (void)copy;
+#ifdef __linux__
+   /* sendfile writes at the current position of the output */
+   if (lseek(out, *out_off, SEEK_SET) < 0) return -1;
+
+   while (*len > 0) {
+      size_t chunk = *len > COPY_MAX_CHUNK ? COPY_MAX_CHUNK : (size_t)*len;
+      ssize_t n = sendfile(out, in, in_off, chunk);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      if (n == 0) {
+         errno = EIO;
+         return -1;
+      }
+      *out_off += n;
+      *len -= (uint64_t)n;
+   }
+   return 0;
+#else
+   (void)in; (void)in_off; (void)out; (void)out_off; (void)len;
+   errno = ENOSYS;
+   return -1;
+#endif
+}
+
+static int copy_with_splice(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                            struct wavutil_copy_options *copy) {
+   (void)copy;
+#ifdef __linux__
+   int pipefd[2];
+   int ret = 0;
+
+   if (pipe(pipefd) < 0) return -1;
+
+   while (*len > 0) {
+      size_t chunk = *len > COPY_MAX_CHUNK ? COPY_MAX_CHUNK : (size_t)*len;
+      ssize_t in_pipe = splice(in, in_off, pipefd[1], NULL, chunk, SPLICE_F_MOVE | SPLICE_F_MORE);
+      if (in_pipe < 0) {
+         if (errno == EINTR) continue;
+         ret = -1;
+         break;
+      }
+      if (in_pipe == 0) {
+         errno = EIO;
+         ret = -1;
+         break;
+      }
+
+      /*
+       * drain everything that went into the pipe before reading more. when
+       * the output refuses, whatever is still in the pipe is given back to
+       * the input offset so the next method copies it again.
+       */
+      while (in_pipe > 0) {
+         ssize_t n = splice(pipefd[0], NULL, out, out_off, (size_t)in_pipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+         if (n < 0) {
+            if (errno == EINTR) continue;
+            *in_off -= in_pipe;
+            ret = -1;
+            break;
+         }
+         in_pipe -= n;
+         *len -= (uint64_t)n;
+      }
+      if (ret) break;
+   }
+
+   int saved = errno;
+   close(pipefd[0]);
+   close(pipefd[1]);
+   errno = saved;
+   return ret;
+#else
+   (void)in; (void)in_off; (void)out; (void)out_off; (void)len;
+   errno = ENOSYS;
+   return -1;
+#endif
+}
+
+/*
+ * every thread keeps its own aligned copy buffer and reuses it for every
+ * file, so batch runs do not allocate per file. it only grows, and is
+ * never zeroed since every byte is read into before it is written out.
+ */
+static _Thread_local uint8_t *copy_buffer;
+static _Thread_local size_t copy_buffer_size;
+
+static uint8_t *copy_buffers(size_t size) {
+   if (size <= copy_buffer_size) return copy_buffer;
+
+   free(copy_buffer);
+   copy_buffer_size = 0;
+   if (posix_memalign((void **)&copy_buffer, BUFFER_ALIGN, size)) {
+      copy_buffer = NULL;
+      wu_log("Data block allocation failed\n");
+      errno = ENOMEM;
+      return NULL;
+   }
+   copy_buffer_size = size;
+   return copy_buffer;
+}
+
+/*
+ * reads a number from the queue settings of the block device behind dev,
+ * or of the whole disk when dev is a partition. returns 0 if there is no
+ * such device (tmpfs, network filesystems) or the value can not be read.
+ */
+static uint64_t device_queue_value(dev_t dev, const char *name) {
+   static const char *const formats[] = {
+      "/sys/dev/block/%u:%u/queue/%s", "/sys/dev/block/%u:%u/../queue/%s"
+   };
+   unsigned long long v = 0;
+
+   for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+      char path[128];
+      snprintf(path, sizeof(path), formats[i], major(dev), minor(dev), name);
+      FILE *f = fopen(path, "r");
+      if (!f) continue;
+      int ok = fscanf(f, "%llu", &v) == 1;
+      fclose(f);
+      if (ok) break;
+      v = 0;
+   }
+   return v;
+}
+
+/*
+ * the device hint for one side of the copy: its optimal I/O size when it
+ * reports one, otherwise the largest request it takes in one go.
+ */
+static uint64_t device_block(dev_t dev) {
+   uint64_t optimal = device_queue_value(dev, "optimal_io_size");
+   if (optimal) return optimal;
+   return device_queue_value(dev, "max_sectors_kb") << 10;
+}
+
+/* buffers in flight for the pipeline and io_uring copies, at least 2 */
+static int copy_depth(const struct wavutil_copy_options *copy) {
+   if (copy->depth == 0) return DEFAULT_DEPTH;
+   return copy->depth > 1 ? copy->depth : 2;
+}
+
+/* the last probe of each thread, since batch runs copy between the same devices */
+static _Thread_local dev_t probed_in, probed_out;
+static _Thread_local size_t probed_block;
+
+/*
+ * picks the block size of the userspace copies: the one set in the
+ * options, the one tuning settled on, or one probed from st_blksize
+ * of both files and the queue settings of the devices under them. the
+ * probe is a whole multiple of the larger st_blksize.
+ */
+static size_t copy_block_size(int in, int out, struct wavutil_copy_options *copy) {
+   if (copy->block_size) return copy->block_size;
+
+   size_t tuned = __atomic_load_n(&copy->tuned, __ATOMIC_ACQUIRE);
+   if (tuned) return tuned;
+
+   struct stat a, b;
+   if (fstat(in, &a) || fstat(out, &b)) return DEFAULT_BLOCK;
+   if (probed_block && probed_in == a.st_dev && probed_out == b.st_dev) return probed_block;
+
+   uint64_t io = (uint64_t)(a.st_blksize > b.st_blksize ? a.st_blksize : b.st_blksize);
+   if (io == 0) io = BLOCK;
+   uint64_t hint_in = device_block(a.st_dev), hint_out = device_block(b.st_dev);
+   uint64_t hint = hint_in > hint_out ? hint_in : hint_out;
+
+   uint64_t block = hint ? hint : DEFAULT_BLOCK;
+   if (block < MIN_BLOCK) block = MIN_BLOCK;
+   if (block > MAX_BLOCK) block = MAX_BLOCK;
+   block = (block + io - 1) / io * io;
+
+   probed_in = a.st_dev;
+   probed_out = b.st_dev;
+   probed_block = (size_t)block;
+
+   if (copy->report) {
+      wu_report("block size: %zu bytes (st_blksize %llu, device hint %llu)\n",
+                probed_block, (unsigned long long)io, (unsigned long long)hint);
+   }
+   return probed_block;
+}
+
+/*
+ * the state of block size tuning (--block-size=auto). each thread measures MIN_BLOCK first
+ * and keeps doubling while that is at least TUNE_GAIN times faster. the
+ * first thread to settle publishes its size in the options for every
+ * later copy made with them, and
+ * tuning can span several files when they are small.
+ */
+struct block_tuner {
+   size_t block;              /* size being measured, 0 when not tuning */
+   uint64_t bytes;            /* copied at that size so far */
+   double seconds;
+   size_t best;
+   double best_rate;          /* bytes per second of best */
+};
+
+static _Thread_local struct block_tuner tuner;
+
+/*
+ * adds one block to the measurement and returns the size of the next one
+ */
+static size_t tune_block(struct wavutil_copy_options *copy, size_t bytes, double seconds) {
+   struct block_tuner *t = &tuner;
+
+   t->bytes += bytes;
+   t->seconds += seconds;
+   if (t->bytes < TUNE_BYTES && t->bytes < 4 * (uint64_t)t->block) return t->block;
+
+   double rate = t->seconds > 0 ? t->bytes / t->seconds : 0;
+   if (rate > t->best_rate * TUNE_GAIN || t->best == 0) {
+      t->best = t->block;
+      t->best_rate = rate;
+      if (t->block * 2 <= MAX_BLOCK) {
+         t->block *= 2;
+         t->bytes = 0;
+         t->seconds = 0;
+         return t->block;
+      }
+   }
+
+   size_t unset = 0;
+   if (__atomic_compare_exchange_n(&copy->tuned, &unset, t->best, 0, __ATOMIC_RELEASE,
+                                   __ATOMIC_RELAXED) && copy->report) {
+      wu_report("block size tuned to %zu bytes (%.1f MB/s)\n", t->best, t->best_rate / 1e6);
+   }
+   memset(t, 0, sizeof(*t));
+   return __atomic_load_n(&copy->tuned, __ATOMIC_ACQUIRE);
+}
+
+static int copy_with_buffer(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                            struct wavutil_copy_options *copy) {
+   size_t block;
+   int tuning = copy->tune && !copy->block_size &&
+                !__atomic_load_n(&copy->tuned, __ATOMIC_ACQUIRE);
+
+   if (tuning) {
+      if (tuner.block == 0) tuner.block = MIN_BLOCK;
+      block = tuner.block;
+   }
+   else {
+      block = copy_block_size(in, out, copy);
+   }
+
+   int num_blocks = 0;
+   while (*len > 0) {
+      /* allocate data to read in the audio data portion of the file */
+      uint8_t *data = copy_buffers(block);
+      if (data == NULL) {
+         return -1;
+      }
+
+      double start = tuning ? now_seconds() : 0;
+      size_t want = *len > block ? block : (size_t)*len;
+      ssize_t bytes = pread(in, data, want, *in_off);
+      if (bytes < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      if (bytes == 0) {
+         errno = EIO;
+         return -1;
+      }
+      num_blocks++;
+
+   #if (DEBUG)
+      fprintf(stderr, "Bytes read: %zd\n", bytes);
+   #endif
+
+      /* write original audio data to the modified wav file */
+      ssize_t written = 0;
+      while (written < bytes) {
+         ssize_t n = pwrite(out, data + written, (size_t)(bytes - written), *out_off + written);
+         if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+         }
+         written += n;
+      }
+
+      *in_off += bytes;
+      *out_off += bytes;
+      *len -= (uint64_t)bytes;
+
+      if (tuning) {
+         block = tune_block(copy, (size_t)bytes, now_seconds() - start);
+         tuning = tuner.block != 0;
+      }
+   }
+
+   #if (DEBUG)
+      fprintf(stderr, "%d blocks read in\n", num_blocks);
+   #endif
+
+   return 0;
+}
+
+/* one buffer of the pipeline ring */
+struct pipe_slot {
+   uint8_t *buf;
+   size_t len;                /* 0 once the reader hit the end of the input */
+};
+
+/*
+ * the state shared by the reader thread and the writer (the calling
+ * thread). the reader fills slots at head, the writer drains them at tail.
+ */
+struct pipeline {
+   int in, out;
+   off_t in_off;
+   uint64_t len;
+   struct pipe_slot *slots;
+   int depth;
+   size_t block;
+
+   pthread_mutex_t lock;
+   pthread_cond_t filled;
+   pthread_cond_t emptied;
+   int head, tail, full;
+   int error;                 /* errno of the first failure, 0 if none */
+   double read_stall;         /* seconds the reader waited for a free buffer */
+};
+
+static void *pipeline_reader(void *arg) {
+   struct pipeline *p = (struct pipeline *)arg;
+   uint64_t left = p->len;
+
+   for (;;) {
+      pthread_mutex_lock(&p->lock);
+      if (p->full == p->depth && !p->error) {
+         double start = now_seconds();
+         while (p->full == p->depth && !p->error) {
+            pthread_cond_wait(&p->emptied, &p->lock);
+         }
+         p->read_stall += now_seconds() - start;
+      }
+      int stop = p->error;
+      pthread_mutex_unlock(&p->lock);
+      if (stop) break;
+
+      struct pipe_slot *slot = &p->slots[p->head];
+      size_t want = left > p->block ? p->block : (size_t)left;
+      ssize_t got = 0;
+      while (want > 0 && (size_t)got < want) {
+         ssize_t n = pread(p->in, slot->buf + got, want - (size_t)got, p->in_off + got);
+         if (n < 0 && errno == EINTR) continue;
+         if (n < 0) {
+            got = -1;
+            break;
+         }
+         if (n == 0) break;
+         got += n;
+      }
+
+      pthread_mutex_lock(&p->lock);
+      if (got < 0) {
+         if (!p->error) p->error = errno;
+      }
+      else {
+         slot->len = (size_t)got;
+         p->in_off += got;
+         left -= (uint64_t)got;
+         p->head = (p->head + 1) % p->depth;
+         p->full++;
+      }
+      pthread_cond_signal(&p->filled);
+      stop = got <= 0 || p->error;
+      pthread_mutex_unlock(&p->lock);
+      if (stop) break;
+   }
+
+   return NULL;
+}
+
+/*
+ * reads and writes at the same time: a reader thread keeps a ring of
+ * aligned buffers filled while this thread writes them out, so neither
+ * disk sits idle waiting for the other. stall counters show which side
+ * was the bottleneck.
+ */
+static int copy_with_pipeline(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                              struct wavutil_copy_options *copy) {
+   struct pipeline p = {0};
+   pthread_t reader;
+   double write_stall = 0, start = now_seconds();
+   int ret = 0;
+
+   p.in = in;
+   p.in_off = *in_off;
+   p.len = *len;
+   p.depth = copy_depth(copy);
+   p.block = copy_block_size(in, out, copy);
+   uint8_t *bufs = copy_buffers(p.block * (size_t)p.depth);
+   if (bufs == NULL) {
+      return -1;
+   }
+   if ((p.slots = calloc((size_t)p.depth, sizeof(*p.slots))) == NULL) {
+      errno = ENOMEM;
+      return -1;
+   }
+   for (int i = 0; i < p.depth; i++) {
+      p.slots[i].buf = bufs + p.block * (size_t)i;
+   }
+   pthread_mutex_init(&p.lock, NULL);
+   pthread_cond_init(&p.filled, NULL);
+   pthread_cond_init(&p.emptied, NULL);
+
+   if ((errno = pthread_create(&reader, NULL, pipeline_reader, &p))) {
+      ret = -1;
+      goto cleanup;
+   }
+
+   for (;;) {
+      pthread_mutex_lock(&p.lock);
+      if (p.full == 0 && !p.error) {
+         double wait = now_seconds();
+         while (p.full == 0 && !p.error) {
+            pthread_cond_wait(&p.filled, &p.lock);
+         }
+         write_stall += now_seconds() - wait;
+      }
+      int error = p.full == 0 ? p.error : 0;
+      pthread_mutex_unlock(&p.lock);
+      if (error) {
+         errno = error;
+         ret = -1;
+         break;
+      }
+
+      struct pipe_slot *slot = &p.slots[p.tail];
+      if (slot->len == 0) {
+         if (*len) {
+            errno = EIO;
+            ret = -1;
+         }
+         break;
+      }
+
+      size_t written = 0;
+      while (written < slot->len) {
+         ssize_t n = pwrite(out, slot->buf + written, slot->len - written, *out_off + (off_t)written);
+         if (n < 0) {
+            if (errno == EINTR) continue;
+            break;
+         }
+         written += (size_t)n;
+      }
+
+      pthread_mutex_lock(&p.lock);
+      if (written < slot->len) {
+         if (!p.error) p.error = errno;
+         pthread_cond_signal(&p.emptied);
+         pthread_mutex_unlock(&p.lock);
+         errno = p.error;
+         ret = -1;
+         break;
+      }
+      *in_off += (off_t)written;
+      *out_off += (off_t)written;
+      *len -= written;
+      p.tail = (p.tail + 1) % p.depth;
+      p.full--;
+      pthread_cond_signal(&p.emptied);
+      pthread_mutex_unlock(&p.lock);
+   }
+
+   int saved = errno;
+   pthread_join(reader, NULL);
+   errno = saved;
+
+   if (copy->report) {
+      wu_report("pipeline: %d x %zu byte buffers, %.3f s, reader stalled %.3f s, "
+                "writer stalled %.3f s\n", p.depth, p.block, now_seconds() - start,
+                p.read_stall, write_stall);
+   }
+
+cleanup:
+   saved = errno;
+   pthread_cond_destroy(&p.emptied);
+   pthread_cond_destroy(&p.filled);
+   pthread_mutex_destroy(&p.lock);
+   free(p.slots);
+   errno = saved;
+   return ret;
+}
+
+#ifdef HAVE_IO_URING
+/*
+ * a bare io_uring: the submission and completion rings mapped from the
+ * kernel, driven with the raw system calls so there is no dependency on
+ * liburing.
+ */
+struct uring {
+   int fd;
+   unsigned entries;
+   unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+   unsigned *cq_head, *cq_tail, *cq_mask;
+   struct io_uring_sqe *sqes;
+   struct io_uring_cqe *cqes;
+   void *sq_ring, *cq_ring;
+   size_t sq_len, cq_len, sqes_len;
+   unsigned queued;           /* sqes written but not yet submitted */
+};
+
+/*
+ * sets up a ring with room for entries submissions. returns -1 with errno
+ * set to ENOSYS when io_uring is missing or disabled.
+ */
+static int uring_init(struct uring *r, unsigned entries) {
+   struct io_uring_params params;
+
+   memset(r, 0, sizeof(*r));
+   memset(&params, 0, sizeof(params));
+   r->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+   if (r->fd < 0) {
+      if (errno == EPERM) errno = ENOSYS;
+      return -1;
+   }
+   r->entries = params.sq_entries;
+
+   r->sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   r->cq_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+   if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      if (r->cq_len > r->sq_len) r->sq_len = r->cq_len;
+      r->cq_len = r->sq_len;
+   }
+
+   r->sq_ring = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     r->fd, IORING_OFF_SQ_RING);
+   if (r->sq_ring == MAP_FAILED) goto fail;
+
+   if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      r->cq_ring = r->sq_ring;
+   }
+   else {
+      r->cq_ring = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        r->fd, IORING_OFF_CQ_RING);
+      if (r->cq_ring == MAP_FAILED) {
+         munmap(r->sq_ring, r->sq_len);
+         goto fail;
+      }
+   }
+
+   r->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+   r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  r->fd, IORING_OFF_SQES);
+   if (r->sqes == MAP_FAILED) {
+      if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_len);
+      munmap(r->sq_ring, r->sq_len);
+      goto fail;
+   }
+
+   uint8_t *sq = (uint8_t *)r->sq_ring, *cq = (uint8_t *)r->cq_ring;
+   r->sq_head  = (unsigned *)(sq + params.sq_off.head);
+   r->sq_tail  = (unsigned *)(sq + params.sq_off.tail);
+   r->sq_mask  = (unsigned *)(sq + params.sq_off.ring_mask);
+   r->sq_array = (unsigned *)(sq + params.sq_off.array);
+   r->cq_head  = (unsigned *)(cq + params.cq_off.head);
+   r->cq_tail  = (unsigned *)(cq + params.cq_off.tail);
+   r->cq_mask  = (unsigned *)(cq + params.cq_off.ring_mask);
+   r->cqes     = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+   return 0;
+
+fail:
+   {
+      int saved = errno;
+      close(r->fd);
+      errno = saved;
+   }
+   return -1;
+}
+
+static void uring_exit(struct uring *r) {
+   munmap(r->sqes, r->sqes_len);
+   if (r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_len);
+   munmap(r->sq_ring, r->sq_len);
+   close(r->fd);
+}
+
+/*
+ * returns a cleared submission entry, or NULL when the ring is full
+ */
+static struct io_uring_sqe *uring_sqe(struct uring *r) {
+   unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+   unsigned tail = *r->sq_tail + r->queued;
+   if (tail - head >= r->entries) return NULL;
+
+   unsigned idx = tail & *r->sq_mask;
+   struct io_uring_sqe *sqe = &r->sqes[idx];
+   memset(sqe, 0, sizeof(*sqe));
+   r->sq_array[idx] = idx;
+   r->queued++;
+   return sqe;
+}
+
+/*
+ * hands every queued entry to the kernel and waits for at least wait_nr
+ * completions. returns -1 with errno set on error.
+ */
+static int uring_submit(struct uring *r, unsigned wait_nr) {
+   unsigned submit = r->queued;
+   __atomic_store_n(r->sq_tail, *r->sq_tail + submit, __ATOMIC_RELEASE);
+   r->queued = 0;
+
+   while (submit > 0 || wait_nr > 0) {
+      long n = syscall(__NR_io_uring_enter, r->fd, submit, wait_nr,
+                       wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+      if (n < 0) {
+         if (errno == EINTR) continue;
+         return -1;
+      }
+      submit -= (unsigned)n;
+      wait_nr = 0;
+   }
+   return 0;
+}
+
+/*
+ * pops one completion. returns 0 if there was one, -1 if the ring is empty.
+ */
+static int uring_cqe(struct uring *r, struct io_uring_cqe *cqe) {
+   unsigned head = *r->cq_head;
+   if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return -1;
+
+   *cqe = r->cqes[head & *r->cq_mask];
+   __atomic_store_n(r->cq_head, head + 1, __ATOMIC_RELEASE);
+   return 0;
+}
+
+/* one linked read -> write pair of the io_uring copy */
+struct uring_slot {
+   uint64_t offset;           /* from the start of the copy */
+   size_t want;
+   int read_res;
+   int write_res;
+   int pending;               /* completions still to come */
+};
+
+/*
+ * queues a read of one block into the slot's buffer, linked to a write of
+ * the same buffer, so the kernel starts the write as soon as the read is
+ * done without a round trip through this thread. returns -1 with errno
+ * set to EBUSY, queueing nothing, when the ring has no room for the pair.
+ */
+static int uring_queue_pair(struct uring *r, int slot, struct uring_slot *s, uint8_t *buf,
+                            int fixed_files, int fixed_bufs, int in, off_t in_off, int out,
+                            off_t out_off) {
+   struct io_uring_sqe *rd = uring_sqe(r);
+   if (rd == NULL) {
+      errno = EBUSY;
+      return -1;
+   }
+   struct io_uring_sqe *wr = uring_sqe(r);
+   if (wr == NULL) {
+      r->queued--;
+      errno = EBUSY;
+      return -1;
+   }
+
+   rd->opcode = fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ;
+   rd->fd = fixed_files ? 0 : in;
+   rd->off = (uint64_t)(in_off + (off_t)s->offset);
+   rd->addr = (uint64_t)(uintptr_t)buf;
+   rd->len = (uint32_t)s->want;
+   rd->buf_index = (uint16_t)slot;
+   rd->flags = IOSQE_IO_LINK | (fixed_files ? IOSQE_FIXED_FILE : 0);
+   rd->user_data = (uint64_t)slot << 1;
+
+   wr->opcode = fixed_bufs ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+   wr->fd = fixed_files ? 1 : out;
+   wr->off = (uint64_t)(out_off + (off_t)s->offset);
+   wr->addr = (uint64_t)(uintptr_t)buf;
+   wr->len = (uint32_t)s->want;
+   wr->buf_index = (uint16_t)slot;
+   wr->flags = fixed_files ? IOSQE_FIXED_FILE : 0;
+   wr->user_data = (uint64_t)slot << 1 | 1;
+
+   s->pending = 2;
+   return 0;
+}
+
+/*
+ * copies with io_uring: up to depth linked read -> write pairs are in
+ * flight at once, reading into registered buffers from registered files.
+ * when the kernel refuses to register them (ex: memlock limits) plain
+ * reads and writes are used instead. pairs complete in any order, so only
+ * what lies below the first short read counts as copied.
+ */
+static int copy_with_uring(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                           struct wavutil_copy_options *copy) {
+   struct uring r;
+   int depth = copy_depth(copy);
+   size_t block = copy_block_size(in, out, copy);
+   int ret = 0, error = 0, eof = 0;
+
+   if (uring_init(&r, (unsigned)depth * 2)) {
+      return -1;
+   }
+
+   uint8_t *bufs = copy_buffers(block * (size_t)depth);
+   struct uring_slot *slots = calloc((size_t)depth, sizeof(*slots));
+   struct iovec *iov = calloc((size_t)depth, sizeof(*iov));
+   if (!slots || !iov || !bufs) {
+      free(slots);
+      free(iov);
+      uring_exit(&r);
+      errno = ENOMEM;
+      return -1;
+   }
+
+   for (int i = 0; i < depth; i++) {
+      iov[i].iov_base = bufs + block * (size_t)i;
+      iov[i].iov_len = block;
+   }
+   int fds[2] = { in, out };
+   int fixed_bufs = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, iov, depth) == 0;
+   int fixed_files = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_FILES, fds, 2) == 0;
+
+   uint64_t total = *len, queued = 0, hole = UINT64_MAX;
+   int inflight = 0;
+
+   for (;;) {
+      /* keep every free slot busy */
+      for (int i = 0; i < depth && !error && !eof && queued < total; i++) {
+         if (slots[i].pending) continue;
+         slots[i].offset = queued;
+         slots[i].want = total - queued > block ? block : (size_t)(total - queued);
+         if (uring_queue_pair(&r, i, &slots[i], (uint8_t *)iov[i].iov_base, fixed_files,
+                              fixed_bufs, in, *in_off, out, *out_off)) {
+            error = errno;
+            break;
+         }
+         queued += slots[i].want;
+         inflight++;
+      }
+      if (inflight == 0) break;
+
+      if (uring_submit(&r, 1)) {
+         error = errno;
+         break;
+      }
+
+      struct io_uring_cqe cqe;
+      while (uring_cqe(&r, &cqe) == 0) {
+         int i = (int)(cqe.user_data >> 1);
+         struct uring_slot *s = &slots[i];
+         if (cqe.user_data & 1) s->write_res = cqe.res;
+         else s->read_res = cqe.res;
+         if (--s->pending) continue;
+         inflight--;
+
+         if (s->read_res < 0) {
+            if (!error) error = -s->read_res;
+            continue;
+         }
+         if (s->write_res == (int)s->want) continue;
+         if (s->write_res < 0 && s->write_res != -ECANCELED) {
+            if (!error) error = -s->write_res;
+            continue;
+         }
+
+         /* a short read (the file shrank) cancels the linked write */
+         size_t got = (size_t)s->read_res;
+         size_t done = s->write_res > 0 ? (size_t)s->write_res : 0;
+         while (done < got) {
+            ssize_t n = pwrite(out, (uint8_t *)iov[i].iov_base + done, got - done,
+                               *out_off + (off_t)(s->offset + done));
+            if (n < 0) {
+               if (errno == EINTR) continue;
+               if (!error) error = errno;
+               break;
+            }
+            done += (size_t)n;
+         }
+         if (got < s->want) {
+            eof = 1;
+            if (s->offset + done < hole) hole = s->offset + done;
+         }
+      }
+   }
+
+   /* wait for anything still in flight before the buffers go away */
+   while (inflight > 0 && uring_submit(&r, 1) == 0) {
+      struct io_uring_cqe cqe;
+      while (uring_cqe(&r, &cqe) == 0) {
+         if (--slots[cqe.user_data >> 1].pending == 0) inflight--;
+      }
+   }
+
+   if (!error) {
+      uint64_t copied = hole < queued ? hole : queued;
+      *in_off += (off_t)copied;
+      *out_off += (off_t)copied;
+      *len -= copied;
+      if (*len) error = EIO;
+   }
+   if (error) ret = -1;
+
+#if (DEBUG)
+   fprintf(stderr, "io_uring: %d slots, fixed buffers %d, fixed files %d\n",
+           depth, fixed_bufs, fixed_files);
+#endif
+
+   uring_exit(&r);
+   free(iov);
+   free(slots);
+   errno = error;
+   return ret;
+}
+#else
+static int copy_with_uring(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                           struct wavutil_copy_options *copy) {
+   (void)in; (void)in_off; (void)out; (void)out_off; (void)len; (void)copy;
+   errno = ENOSYS;
+   return -1;
+}
+#endif
+
+#ifdef HAVE_IO_URING
+/* a ring sized for a number of files, two submissions each */
+struct wavutil_ring {
+   struct uring r;
+   unsigned files;
+};
+
+struct wavutil_ring *wavutil_ring_open(unsigned files) {
+   struct wavutil_ring *ring = calloc(1, sizeof(*ring));
+   if (ring == NULL) {
+      errno = ENOMEM;
+      return NULL;
+   }
+   if (uring_init(&ring->r, 2 * files)) {
+      free(ring);
+      return NULL;
+   }
+   ring->files = files;
+   return ring;
+}
+
+void wavutil_ring_close(struct wavutil_ring *ring) {
+   if (ring) {
+      uring_exit(&ring->r);
+      free(ring);
+   }
+}
+
+/*
+ * opens n files and reads the first BLOCK bytes of each with two rounds
+ * of batched submissions: every open, then a statx and a read for every
+ * file that opened. heads must hold n * BLOCK bytes and is registered
+ * with the ring when the kernel allows it. files that fail are left with
+ * fd -1 so the caller can go through the normal path and report why.
+ * returns -1 only if the ring itself failed.
+ */
+int wavutil_prefetch(struct wavutil_ring *ring, char **paths, size_t n, int flags, uint8_t *heads,
+                     struct wavutil_prefetch *pre) {
+   struct uring *r = &ring->r;
+   if (n > ring->files) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   struct statx *stx = calloc(n, sizeof(*stx));
+   if (!stx) return -1;
+
+   struct iovec iov = { heads, n * BLOCK };
+   int fixed = syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+
+   for (size_t i = 0; i < n; i++) {
+      struct io_uring_sqe *sqe = uring_sqe(r);
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (uint64_t)(uintptr_t)paths[i];
+      sqe->open_flags = (uint32_t)(flags | O_CLOEXEC);
+      sqe->user_data = i;
+      pre[i].fd = -1;
+      pre[i].head = heads + i * BLOCK;
+      pre[i].len = 0;
+   }
+
+   size_t opened = 0;
+   for (size_t left = n; left > 0; ) {
+      struct io_uring_cqe cqe;
+      if (uring_submit(r, 1)) goto fail;
+      while (left > 0 && uring_cqe(r, &cqe) == 0) {
+         pre[cqe.user_data].fd = cqe.res;
+         if (cqe.res >= 0) opened++;
+         left--;
+      }
+   }
+
+   for (size_t i = 0; i < n; i++) {
+      if (pre[i].fd < 0) continue;
+
+      struct io_uring_sqe *sqe = uring_sqe(r);
+      sqe->opcode = IORING_OP_STATX;
+      sqe->fd = pre[i].fd;
+      sqe->addr = (uint64_t)(uintptr_t)"";
+      sqe->statx_flags = AT_EMPTY_PATH;
+      sqe->len = STATX_SIZE;
+      sqe->off = (uint64_t)(uintptr_t)&stx[i];
+      sqe->user_data = i << 1;
+
+      sqe = uring_sqe(r);
+      sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe->fd = pre[i].fd;
+      sqe->addr = (uint64_t)(uintptr_t)pre[i].head;
+      sqe->len = BLOCK;
+      sqe->user_data = i << 1 | 1;
+   }
+
+   for (size_t left = opened * 2; left > 0; ) {
+      struct io_uring_cqe cqe;
+      if (uring_submit(r, 1)) goto fail;
+      while (left > 0 && uring_cqe(r, &cqe) == 0) {
+         size_t i = (size_t)(cqe.user_data >> 1);
+         if (cqe.res < 0) {
+            /* close it and let the normal path find out what is wrong */
+            if (pre[i].fd >= 0) close(pre[i].fd);
+            pre[i].fd = -1;
+         }
+         else if (cqe.user_data & 1) {
+            pre[i].len = (size_t)cqe.res;
+         }
+         left--;
+      }
+   }
+
+   for (size_t i = 0; i < n; i++) {
+      pre[i].file_size = stx[i].stx_size;
+   }
+   if (fixed) syscall(__NR_io_uring_register, r->fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+   free(stx);
+   return 0;
+
+fail:
+   /* the ring is unusable, hand back what was opened */
+   for (size_t i = 0; i < n; i++) {
+      if (pre[i].fd >= 0) close(pre[i].fd);
+      pre[i].fd = -1;
+   }
+   free(stx);
+   return -1;
+}
+#else
+struct wavutil_ring *wavutil_ring_open(unsigned files) {
+   (void)files;
+   errno = ENOSYS;
+   return NULL;
+}
+
+void wavutil_ring_close(struct wavutil_ring *ring) {
+   (void)ring;
+}
+
+int wavutil_prefetch(struct wavutil_ring *ring, char **paths, size_t n, int flags, uint8_t *heads,
+                     struct wavutil_prefetch *pre) {
+   (void)ring; (void)paths; (void)n; (void)flags; (void)heads; (void)pre;
+   errno = ENOSYS;
+   return -1;
+}
+#endif
+
+typedef int (*copy_fn)(int, off_t *, int, off_t *, uint64_t *, struct wavutil_copy_options *);
+
+static const copy_fn copy_fns[WAVUTIL_COPY_METHODS] = {
+   NULL,
+   copy_with_file_range,
+   copy_with_sendfile,
+   copy_with_splice,
+   copy_with_uring,
+   copy_with_buffer,
+   copy_with_pipeline
+};
+
+/*
+ * Copies len bytes from in at in_off to out at out_off with the method in
+ * copy. With WAVUTIL_COPY_AUTO every method is tried from the fastest down,
+ * continuing from wherever the previous one stopped. Returns the method
+ * that finished the copy, or -1 on a real I/O error.
+ */
+int wavutil_copy_range(int in, off_t in_off, int out, off_t out_off, uint64_t len,
+                       struct wavutil_copy_options *copy) {
+   struct wavutil_copy_options defaults = {0};
+   if (copy == NULL) copy = &defaults;
+   int method = copy->method;
+   int first = method == WAVUTIL_COPY_AUTO ? WAVUTIL_COPY_FILE_RANGE : method;
+   int last  = method == WAVUTIL_COPY_AUTO ? WAVUTIL_COPY_BUFFERED : method;
+
+   for (int m = first; m <= last; m++) {
+      if (copy_fns[m](in, &in_off, out, &out_off, &len, copy) == 0) {
+      #if (DEBUG)
+         fprintf(stderr, "copy strategy: %s\n", wavutil_copy_names[m]);
+      #endif
+         return m;
+      }
+      if (!copy_unsupported(errno)) {
+         return -1;
+      }
+   #if (DEBUG)
+      fprintf(stderr, "copy strategy %s unavailable: %s\n", wavutil_copy_names[m], strerror(errno));
+   #endif
+   }
+
+   return -1;
+}
+
+/*
+ * turns O_DIRECT on or off for fd. returns the old flags, or -1 with
+ * errno set (EINVAL when the filesystem does not do direct I/O).
+ */
+static int set_direct(int fd, int on) {
+   int flags = fcntl(fd, F_GETFL);
+   if (flags < 0) return -1;
+   if (fcntl(fd, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT) < 0) return -1;
+   return flags;
+}
+
+/*
+ * copies like the other copy functions but with O_DIRECT, so neither file
+ * goes through the page cache. direct I/O needs aligned offsets, lengths
+ * and memory, and neither end of the copy is aligned (the header is 44
+ * bytes, or longer), so:
+ *  - the output up to its first aligned offset, and the partial block at
+ *    the end, are copied normally
+ *  - everything in between is written with aligned writes, read with
+ *    aligned reads that start up to DIRECT_ALIGN bytes early, moving the
+ *    data down to the start of the buffer when the skew is not zero
+ * the file status flags are restored before returning.
+ */
+static int copy_direct(int in, off_t *in_off, int out, off_t *out_off, uint64_t *len,
+                       struct wavutil_copy_options *copy) {
+   uint64_t end = (uint64_t)*out_off + *len;
+   uint64_t body = ((uint64_t)*out_off + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+   if (body > end) body = end;
+   uint64_t tail = body + (end - body) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+   /* the unaligned head */
+   uint64_t head = body - (uint64_t)*out_off, left = head;
+   if (left && copy_with_buffer(in, in_off, out, out_off, &left, copy)) return -1;
+   *len -= head - left;
+
+   size_t block = (copy_block_size(in, out, copy) + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+   uint8_t *buf = copy_buffers(block + DIRECT_ALIGN);
+   if (buf == NULL) return -1;
+
+   int in_flags = set_direct(in, 1);
+   if (in_flags < 0) return -1;
+   int out_flags = set_direct(out, 1);
+   if (out_flags < 0) {
+      int saved = errno;
+      fcntl(in, F_SETFL, in_flags);
+      errno = saved;
+      return -1;
+   }
+
+   int error = 0;
+   while ((uint64_t)*out_off < tail) {
+      size_t want = tail - (uint64_t)*out_off > block ? block : (size_t)(tail - (uint64_t)*out_off);
+      size_t skew = (size_t)(*in_off % DIRECT_ALIGN);
+      size_t span = (skew + want + DIRECT_ALIGN - 1) / DIRECT_ALIGN * DIRECT_ALIGN;
+
+      ssize_t got = 0, r = 0;
+      while ((size_t)got < skew + want) {
+         r = pread(in, buf + got, span - (size_t)got, *in_off - (off_t)skew + got);
+         if (r < 0 && errno == EINTR) continue;
+         if (r <= 0) break;
+         got += r;
+      }
+      if ((size_t)got < skew + want) {
+         /* the input shrank, the tail copy finds that out and fails */
+         if (r < 0) error = errno;
+         break;
+      }
+      if (skew) memmove(buf, buf + skew, want);
+
+      size_t written = 0;
+      while (written < want) {
+         ssize_t w = pwrite(out, buf + written, want - written, *out_off + (off_t)written);
+         if (w < 0) {
+            if (errno == EINTR) continue;
+            error = errno;
+            break;
+         }
+         written += (size_t)w;
+      }
+      if (error) break;
+
+      *in_off += (off_t)want;
+      *out_off += (off_t)want;
+      *len -= want;
+   }
+
+   fcntl(in, F_SETFL, in_flags);
+   fcntl(out, F_SETFL, out_flags);
+   if (error) {
+      errno = error;
+      return -1;
+   }
+
+   /* the partial block at the end */
+   return *len ? copy_with_buffer(in, in_off, out, out_off, len, copy) : 0;
+}
+
+/*
+ * drops what the copy left in the page cache, so a bulk run does not
+ * push out the working set of everything else on the machine. the output
+ * has to reach the disk first since dirty pages can not be dropped.
+ */
+static void drop_cache(int in, int out) {
+   posix_fadvise(in, 0, 0, POSIX_FADV_DONTNEED);
+   if (fdatasync(out) == 0) {
+      posix_fadvise(out, 0, 0, POSIX_FADV_DONTNEED);
+   }
+}
+
+/*
+ * this function writes the audio data to the newly created wav files,
+ * starting at out_off (the header of the new file may be longer, ex: a
+ * ds64 chunk was added). everything after the header is moved with
+ * wavutil_copy_range so the payload never has to pass through a userspace
+ * buffer when the kernel can help. returns 0 on success and -1 on error.
+ */
+static int write_data(const char *name, const wavutil_info *info, int in, int out, off_t out_off,
+                      struct wavutil_copy_options *copy, const struct wavutil_map *map) {
+   uint64_t len = info->file_size - info->data_offset;
+   struct wavutil_copy_options defaults = {0};
+   if (copy == NULL) copy = &defaults;
+
+   /* around the page cache, or through it and then out of it again */
+   if (copy->direct) {
+      off_t in_off = (off_t)info->data_offset;
+      int ret = copy_direct(in, &in_off, out, &out_off, &len, copy);
+      if (ret && copy_unsupported(errno)) {
+      #if (DEBUG)
+         fprintf(stderr, "O_DIRECT unavailable for %s: %s\n", name, strerror(errno));
+      #endif
+         ret = wavutil_copy_range(in, in_off, out, out_off, len, copy) < 0 ? -1 : 0;
+      }
+      if (ret) {
+         wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+         return -1;
+      }
+      drop_cache(in, out);
+      return 0;
+   }
+
+   /*
+    * everything after the header the mapping covers is written straight
+    * out of it, the rest (past a prefetched map) is copied from the file
+    */
+   off_t in_off = (off_t)info->data_offset;
+   if (map && map->base && map->size > info->data_offset) {
+      const uint8_t *src = map->base + info->data_offset;
+      size_t left = map->size - info->data_offset;
+      if (left > len) left = (size_t)len;
+      len -= left;
+      in_off += (off_t)left;
+      while (left > 0) {
+         ssize_t n = pwrite(out, src, left > COPY_MAX_CHUNK ? COPY_MAX_CHUNK : left, out_off);
+         if (n < 0) {
+            if (errno == EINTR) continue;
+            wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+            return -1;
+         }
+         src += n;
+         left -= (size_t)n;
+         out_off += n;
+      }
+   }
+   if (len == 0) return 0;
+
+   /* the audio data and any chunks after it */
+   if (wavutil_copy_range(in, in_off, out, out_off, len, copy) < 0) {
+      wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+/*
+ * makes out a copy on write clone of in. returns -1 with errno set when
+ * the filesystem (or kernel) can not share extents between the two.
+ */
+int wavutil_clone(int in, int out) {
+#if defined(__linux__) && defined(FICLONE)
+   return ioctl(out, FICLONE, in);
+#else
+   (void)in; (void)out;
+   errno = EOPNOTSUPP;
+   return -1;
+#endif
+}
+
+int64_t wavutil_dedupe(int in, uint64_t in_off, int out, uint64_t out_off, uint64_t len) {
+#if defined(__linux__) && defined(FIDEDUPERANGE)
+   struct stat st;
+   if (fstat(out, &st)) {
+      wu_log("Failed to stat output\n");
+      return -1;
+   }
+   uint64_t block = st.st_blksize > 0 ? (uint64_t)st.st_blksize : 4096;
+   if (in_off % block != out_off % block) {
+      errno = EINVAL;
+      return -1;
+   }
+
+   /* round the range in to whole blocks */
+   uint64_t skip = (block - in_off % block) % block;
+   if (len <= skip) return 0;
+   in_off += skip;
+   out_off += skip;
+   len = (len - skip) / block * block;
+
+   struct {
+      struct file_dedupe_range range;
+      struct file_dedupe_range_info info;
+   } req;
+   uint64_t shared = 0;
+   while (shared < len) {
+      memset(&req, 0, sizeof(req));
+      req.range.src_offset = in_off + shared;
+      req.range.src_length = len - shared;
+      req.range.dest_count = 1;
+      req.info.dest_fd = out;
+      req.info.dest_offset = out_off + shared;
+      if (ioctl(in, FIDEDUPERANGE, &req) < 0) {
+         return -1;
+      }
+      if (req.info.status == FILE_DEDUPE_RANGE_DIFFERS) {
+         errno = EBADE;
+         return -1;
+      }
+      if (req.info.status < 0) {
+         errno = -req.info.status;
+         return -1;
+      }
+      /* filesystems share at most a few MB per call */
+      if (req.info.bytes_deduped == 0) break;
+      shared += req.info.bytes_deduped;
+   }
+   return (int64_t)shared;
+#else
+   (void)in; (void)in_off; (void)out; (void)out_off; (void)len;
+   errno = EOPNOTSUPP;
+   return -1;
+#endif
+}
+
+/*
+ * writes the modified wav file using the requested strategy and returns
+ * the strategy that was actually used, or -1 on error. a refused reflink
+ * under auto falls back to writing the header and copying the audio data.
+ */
+int wavutil_write(const char *name, int original, const wavutil_info *info,
+                  const wavutil_header *edited, enum wavutil_output_strategy strategy,
+                  struct wavutil_copy_options *copy, const struct wavutil_map *map) {
+   if (strategy != WAVUTIL_OUTPUT_COPY) {
+      wu_trace("create", 1, 0);
+      int out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      wu_trace("create", 0, 0);
+      if (out < 0) {
+         wu_log("Failed to create %s\n", name);
+         return -1;
+      }
+
+      wu_trace("clone", 1, 0);
+      if (wavutil_clone(original, out) == 0) {
+         /* the clone still has the original header */
+         ssize_t patched = wavutil_patch(out, info, edited);
+         wu_trace("clone", 0, patched > 0 ? (uint64_t)patched : 0);
+         if (patched < 0) {
+            wu_log("Patching the header of %s failed: %s\n", name, strerror(errno));
+            close(out);
+            return -1;
+         }
+         wu_trace("close", 1, 0);
+         close(out);
+         wu_trace("close", 0, 0);
+         return WAVUTIL_OUTPUT_REFLINK;
+      }
+      wu_trace("clone", 0, 0);
+
+      if (strategy == WAVUTIL_OUTPUT_REFLINK) {
+         wu_log("Cloning into %s failed: %s\n", name, strerror(errno));
+         close(out);
+         return -1;
+      }
+   #if (DEBUG)
+      fprintf(stderr, "reflink unavailable: %s\n", strerror(errno));
+   #endif
+      close(out);
+   }
+
+   /* create the modified file with the altered header data */
+   wu_trace("create", 1, 0);
+   FILE *modified = wavutil_create(name, original, info, edited, info->data_size);
+   if (modified == NULL) {
+      wu_trace("create", 0, 0);
+      return -1;
+   }
+
+   /* the header is still sitting in the stdio buffer */
+   int ret = -1;
+   if (fflush(modified)) {
+      wu_trace("create", 0, 0);
+      wu_log("Writing header to %s failed\n", name);
+   }
+   else {
+      off_t header = ftello(modified);
+      wu_trace("create", 0, (uint64_t)header);
+
+      /* write the audio data to the new files */
+      wu_trace("copy", 1, 0);
+      ret = write_data(name, info, original, fileno(modified), header, copy, map);
+      wu_trace("copy", 0, ret == 0 ? info->file_size - info->data_offset : 0);
+   }
+
+   /* close the modified file */
+   wu_trace("close", 1, 0);
+   if (fclose(modified) && ret == 0) {
+      wu_log("Closing %s failed: %s\n", name, strerror(errno));
+      ret = -1;
+   }
+   wu_trace("close", 0, 0);
+
+   return ret < 0 ? -1 : WAVUTIL_OUTPUT_COPY;
+}
+
+/*
+ * like wavutil_write with the copy strategy, into a file the caller
+ * opened: the edited header is written at the start of out and the audio
+ * data after it. returns 0 on success and -1 on error.
+ */
+int wavutil_write_fd(int in, const wavutil_info *info, const wavutil_header *edited, int out,
+                     struct wavutil_copy_options *copy, const struct wavutil_map *map) {
+   size_t len;
+   wu_trace("create", 1, 0);
+   uint8_t *prefix = wavutil_prefix(in, info, edited, info->data_size, &len);
+   if (prefix == NULL) {
+      wu_trace("create", 0, 0);
+      return -1;
+   }
+   preallocate(out, info, len, info->data_size, "output");
+
+   if (write_at(out, prefix, len, 0)) {
+      wu_trace("create", 0, 0);
+      wu_log("Writing header failed: %s\n", strerror(errno));
+      free(prefix);
+      return -1;
+   }
+   free(prefix);
+   wu_trace("create", 0, len);
+
+   wu_trace("copy", 1, 0);
+   int ret = write_data("output", info, in, out, (off_t)len, copy, map);
+   wu_trace("copy", 0, ret == 0 ? info->file_size - info->data_offset : 0);
+   return ret;
+}
+
+/*
+ * the sample format of a file. WAVE_FORMAT_EXTENSIBLE files say whether
+ * their samples are integers or floats in their sub format.
+ */
+enum wavutil_sample_format wavutil_file_format(int fd, const struct wavutil_map *map,
+                                               const wavutil_info *info) {
+   const struct wavutil_chunk_entry *c = &info->chunks[info->fmt];
+   struct wavutil_fmt_chunk f = info->header.f;
+   uint16_t sub;
+
+   if (f.audioFormat == WAVE_FORMAT_EXTENSIBLE) {
+      if (c->size < EXTENSIBLE_SIZE ||
+          read_at(fd, map, &sub, sizeof(sub), c->offset + CHUNK_HEADER_SIZE + EXTENSIBLE_SUB_FORMAT) ||
+          sub == WAVE_FORMAT_EXTENSIBLE) {
+         return WAVUTIL_SAMPLE_UNKNOWN;
+      }
+      f.audioFormat = sub;
+   }
+   return wavutil_sample_format(&f);
+}
+
+/*
+ * converts samples samples of audio data, starting at out_off in out,
+ * one block at a time through the thread's copy buffer (only the output
+ * half of it when the whole data chunk is in map).
+ */
+static int convert_data(const char *name, int in, const struct wavutil_map *map,
+                        const wavutil_info *info, enum wavutil_sample_format from, int out,
+                        uint64_t out_off, enum wavutil_sample_format to, uint64_t samples,
+                        struct wavutil_copy_options *copy) {
+   size_t in_size = wavutil_sample_size(from), out_size = wavutil_sample_size(to);
+   size_t channels = info->header.f.numChannels;
+   uint64_t in_off = info->data_offset;
+
+   /* whole frames, and at least one however small the block size was set */
+   size_t block = copy_block_size(in, out, copy) / (in_size > out_size ? in_size : out_size);
+   block = block / channels * channels;
+   if (block < channels) block = channels;
+
+   const uint8_t *mapped = NULL;
+   if (map && map->base && map->size >= in_off && map->size - in_off >= samples * in_size) {
+      mapped = map->base + in_off;
+   }
+
+   size_t in_bytes = mapped ? 0 : (block * in_size + BUFFER_ALIGN - 1) / BUFFER_ALIGN * BUFFER_ALIGN;
+   uint8_t *buf = copy_buffers(in_bytes + block * out_size);
+   if (buf == NULL) {
+      return -1;
+   }
+
+   for (uint64_t done = 0; done < samples; ) {
+      size_t n = samples - done > block ? block : (size_t)(samples - done);
+      const uint8_t *src = mapped ? mapped + done * in_size : buf;
+
+      errno = 0;
+      if (!mapped && read_at(in, NULL, buf, n * in_size, in_off)) {
+         wu_log("Reading audio data failed: %s\n", errno ? strerror(errno) : "short read");
+         if (errno == 0) errno = EIO;
+         return -1;
+      }
+      wavutil_convert_samples(buf + in_bytes, to, src, from, n);
+      if (write_at(out, buf + in_bytes, n * out_size, out_off)) {
+         wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+         return -1;
+      }
+
+      done += n;
+      in_off += n * in_size;
+      out_off += n * out_size;
+   }
+   return 0;
+}
+
+/*
+ * writes a copy of the file with its samples converted to format: the
+ * rewritten header, the converted data chunk, then whatever chunks came
+ * after the original one. returns 0 on success and -1 on error.
+ */
+int wavutil_convert(const char *name, int in, const wavutil_info *info,
+                    const struct wavutil_map *map, enum wavutil_sample_format format,
+                    struct wavutil_copy_options *copy) {
+   struct wavutil_copy_options defaults = {0};
+   if (copy == NULL) copy = &defaults;
+   enum wavutil_sample_format from = wavutil_file_format(in, map, info);
+   size_t in_size = wavutil_sample_size(from);
+   unsigned channels = info->header.f.numChannels;
+
+   if (in_size == 0 || channels == 0) {
+      wu_log("Unsupported sample format: audioFormat %u, %u bits, %u channels\n",
+             info->header.f.audioFormat, info->header.f.bitsPerSample, channels);
+      errno = EINVAL;
+      return -1;
+   }
+
+   wavutil_header edited = info->header;
+   if (wavutil_set_sample_format(&edited.f, format)) {
+      wu_log("Unsupported sample format: %d\n", (int)format);
+      return -1;
+   }
+
+   /* a partial frame at the end of the data chunk is dropped */
+   uint64_t samples = info->data_size / (in_size * channels) * channels;
+   uint64_t data_size = samples * wavutil_sample_size(format);
+
+   size_t len;
+   uint8_t *prefix = wavutil_prefix(in, info, &edited, data_size, &len);
+   if (prefix == NULL) {
+      return -1;
+   }
+
+   /* a ds64 chunk inserted in front of everything moved the fmt chunk along */
+   if (edited.f.audioFormat == WAVE_FORMAT_EXTENSIBLE) {
+      uint8_t *body = prefix + info->chunks[info->fmt].offset + (len - info->data_offset) +
+                      CHUNK_HEADER_SIZE;
+      uint16_t valid = edited.f.bitsPerSample;
+      uint16_t sub = wavutil_sample_is_float(format) ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+      memcpy(body + EXTENSIBLE_VALID_BITS, &valid, sizeof(valid));
+      memcpy(body + EXTENSIBLE_SUB_FORMAT, &sub, sizeof(sub));
+   }
+
+   int out = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+   if (out < 0) {
+      wu_log("Failed to create %s\n", name);
+      free(prefix);
+      return -1;
+   }
+   preallocate(out, info, len, data_size, name);
+
+   int ret = -1;
+   if (write_at(out, prefix, len, 0)) {
+      wu_log("Writing header to %s failed: %s\n", name, strerror(errno));
+      goto done;
+   }
+   if (convert_data(name, in, map, info, from, out, len, format, samples, copy)) {
+      goto done;
+   }
+
+   /* the pad byte of an odd sized data chunk, then the chunks after it */
+   uint64_t out_off = len + data_size;
+   if ((data_size & 1) && write_at(out, "", 1, out_off++)) {
+      wu_log("Writing audio data to %s failed: %s\n", name, strerror(errno));
+      goto done;
+   }
+   uint64_t data_end = info->data_offset + info->data_size + (info->data_size & 1);
+   if (info->file_size > data_end &&
+       wavutil_copy_range(in, (off_t)data_end, out, (off_t)out_off, info->file_size - data_end,
+                          copy) < 0) {
+      wu_log("Writing trailing chunks to %s failed: %s\n", name, strerror(errno));
+      goto done;
+   }
+   ret = 0;
+
+done:
+   free(prefix);
+   if (close(out) && ret == 0) {
+      wu_log("Closing %s failed: %s\n", name, strerror(errno));
+      ret = -1;
+   }
+   return ret;
+}
+
+/*
+ * wavutil_read on bytes the caller already has: the first len bytes of
+ * a file that is file_size bytes long. returns -1 if any chunk header
+ * lies past len.
+ */
+int wavutil_parse(const void *buf, size_t len, uint64_t file_size, wavutil_info *info) {
+   struct wavutil_map map = {0};
+   map.base = (uint8_t *)buf;
+   map.file_size = file_size;
+   map.size = len < file_size ? len : (size_t)file_size;
+   return wavutil_read(-1, &map, info);
+}
+
+void wavutil_thread_done(void) {
+   free(copy_buffer);
+   copy_buffer = NULL;
+   copy_buffer_size = 0;
+}
@@ -0,0 +1,479 @@
+/*
+ * libwavutil: read, verify, edit and rewrite wav file headers in process.
+ *
+ * the parser walks the RIFF tree of a file (RIFF or RF64/BW64) and fills
+ * in a wavutil_info; the writer produces a copy with an edited header, or
+ * patches the header of a file in place. nothing here exits or prints to
+ * stdout: functions return -1 with errno set, and describe what went
+ * wrong through the log callback (stderr unless changed) and
+ * wavutil_error(). everything is safe to call from several threads at
+ * once on different files.
+ *
+ * the layout of the structs below is part of the API. it only changes
+ * with WAVUTIL_VERSION_MAJOR (and the soname along with it).
+ */
+#ifndef WAVUTIL_H
+#define WAVUTIL_H
+
+#include <stdio.h> /* FILE */
+#include <stdint.h> /* uint types */
+#include <sys/types.h> /* off_t, ssize_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WAVUTIL_VERSION_MAJOR 1
+#define WAVUTIL_VERSION_MINOR 0
+
+#if defined(__GNUC__)
+#define WAVUTIL_API __attribute__((visibility("default")))
+#else
+#define WAVUTIL_API
+#endif
+
+#define WAVUTIL_ID_LEN 4 /* chunk IDs */
+#define WAVUTIL_HEAD_SIZE 4096 /* bytes of each file read by wavutil_prefetch */
+
+/* RIFF definitions */
+struct wavutil_riff_chunk {
+   char chunkID[WAVUTIL_ID_LEN];
+   uint32_t chunkSize;
+   char format[WAVUTIL_ID_LEN];
+};
+
+/* RF64/BW64 definitions, for files bigger than 4gb */
+struct wavutil_ds64_chunk {
+   char chunkID[WAVUTIL_ID_LEN];
+   uint32_t chunkSize;
+   uint32_t riffSizeLow;
+   uint32_t riffSizeHigh;
+   uint32_t dataSizeLow;
+   uint32_t dataSizeHigh;
+   uint32_t sampleCountLow;
+   uint32_t sampleCountHigh;
+   uint32_t tableLength;
+};
+
+/* fmt definitions */
+struct wavutil_fmt_chunk {
+   char chunkID[WAVUTIL_ID_LEN];
+   uint32_t chunkSize;
+   uint16_t audioFormat;
+   uint16_t numChannels;
+   uint32_t sampleRate;
+   uint32_t byteRate;
+   uint16_t blockAlign;
+   uint16_t bitsPerSample;
+};
+
+/* data definitions */
+struct wavutil_data_chunk {
+   char chunkID[WAVUTIL_ID_LEN];
+   uint32_t chunkSize;
+};
+
+/* the wav file containing the 3 chunks */
+typedef struct wavutil_header_t {
+   struct wavutil_riff_chunk r;
+   struct wavutil_fmt_chunk f;
+   struct wavutil_data_chunk d;
+}wavutil_header;
+
+/* a chunk found while walking the RIFF tree */
+struct wavutil_chunk_entry {
+   char id[WAVUTIL_ID_LEN];
+   uint64_t size;      /* size of the chunk body, from ds64 if need be */
+   uint64_t offset;    /* file offset of the 8 byte chunk header */
+};
+
+/*
+ * everything known about a wav file after walking its chunks. header
+ * holds the riff, fmt and data chunk headers wherever they were found,
+ * the chunk table holds every chunk in file order.
+ */
+typedef struct wavutil_info_t {
+   wavutil_header header;
+   struct wavutil_chunk_entry *chunks;
+   size_t num_chunks;
+   int fmt;               /* index of the fmt chunk, -1 if missing */
+   int data;              /* index of the data chunk, -1 if missing */
+   int ds64;              /* index of the ds64 chunk, -1 if not RF64 */
+   uint64_t riff_size;    /* size of the RIFF/RF64 chunk */
+   uint64_t file_size;
+   uint64_t data_offset;  /* first byte of audio data */
+   uint64_t data_size;    /* bytes of audio data actually in the file */
+} wavutil_info;
+
+/*
+ * a read only mapping of a wav file. data points into the mapping, so
+ * the audio data can be read without copying it anywhere. a map can also
+ * wrap the first bytes of a file read ahead of time, in which case size
+ * is smaller than file_size and anything past it is read from the file.
+ */
+struct wavutil_map {
+   uint8_t *base;
+   size_t size;
+   uint64_t file_size;
+   const uint8_t *data;   /* first byte of audio data */
+   size_t data_size;      /* bytes of audio data inside the mapping */
+};
+
+/*
+ * a file opened ahead of time along with the start of its contents, so
+ * the header can be parsed without any more system calls.
+ */
+struct wavutil_prefetch {
+   int fd;                    /* -1 if it could not be opened */
+   uint64_t file_size;
+   uint8_t *head;             /* the first len bytes of the file */
+   size_t len;
+};
+
+/*
+ * ways the audio data can be moved from the original file to the
+ * modified file. auto tries them in order, falling back whenever the
+ * kernel or filesystem refuses one.
+ */
+enum wavutil_copy_method {
+   WAVUTIL_COPY_AUTO,
+   WAVUTIL_COPY_FILE_RANGE,
+   WAVUTIL_COPY_SENDFILE,
+   WAVUTIL_COPY_SPLICE,
+   WAVUTIL_COPY_URING,
+   WAVUTIL_COPY_BUFFERED,
+   WAVUTIL_COPY_PIPELINE,             /* only when asked for, auto stops at buffered */
+   WAVUTIL_COPY_METHODS
+};
+
+WAVUTIL_API extern const char *const wavutil_copy_names[WAVUTIL_COPY_METHODS];
+
+/*
+ * how a modified file is produced. reflink clones the original (sharing
+ * its extents on btrfs/XFS) and then patches the header, copy writes the
+ * header and copies the audio data, auto tries reflink first.
+ */
+enum wavutil_output_strategy {
+   WAVUTIL_OUTPUT_AUTO,
+   WAVUTIL_OUTPUT_REFLINK,
+   WAVUTIL_OUTPUT_COPY,
+   WAVUTIL_OUTPUT_STRATEGIES
+};
+
+WAVUTIL_API extern const char *const wavutil_output_names[WAVUTIL_OUTPUT_STRATEGIES];
+
+/* how the samples of the data chunk are stored */
+enum wavutil_sample_format {
+   WAVUTIL_SAMPLE_UNKNOWN,
+   WAVUTIL_SAMPLE_S16,                /* integer PCM */
+   WAVUTIL_SAMPLE_S24,                /* integer PCM, 3 bytes per sample */
+   WAVUTIL_SAMPLE_S32,                /* integer PCM */
+   WAVUTIL_SAMPLE_F32,                /* IEEE float */
+   WAVUTIL_SAMPLE_F64,                /* IEEE float */
+   WAVUTIL_SAMPLE_U8,                 /* integer PCM, unsigned with 128 as zero */
+   WAVUTIL_SAMPLE_FORMATS
+};
+
+WAVUTIL_API extern const char *const wavutil_sample_names[WAVUTIL_SAMPLE_FORMATS];
+
+/*
+ * how a copy moves the audio data, passed to every call that copies.
+ * zeroed (or a NULL pointer) is the default: auto, a block size probed
+ * from the files and 4 buffers. the copies fill in tuned, so threads
+ * sharing one struct tune once; set the rest before the first copy.
+ */
+struct wavutil_copy_options {
+   enum wavutil_copy_method method;
+   size_t block_size;         /* bytes per copy buffer, 0 to probe the files */
+   int depth;                 /* buffers in the pipeline or io_uring ring, 0 for 4 */
+   int report;                /* log the block size and pipeline stall counters */
+   int tune;                  /* ramp the block size up while measuring */
+   int direct;                /* bypass the page cache with O_DIRECT */
+   size_t tuned;              /* the size tuning settled on, 0 until then */
+};
+
+/* (major << 16) | minor of the library that is actually loaded */
+WAVUTIL_API int wavutil_version(void);
+
+/*
+ * every failure is described in one line (without a newline) passed to
+ * fn, which defaults to printing it on stderr. so are the reports asked
+ * for with wavutil_copy_options.report. NULL silences the library.
+ */
+typedef void (*wavutil_log_fn)(void *ctx, const char *msg);
+WAVUTIL_API void wavutil_set_log(wavutil_log_fn fn, void *ctx);
+
+/* the last failure described on this thread, "" if there was none */
+WAVUTIL_API const char *wavutil_error(void);
+
+/*
+ * called on the working thread as each step of wavutil_write and
+ * wavutil_write_fd starts (begin 1) and ends (begin 0, with the bytes it
+ * wrote): "create" opens the output and writes its header, "clone"
+ * reflinks the original and patches the clone, "copy" moves the audio
+ * data and "close" closes the output. NULL, the default, turns it off.
+ */
+typedef void (*wavutil_trace_fn)(void *ctx, const char *step, int begin, uint64_t bytes);
+WAVUTIL_API void wavutil_set_trace(wavutil_trace_fn fn, void *ctx);
+
+/*
+ * reading. wavutil_read walks the chunks of an open file, through map
+ * when it is not NULL; wavutil_parse does the same for the first len
+ * bytes of a file held by the caller, and fails if the chunks do not all
+ * fit in them. both return 0 on success and -1 on error, and the info is
+ * released with wavutil_free.
+ */
+WAVUTIL_API int wavutil_map(int fd, struct wavutil_map *map);
+WAVUTIL_API void wavutil_unmap(struct wavutil_map *map);
+WAVUTIL_API void wavutil_prefetch_map(const struct wavutil_prefetch *pre, struct wavutil_map *map);
+WAVUTIL_API int wavutil_read(int fd, const struct wavutil_map *map, wavutil_info *info);
+WAVUTIL_API int wavutil_parse(const void *buf, size_t len, uint64_t file_size, wavutil_info *info);
+WAVUTIL_API void wavutil_free(wavutil_info *info);
+WAVUTIL_API int wavutil_is_rf64(const char *id);
+
+/*
+ * checks that info describes a wav file. each problem is printed to out
+ * (when it is not NULL) and the number of problems is returned.
+ */
+WAVUTIL_API int wavutil_verify(FILE *out, const wavutil_info *info);
+
+/*
+ * editing. wavutil_edit applies one field=value edit (ex: sampleRate=48000)
+ * to a header; wavutil_patch writes only the bytes that differ between
+ * info's header and edited into the file and returns how many it wrote;
+ * wavutil_backup saves everything in front of the audio data to name.
+ */
+WAVUTIL_API int wavutil_edit(wavutil_header *header, const char *edit);
+WAVUTIL_API ssize_t wavutil_patch(int fd, const wavutil_info *info, const wavutil_header *edited);
+WAVUTIL_API int wavutil_backup(const char *name, int fd, const wavutil_info *info);
+
+/*
+ * the header of an output file whose data chunk holds data_size bytes,
+ * promoted to RF64 when it no longer fits 32 bit sizes. the caller frees
+ * it; *len is its size.
+ */
+WAVUTIL_API uint8_t *wavutil_prefix(int fd, const wavutil_info *info, const wavutil_header *edited,
+                                    uint64_t data_size, size_t *len);
+
+/*
+ * writing. wavutil_create makes name and writes the edited header to it,
+ * ready for data_size bytes of audio data. wavutil_write writes a whole
+ * modified copy to name with the given strategy and returns the strategy
+ * used; wavutil_write_fd does the same into an open, empty file. copy
+ * may be NULL for the default copy options. map may be NULL; when it is
+ * not the audio data is written out of it.
+ */
+WAVUTIL_API FILE *wavutil_create(const char *name, int fd, const wavutil_info *info,
+                                 const wavutil_header *header, uint64_t data_size);
+WAVUTIL_API int wavutil_write(const char *name, int fd, const wavutil_info *info,
+                              const wavutil_header *edited, enum wavutil_output_strategy strategy,
+                              struct wavutil_copy_options *copy, const struct wavutil_map *map);
+WAVUTIL_API int wavutil_write_fd(int in, const wavutil_info *info, const wavutil_header *edited,
+                                 int out, struct wavutil_copy_options *copy,
+                                 const struct wavutil_map *map);
+
+/*
+ * copies len bytes between two files with the method in copy (auto when
+ * it is NULL), returning the method that finished the copy;
+ * wavutil_clone makes out a copy on write clone of in.
+ */
+WAVUTIL_API int wavutil_copy_range(int in, off_t in_off, int out, off_t out_off, uint64_t len,
+                                   struct wavutil_copy_options *copy);
+WAVUTIL_API int wavutil_clone(int in, int out);
+
+/*
+ * shares the storage of len bytes of out with the same bytes of in
+ * (FIDEDUPERANGE), leaving both files' contents as they were. only whole
+ * filesystem blocks can be shared, so the offsets must sit at the same
+ * place within a block (EINVAL otherwise) and the partial blocks at
+ * either end are skipped. the kernel compares the bytes first: EBADE if
+ * they differ. returns the number of bytes now shared, or -1.
+ */
+WAVUTIL_API int64_t wavutil_dedupe(int in, uint64_t in_off, int out, uint64_t out_off,
+                                   uint64_t len);
+
+/*
+ * sample formats. wavutil_sample_format reads one from a fmt chunk
+ * (WAVE_FORMAT_EXTENSIBLE counts as integer PCM) and
+ * wavutil_set_sample_format rewrites audioFormat, bitsPerSample,
+ * blockAlign and byteRate for another; wavutil_sample_size is the bytes
+ * per sample, 0 for WAVUTIL_SAMPLE_UNKNOWN.
+ */
+WAVUTIL_API enum wavutil_sample_format wavutil_sample_format(const struct wavutil_fmt_chunk *f);
+WAVUTIL_API int wavutil_set_sample_format(struct wavutil_fmt_chunk *f,
+                                          enum wavutil_sample_format format);
+WAVUTIL_API size_t wavutil_sample_size(enum wavutil_sample_format format);
+WAVUTIL_API int wavutil_sample_is_float(enum wavutil_sample_format format);
+
+/* the sample format of a file, reading the sub format of WAVE_FORMAT_EXTENSIBLE */
+WAVUTIL_API enum wavutil_sample_format wavutil_file_format(int fd, const struct wavutil_map *map,
+                                                   const wavutil_info *info);
+
+/*
+ * converts n samples between two formats (src and dst must not overlap).
+ * integers are scaled to [-1, 1) and back with rounding and clipping.
+ * the integer <-> float32 pairs use the best SIMD kernels the CPU has:
+ * wavutil_simd names them and wavutil_set_simd forces others (avx2,
+ * sse4.1, neon or scalar), returning -1 if they are not available.
+ */
+WAVUTIL_API int wavutil_convert_samples(void *dst, enum wavutil_sample_format to, const void *src,
+                                        enum wavutil_sample_format from, size_t n);
+WAVUTIL_API const char *wavutil_simd(void);
+WAVUTIL_API int wavutil_set_simd(const char *name);
+
+/*
+ * writes a copy of the file to name with its samples converted to
+ * format, block by block (out of map when it is not NULL). the fmt chunk
+ * is rewritten, the data chunk resized (promoting the file to RF64 when
+ * it outgrows 32 bit sizes) and every other chunk kept. the blocks are
+ * the block size of copy (NULL for the default). returns 0 on success
+ * and -1 on error.
+ */
+WAVUTIL_API int wavutil_convert(const char *name, int fd, const wavutil_info *info,
+                                const struct wavutil_map *map, enum wavutil_sample_format format,
+                                struct wavutil_copy_options *copy);
+
+/* one output of wavutil_split_channels: channels of the input, 0 based, in this order */
+struct wavutil_channels {
+   const char *name;
+   const unsigned *channels;  /* a channel can be given more than once */
+   unsigned count;
+};
+
+/*
+ * writes channels of a file to n files in one pass over its audio data
+ * (out of map when it is not NULL), ex: a 16 channel file into 16 mono
+ * files, or channels 3 and 4 alone. each output keeps the other chunks,
+ * with numChannels, blockAlign, byteRate and the channel mask of the fmt
+ * chunk rewritten and the data chunk resized. samples are moved whole
+ * whatever their format. returns 0 on success and -1 on error.
+ */
+WAVUTIL_API int wavutil_split_channels(int fd, const wavutil_info *info,
+                                       const struct wavutil_map *map,
+                                       const struct wavutil_channels *outputs, unsigned n);
+
+/*
+ * the other way around: writes the channels of n files side by side to
+ * name, those of fds[0] first. the inputs must have the same sample
+ * format and rate; shorter ones are padded with silence. the other
+ * chunks are those of the first input. returns 0 on success and -1 on
+ * error.
+ */
+WAVUTIL_API int wavutil_interleave(const char *name, const int *fds, const wavutil_info *infos,
+                                   unsigned n);
+
+/*
+ * writes a copy of the file to name with its audio resampled to rate Hz
+ * (out of map when it is not NULL), through a polyphase windowed sinc
+ * filter flat to 20 kHz at 44.1 kHz and 110 dB down past the lower
+ * Nyquist. the data is streamed in blocks through float32 and written
+ * back in the same sample format; sampleRate and byteRate are rewritten,
+ * the data chunk resized and every other chunk kept. threads is how many
+ * threads share the channels, 0 for one per CPU on big files. returns 0
+ * on success and -1 on error.
+ */
+WAVUTIL_API int wavutil_resample(const char *name, int fd, const wavutil_info *info,
+                                 const struct wavutil_map *map, uint32_t rate, int threads);
+
+/*
+ * frees the filters wavutil_resample keeps between calls, one per ratio
+ * for the last few ratios used. one still in use by a running resample
+ * is freed when that finishes. the next call designs its filter again.
+ */
+WAVUTIL_API void wavutil_resample_cleanup(void);
+
+/* levels of one channel, 1.0 being full scale */
+struct wavutil_channel_stats {
+   double peak;               /* largest magnitude of a sample */
+   double true_peak;          /* largest magnitude between samples (4x oversampled, BS.1770) */
+   double rms;
+   double dc;                 /* mean of the samples */
+   uint64_t clips;            /* samples at full scale (integers) or beyond it (floats) */
+};
+
+struct wavutil_stats {
+   unsigned channels;
+   uint64_t frames;
+   struct wavutil_channel_stats *channel;   /* one per channel */
+};
+
+/*
+ * reads all of the audio data once (out of map when it is not NULL) and
+ * measures every channel, on up to threads threads (0 for one per CPU
+ * when the file is big enough). returns 0 on success and -1 on error;
+ * the stats are released with wavutil_stats_free.
+ */
+WAVUTIL_API int wavutil_stats(int fd, const wavutil_info *info, const struct wavutil_map *map,
+                              int threads, struct wavutil_stats *stats);
+WAVUTIL_API void wavutil_stats_free(struct wavutil_stats *stats);
+
+/* EBU R128 loudness of a file, -inf LUFS when too short or too quiet to measure */
+struct wavutil_loudness {
+   unsigned channels;
+   uint64_t frames;
+   double integrated;         /* LUFS, gated (ITU-R BS.1770-4) */
+   double range;              /* LU, loudness range (EBU Tech 3342) */
+   double momentary_max;      /* LUFS, loudest 400 ms */
+   double short_term_max;     /* LUFS, loudest 3 s */
+};
+
+/*
+ * reads all of the audio data (out of map when it is not NULL) through
+ * the K-weighting filter and measures its loudness, with the channels
+ * shared out between up to threads threads (0 for one per CPU when the
+ * file is big enough). the LFE of 6 and 8 channel files is left out and
+ * their surrounds weighted as in BS.1770. returns 0 on success and -1 on
+ * error.
+ */
+WAVUTIL_API int wavutil_loudness(int fd, const wavutil_info *info, const struct wavutil_map *map,
+                                 int threads, struct wavutil_loudness *loudness);
+
+/* digests of the audio data */
+enum wavutil_hash_algorithm {
+   WAVUTIL_HASH_MD5,
+   WAVUTIL_HASH_XXH3,                 /* XXH3 64 bit, not cryptographic */
+   WAVUTIL_HASH_BLAKE3,
+   WAVUTIL_HASH_ALGORITHMS
+};
+
+#define WAVUTIL_HASH_MAX 32   /* bytes in the longest digest */
+
+WAVUTIL_API extern const char *const wavutil_hash_names[WAVUTIL_HASH_ALGORITHMS];
+WAVUTIL_API size_t wavutil_hash_size(enum wavutil_hash_algorithm algorithm);
+
+/*
+ * hashes the data chunk alone (out of map when it is not NULL), so
+ * header edits and other chunks do not change the digest. blake3 hashes
+ * big files on up to threads threads (0 for one per CPU). digest gets
+ * wavutil_hash_size bytes, in the order md5sum, xxhsum -H3 and b3sum
+ * print them. wavutil_hash_range does the same for any len bytes from
+ * offset. return 0 on success and -1 on error.
+ */
+WAVUTIL_API int wavutil_hash(int fd, const wavutil_info *info, const struct wavutil_map *map,
+                             enum wavutil_hash_algorithm algorithm, int threads, uint8_t *digest);
+WAVUTIL_API int wavutil_hash_range(int fd, const struct wavutil_map *map, uint64_t offset,
+                                   uint64_t len, enum wavutil_hash_algorithm algorithm, int threads,
+                                   uint8_t *digest);
+
+/* frees the copy buffers of the calling thread, ex: before it exits */
+WAVUTIL_API void wavutil_thread_done(void);
+
+/*
+ * opens up to files files at a time and reads their first
+ * WAVUTIL_HEAD_SIZE bytes into heads with a few io_uring submissions
+ * instead of several system calls per file. wavutil_ring_open returns
+ * NULL with errno set (ENOSYS when io_uring is not available). files
+ * that could not be opened get fd -1, the others are the caller's to
+ * close. returns -1 if the ring failed, and then it should be closed.
+ */
+struct wavutil_ring;
+WAVUTIL_API struct wavutil_ring *wavutil_ring_open(unsigned files);
+WAVUTIL_API int wavutil_prefetch(struct wavutil_ring *ring, char **paths, size_t n, int flags,
+                                 uint8_t *heads, struct wavutil_prefetch *pre);
+WAVUTIL_API void wavutil_ring_close(struct wavutil_ring *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,241 @@
+/*
+ * wavutil.hpp: typed, zero-copy views of the audio data of a wav file
+ * for C++ code linking libwavutil. header only, C++14.
+ *
+ * the sample format and channel count are read from the fmt chunk once,
+ * and dispatch() calls a generic function with a FrameView specialized
+ * for them, so the loops inside are compiled (and vectorized) once per
+ * format instead of checking the format fields for every sample:
+ *
+ *    wavutil::dispatch(info, data, size, [&](auto view) {
+ *       for (size_t i = 0; i < view.frames(); i++)
+ *          for (unsigned c = 0; c < view.channels(); c++)
+ *             peak = std::max(peak, std::abs(view.normalized(i, c)));
+ *    });
+ *
+ * samples are little endian (as in the file) and loaded with memcpy, so
+ * the payload does not need to be aligned. mono and stereo get their own
+ * specializations, other channel counts share one with a runtime count.
+ */
+#ifndef WAVUTIL_HPP
+#define WAVUTIL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#include "wavutil.h"
+
+namespace wavutil {
+
+/* packed 24 bit samples, loaded as sign extended int32_t */
+struct int24_t {
+   uint8_t bytes[3];
+};
+
+/*
+ * the format of the samples, read by the library (wavutil_sample_format)
+ * so C and C++ callers always agree on it
+ */
+inline enum wavutil_sample_format sample_format(const wavutil_fmt_chunk &f) {
+   return wavutil_sample_format(&f);
+}
+
+/*
+ * how one stored sample is loaded and stored. value_type is what a load
+ * returns; scale maps it to [-1, 1) for integers (1 for floats).
+ */
+template <typename SampleT> struct SampleTraits;
+
+template <> struct SampleTraits<int16_t> {
+   using value_type = int16_t;
+   static constexpr size_t size = 2;
+   static constexpr double scale = 32768.0;
+   static value_type load(const uint8_t *p) {
+      value_type v;
+      std::memcpy(&v, p, size);
+      return v;
+   }
+   static void store(uint8_t *p, value_type v) { std::memcpy(p, &v, size); }
+};
+
+template <> struct SampleTraits<int24_t> {
+   using value_type = int32_t;
+   static constexpr size_t size = 3;
+   static constexpr double scale = 8388608.0;
+   static value_type load(const uint8_t *p) {
+      uint32_t u = (uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24;
+      return (int32_t)u >> 8;
+   }
+   static void store(uint8_t *p, value_type v) {
+      p[0] = (uint8_t)v;
+      p[1] = (uint8_t)(v >> 8);
+      p[2] = (uint8_t)(v >> 16);
+   }
+};
+
+template <> struct SampleTraits<int32_t> {
+   using value_type = int32_t;
+   static constexpr size_t size = 4;
+   static constexpr double scale = 2147483648.0;
+   static value_type load(const uint8_t *p) {
+      value_type v;
+      std::memcpy(&v, p, size);
+      return v;
+   }
+   static void store(uint8_t *p, value_type v) { std::memcpy(p, &v, size); }
+};
+
+template <> struct SampleTraits<float> {
+   using value_type = float;
+   static constexpr size_t size = 4;
+   static constexpr double scale = 1.0;
+   static value_type load(const uint8_t *p) {
+      value_type v;
+      std::memcpy(&v, p, size);
+      return v;
+   }
+   static void store(uint8_t *p, value_type v) { std::memcpy(p, &v, size); }
+};
+
+template <> struct SampleTraits<double> {
+   using value_type = double;
+   static constexpr size_t size = 8;
+   static constexpr double scale = 1.0;
+   static value_type load(const uint8_t *p) {
+      value_type v;
+      std::memcpy(&v, p, size);
+      return v;
+   }
+   static void store(uint8_t *p, value_type v) { std::memcpy(p, &v, size); }
+};
+
+/* the channel count of a view that only knows it at run time */
+constexpr unsigned Dynamic = 0;
+
+/*
+ * interleaved frames of Channels samples of SampleT over a byte buffer
+ * that is not copied or owned. Byte is const uint8_t for a read only
+ * view and uint8_t for one that can store samples too.
+ */
+template <typename SampleT, unsigned Channels = Dynamic, typename Byte = const uint8_t>
+class FrameView {
+public:
+   using traits = SampleTraits<SampleT>;
+   using value_type = typename traits::value_type;
+
+   FrameView() = default;
+
+   /* frames whole frames starting at data; channels only counts if Dynamic */
+   FrameView(Byte *data, size_t frames, unsigned channels = Channels)
+      : data_(data), frames_(frames), channels_(Channels ? Channels : channels) {}
+
+   size_t frames() const { return frames_; }
+   unsigned channels() const { return Channels ? Channels : channels_; }
+   size_t frame_size() const { return traits::size * channels(); }
+   Byte *data() const { return data_; }
+
+   value_type load(size_t frame, unsigned channel) const {
+      return traits::load(at(frame, channel));
+   }
+
+   /* the sample scaled to [-1, 1) */
+   double normalized(size_t frame, unsigned channel) const {
+      return load(frame, channel) / traits::scale;
+   }
+
+   void store(size_t frame, unsigned channel, value_type v) const {
+      static_assert(!std::is_const<Byte>::value, "store() needs a writable view");
+      traits::store(at(frame, channel), v);
+   }
+
+   /* count frames starting at first, clamped to the view */
+   FrameView subview(size_t first, size_t count) const {
+      if (first > frames_) first = frames_;
+      if (count > frames_ - first) count = frames_ - first;
+      return FrameView(data_ + first * frame_size(), count, channels());
+   }
+
+private:
+   Byte *at(size_t frame, unsigned channel) const {
+      return data_ + frame * frame_size() + channel * traits::size;
+   }
+
+   Byte *data_ = nullptr;
+   size_t frames_ = 0;
+   unsigned channels_ = Channels;
+};
+
+namespace detail {
+
+template <typename SampleT, typename Byte, typename Fn>
+bool dispatch_channels(Byte *data, size_t size, unsigned channels, Fn &&fn) {
+   size_t frame = SampleTraits<SampleT>::size * channels;
+   size_t frames = size / frame;
+   switch (channels) {
+   case 1:
+      fn(FrameView<SampleT, 1, Byte>(data, frames));
+      return true;
+   case 2:
+      fn(FrameView<SampleT, 2, Byte>(data, frames));
+      return true;
+   default:
+      fn(FrameView<SampleT, Dynamic, Byte>(data, frames, channels));
+      return true;
+   }
+}
+
+} // namespace detail
+
+/*
+ * calls fn with a FrameView of size bytes of audio data at data, typed
+ * by the fmt chunk. a partial frame at the end is left out. returns
+ * false (without calling fn) when the format is not one of int16, int24,
+ * int32, float32 or float64 or the file has no channels.
+ */
+template <typename Byte, typename Fn>
+bool dispatch(const wavutil_fmt_chunk &f, Byte *data, size_t size, Fn &&fn) {
+   static_assert(sizeof(Byte) == 1, "views are over bytes");
+   unsigned channels = f.numChannels;
+   if (channels == 0) return false;
+
+   switch (sample_format(f)) {
+   case WAVUTIL_SAMPLE_S16:
+      return detail::dispatch_channels<int16_t>(data, size, channels, std::forward<Fn>(fn));
+   case WAVUTIL_SAMPLE_S24:
+      return detail::dispatch_channels<int24_t>(data, size, channels, std::forward<Fn>(fn));
+   case WAVUTIL_SAMPLE_S32:
+      return detail::dispatch_channels<int32_t>(data, size, channels, std::forward<Fn>(fn));
+   case WAVUTIL_SAMPLE_F32:
+      return detail::dispatch_channels<float>(data, size, channels, std::forward<Fn>(fn));
+   case WAVUTIL_SAMPLE_F64:
+      return detail::dispatch_channels<double>(data, size, channels, std::forward<Fn>(fn));
+   default:
+      return false;
+   }
+}
+
+/* the same for a parsed file whose audio data is at data */
+template <typename Byte, typename Fn>
+bool dispatch(const wavutil_info &info, Byte *data, size_t size, Fn &&fn) {
+   return dispatch(info.header.f, data, size, std::forward<Fn>(fn));
+}
+
+/*
+ * the same for the audio data of a file mapped whole with wavutil_map
+ * and read with wavutil_read (not a prefetched head)
+ */
+template <typename Fn>
+bool dispatch(const wavutil_info &info, const struct wavutil_map &map, Fn &&fn) {
+   if (info.data_offset > map.size) return false;
+   size_t size = map.size - (size_t)info.data_offset;
+   if (info.data_size < size) size = (size_t)info.data_size;
+   const uint8_t *data = map.base + info.data_offset;
+   return dispatch(info.header.f, data, size, std::forward<Fn>(fn));
+}
+
+} // namespace wavutil
+
+#endif
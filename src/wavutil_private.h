@@ -0,0 +1,19 @@
+/*
+ * wavutil_private.h: shared between the source files of libwavutil,
+ * none of it is exported.
+ */
+#ifndef WAVUTIL_PRIVATE_H
+#define WAVUTIL_PRIVATE_H
+
+#include <stdint.h> /* uint64_t */
+
+/* describes a failure for wavutil_error and the log callback, see wavutil.c */
+void wu_log(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* passes a report (wavutil_copy_options.report) to the log callback, leaving wavutil_error alone */
+void wu_report(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* reports a step of writing a file to the trace callback, see wavutil_set_trace */
+void wu_trace(const char *step, int begin, uint64_t bytes);
+
+#endif
@@ -0,0 +1,128 @@
+#!/bin/sh
+#
+# cli_test.sh: checks what wav-util prints for other programs and what
+# its scan cache keeps, run by make test
+#
+# usage: tests/cli_test.sh [path to wav-util]
+#
+# a file name with every character the formats have to escape goes
+# through --format=json and csv, one file at a time and in a scan, dedup
+# sorts out a copy it cannot reflink, and a scan with --cache runs while
+# a file cannot be read and again once it can. the exit status is nonzero if any check failed.
+
+WAV_UTIL=${1:-./wav-util}
+SAMPLE=$(dirname "$0")/../audio/CantinaBand3.wav
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+failed=0
+total=0
+
+# check NAME COMMAND...: runs the command and counts a failure
+check() {
+   name=$1
+   shift
+   total=$((total + 1))
+   if "$@"; then
+      printf 'ok   cli %s\n' "$name"
+   else
+      printf 'FAIL cli %s\n' "$name"
+      failed=$((failed + 1))
+   fi
+}
+
+# same FILE FORMAT ARGS...: the file holds exactly what printf makes of them
+same() {
+   file=$1
+   format=$2
+   shift 2
+   printf "$format" "$@" > "$dir/expected"
+   cmp -s "$file" "$dir/expected" || {
+      echo "  expected:"; cat "$dir/expected"; echo "  got:"; cat "$file"
+      return 1
+   }
+}
+
+# a quote, a backslash, a tab, UTF-8, a comma, a newline and a byte that is not UTF-8
+mkdir "$dir/names"
+odd=$(printf 'a"b\\c\t\303\251,d\n\377.wav')
+cp "$SAMPLE" "$dir/names/$odd"
+json_path='"path": "%s/names/a\\"b\\\\c\\u0009\303\251,d\\u000a\\ufffd.wav"'
+csv_path='"%s/names/a""b\\c\t\303\251,d\n\377.wav"'
+
+json() {
+   "$WAV_UTIL" --format=json "$dir/names/$odd" > "$dir/out" &&
+      grep -F "$(printf "$json_path" "$dir")" "$dir/out" > /dev/null
+}
+check json json
+
+csv() {
+   "$WAV_UTIL" --format=csv "$dir/names/$odd" > "$dir/out" &&
+      tail -n +2 "$dir/out" > "$dir/row" &&
+      same "$dir/row" "$csv_path,1,RIFF,132336,1,1,22050,44100,2,16,44,132300,2\n" "$dir"
+}
+check csv csv
+
+scan_json() {
+   "$WAV_UTIL" --format=json --scan="$dir/names" > "$dir/out" 2> /dev/null &&
+      grep -F "$(printf "$json_path" "$dir")" "$dir/out" > /dev/null
+}
+check scan-json scan_json
+
+scan_csv() {
+   "$WAV_UTIL" --format=csv --scan="$dir/names" 2> /dev/null > "$dir/out" &&
+      tail -n +2 "$dir/out" > "$dir/row" &&
+      same "$dir/row" "$csv_path,1,RIFF,132336,1,1,22050,44100,2,16,44,132300,2\n" "$dir"
+}
+check scan-csv scan_csv
+
+# a copy with a LIST chunk in front has its data 20 bytes further on, so
+# no block of it lines up with the original's
+dedup_misaligned() {
+   mkdir "$dir/dedup" && cp "$SAMPLE" "$dir/dedup/a.wav" || return 1
+   { printf 'RIFF\004\005\002\000WAVELIST\014\000\000\000INFOICMT\000\000\000\000' &&
+      tail -c +13 "$SAMPLE"; } > "$dir/dedup/b.wav" &&
+      "$WAV_UTIL" dedup --dry-run --link=reflink --format=csv "$dir/dedup" 2> /dev/null > "$dir/out" &&
+      grep -F "$dir/dedup/b.wav,misaligned" "$dir/out" > /dev/null
+}
+check dedup-misaligned dedup_misaligned
+
+# root reads files whatever their mode, so the scan runs as nobody
+as_user=
+if [ "$(id -u)" = 0 ]; then
+   if command -v setpriv > /dev/null; then
+      as_user="setpriv --reuid=65534 --regid=65534 --clear-groups"
+      chmod 755 "$dir"
+   else
+      printf 'skip cli scan-cache: running as root without setpriv\n'
+      as_user=skip
+   fi
+fi
+
+# summary FILE TEXT: the scan's summary line starts with TEXT
+summary() {
+   grep -F "$2 in " "$1" > /dev/null || { echo "  got:"; cat "$1"; return 1; }
+}
+
+# an unreadable file is reported and left out of the cache, so the next
+# scan parses it instead of listing it as invalid
+scan_cache() {
+   mkdir "$dir/scan" && chmod 777 "$dir/scan" &&
+      cp "$SAMPLE" "$dir/scan/good.wav" && cp "$SAMPLE" "$dir/scan/locked.wav" &&
+      chmod 644 "$dir/scan/good.wav" && chmod 000 "$dir/scan/locked.wav" || return 1
+
+   $as_user "$WAV_UTIL" --scan="$dir/scan" --cache="$dir/scan/cache" > /dev/null 2> "$dir/err" &&
+      { echo "  a scan with an unreadable file succeeded"; return 1; }
+   summary "$dir/err" "1 files (0 cached, 0 invalid, 1 unreadable)" || return 1
+
+   chmod 644 "$dir/scan/locked.wav"
+   $as_user "$WAV_UTIL" --scan="$dir/scan" --cache="$dir/scan/cache" > /dev/null 2> "$dir/err" &&
+      summary "$dir/err" "2 files (1 cached, 0 invalid, 0 unreadable)" || return 1
+
+   $as_user "$WAV_UTIL" --scan="$dir/scan" --cache="$dir/scan/cache" > /dev/null 2> "$dir/err" &&
+      summary "$dir/err" "2 files (2 cached, 0 invalid, 0 unreadable)"
+}
+[ "$as_user" = skip ] || check scan-cache scan_cache
+
+printf '%d of %d CLI tests failed\n' "$failed" "$total"
+[ "$failed" = 0 ]
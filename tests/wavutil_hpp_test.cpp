@@ -0,0 +1,148 @@
+/*
+ * wavutil_hpp_test.cpp: checks that wavutil.hpp compiles as C++14 and
+ * that its views agree with the library, run by make test
+ *
+ * everything happens on buffers in memory: the sample format is read
+ * the same way wavutil_sample_format reads it, dispatch() picks the view
+ * the fmt chunk describes, and loads, stores and subviews land on the
+ * right bytes. the exit status is nonzero if any check failed.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+
+#include "../src/wavutil.hpp"
+
+static int failed;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static bool check(bool ok, const char *what, int line) {
+   if (!ok) {
+      std::fprintf(stderr, "  line %d: %s\n", line, what);
+      failed++;
+   }
+   return ok;
+}
+
+static wavutil_fmt_chunk make_fmt(enum wavutil_sample_format format, unsigned channels) {
+   wavutil_fmt_chunk f;
+   std::memset(&f, 0, sizeof(f));
+   std::memcpy(f.chunkID, "fmt ", WAVUTIL_ID_LEN);
+   f.chunkSize = 16;
+   f.audioFormat = 1;
+   f.numChannels = (uint16_t)channels;
+   f.sampleRate = 48000;
+   wavutil_set_sample_format(&f, format);
+   return f;
+}
+
+/* the C++ header reads every format the way the library does */
+static void test_format() {
+   for (int i = 0; i < WAVUTIL_SAMPLE_FORMATS; i++) {
+      wavutil_fmt_chunk f = make_fmt((enum wavutil_sample_format)i, 2);
+      CHECK(wavutil::sample_format(f) == wavutil_sample_format(&f));
+   }
+
+   /* 16 bit ADPCM is not 16 bit PCM */
+   wavutil_fmt_chunk adpcm = make_fmt(WAVUTIL_SAMPLE_S16, 1);
+   adpcm.audioFormat = 2;
+   CHECK(wavutil::sample_format(adpcm) == WAVUTIL_SAMPLE_UNKNOWN);
+   uint8_t bytes[4] = {0};
+   CHECK(!wavutil::dispatch(adpcm, bytes, sizeof(bytes), [](auto) {}));
+
+   /* nor are unsigned 8 bit samples or a file without channels dispatched */
+   CHECK(!wavutil::dispatch(make_fmt(WAVUTIL_SAMPLE_U8, 1), bytes, sizeof(bytes), [](auto) {}));
+   CHECK(!wavutil::dispatch(make_fmt(WAVUTIL_SAMPLE_S16, 0), bytes, sizeof(bytes), [](auto) {}));
+}
+
+/* stereo gets its own view, loads are little endian and unaligned */
+static void test_stereo() {
+   const int16_t samples[] = { 0, 16384, -32768, 32767, 1, -1 };
+   std::vector<uint8_t> bytes(1 + sizeof(samples));
+   std::memcpy(bytes.data() + 1, samples, sizeof(samples));
+
+   unsigned channels = 0;
+   size_t frames = 0;
+   double sum = 0;
+   bool ok = wavutil::dispatch(make_fmt(WAVUTIL_SAMPLE_S16, 2), (const uint8_t *)bytes.data() + 1,
+                               sizeof(samples) + 1, [&](auto view) {
+      channels = view.channels();
+      frames = view.frames();
+      for (size_t i = 0; i < view.frames(); i++) sum += view.normalized(i, 1);
+   });
+   CHECK(ok);
+   CHECK(channels == 2);
+   CHECK(frames == 3);
+   CHECK(std::fabs(sum - (0.5 + 32767 / 32768.0 - 1 / 32768.0)) < 1e-12);
+}
+
+/* 24 bit samples sign extend, and a writable view stores through */
+static void test_int24() {
+   uint8_t bytes[5 * 3 * 2] = {0};
+   wavutil::FrameView<wavutil::int24_t, wavutil::Dynamic, uint8_t> out(bytes, 2, 5);
+   for (size_t i = 0; i < out.frames(); i++) {
+      for (unsigned c = 0; c < out.channels(); c++) {
+         out.store(i, c, c % 2 ? -8388608 : 8388607 - (int)i);
+      }
+   }
+
+   wavutil::FrameView<wavutil::int24_t> view(bytes, 2, 5);
+   CHECK(view.channels() == 5);
+   CHECK(view.load(0, 0) == 8388607);
+   CHECK(view.load(1, 4) == 8388606);
+   CHECK(view.load(1, 3) == -8388608);
+   CHECK(bytes[3] == 0x00 && bytes[4] == 0x00 && bytes[5] == 0x80);
+   CHECK(view.subview(1, 10).frames() == 1);
+   CHECK(view.subview(1, 10).load(0, 0) == 8388606);
+   CHECK(view.subview(3, 1).frames() == 0);
+}
+
+/* a whole file mapping, with a partial frame at the end left out */
+static void test_map() {
+   const double samples[] = { 0.25, -0.5, 1.0 };
+   std::vector<uint8_t> bytes(64 + sizeof(samples) + 3);
+   std::memcpy(bytes.data() + 64, samples, sizeof(samples));
+
+   wavutil_info info;
+   std::memset(&info, 0, sizeof(info));
+   info.header.f = make_fmt(WAVUTIL_SAMPLE_F64, 1);
+   info.data_offset = 64;
+   info.data_size = sizeof(samples) + 3;
+   struct wavutil_map map;
+   std::memset(&map, 0, sizeof(map));
+   map.base = bytes.data();
+   map.size = bytes.size();
+   map.file_size = bytes.size();
+
+   double sum = 0;
+   size_t frames = 0;
+   CHECK(wavutil::dispatch(info, map, [&](auto view) {
+      frames = view.frames();
+      for (size_t i = 0; i < view.frames(); i++) sum += view.normalized(i, 0);
+   }));
+   CHECK(frames == 3);
+   CHECK(sum == 0.75);
+
+   info.data_offset = bytes.size() + 1;
+   CHECK(!wavutil::dispatch(info, map, [](auto) {}));
+}
+
+int main() {
+   static const struct { const char *name; void (*run)(); } tests[] = {
+      { "format", test_format }, { "stereo", test_stereo }, { "int24", test_int24 },
+      { "map", test_map },
+   };
+
+   int bad = 0;
+   for (const auto &t : tests) {
+      failed = 0;
+      t.run();
+      std::printf("%-4s hpp %s\n", failed ? "FAIL" : "ok", t.name);
+      if (failed) bad++;
+   }
+   std::printf("%d of %zu C++ tests failed\n", bad, sizeof(tests) / sizeof(tests[0]));
+   return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}
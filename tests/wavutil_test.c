@@ -0,0 +1,954 @@
+/*
+ * wavutil_test.c: checks libwavutil end to end, run by make test
+ *
+ * every test writes its own synthetic files into a temporary directory
+ * (TMPDIR or /tmp) and goes through the public API the way a program
+ * linking the library would: parsing RIFF and RF64 headers, editing and
+ * rewriting them (also out of a mapping), the digests against published
+ * vectors, and round trips through convert, split and interleave and
+ * resample. the SIMD paths are checked against the scalar ones. a line
+ * is printed per test and the exit status is nonzero if any failed.
+ */
+#define _GNU_SOURCE
+#include <stdio.h> /* io functions */
+#include <stdint.h> /* uint types */
+#include <stdlib.h> /* mem allocation */
+#include <string.h> /* memcmp */
+#include <math.h> /* sin */
+#include <errno.h> /* errno */
+#include <fcntl.h> /* open */
+#include <dirent.h> /* cleaning up the directory */
+#include <unistd.h> /* pread, unlink */
+#include <sys/stat.h> /* fstat */
+
+#include "../src/wavutil.h"
+
+static char dir[256];
+static int failed;            /* checks that failed in the current test */
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int check(int ok, const char *what, int line) {
+   if (!ok) {
+      fprintf(stderr, "  line %d: %s\n", line, what);
+      failed++;
+   }
+   return ok;
+}
+
+/* a file in the test directory, in one of a few rotating buffers */
+static const char *path(const char *name) {
+   static char buf[8][512];
+   static int next;
+   char *p = buf[next++ % 8];
+   snprintf(p, sizeof(buf[0]), "%s/%s", dir, name);
+   return p;
+}
+
+static void put16(uint8_t *p, uint16_t v) {
+   p[0] = (uint8_t)v;
+   p[1] = (uint8_t)(v >> 8);
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+   put16(p, (uint16_t)v);
+   put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+   put32(p, (uint32_t)v);
+   put32(p + 4, (uint32_t)(v >> 32));
+}
+
+/* how a synthetic file is laid out around its audio data */
+enum layout {
+   PLAIN,                     /* RIFF, fmt, data */
+   CHUNKS,                    /* JUNK and LIST before the data, LIST after it */
+   RF64                       /* RF64 with a ds64 chunk and 0xFFFFFFFF sizes */
+};
+
+/* writes a file holding data_size bytes of data, returns 0 on success */
+static int write_wav(const char *name, enum wavutil_sample_format format, unsigned channels,
+                     uint32_t rate, const void *data, size_t data_size, enum layout layout) {
+   static const uint8_t list[] = "LIST\x0c\0\0\0INFOICMT\0\0\0\0";
+   uint8_t h[256];
+   size_t n = 12;
+
+   memcpy(h + 8, "WAVE", 4);
+   if (layout == CHUNKS) {
+      memcpy(h + n, "JUNK", 4);
+      put32(h + n + 4, 6);
+      memset(h + n + 8, 0, 6);
+      n += 14;
+   }
+   size_t ds64 = n;
+   if (layout == RF64) n += 36;
+
+   struct wavutil_fmt_chunk f = {0};
+   f.numChannels = (uint16_t)channels;
+   f.sampleRate = rate;
+   wavutil_set_sample_format(&f, format);
+   memcpy(h + n, "fmt ", 4);
+   put32(h + n + 4, 16);
+   put16(h + n + 8, f.audioFormat);
+   put16(h + n + 10, f.numChannels);
+   put32(h + n + 12, f.sampleRate);
+   put32(h + n + 16, f.byteRate);
+   put16(h + n + 20, f.blockAlign);
+   put16(h + n + 22, f.bitsPerSample);
+   n += 24;
+
+   if (layout == CHUNKS) {
+      memcpy(h + n, list, sizeof(list) - 1);
+      n += sizeof(list) - 1;
+   }
+   memcpy(h + n, "data", 4);
+   put32(h + n + 4, layout == RF64 ? UINT32_MAX : (uint32_t)data_size);
+   n += 8;
+
+   size_t trailer = layout == CHUNKS ? sizeof(list) - 1 : 0;
+   uint64_t riff = n - 8 + data_size + (data_size & 1) + trailer;
+   if (layout == RF64) {
+      memcpy(h, "RF64", 4);
+      put32(h + 4, UINT32_MAX);
+      memcpy(h + ds64, "ds64", 4);
+      put32(h + ds64 + 4, 28);
+      put64(h + ds64 + 8, riff);
+      put64(h + ds64 + 16, data_size);
+      put64(h + ds64 + 24, data_size / f.blockAlign);
+      put32(h + ds64 + 32, 0);
+   }
+   else {
+      memcpy(h, "RIFF", 4);
+      put32(h + 4, (uint32_t)riff);
+   }
+
+   FILE *out = fopen(name, "wb");
+   if (out == NULL) return -1;
+   int ok = fwrite(h, 1, n, out) == n && fwrite(data, 1, data_size, out) == data_size;
+   if (ok && (data_size & 1)) ok = fputc(0, out) == 0;
+   if (ok && trailer) ok = fwrite(list, 1, trailer, out) == trailer;
+   if (fclose(out)) ok = 0;
+   return ok ? 0 : -1;
+}
+
+/*
+ * frames of a sine per channel (freq, then 1.5 times higher for each
+ * channel after the first) at amp, in format. the caller frees it.
+ */
+static void *sine(enum wavutil_sample_format format, unsigned channels, uint32_t rate,
+                  size_t frames, double freq, double amp) {
+   size_t n = frames * channels;
+   double *wave = malloc(n * sizeof(double) + 1);
+   void *out = malloc(n * wavutil_sample_size(format) + 1);
+   if (wave == NULL || out == NULL) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+   }
+   for (size_t i = 0; i < frames; i++) {
+      for (unsigned c = 0; c < channels; c++) {
+         wave[i * channels + c] = amp * sin(2 * M_PI * freq * pow(1.5, c) * i / rate);
+      }
+   }
+   wavutil_convert_samples(out, format, wave, WAVUTIL_SAMPLE_F64, n);
+   free(wave);
+   return out;
+}
+
+/* a whole file in memory with its parsed header */
+struct loaded {
+   uint8_t *buf;
+   size_t len;
+   wavutil_info info;
+   const uint8_t *data;
+};
+
+static int load(const char *name, struct loaded *l) {
+   memset(l, 0, sizeof(*l));
+   int fd = open(name, O_RDONLY);
+   struct stat st;
+   if (fd < 0 || fstat(fd, &st)) {
+      if (fd >= 0) close(fd);
+      return -1;
+   }
+   l->len = (size_t)st.st_size;
+   l->buf = malloc(l->len + 1);
+   int ok = l->buf && pread(fd, l->buf, l->len, 0) == (ssize_t)l->len;
+   close(fd);
+   if (!ok || wavutil_parse(l->buf, l->len, l->len, &l->info)) {
+      free(l->buf);
+      l->buf = NULL;
+      return -1;
+   }
+   l->data = l->buf + l->info.data_offset;
+   return 0;
+}
+
+static void unload(struct loaded *l) {
+   if (l->buf) wavutil_free(&l->info);
+   free(l->buf);
+   l->buf = NULL;
+}
+
+/* the log callback keeps the last message instead of printing it */
+static char last_log[512];
+static int logged;
+
+static void capture_log(void *ctx, const char *msg) {
+   (void)ctx;
+   snprintf(last_log, sizeof(last_log), "%s", msg);
+   logged++;
+}
+
+/* the index of the chunk called id, -1 if there is none */
+static int find_chunk(const wavutil_info *info, const char *id) {
+   for (size_t i = 0; i < info->num_chunks; i++) {
+      if (!memcmp(info->chunks[i].id, id, WAVUTIL_ID_LEN)) return (int)i;
+   }
+   return -1;
+}
+
+static void test_parse(void) {
+   size_t frames = 1001;
+   void *data = sine(WAVUTIL_SAMPLE_S24, 3, 48000, frames, 440, 0.5);
+   size_t size = frames * 3 * 3;
+   struct loaded l;
+
+   for (int layout = PLAIN; layout <= RF64; layout++) {
+      CHECK(write_wav(path("parse.wav"), WAVUTIL_SAMPLE_S24, 3, 48000, data, size, layout) == 0);
+      if (!CHECK(load(path("parse.wav"), &l) == 0)) continue;
+      const wavutil_info *info = &l.info;
+
+      CHECK(wavutil_verify(NULL, info) == 0);
+      CHECK(info->fmt >= 0 && info->data >= 0);
+      CHECK(info->header.f.numChannels == 3);
+      CHECK(info->header.f.sampleRate == 48000);
+      CHECK(info->header.f.bitsPerSample == 24);
+      CHECK(info->header.f.blockAlign == 9);
+      CHECK(info->data_size == size);
+      CHECK(!memcmp(l.data, data, size));
+      CHECK(info->file_size == l.len);
+      CHECK(wavutil_sample_format(&info->header.f) == WAVUTIL_SAMPLE_S24);
+      if (layout == CHUNKS) {
+         CHECK(info->num_chunks == 5);
+         CHECK(find_chunk(info, "JUNK") == 0);
+         CHECK(info->chunks[info->num_chunks - 1].offset == info->data_offset + size + 1);
+      }
+      if (layout == RF64) {
+         CHECK(wavutil_is_rf64(info->header.r.chunkID));
+         CHECK(info->ds64 >= 0);
+         CHECK(info->riff_size == l.len - 8);
+         CHECK(info->chunks[info->data].size == size);
+      }
+      else {
+         CHECK(info->ds64 < 0);
+      }
+      unload(&l);
+   }
+
+   /* the same bytes parse from a caller's buffer, but not when cut short */
+   uint8_t head[64];
+   CHECK(write_wav(path("parse.wav"), WAVUTIL_SAMPLE_S24, 3, 48000, data, size, PLAIN) == 0);
+   int fd = open(path("parse.wav"), O_RDONLY);
+   CHECK(pread(fd, head, sizeof(head), 0) == sizeof(head));
+   wavutil_info info;
+   if (CHECK(wavutil_parse(head, sizeof(head), 44 + size + 1, &info) == 0)) {
+      CHECK(info.data_offset == 44);
+      CHECK(info.data_size == size);
+      wavutil_free(&info);
+   }
+   CHECK(wavutil_parse(head, 20, 44 + size + 1, &info) == -1);
+   close(fd);
+
+   /* a data chunk cut short by the end of the file is not valid either */
+   CHECK(write_wav(path("parse.wav"), WAVUTIL_SAMPLE_S16, 1, 8000, data, size, PLAIN) == 0);
+   CHECK(truncate(path("parse.wav"), 44 + size / 2) == 0);
+   if (CHECK(load(path("parse.wav"), &l) == 0)) {
+      CHECK(l.info.data_size == size / 2);
+      CHECK(wavutil_verify(NULL, &l.info) == 1);
+      unload(&l);
+   }
+
+   /* a fmt chunk without a data chunk is not a wav file */
+   CHECK(write_wav(path("parse.wav"), WAVUTIL_SAMPLE_S16, 1, 8000, "", 0, PLAIN) == 0);
+   if (CHECK(load(path("parse.wav"), &l) == 0)) {
+      CHECK(wavutil_verify(NULL, &l.info) == 0);
+      memcpy(l.info.header.r.format, "AVI ", 4);
+      l.info.data = -1;
+      CHECK(wavutil_verify(NULL, &l.info) == 2);
+      unload(&l);
+   }
+   free(data);
+}
+
+static void test_log(void) {
+   /* failures go to the callback, and to wavutil_error on this thread */
+   wavutil_set_log(capture_log, NULL);
+   logged = 0;
+   wavutil_info info;
+   CHECK(wavutil_parse("RIFF", 4, 4, &info) == -1);
+   CHECK(logged == 1);
+   CHECK(strlen(wavutil_error()) > 0);
+   CHECK(!strcmp(wavutil_error(), last_log));
+
+   wavutil_header h = {0};
+   CHECK(wavutil_edit(&h, "sampleRate=48000") == 0);
+   CHECK(h.f.sampleRate == 48000);
+   CHECK(wavutil_edit(&h, "numChannels=0x10") == 0);
+   CHECK(h.f.numChannels == 16);
+   CHECK(wavutil_edit(&h, "numChannels=70000") == -1);
+   CHECK(wavutil_edit(&h, "sampleRate=-1") == -1);
+   CHECK(wavutil_edit(&h, "noSuchField=1") == -1);
+   CHECK(wavutil_edit(&h, "sampleRate") == -1);
+   CHECK(logged == 5);
+
+   /* reports go to the callback too, without replacing the last failure */
+   char failure[sizeof(last_log)];
+   snprintf(failure, sizeof(failure), "%s", wavutil_error());
+   CHECK(write_wav(path("log.wav"), WAVUTIL_SAMPLE_S16, 1, 8000, "\0\0\0\0", 4, PLAIN) == 0);
+   int in = open(path("log.wav"), O_RDONLY);
+   int out = open(path("log_copy.wav"), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   struct wavutil_copy_options report = { .method = WAVUTIL_COPY_PIPELINE, .report = 1 };
+   CHECK(wavutil_copy_range(in, 0, out, 0, 48, &report) == WAVUTIL_COPY_PIPELINE);
+   close(in);
+   close(out);
+   CHECK(logged > 5 && !strncmp(last_log, "pipeline:", 9));
+   CHECK(!strcmp(wavutil_error(), failure));
+   logged = 5;
+
+   wavutil_set_log(NULL, NULL);
+   CHECK(wavutil_parse("RIFF", 4, 4, &info) == -1);
+   CHECK(logged == 5);
+   wavutil_set_log(capture_log, NULL);
+}
+
+/* what a copy of orig with an edited header should look like */
+static void check_copy(const char *orig, const char *copy, uint32_t rate) {
+   struct loaded a, b;
+   if (!CHECK(load(orig, &a) == 0)) return;
+   if (CHECK(load(copy, &b) == 0)) {
+      CHECK(b.info.header.f.sampleRate == rate);
+      CHECK(b.info.data_size == a.info.data_size);
+      CHECK(!memcmp(a.data, b.data, a.info.data_size));
+      CHECK(b.info.num_chunks == a.info.num_chunks);
+      /* the chunks after the data come along too */
+      CHECK(!memcmp(a.buf + a.info.data_offset, b.buf + b.info.data_offset,
+                    a.len - a.info.data_offset));
+      unload(&b);
+   }
+   unload(&a);
+}
+
+static void test_write(void) {
+   size_t frames = 48000 + 1;
+   void *data = sine(WAVUTIL_SAMPLE_S16, 1, 48000, frames, 1000, 0.5);
+   const char *orig = path("write.wav"), *copy = path("write_copy.wav");
+
+   for (int layout = PLAIN; layout <= RF64; layout++) {
+      CHECK(write_wav(orig, WAVUTIL_SAMPLE_S16, 1, 48000, data, frames * 2, layout) == 0);
+      int fd = open(orig, O_RDONLY);
+      struct wavutil_map map = {0};
+      wavutil_info info;
+      if (!CHECK(fd >= 0 && wavutil_map(fd, &map) == 0)) return;
+      if (!CHECK(wavutil_read(fd, &map, &info) == 0)) return;
+      wavutil_header edited = info.header;
+      CHECK(wavutil_edit(&edited, "sampleRate=44100") == 0);
+
+      /* out of the mapping the library made itself */
+      unlink(copy);
+      CHECK(wavutil_write(copy, fd, &info, &edited, WAVUTIL_OUTPUT_COPY, NULL, &map) >= 0);
+      check_copy(orig, copy, 44100);
+
+      /* a mapping of the first bytes alone, the rest read from the file */
+      uint8_t head[100];
+      CHECK(pread(fd, head, sizeof(head), 0) == sizeof(head));
+      struct wavutil_prefetch pre = { fd, info.file_size, head, sizeof(head) };
+      struct wavutil_map part = {0};
+      wavutil_info partial;
+      wavutil_prefetch_map(&pre, &part);
+      if (CHECK(wavutil_read(fd, &part, &partial) == 0)) {
+         unlink(copy);
+         CHECK(wavutil_write(copy, fd, &partial, &edited, WAVUTIL_OUTPUT_COPY, NULL, &part) >= 0);
+         check_copy(orig, copy, 44100);
+         wavutil_free(&partial);
+      }
+
+      /* every copy method the kernel has, the userspace ones always */
+      for (int m = WAVUTIL_COPY_AUTO; m < WAVUTIL_COPY_METHODS; m++) {
+         unlink(copy);
+         int out = open(copy, O_RDWR | O_CREAT | O_TRUNC, 0644);
+         errno = 0;
+         struct wavutil_copy_options method = { .method = (enum wavutil_copy_method)m };
+         int ret = wavutil_write_fd(fd, &info, &edited, out, &method, NULL);
+         close(out);
+         if (ret < 0 && (errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL) &&
+             strcmp(wavutil_copy_names[m], "buffered") && strcmp(wavutil_copy_names[m], "pipeline")) {
+            continue;
+         }
+         if (!check(ret >= 0, wavutil_copy_names[m], __LINE__)) continue;
+         check_copy(orig, copy, 44100);
+
+         /* asking for more than the file holds is an error, not a short copy */
+         if (m == WAVUTIL_COPY_AUTO) continue;
+         out = open(copy, O_RDWR | O_TRUNC);
+         errno = 0;
+         ret = wavutil_copy_range(fd, 0, out, 0, info.file_size + 4096, &method);
+         close(out);
+         check(ret < 0 && errno == EIO, wavutil_copy_names[m], __LINE__);
+      }
+
+      /* and in place, only the bytes that changed */
+      close(fd);
+      wavutil_free(&info);
+      wavutil_unmap(&map);
+      fd = open(orig, O_RDWR);
+      CHECK(wavutil_read(fd, NULL, &info) == 0);
+      CHECK(wavutil_patch(fd, &info, &edited) == 2);
+      wavutil_free(&info);
+      CHECK(wavutil_read(fd, NULL, &info) == 0);
+      CHECK(info.header.f.sampleRate == 44100);
+      CHECK(info.data_size == frames * 2);
+      wavutil_free(&info);
+      close(fd);
+   }
+   free(data);
+
+   /* a header for more than 4 GB of data is promoted to RF64 */
+   CHECK(write_wav(orig, WAVUTIL_SAMPLE_S16, 2, 48000, "\0\0\0\0", 4, PLAIN) == 0);
+   int fd = open(orig, O_RDONLY);
+   wavutil_info info;
+   size_t len;
+   if (CHECK(wavutil_read(fd, NULL, &info) == 0)) {
+      uint64_t big = 5ull << 30;
+      uint8_t *prefix = wavutil_prefix(fd, &info, &info.header, big, &len);
+      if (CHECK(prefix != NULL)) {
+         CHECK(!memcmp(prefix, "RF64", 4));
+         wavutil_info promoted;
+         if (CHECK(wavutil_parse(prefix, len, len + big, &promoted) == 0)) {
+            CHECK(promoted.ds64 >= 0);
+            CHECK(promoted.data_offset == len);
+            CHECK(promoted.data_size == big);
+            CHECK(promoted.header.f.numChannels == 2);
+            wavutil_free(&promoted);
+         }
+         free(prefix);
+      }
+      wavutil_free(&info);
+   }
+   close(fd);
+}
+
+/* hex digests of n bytes of i % 251, as b3sum, xxhsum -H3 and md5sum print them */
+struct hash_vector {
+   enum wavutil_hash_algorithm algorithm;
+   size_t len;
+   const char *digest;
+};
+
+static const struct hash_vector hash_vectors[] = {
+   { WAVUTIL_HASH_MD5, 0, "d41d8cd98f00b204e9800998ecf8427e" },
+   { WAVUTIL_HASH_MD5, 1, "93b885adfe0da089cdf634904fd59f71" },
+   { WAVUTIL_HASH_MD5, 1024, "9ee0a0e0c0bc0f1ff29d663d1fdf0743" },
+   { WAVUTIL_HASH_MD5, 102400, "1a0f81547e5ba2e9c4a4b94a74731993" },
+   { WAVUTIL_HASH_MD5, 3158061, "d3958b0038155d4667150246e326ae1d" },
+   { WAVUTIL_HASH_XXH3, 0, "2d06800538d394c2" },
+   { WAVUTIL_HASH_XXH3, 1, "c44bdff4074eecdb" },
+   { WAVUTIL_HASH_XXH3, 3, "5f4299fc161c9cbb" },
+   { WAVUTIL_HASH_XXH3, 1023, "d3d91d80ac495685" },
+   { WAVUTIL_HASH_XXH3, 1025, "e95c42288f28186e" },
+   { WAVUTIL_HASH_XXH3, 102400, "1428e17f1cac2837" },
+   { WAVUTIL_HASH_XXH3, 1 << 20, "6e0d7ac36b8c10ff" },
+   /* from the BLAKE3 test vectors */
+   { WAVUTIL_HASH_BLAKE3, 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+   { WAVUTIL_HASH_BLAKE3, 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+   { WAVUTIL_HASH_BLAKE3, 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+   { WAVUTIL_HASH_BLAKE3, 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+   { WAVUTIL_HASH_BLAKE3, 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+   { WAVUTIL_HASH_BLAKE3, 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+   { WAVUTIL_HASH_BLAKE3, 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+   { WAVUTIL_HASH_BLAKE3, 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+   /* past the official vectors, from the reference implementation: batches of 64 chunks */
+   { WAVUTIL_HASH_BLAKE3, 1 << 20, "74cb441fd087764ca9c3694da742ebe30cbeb3060a17009ca81825c7a8d10343" },
+   { WAVUTIL_HASH_BLAKE3, (1 << 20) + 1, "2f053cd7472cf0cd2f9adaf45c1180255b91b9a865404a63671a0ee5f792ed33" },
+   { WAVUTIL_HASH_BLAKE3, 3158061, "deca5c86911eb9089826b3022bdf721ba0d5fad4d2e1af9110304bdfb71211e9" },
+};
+
+static void hex(char *out, const uint8_t *digest, size_t len) {
+   for (size_t i = 0; i < len; i++) {
+      sprintf(out + 2 * i, "%02x", digest[i]);
+   }
+}
+
+static void test_hash(void) {
+   size_t len = 3158061;   /* the longest vector: 3 MiB and a partial chunk */
+   uint8_t *buf = malloc(len);
+   for (size_t i = 0; i < len; i++) {
+      buf[i] = (uint8_t)(i % 251);
+   }
+   int fd = open(path("hash.bin"), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   CHECK(write(fd, buf, len) == (ssize_t)len);
+   struct wavutil_map map = {0};
+   CHECK(wavutil_map(fd, &map) == 0);
+
+   const char *simd = wavutil_simd();
+   static const char *const kernels[] = { NULL, "scalar" };
+   for (size_t k = 0; k < 2; k++) {
+      if (kernels[k]) CHECK(wavutil_set_simd(kernels[k]) == 0);
+      for (size_t v = 0; v < sizeof(hash_vectors) / sizeof(hash_vectors[0]); v++) {
+         const struct hash_vector *hv = &hash_vectors[v];
+         size_t size = wavutil_hash_size(hv->algorithm);
+         uint8_t digest[WAVUTIL_HASH_MAX];
+         char text[2 * WAVUTIL_HASH_MAX + 1];
+
+         /* read, mapped and on 4 threads, all the same */
+         for (int how = 0; how < 3; how++) {
+            memset(digest, 0, sizeof(digest));
+            int ret = wavutil_hash_range(fd, how == 1 ? &map : NULL, 0, hv->len, hv->algorithm,
+                                         how == 2 ? 4 : 1, digest);
+            hex(text, digest, size);
+            if (!check(ret == 0 && !strcmp(text, hv->digest), hv->digest, __LINE__)) {
+               fprintf(stderr, "  %s of %zu bytes (%s kernels): %s\n",
+                       wavutil_hash_names[hv->algorithm], hv->len, wavutil_simd(), text);
+            }
+         }
+      }
+   }
+   wavutil_set_simd(simd);
+
+   /* a file hashes its data chunk alone */
+   CHECK(write_wav(path("hash.wav"), WAVUTIL_SAMPLE_S16, 2, 48000, buf, 1024, CHUNKS) == 0);
+   int wav = open(path("hash.wav"), O_RDONLY);
+   wavutil_info info;
+   if (CHECK(wavutil_read(wav, NULL, &info) == 0)) {
+      uint8_t a[WAVUTIL_HASH_MAX], b[WAVUTIL_HASH_MAX];
+      CHECK(wavutil_hash(wav, &info, NULL, WAVUTIL_HASH_BLAKE3, 1, a) == 0);
+      CHECK(wavutil_hash_range(fd, NULL, 0, 1024, WAVUTIL_HASH_BLAKE3, 1, b) == 0);
+      CHECK(!memcmp(a, b, 32));
+      wavutil_free(&info);
+   }
+   close(wav);
+   wavutil_unmap(&map);
+   close(fd);
+   free(buf);
+}
+
+static void test_convert(void) {
+   /* integers go to float and back without losing a bit */
+   static const enum wavutil_sample_format ints[] = {
+      WAVUTIL_SAMPLE_U8, WAVUTIL_SAMPLE_S16, WAVUTIL_SAMPLE_S24, WAVUTIL_SAMPLE_S32
+   };
+   size_t n = 4099;
+   const char *simd = wavutil_simd();
+
+   for (size_t k = 0; k < 2; k++) {
+      if (k) CHECK(wavutil_set_simd("scalar") == 0);
+      for (size_t i = 0; i < sizeof(ints) / sizeof(ints[0]); i++) {
+         enum wavutil_sample_format f = ints[i];
+         enum wavutil_sample_format via = f == WAVUTIL_SAMPLE_S32 ? WAVUTIL_SAMPLE_F64
+                                                                  : WAVUTIL_SAMPLE_F32;
+         size_t size = wavutil_sample_size(f);
+         uint8_t *src = malloc(n * size), *back = malloc(n * size);
+         double *mid = malloc(n * sizeof(double));
+         uint32_t seed = 1;
+         for (size_t j = 0; j < n * size; j++) {
+            seed = seed * 1664525u + 1013904223u;
+            src[j] = (uint8_t)(seed >> 24);
+         }
+         CHECK(wavutil_convert_samples(mid, via, src, f, n) == 0);
+         CHECK(wavutil_convert_samples(back, f, mid, via, n) == 0);
+         if (!check(!memcmp(src, back, n * size), wavutil_sample_names[f], __LINE__)) {
+            fprintf(stderr, "  with %s kernels\n", wavutil_simd());
+         }
+         free(src);
+         free(back);
+         free(mid);
+      }
+   }
+   wavutil_set_simd(simd);
+
+   /* floats out of range clip, they do not wrap */
+   float loud[4] = { 1.5f, -1.5f, 1.0f, -1.0f };
+   int16_t s[4];
+   CHECK(wavutil_convert_samples(s, WAVUTIL_SAMPLE_S16, loud, WAVUTIL_SAMPLE_F32, 4) == 0);
+   CHECK(s[0] == INT16_MAX && s[1] == INT16_MIN && s[2] == INT16_MAX && s[3] == INT16_MIN);
+
+   /* and a whole file to float and back is the same file */
+   size_t frames = 20001;
+   void *data = sine(WAVUTIL_SAMPLE_S16, 2, 44100, frames, 440, 0.7);
+   const char *orig = path("convert.wav"), *mid = path("convert_f32.wav"),
+              *back = path("convert_s16.wav");
+   CHECK(write_wav(orig, WAVUTIL_SAMPLE_S16, 2, 44100, data, frames * 4, CHUNKS) == 0);
+   struct loaded l;
+   int fd = open(orig, O_RDONLY);
+   wavutil_info info;
+   if (CHECK(wavutil_read(fd, NULL, &info) == 0)) {
+      /* a block size smaller than one sample still converts a frame at a time */
+      struct wavutil_copy_options tiny = { .block_size = 3 };
+      CHECK(wavutil_convert(mid, fd, &info, NULL, WAVUTIL_SAMPLE_F32, &tiny) == 0);
+      wavutil_free(&info);
+   }
+   close(fd);
+   if (CHECK(load(mid, &l) == 0)) {
+      CHECK(wavutil_sample_format(&l.info.header.f) == WAVUTIL_SAMPLE_F32);
+      CHECK(l.info.header.f.blockAlign == 8);
+      CHECK(l.info.header.f.byteRate == 44100 * 8);
+      CHECK(l.info.data_size == frames * 8);
+      unload(&l);
+   }
+   fd = open(mid, O_RDONLY);
+   struct wavutil_map map = {0};
+   CHECK(wavutil_map(fd, &map) == 0);
+   if (CHECK(wavutil_read(fd, &map, &info) == 0)) {
+      CHECK(wavutil_convert(back, fd, &info, &map, WAVUTIL_SAMPLE_S16, NULL) == 0);
+      wavutil_free(&info);
+   }
+   wavutil_unmap(&map);
+   close(fd);
+   struct loaded a, b;
+   if (CHECK(load(orig, &a) == 0)) {
+      if (CHECK(load(back, &b) == 0)) {
+         CHECK(a.len == b.len && !memcmp(a.buf, b.buf, a.len));
+         unload(&b);
+      }
+      unload(&a);
+   }
+   free(data);
+}
+
+#define MAX_CHANNELS 10
+
+/* splits a file of channels channels into mono files and two picked channels, and back */
+static void test_split(enum wavutil_sample_format f, unsigned channels, size_t frames) {
+   size_t size = wavutil_sample_size(f), frame = size * channels;
+   void *data = sine(f, channels, 48000, frames, 100, 0.5);
+   char orig[512];   /* path() only keeps 8 names, fewer than the outputs */
+   snprintf(orig, sizeof(orig), "%s", path("channels.wav"));
+   CHECK(write_wav(orig, f, channels, 48000, data, frames * frame, CHUNKS) == 0);
+
+   /* every channel to a file of its own, and channels 3 and 1 (2 and 1 of stereo) */
+   char names[MAX_CHANNELS + 1][512];
+   unsigned list[MAX_CHANNELS], pick[2] = { channels > 2 ? 2 : 1, 0 };
+   struct wavutil_channels outputs[MAX_CHANNELS + 1];
+   for (unsigned c = 0; c < channels; c++) list[c] = c;
+   for (unsigned c = 0; c <= channels; c++) {
+      snprintf(names[c], sizeof(names[c]), "%s", path(c < channels ? "mono.wav" : "pick.wav"));
+      if (c < channels) snprintf(names[c] + strlen(names[c]) - 4, 16, "_%u.wav", c);
+      outputs[c].name = names[c];
+      outputs[c].channels = c < channels ? list + c : pick;
+      outputs[c].count = c < channels ? 1 : 2;
+   }
+   int fd = open(orig, O_RDONLY);
+   wavutil_info info;
+   if (!CHECK(wavutil_read(fd, NULL, &info) == 0)) {
+      close(fd);
+      free(data);
+      return;
+   }
+   /* the mono files alone take the transpose, the pair is gathered */
+   CHECK(wavutil_split_channels(fd, &info, NULL, outputs, channels) == 0);
+   CHECK(wavutil_split_channels(fd, &info, NULL, outputs + channels, 1) == 0);
+   wavutil_free(&info);
+   close(fd);
+
+   struct loaded pick_file;
+   if (CHECK(load(names[channels], &pick_file) == 0)) {
+      const uint8_t *in = data, *out = pick_file.data;
+      CHECK(pick_file.info.header.f.numChannels == 2);
+      CHECK(pick_file.info.data_size == frames * size * 2);
+      int same = 1;
+      for (size_t j = 0; j < frames && same; j++) {
+         same = !memcmp(out + j * 2 * size, in + j * frame + pick[0] * size, size) &&
+                !memcmp(out + j * 2 * size + size, in + j * frame, size);
+      }
+      CHECK(same);
+      unload(&pick_file);
+   }
+
+   /* the mono files put back together are the original */
+   int fds[MAX_CHANNELS];
+   wavutil_info infos[MAX_CHANNELS];
+   for (unsigned c = 0; c < channels; c++) {
+      fds[c] = open(names[c], O_RDONLY);
+      CHECK(wavutil_read(fds[c], NULL, &infos[c]) == 0);
+      CHECK(infos[c].header.f.numChannels == 1);
+   }
+   CHECK(wavutil_interleave(path("interleaved.wav"), fds, infos, channels) == 0);
+   for (unsigned c = 0; c < channels; c++) {
+      wavutil_free(&infos[c]);
+      close(fds[c]);
+   }
+   struct loaded a, b;
+   if (CHECK(load(orig, &a) == 0)) {
+      if (CHECK(load(path("interleaved.wav"), &b) == 0)) {
+         if (!check(a.len == b.len && !memcmp(a.buf, b.buf, a.len), wavutil_sample_names[f],
+                    __LINE__)) {
+            fprintf(stderr, "  %u channels with %s kernels\n", channels, wavutil_simd());
+         }
+         unload(&b);
+      }
+      unload(&a);
+   }
+   free(data);
+}
+
+/*
+ * splits and interleaves through every kernel: the 8x8 (4x4) tiles with
+ * 10 channels, the narrow tiles with 5 and 6 and the stereo one, each
+ * with a few frames left for the scalar edges
+ */
+static void test_channels(void) {
+   static const enum wavutil_sample_format formats[] = {
+      WAVUTIL_SAMPLE_U8, WAVUTIL_SAMPLE_S16, WAVUTIL_SAMPLE_S24, WAVUTIL_SAMPLE_F32,
+      WAVUTIL_SAMPLE_F64
+   };
+   static const unsigned counts[] = { 2, 5, 6, 10 };
+   size_t frames = 65536 + 7;   /* a few blocks and a bit */
+   const char *simd = wavutil_simd();
+
+   for (size_t k = 0; k < 2; k++) {
+      if (k) CHECK(wavutil_set_simd("scalar") == 0);
+      for (size_t n = 0; n < sizeof(counts) / sizeof(counts[0]); n++) {
+         for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+            test_split(formats[i], counts[n], frames);
+         }
+      }
+   }
+   wavutil_set_simd(simd);
+}
+
+/* sample i of the float32 or int16 data of a file, wherever it sits */
+static float f32_at(const uint8_t *data, size_t i) {
+   float v;
+   memcpy(&v, data + i * sizeof(v), sizeof(v));
+   return v;
+}
+
+static int s16_at(const uint8_t *data, size_t i) {
+   int16_t v;
+   memcpy(&v, data + i * sizeof(v), sizeof(v));
+   return v;
+}
+
+/*
+ * the amplitude of the sine at freq in the middle half of n samples,
+ * and what is left once it is taken out (least squares)
+ */
+static void fit_sine(const uint8_t *x, size_t n, double freq, double rate, double *amp,
+                     double *residual) {
+   size_t lo = n / 4, hi = 3 * n / 4;
+   double s = 0, c = 0, r = 0;
+   for (size_t i = lo; i < hi; i++) {
+      s += f32_at(x, i) * sin(2 * M_PI * freq * i / rate);
+      c += f32_at(x, i) * cos(2 * M_PI * freq * i / rate);
+   }
+   s *= 2.0 / (hi - lo);
+   c *= 2.0 / (hi - lo);
+   for (size_t i = lo; i < hi; i++) {
+      double e = f32_at(x, i) - s * sin(2 * M_PI * freq * i / rate) - c * cos(2 * M_PI * freq * i / rate);
+      r += e * e;
+   }
+   *amp = hypot(s, c);
+   *residual = sqrt(r / (hi - lo));
+}
+
+/* resamples name to rate into out, returns 0 on success */
+static int resample(const char *name, const char *out, uint32_t rate, int threads, int use_map) {
+   int fd = open(name, O_RDONLY);
+   struct wavutil_map map = {0};
+   wavutil_info info;
+   int ret = -1;
+   if (fd < 0) return -1;
+   if ((!use_map || wavutil_map(fd, &map) == 0) &&
+       wavutil_read(fd, use_map ? &map : NULL, &info) == 0) {
+      ret = wavutil_resample(out, fd, &info, use_map ? &map : NULL, rate, threads);
+      wavutil_free(&info);
+   }
+   wavutil_unmap(&map);
+   close(fd);
+   return ret;
+}
+
+static void test_resample(void) {
+   static const struct { uint32_t from, to; } ratios[] = {
+      { 44100, 48000 }, { 48000, 44100 }, { 44100, 96000 }, { 96000, 48000 },
+      { 48000, 8000 }, { 44100, 44101 },
+   };
+   const char *orig = path("resample.wav"), *out = path("resampled.wav");
+   struct loaded l;
+
+   for (size_t i = 0; i < sizeof(ratios) / sizeof(ratios[0]); i++) {
+      uint32_t from = ratios[i].from, to = ratios[i].to;
+      size_t frames = from / 2 + 1;
+      void *data = sine(WAVUTIL_SAMPLE_F32, 1, from, frames, 1000, 0.5);
+      CHECK(write_wav(orig, WAVUTIL_SAMPLE_F32, 1, from, data, frames * 4, CHUNKS) == 0);
+      CHECK(resample(orig, out, to, 1, 0) == 0);
+      if (CHECK(load(out, &l) == 0)) {
+         uint64_t expect = ((uint64_t)frames * to + from - 1) / from;
+         CHECK(l.info.header.f.sampleRate == to);
+         CHECK(l.info.header.f.byteRate == to * 4);
+         CHECK(l.info.data_size == expect * 4);
+         CHECK(find_chunk(&l.info, "LIST") >= 0);
+
+         /* the same tone, at the same level, with nothing much around it */
+         double amp, residual;
+         fit_sine(l.data, (size_t)expect, 1000, to, &amp, &residual);
+         if (!check(fabs(amp - 0.5) < 1e-3 && residual < 1e-4, "sine kept", __LINE__)) {
+            fprintf(stderr, "  %u to %u Hz: amplitude %f, residual %g\n", from, to, amp, residual);
+         }
+         unload(&l);
+      }
+      free(data);
+   }
+
+   /* above the new Nyquist is filtered out rather than folded back */
+   void *high = sine(WAVUTIL_SAMPLE_F32, 1, 96000, 48000, 30000, 0.5);
+   CHECK(write_wav(orig, WAVUTIL_SAMPLE_F32, 1, 96000, high, 48000 * 4, PLAIN) == 0);
+   CHECK(resample(orig, out, 48000, 1, 0) == 0);
+   if (CHECK(load(out, &l) == 0)) {
+      size_t n = (size_t)(l.info.data_size / 4);
+      double sum = 0;
+      for (size_t j = n / 4; j < 3 * n / 4; j++) {
+         sum += f32_at(l.data, j) * f32_at(l.data, j);
+      }
+      CHECK(sqrt(sum / (n / 2)) < 1e-5);
+      unload(&l);
+   }
+   free(high);
+
+   /* threads, the mapping and the scalar kernels do not change a sample */
+   size_t frames = 100003;
+   void *data = sine(WAVUTIL_SAMPLE_S16, 3, 44100, frames, 440, 0.5);
+   CHECK(write_wav(orig, WAVUTIL_SAMPLE_S16, 3, 44100, data, frames * 6, PLAIN) == 0);
+   CHECK(resample(orig, out, 48000, 1, 0) == 0);
+   CHECK(resample(orig, path("resampled_3.wav"), 48000, 3, 1) == 0);
+   const char *simd = wavutil_simd();
+   CHECK(wavutil_set_simd("scalar") == 0);
+   CHECK(resample(orig, path("resampled_scalar.wav"), 48000, 2, 0) == 0);
+   wavutil_set_simd(simd);
+   struct loaded a, b, c;
+   if (CHECK(load(out, &a) == 0)) {
+      if (CHECK(load(path("resampled_3.wav"), &b) == 0)) {
+         CHECK(a.len == b.len && !memcmp(a.buf, b.buf, a.len));
+         unload(&b);
+      }
+      if (CHECK(load(path("resampled_scalar.wav"), &c) == 0)) {
+         /* the sums are ordered differently, at most a rounding apart */
+         int close_enough = a.info.data_size == c.info.data_size;
+         for (size_t j = 0; close_enough && j < a.info.data_size / 2; j++) {
+            close_enough = abs(s16_at(a.data, j) - s16_at(c.data, j)) <= 1;
+         }
+         CHECK(close_enough);
+         unload(&c);
+      }
+      unload(&a);
+   }
+
+   /* the same rate is a plain copy */
+   CHECK(resample(orig, out, 44100, 1, 0) == 0);
+   if (CHECK(load(orig, &a) == 0)) {
+      if (CHECK(load(out, &b) == 0)) {
+         CHECK(a.len == b.len && !memcmp(a.buf, b.buf, a.len));
+         unload(&b);
+      }
+      unload(&a);
+   }
+   CHECK(resample(orig, out, 1, 1, 0) == -1);
+
+   /*
+    * more ratios than the cache holds push 44.1k to 48k out, and so does
+    * a cleanup: designed again, its filter gives the same file
+    */
+   for (uint32_t rate = 8000; rate < 18000; rate += 1000) {
+      CHECK(resample(orig, out, rate, 1, 0) == 0);
+   }
+   for (int k = 0; k < 2; k++) {
+      if (k) wavutil_resample_cleanup();
+      CHECK(resample(orig, out, 48000, 1, 0) == 0);
+      if (CHECK(load(path("resampled_3.wav"), &a) == 0)) {
+         if (CHECK(load(out, &b) == 0)) {
+            CHECK(a.len == b.len && !memcmp(a.buf, b.buf, a.len));
+            unload(&b);
+         }
+         unload(&a);
+      }
+   }
+   wavutil_resample_cleanup();
+   wavutil_resample_cleanup();
+   free(data);
+}
+
+static void test_measure(void) {
+   /* EBU Tech 3341 case 1: a 1 kHz sine at -23 dBFS in both channels is -23 LUFS */
+   size_t frames = 10 * 48000;
+   void *data = sine(WAVUTIL_SAMPLE_F32, 1, 48000, frames, 1000, pow(10, -23 / 20.0));
+   float *stereo = malloc(frames * 2 * sizeof(float));
+   for (size_t i = 0; i < frames; i++) {
+      stereo[2 * i] = stereo[2 * i + 1] = ((float *)data)[i];
+   }
+   CHECK(write_wav(path("loudness.wav"), WAVUTIL_SAMPLE_F32, 2, 48000, stereo, frames * 8,
+                   PLAIN) == 0);
+   int fd = open(path("loudness.wav"), O_RDONLY);
+   wavutil_info info;
+   if (CHECK(wavutil_read(fd, NULL, &info) == 0)) {
+      struct wavutil_loudness loudness;
+      CHECK(wavutil_loudness(fd, &info, NULL, 1, &loudness) == 0);
+      CHECK(fabs(loudness.integrated + 23) < 0.1);
+      CHECK(loudness.range < 0.1);
+
+      struct wavutil_stats stats;
+      if (CHECK(wavutil_stats(fd, &info, NULL, 1, &stats) == 0)) {
+         double amp = pow(10, -23 / 20.0);
+         CHECK(stats.channels == 2 && stats.frames == frames);
+         CHECK(fabs(stats.channel[0].peak - amp) < 1e-4);
+         CHECK(fabs(stats.channel[1].rms - amp / sqrt(2)) < 1e-4);
+         CHECK(fabs(stats.channel[0].dc) < 1e-4);
+         wavutil_stats_free(&stats);
+      }
+      wavutil_free(&info);
+   }
+   close(fd);
+   free(stereo);
+   free(data);
+}
+
+/* removes the test directory and everything in it */
+static void clean_up(void) {
+   DIR *d = opendir(dir);
+   if (d == NULL) return;
+   struct dirent *e;
+   while ((e = readdir(d)) != NULL) {
+      if (strcmp(e->d_name, ".") && strcmp(e->d_name, "..")) {
+         unlink(path(e->d_name));
+      }
+   }
+   closedir(d);
+   rmdir(dir);
+}
+
+int main(void) {
+   static const struct { const char *name; void (*run)(void); } tests[] = {
+      { "parse", test_parse }, { "log", test_log }, { "write", test_write },
+      { "hash", test_hash }, { "convert", test_convert }, { "channels", test_channels },
+      { "resample", test_resample }, { "measure", test_measure },
+   };
+
+   const char *tmp = getenv("TMPDIR");
+   snprintf(dir, sizeof(dir), "%s/wavutil-test.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+   if (mkdtemp(dir) == NULL) {
+      fprintf(stderr, "Failed to create a directory for the test files: %s\n", strerror(errno));
+      return EXIT_FAILURE;
+   }
+   /* expected failures are checked through wavutil_error, not printed */
+   wavutil_set_log(capture_log, NULL);
+
+   int bad = 0;
+   for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+      failed = 0;
+      tests[i].run();
+      printf("%-4s %s\n", failed ? "FAIL" : "ok", tests[i].name);
+      if (failed) bad++;
+   }
+   clean_up();
+   printf("%d of %zu tests failed\n", bad, sizeof(tests) / sizeof(tests[0]));
+   return bad ? EXIT_FAILURE : EXIT_SUCCESS;
+}